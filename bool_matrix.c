@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "bool_matrix.h"
+
+// rows of B combined per lookup table in the Four Russians product
+#define RUSSIANS_BITS 8
+
+// threads with fewer rows than this OR rows of B directly, since
+// building the lookup tables would cost more than it saves
+#define RUSSIANS_MIN_ROWS 64
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
+#define ROW(b,i) ((b)->bits + (i) * (b)->words)
+
+/*
+ * Allocate space for a boolean matrix of order n with all elements
+ * cleared. Return NULL if the allocation is not successful.
+ */
+bool_matrix* new_bool_matrix(size_t n)
+{
+   bool_matrix* b = malloc(sizeof(bool_matrix));
+   if(b == NULL)
+      return NULL;
+
+   size_t words = (n + 63) / 64;
+   size_t num_words = n * words;
+   b->bits = calloc(num_words ? num_words : 1, sizeof(uint64_t));
+   if(b->bits == NULL) {
+      free(b);
+      return NULL;
+   }
+
+   b->order = n;
+   b->words = words;
+
+   return b;
+}
+
+/*
+ * Deallocate the dynamic memory allocated for the given boolean matrix.
+ */
+void free_bool_matrix(bool_matrix* b)
+{
+   if(b == NULL)
+      return;
+
+   free(b->bits);
+   free(b);
+}
+
+/*
+ * Build a boolean matrix with a bit set for every nonzero element of m.
+ * Return NULL if anything is wrong.
+ */
+bool_matrix* square_to_bool_matrix(square_matrix* m)
+{
+   if(m == NULL)
+      return NULL;
+
+   size_t n = m->order;
+   matrix_element** data = m->data;
+
+   bool_matrix* b = new_bool_matrix(n);
+   if(b == NULL)
+      return NULL;
+
+   for(size_t i = 0; i < n; i++) {
+      uint64_t* row = ROW(b, i);
+      for(size_t j = 0; j < n; j++)
+         row[j / 64] |= (uint64_t) (data[i][j] != 0) << (j % 64);
+   }
+
+   return b;
+}
+
+/*
+ * Expand a boolean matrix into a newly allocated 0/1 square matrix.
+ * Return NULL if anything is wrong.
+ */
+square_matrix* bool_to_square_matrix(bool_matrix* b)
+{
+   if(b == NULL)
+      return NULL;
+
+   size_t n = b->order;
+
+   square_matrix* res = new_square_matrix(n);
+   if(res == NULL)
+      return NULL;
+
+   matrix_element** data = res->data;
+   for(size_t i = 0; i < n; i++) {
+      uint64_t* row = ROW(b, i);
+      for(size_t j = 0; j < n; j++)
+         data[i][j] = (row[j / 64] >> (j % 64)) & 1;
+   }
+
+   return res;
+}
+
+/*
+ * Compare two boolean matrices, return 0 if they are the same,
+ * non-zero values otherwise.
+ */
+int compare_bool_matrices(bool_matrix* b1, bool_matrix* b2)
+{
+   if(b1 == NULL || b2 == NULL)
+      return -1;
+
+   if(b1->order != b2->order)
+      return -2;
+
+   return memcmp(b1->bits, b2->bits, b1->order * b1->words * sizeof(uint64_t)) != 0;
+}
+
+/*
+ * Return the number of set elements of the given boolean matrix.
+ */
+size_t count_bool_matrix(bool_matrix* b)
+{
+   if(b == NULL)
+      return 0;
+
+   size_t count = 0;
+   for(size_t w = 0; w < b->order * b->words; w++)
+      count += __builtin_popcountll(b->bits[w]);
+
+   return count;
+}
+
+
+//////////////////////////////////////////////
+//                                          //
+// Multi-threaded boolean multiplication    //
+//                                          //
+//////////////////////////////////////////////
+
+typedef struct {
+   size_t first_row, last_row;
+   bool_matrix *b1, *b2, *res;
+} thread_arg_t_bool;
+
+
+/*
+ * Row i of the product is the OR of the rows k of b2 for which
+ * element (i,k) of b1 is set. The direct version visits the set bits
+ * of row i of b1 one by one.
+ */
+static void bool_mul_rows_direct(bool_matrix* b1, bool_matrix* b2, bool_matrix* res,
+                                 size_t first_row, size_t last_row)
+{
+   size_t words = b1->words;
+
+   for(size_t i = first_row; i < last_row; i++) {
+      uint64_t* restrict dst = ROW(res, i);
+      const uint64_t* a = ROW(b1, i);
+
+      for(size_t w = 0; w < words; w++)
+         for(uint64_t bits = a[w]; bits; bits &= bits - 1) {
+            const uint64_t* restrict src = ROW(b2, w*64 + __builtin_ctzll(bits));
+            for(size_t v = 0; v < words; v++)
+               dst[v] |= src[v];
+         }
+   }
+}
+
+/*
+ * Four Russians version: for every group of RUSSIANS_BITS rows of b2
+ * build a table holding the OR of each subset of the group, then
+ * handle a whole byte of row i of b1 with one table lookup.
+ */
+static void bool_mul_rows_russians(bool_matrix* b1, bool_matrix* b2, bool_matrix* res,
+                                   size_t first_row, size_t last_row)
+{
+   size_t n = b1->order;
+   size_t words = b1->words;
+
+   uint64_t* table = malloc(((size_t)1 << RUSSIANS_BITS) * words * sizeof(uint64_t));
+   assert(table != NULL); // could have handled errors better
+   memset(table, 0, words * sizeof(uint64_t));    // entry 0 is the empty subset
+
+   for(size_t k0 = 0; k0 < n; k0 += RUSSIANS_BITS) {
+      size_t group = MIN(RUSSIANS_BITS, n - k0);
+
+      // each entry adds its lowest row to an entry built earlier
+      for(size_t s = 1; s < ((size_t)1 << group); s++) {
+         uint64_t* restrict dst = table + s * words;
+         const uint64_t* prev = table + (s & (s - 1)) * words;
+         const uint64_t* row  = ROW(b2, k0 + __builtin_ctzll(s));
+         for(size_t v = 0; v < words; v++)
+            dst[v] = prev[v] | row[v];
+      }
+
+      // groups never straddle a word since 64 is a multiple of RUSSIANS_BITS
+      size_t w = k0 / 64, shift = k0 % 64;
+      for(size_t i = first_row; i < last_row; i++) {
+         size_t s = (ROW(b1, i)[w] >> shift) & (((size_t)1 << RUSSIANS_BITS) - 1);
+         if(s == 0)
+            continue;
+         uint64_t* restrict dst = ROW(res, i);
+         const uint64_t* restrict src = table + s * words;
+         for(size_t v = 0; v < words; v++)
+            dst[v] |= src[v];
+      }
+   }
+
+   free(table);
+}
+
+
+static void * thread_bool_mul(void * p_arg)
+{
+   thread_arg_t_bool *p = p_arg;
+
+   if(p->last_row - p->first_row < RUSSIANS_MIN_ROWS)
+      bool_mul_rows_direct(p->b1, p->b2, p->res, p->first_row, p->last_row);
+   else
+      bool_mul_rows_russians(p->b1, p->b2, p->res, p->first_row, p->last_row);
+
+   pthread_exit(NULL);
+}
+
+
+/*
+ * Multiply two boolean matrices into res, a cleared matrix
+ * distinct from both operands.
+ */
+static void bool_mul_into(bool_matrix* b1, bool_matrix* b2, bool_matrix* res, size_t num_threads)
+{
+   size_t n = b1->order;
+
+   // adjust number of threads for small matrices
+   num_threads = (n < num_threads) ? n : num_threads;
+   if(num_threads == 0)
+      return;
+
+   pthread_t tid[num_threads];
+   thread_arg_t_bool args[num_threads];
+
+   // each thread gets a contiguous range of rows so that its
+   // lookup tables are reused for as many rows as possible
+   for(size_t i = 0; i < num_threads; i ++) {
+      args[i] = (thread_arg_t_bool){n * i / num_threads, n * (i + 1) / num_threads, b1, b2, res};
+      int status = pthread_create(&tid[i], NULL, thread_bool_mul, &args[i]);
+      assert(status == 0); // could have handled errors better
+   }
+
+   // wait for threads to terminate
+   for(size_t i = 0; i < num_threads; i ++)
+      pthread_join(tid[i], NULL);
+}
+
+
+/*
+ * Compute the boolean (AND/OR) product of two boolean matrices. Return
+ * a pointer to the newly allocated result or NULL if anything is wrong.
+ */
+bool_matrix* mul_bool_matrices_threads(bool_matrix* b1, bool_matrix* b2, size_t num_threads)
+{
+   if(b1 == NULL || b2 == NULL || b1->order != b2->order || num_threads == 0)
+      return NULL;
+
+   bool_matrix* res = new_bool_matrix(b1->order);
+   if(res == NULL)
+      return NULL;
+
+   bool_mul_into(b1, b2, res, num_threads);
+
+   return res;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Transitive closure              //
+//                                 //
+/////////////////////////////////////
+
+
+/*
+ * Compute the transitive closure of the relation given by b, or the
+ * reflexive transitive closure if reflexive is non-zero. Return a
+ * pointer to the newly allocated result or NULL if anything is wrong.
+ *
+ * R = b | I is squared until it stops changing, which takes at most
+ * ceil(log2(n)) products since every squaring doubles the path length
+ * covered. The transitive closure is then b * R.
+ */
+bool_matrix* transitive_closure_bool_matrix_threads(bool_matrix* b, int reflexive, size_t num_threads)
+{
+   if(b == NULL || num_threads == 0)
+      return NULL;
+
+   size_t n = b->order;
+   size_t words = b->words;
+
+   bool_matrix* r   = new_bool_matrix(n);
+   bool_matrix* tmp = new_bool_matrix(n);
+   if(r == NULL || tmp == NULL) {
+      free_bool_matrix(r);
+      free_bool_matrix(tmp);
+      return NULL;
+   }
+
+   memcpy(r->bits, b->bits, n * words * sizeof(uint64_t));
+   for(size_t i = 0; i < n; i++)
+      ROW(r, i)[i / 64] |= (uint64_t) 1 << (i % 64);
+
+   for(size_t covered = 1; covered < n; covered *= 2) {
+      memset(tmp->bits, 0, n * words * sizeof(uint64_t));
+      bool_mul_into(r, r, tmp, num_threads);
+
+      bool_matrix* t = r; r = tmp; tmp = t;
+      if(compare_bool_matrices(r, tmp) == 0)
+         break;
+   }
+
+   if(reflexive) {
+      free_bool_matrix(tmp);
+      return r;
+   }
+
+   memset(tmp->bits, 0, n * words * sizeof(uint64_t));
+   bool_mul_into(b, r, tmp, num_threads);
+   free_bool_matrix(r);
+
+   return tmp;
+}
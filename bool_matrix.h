@@ -0,0 +1,26 @@
+#ifndef __bool_matrix_h__
+#define __bool_matrix_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "square_matrix3.h"
+
+typedef struct {
+    size_t order;
+    size_t words;       // 64-bit words per row
+    uint64_t* bits;     // element (i,j) is bit j%64 of bits[i*words + j/64]; padding bits are zero
+} bool_matrix;
+
+bool_matrix* new_bool_matrix(size_t order);
+void free_bool_matrix(bool_matrix* b);
+
+bool_matrix* square_to_bool_matrix(square_matrix* m);
+square_matrix* bool_to_square_matrix(bool_matrix* b);
+
+int    compare_bool_matrices(bool_matrix* b1, bool_matrix* b2);
+size_t count_bool_matrix(bool_matrix* b);
+
+bool_matrix* mul_bool_matrices_threads(bool_matrix* b1, bool_matrix* b2, size_t num_threads);
+bool_matrix* transitive_closure_bool_matrix_threads(bool_matrix* b, int reflexive, size_t num_threads);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef __chunk_sched_h__
+#define __chunk_sched_h__
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Dynamic chunk scheduling for threaded kernels. Threads claim chunks
+// of units 0..size-1 from a shared atomic counter instead of taking a
+// fixed share, so a thread that is slowed down, e.g. by other work on
+// the same core, claims fewer chunks rather than stalling the call.
+//
+// CHUNK_GUIDED chunks shrink with the remaining work, remaining /
+// (2 * num_threads) but at least min_chunk units, so early claims are
+// large and the last ones small enough to even out the finish.
+// CHUNK_DYNAMIC chunks are always min_chunk units.
+//
+// Usage, with s shared by all threads:
+//    chunk_sched s;
+//    chunk_sched_init(&s, n, num_threads, 1, CHUNK_GUIDED);
+//    ... and in each thread:
+//    size_t first, last;
+//    while(chunk_sched_next(&s, &first, &last))
+//       for(size_t i = first; i < last; i++) ...
+
+#define CHUNK_CACHE_LINE 64
+#define MIN_CHUNK_WORK   16384  // element operations worth claiming as one chunk
+
+typedef enum {
+   CHUNK_GUIDED,
+   CHUNK_DYNAMIC
+} chunk_policy;
+
+typedef struct {
+   // the counter has a cache line to itself, so that claiming does not
+   // invalidate the read-only fields or a neighbour's data
+   _Alignas(CHUNK_CACHE_LINE) atomic_size_t next;
+   _Alignas(CHUNK_CACHE_LINE) size_t size;
+   size_t num_threads;
+   size_t min_chunk;
+   chunk_policy policy;
+} chunk_sched;
+
+static inline void chunk_sched_init(chunk_sched* s, size_t size, size_t num_threads, size_t min_chunk, chunk_policy policy)
+{
+   atomic_init(&s->next, 0);
+   s->size = size;
+   s->num_threads = num_threads ? num_threads : 1;
+   s->min_chunk = min_chunk ? min_chunk : 1;
+   s->policy = policy;
+}
+
+/*
+ * Claim the next chunk, units first .. last-1. Return 0 when no units
+ * are left.
+ */
+static inline int chunk_sched_next(chunk_sched* s, size_t* first, size_t* last)
+{
+   size_t start = atomic_load_explicit(&s->next, memory_order_relaxed);
+   size_t chunk;
+
+   if(s->policy == CHUNK_DYNAMIC) {
+      if(start >= s->size)
+         return 0;
+      start = atomic_fetch_add_explicit(&s->next, s->min_chunk, memory_order_relaxed);
+      chunk = s->min_chunk;
+   }
+   else {
+      do {
+         if(start >= s->size)
+            return 0;
+         chunk = (s->size - start) / (2 * s->num_threads);
+         if(chunk < s->min_chunk)
+            chunk = s->min_chunk;
+      } while(!atomic_compare_exchange_weak_explicit(&s->next, &start, start + chunk,
+                                                     memory_order_relaxed, memory_order_relaxed));
+   }
+
+   if(start >= s->size)
+      return 0;
+   *first = start;
+   *last = (chunk < s->size - start) ? start + chunk : s->size;
+   return 1;
+}
+
+// units in a chunk of work worth claiming, for kernels whose units cost
+// unit_work operations each; min_work is usually MIN_CHUNK_WORK
+static inline size_t chunk_min_units(size_t unit_work, size_t min_work)
+{
+   return (unit_work >= min_work) ? 1 : (min_work + unit_work - 1) / (unit_work ? unit_work : 1);
+}
+
+#endif
@@ -0,0 +1,506 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "compact_matrix.h"
+#include "matrix_threads.h"
+
+#define TRANSPOSE_BLOCK 64
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+#define MAX(x,y) ((x)>(y) ? (x) : (y))
+
+// position of a type in the kernel tables
+#define TYPE_INDEX(t) ((t) == COMPACT_INT8 ? 0 : (t) == COMPACT_INT16 ? 1 : 2)
+
+typedef struct {
+   size_t id, num_threads;
+   square_matrix *m;
+   compact_matrix *c1, *c2, *cres;
+   matrix_element min, max;    // range found by thread_range
+} thread_arg_t_compact;
+
+typedef void * (*compact_thread_fn)(void *);
+
+DEFINE_RUN_THREADS_INTO(thread_arg_t_compact)
+
+// elements first .. last-1 of thread id's share of size
+#define FLAT_RANGE(p, size, first, last)                        \
+   size_t first = (size) * (p)->id / (p)->num_threads;           \
+   size_t last  = (size) * ((p)->id + 1) / (p)->num_threads
+
+
+/////////////////////////////////////
+//                                 //
+// Types and ranges                //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * Return the narrowest type that holds every value in [min, max].
+ */
+compact_type compact_type_for_range(int64_t min, int64_t max)
+{
+   if(min >= INT8_MIN && max <= INT8_MAX)
+      return COMPACT_INT8;
+   if(min >= INT16_MIN && max <= INT16_MAX)
+      return COMPACT_INT16;
+   return COMPACT_INT32;
+}
+
+static void * thread_range(void * p_arg)
+{
+   thread_arg_t_compact *p = p_arg;
+   size_t n = p->m->order;
+   FLAT_RANGE(p, n * n, first, last);
+   const matrix_element* data = p->m->data[0];
+
+   matrix_element lo = first < last ? data[first] : 0, hi = lo;
+   for(size_t e = first; e < last; e++) {
+      lo = MIN(lo, data[e]);
+      hi = MAX(hi, data[e]);
+   }
+
+   p->min = lo;
+   p->max = hi;
+
+   return NULL;
+}
+
+// smallest and largest element of m, both 0 for an empty matrix
+static void scan_range(square_matrix* m, size_t num_threads, matrix_element* min, matrix_element* max)
+{
+   size_t n = m->order;
+   num_threads = clamp_threads(n * n, num_threads);
+   thread_arg_t_compact args[num_threads];
+
+   run_threads_into(thread_range, (thread_arg_t_compact){.m = m}, args, num_threads);
+
+   // threads with no elements report 0, which must not count
+   *min = *max = 0;
+   for(size_t i = 0, seen = 0; i < num_threads; i++)
+      if(i * n * n / num_threads < (i + 1) * n * n / num_threads) {
+         *min = seen ? MIN(*min, args[i].min) : args[i].min;
+         *max = seen ? MAX(*max, args[i].max) : args[i].max;
+         seen = 1;
+      }
+}
+
+/*
+ * Scan m and return the narrowest type that holds all its elements.
+ * Return COMPACT_INT32 if m is NULL.
+ */
+compact_type detect_compact_type_threads(square_matrix* m, size_t num_threads)
+{
+   if(m == NULL || num_threads == 0)
+      return COMPACT_INT32;
+
+   matrix_element min, max;
+   scan_range(m, num_threads, &min, &max);
+
+   return compact_type_for_range(min, max);
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Kernels for each type           //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * Per element type T: conversions from and to matrix_element, the
+ * transpose, and the product. The product is the IKJ loop of
+ * thread_mul() in square_matrix3.c with each element of A and of the
+ * row of B widened to matrix_element as it is loaded, so the narrow
+ * matrices are what travel through the caches and the arithmetic is
+ * the same as for the row-major product.
+ */
+#define DEFINE_COMPACT_KERNELS(T)                                                            \
+static void * thread_to_##T(void * p_arg)                                                    \
+{                                                                                            \
+   thread_arg_t_compact *p = p_arg;                                                          \
+   size_t n = p->m->order;                                                                   \
+   FLAT_RANGE(p, n * n, first, last);                                                        \
+   const matrix_element* restrict src = p->m->data[0];                                       \
+   T* restrict dst = p->cres->data;                                                          \
+                                                                                             \
+   for(size_t e = first; e < last; e++)                                                      \
+      dst[e] = (T) src[e];                                                                   \
+                                                                                             \
+   return NULL;                                                                              \
+}                                                                                            \
+                                                                                             \
+static void * thread_from_##T(void * p_arg)                                                  \
+{                                                                                            \
+   thread_arg_t_compact *p = p_arg;                                                          \
+   size_t n = p->c1->order;                                                                  \
+   FLAT_RANGE(p, n * n, first, last);                                                        \
+   const T* restrict src = p->c1->data;                                                      \
+   matrix_element* restrict dst = p->m->data[0];                                             \
+                                                                                             \
+   for(size_t e = first; e < last; e++)                                                      \
+      dst[e] = src[e];                                                                       \
+                                                                                             \
+   return NULL;                                                                              \
+}                                                                                            \
+                                                                                             \
+/* thread id transposes bands of TRANSPOSE_BLOCK rows id, id + num_threads, ... */           \
+static void * thread_transpose_##T(void * p_arg)                                             \
+{                                                                                            \
+   thread_arg_t_compact *p = p_arg;                                                          \
+   size_t n = p->c1->order;                                                                  \
+   const T* restrict src = p->c1->data;                                                      \
+   T* restrict dst = p->cres->data;                                                          \
+                                                                                             \
+   for(size_t i0 = p->id * TRANSPOSE_BLOCK; i0 < n; i0 += p->num_threads * TRANSPOSE_BLOCK) \
+      for(size_t j0 = 0; j0 < n; j0 += TRANSPOSE_BLOCK)                                      \
+         for(size_t i = i0; i < MIN(i0 + TRANSPOSE_BLOCK, n); i++)                           \
+            for(size_t j = j0; j < MIN(j0 + TRANSPOSE_BLOCK, n); j++)                        \
+               dst[j*n + i] = src[i*n + j];                                                  \
+                                                                                             \
+   return NULL;                                                                              \
+}                                                                                            \
+                                                                                             \
+/* thread id will do rows id, id + num_threads, id + 2*num_threads, ... */                   \
+static void * thread_mul_##T(void * p_arg)                                                   \
+{                                                                                            \
+   thread_arg_t_compact *p = p_arg;                                                          \
+   size_t n = p->c1->order;                                                                  \
+   const T* data1 = p->c1->data;                                                             \
+   const T* data2 = p->c2->data;                                                             \
+   matrix_element** data = p->m->data;                                                       \
+                                                                                             \
+   for(size_t i = p->id; i < n; i += p->num_threads) {                                       \
+      matrix_element* restrict row = data[i];                                                \
+      memset(row, 0, n * sizeof(matrix_element));                                           \
+                                                                                             \
+      for(size_t k = 0; k < n; k++) {                                                        \
+         matrix_element a = data1[i*n + k];                                                  \
+         const T* restrict src = data2 + k*n;                                                \
+         for(size_t j = 0; j < n; j++)                                                       \
+            row[j] += a * (matrix_element) src[j];                                           \
+      }                                                                                      \
+   }                                                                                         \
+                                                                                             \
+   return NULL;                                                                              \
+}
+
+DEFINE_COMPACT_KERNELS(int8_t)
+DEFINE_COMPACT_KERNELS(int16_t)
+DEFINE_COMPACT_KERNELS(int32_t)
+
+/*
+ * Per pair of an operand type TI and a result type TR at least as
+ * wide: addition, and widening of a whole matrix.
+ */
+#define DEFINE_COMPACT_PAIR_KERNELS(TI, TR)                                                  \
+static void * thread_add_##TI##_##TR(void * p_arg)                                           \
+{                                                                                            \
+   thread_arg_t_compact *p = p_arg;                                                          \
+   size_t n = p->c1->order;                                                                  \
+   FLAT_RANGE(p, n * n, first, last);                                                        \
+   const TI* restrict data1 = p->c1->data;                                                   \
+   const TI* restrict data2 = p->c2->data;                                                   \
+   TR* restrict data = p->cres->data;                                                        \
+                                                                                             \
+   for(size_t e = first; e < last; e++)                                                      \
+      data[e] = (TR) ((matrix_element) data1[e] + data2[e]);                                 \
+                                                                                             \
+   return NULL;                                                                              \
+}                                                                                            \
+                                                                                             \
+static void * thread_widen_##TI##_##TR(void * p_arg)                                         \
+{                                                                                            \
+   thread_arg_t_compact *p = p_arg;                                                          \
+   size_t n = p->c1->order;                                                                  \
+   FLAT_RANGE(p, n * n, first, last);                                                        \
+   const TI* restrict src = p->c1->data;                                                     \
+   TR* restrict dst = p->cres->data;                                                         \
+                                                                                             \
+   for(size_t e = first; e < last; e++)                                                      \
+      dst[e] = src[e];                                                                       \
+                                                                                             \
+   return NULL;                                                                              \
+}
+
+DEFINE_COMPACT_PAIR_KERNELS(int8_t,  int8_t)
+DEFINE_COMPACT_PAIR_KERNELS(int8_t,  int16_t)
+DEFINE_COMPACT_PAIR_KERNELS(int8_t,  int32_t)
+DEFINE_COMPACT_PAIR_KERNELS(int16_t, int16_t)
+DEFINE_COMPACT_PAIR_KERNELS(int16_t, int32_t)
+DEFINE_COMPACT_PAIR_KERNELS(int32_t, int32_t)
+
+static const compact_thread_fn to_kernels[3]        = {thread_to_int8_t,        thread_to_int16_t,        thread_to_int32_t};
+static const compact_thread_fn from_kernels[3]      = {thread_from_int8_t,      thread_from_int16_t,      thread_from_int32_t};
+static const compact_thread_fn transpose_kernels[3] = {thread_transpose_int8_t, thread_transpose_int16_t, thread_transpose_int32_t};
+static const compact_thread_fn mul_kernels[3]       = {thread_mul_int8_t,       thread_mul_int16_t,       thread_mul_int32_t};
+
+// [operand type][result type], NULL where the result would be narrower
+static const compact_thread_fn add_kernels[3][3] = {
+   {thread_add_int8_t_int8_t, thread_add_int8_t_int16_t,  thread_add_int8_t_int32_t},
+   {NULL,                     thread_add_int16_t_int16_t, thread_add_int16_t_int32_t},
+   {NULL,                     NULL,                       thread_add_int32_t_int32_t},
+};
+static const compact_thread_fn widen_kernels[3][3] = {
+   {thread_widen_int8_t_int8_t, thread_widen_int8_t_int16_t,  thread_widen_int8_t_int32_t},
+   {NULL,                       thread_widen_int16_t_int16_t, thread_widen_int16_t_int32_t},
+   {NULL,                       NULL,                         thread_widen_int32_t_int32_t},
+};
+
+
+/////////////////////////////////////
+//                                 //
+// Construction and conversions    //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * Allocate space for a compact matrix of order n and type type.
+ * Return NULL if the type is unknown or the allocation is not successful.
+ *
+ * The elements and the bounds are left for the caller to set: every
+ * operation trusts min and max, so a compact matrix is only ever made
+ * by the conversions and operations below.
+ */
+static compact_matrix* new_compact_matrix(size_t n, compact_type type)
+{
+   if(type != COMPACT_INT8 && type != COMPACT_INT16 && type != COMPACT_INT32)
+      return NULL;
+
+   compact_matrix* c = malloc(sizeof(compact_matrix));
+   if(c == NULL)
+      return NULL;
+
+   c->data = malloc((n ? n * n : 1) * type);
+   if(c->data == NULL) {
+      free(c);
+      return NULL;
+   }
+
+   c->order = n;
+   c->type = type;
+   c->min = c->max = 0;
+
+   return c;
+}
+
+/*
+ * Deallocate the dynamic memory allocated for the given compact matrix.
+ */
+void free_compact_matrix(compact_matrix* c)
+{
+   if(c == NULL)
+      return;
+
+   free(c->data);
+   free(c);
+}
+
+/*
+ * Convert m, whose elements lie in min .. max, to a compact matrix of
+ * type type, which must hold that range.
+ */
+static compact_matrix* to_compact_matrix(square_matrix* m, compact_type type, matrix_element min, matrix_element max,
+                                         size_t num_threads)
+{
+   compact_matrix* c = new_compact_matrix(m->order, type);
+   if(c == NULL)
+      return NULL;
+   c->min = min;
+   c->max = max;
+
+   num_threads = clamp_threads(m->order * m->order, num_threads);
+   thread_arg_t_compact args[num_threads];
+   run_threads_into(to_kernels[TYPE_INDEX(type)], (thread_arg_t_compact){.m = m, .cres = c}, args, num_threads);
+
+   return c;
+}
+
+/*
+ * Convert m to a compact matrix of type type. Return a pointer to the
+ * newly allocated matrix or NULL if anything is wrong, including an
+ * element that type cannot hold.
+ */
+compact_matrix* square_to_compact_matrix_as_threads(square_matrix* m, compact_type type, size_t num_threads)
+{
+   if(m == NULL || num_threads == 0)
+      return NULL;
+
+   matrix_element min, max;
+   scan_range(m, num_threads, &min, &max);
+   if(compact_type_for_range(min, max) > type)
+      return NULL;
+
+   return to_compact_matrix(m, type, min, max, num_threads);
+}
+
+/*
+ * Convert m to a compact matrix of the narrowest type that holds it.
+ * Return a pointer to the newly allocated matrix or NULL if anything is
+ * wrong
+ */
+compact_matrix* square_to_compact_matrix_threads(square_matrix* m, size_t num_threads)
+{
+   if(m == NULL || num_threads == 0)
+      return NULL;
+
+   // one scan gives both the type and the bounds
+   matrix_element min, max;
+   scan_range(m, num_threads, &min, &max);
+
+   return to_compact_matrix(m, compact_type_for_range(min, max), min, max, num_threads);
+}
+
+/*
+ * Convert a compact matrix back to a square matrix. Return a pointer to
+ * the newly allocated matrix or NULL if anything is wrong
+ */
+square_matrix* compact_to_square_matrix_threads(compact_matrix* c, size_t num_threads)
+{
+   if(c == NULL || num_threads == 0)
+      return NULL;
+
+   square_matrix* m = new_square_matrix(c->order);
+   if(m == NULL)
+      return NULL;
+
+   num_threads = clamp_threads(c->order * c->order, num_threads);
+   thread_arg_t_compact args[num_threads];
+   run_threads_into(from_kernels[TYPE_INDEX(c->type)], (thread_arg_t_compact){.c1 = c, .m = m}, args, num_threads);
+
+   return m;
+}
+
+/*
+ * Return a copy of c widened to type, or NULL if anything is wrong.
+ */
+static compact_matrix* widen_compact_matrix(compact_matrix* c, compact_type type, size_t num_threads)
+{
+   compact_matrix* w = new_compact_matrix(c->order, type);
+   if(w == NULL)
+      return NULL;
+   w->min = c->min;
+   w->max = c->max;
+
+   num_threads = clamp_threads(c->order * c->order, num_threads);
+   thread_arg_t_compact args[num_threads];
+   run_threads_into(widen_kernels[TYPE_INDEX(c->type)][TYPE_INDEX(type)], (thread_arg_t_compact){.c1 = c, .cres = w},
+                    args, num_threads);
+
+   return w;
+}
+
+/*
+ * Bring two operands to the same type: *w1 and *w2 are the operands or
+ * widened copies of them to free with release_operands().
+ * Return 0 on success, -1 if anything is wrong.
+ */
+static int common_operands(compact_matrix* c1, compact_matrix* c2, compact_matrix** w1, compact_matrix** w2,
+                           size_t num_threads)
+{
+   *w1 = c1->type < c2->type ? widen_compact_matrix(c1, c2->type, num_threads) : c1;
+   *w2 = c2->type < c1->type ? widen_compact_matrix(c2, c1->type, num_threads) : c2;
+
+   return (*w1 == NULL || *w2 == NULL) ? -1 : 0;
+}
+
+static void release_operands(compact_matrix* c1, compact_matrix* c2, compact_matrix* w1, compact_matrix* w2)
+{
+   if(w1 != c1) free_compact_matrix(w1);
+   if(w2 != c2) free_compact_matrix(w2);
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Operations                      //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * Compute the sum of two compact matrices in the narrowest type that
+ * holds the sum of their bounds. Return a pointer to the newly allocated
+ * result or NULL if anything is wrong
+ */
+compact_matrix* add_compact_matrices_threads(compact_matrix* c1, compact_matrix* c2, size_t num_threads)
+{
+   if(c1 == NULL || c2 == NULL || c1->order != c2->order || num_threads == 0)
+      return NULL;
+
+   compact_matrix *w1, *w2;
+   if(common_operands(c1, c2, &w1, &w2, num_threads) != 0) {
+      release_operands(c1, c2, w1, w2);
+      return NULL;
+   }
+
+   int64_t min = (int64_t) c1->min + c2->min, max = (int64_t) c1->max + c2->max;
+   compact_type type = MAX(w1->type, compact_type_for_range(min, max));
+   compact_matrix* res = new_compact_matrix(c1->order, type);
+
+   if(res != NULL) {
+      // bounds beyond matrix_element wrap the way int sums do
+      res->min = min < INT32_MIN ? INT32_MIN : min;
+      res->max = max > INT32_MAX ? INT32_MAX : max;
+
+      size_t nt = clamp_threads(c1->order * c1->order, num_threads);
+      thread_arg_t_compact args[nt];
+      run_threads_into(add_kernels[TYPE_INDEX(w1->type)][TYPE_INDEX(type)],
+                       (thread_arg_t_compact){.c1 = w1, .c2 = w2, .cres = res}, args, nt);
+   }
+
+   release_operands(c1, c2, w1, w2);
+
+   return res;
+}
+
+/*
+ * Compute the transpose of a compact matrix, of the same type. Return a
+ * pointer to the newly allocated result or NULL if anything is wrong
+ */
+compact_matrix* transpose_compact_matrix_threads(compact_matrix* c, size_t num_threads)
+{
+   if(c == NULL || num_threads == 0)
+      return NULL;
+
+   compact_matrix* res = new_compact_matrix(c->order, c->type);
+   if(res == NULL)
+      return NULL;
+   res->min = c->min;
+   res->max = c->max;
+
+   num_threads = clamp_threads((c->order + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK, num_threads);
+   thread_arg_t_compact args[num_threads];
+   run_threads_into(transpose_kernels[TYPE_INDEX(c->type)], (thread_arg_t_compact){.c1 = c, .cres = res}, args, num_threads);
+
+   return res;
+}
+
+/*
+ * Compute the product of two compact matrices, accumulated in
+ * matrix_element. Return a pointer to the newly allocated result matrix
+ * or NULL if anything is wrong
+ */
+square_matrix* mul_compact_matrices_threads(compact_matrix* c1, compact_matrix* c2, size_t num_threads)
+{
+   if(c1 == NULL || c2 == NULL || c1->order != c2->order || num_threads == 0)
+      return NULL;
+
+   compact_matrix *w1, *w2;
+   if(common_operands(c1, c2, &w1, &w2, num_threads) != 0) {
+      release_operands(c1, c2, w1, w2);
+      return NULL;
+   }
+
+   square_matrix* res = new_square_matrix(c1->order);
+   if(res != NULL) {
+      size_t nt = clamp_threads(c1->order, num_threads);
+      thread_arg_t_compact args[nt];
+      run_threads_into(mul_kernels[TYPE_INDEX(w1->type)], (thread_arg_t_compact){.c1 = w1, .c2 = w2, .m = res}, args, nt);
+   }
+
+   release_operands(c1, c2, w1, w2);
+
+   return res;
+}
@@ -0,0 +1,44 @@
+#ifndef __compact_matrix_h__
+#define __compact_matrix_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "square_matrix3.h"
+
+// Element types of compact matrices; the value is the element size
+typedef enum {
+    COMPACT_INT8  = 1,
+    COMPACT_INT16 = 2,
+    COMPACT_INT32 = 4
+} compact_type;
+
+// A compact matrix stores its elements row by row in the narrowest
+// type that holds them. min and max bound the elements: exact after a
+// conversion, the bounds of the operands' sum after an addition. Only
+// the conversions and operations below make compact matrices, so the
+// bounds are always set.
+typedef struct {
+    size_t order;
+    compact_type type;
+    matrix_element min, max;
+    void* data;     // order*order elements of type int8_t, int16_t or int32_t
+} compact_matrix;
+
+compact_type compact_type_for_range(int64_t min, int64_t max);
+compact_type detect_compact_type_threads(square_matrix* m, size_t num_threads);
+
+void free_compact_matrix(compact_matrix* c);
+
+// convert in the narrowest type that holds m, or in type, which must hold m
+compact_matrix* square_to_compact_matrix_threads(square_matrix* m, size_t num_threads);
+compact_matrix* square_to_compact_matrix_as_threads(square_matrix* m, compact_type type, size_t num_threads);
+square_matrix* compact_to_square_matrix_threads(compact_matrix* c, size_t num_threads);
+
+// Operands of different types are widened to the wider type. The sum
+// is as narrow as the operands unless their bounds could overflow it;
+// products are accumulated in and returned as matrix_element.
+compact_matrix* add_compact_matrices_threads(compact_matrix* c1, compact_matrix* c2, size_t num_threads);
+compact_matrix* transpose_compact_matrix_threads(compact_matrix* c, size_t num_threads);
+square_matrix* mul_compact_matrices_threads(compact_matrix* c1, compact_matrix* c2, size_t num_threads);
+
+#endif
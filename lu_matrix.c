@@ -0,0 +1,370 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <assert.h>
+#include "lu_matrix.h"
+
+#define LU_BLOCK      64      // columns of a panel
+#define LU_COL_BLOCK  1024    // columns of the trailing update per pass, to keep U12 rows in cache
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
+
+/*
+ * Define the factorization and solves for the floating-point type T.
+ *
+ * The factorization is right-looking: for every panel of LU_BLOCK
+ * columns it factors the panel with partial pivoting, solves the block
+ * row U12 = L11^-1 A12 and subtracts L21 * U12 from the trailing matrix.
+ * The multiply engine only multiplies int matrices, so the trailing
+ * update cannot call it: lu_trailing_##T is a private copy of the IKJ
+ * kernel of thread_mul() in square_matrix3.c for T. One team of
+ * threads, created once, does all three steps in lockstep, separated by
+ * barriers:
+ *   - panel: rows are dealt out row-cyclically; each thread finds its
+ *     best pivot candidate, thread 0 picks the winner and swaps the rows,
+ *     and each thread scales and updates its own rows of the panel;
+ *   - block row: each thread solves a contiguous range of columns;
+ *   - trailing update: row-cyclic like mul_square_matrices_threads(), so
+ *     the shrinking matrix stays evenly split.
+ */
+#define DEFINE_LU(T)                                                                       \
+typedef struct {                                                                           \
+   T* a;                                                                                   \
+   size_t n, num_threads;                                                                  \
+   size_t* perm;                                                                           \
+   int sign, singular, pivot_ok;                                                           \
+   size_t* cand_row;       /* best pivot row found by each thread */                       \
+   T* cand_val;            /* and its absolute value */                                    \
+   pthread_barrier_t barrier;                                                              \
+} lu_team_##T;                                                                             \
+                                                                                           \
+typedef struct {                                                                           \
+   lu_team_##T* team;                                                                      \
+   size_t id;                                                                              \
+} lu_thread_arg_##T;                                                                       \
+                                                                                           \
+static void lu_panel_##T(lu_team_##T* t, size_t id, size_t k, size_t kb)                   \
+{                                                                                          \
+   size_t n = t->n, nt = t->num_threads;                                                   \
+   T* a = t->a;                                                                            \
+                                                                                           \
+   for(size_t j = k; j < k + kb; j++) {                                                    \
+      /* this thread's candidate among rows j + id, j + id + nt, ... */                    \
+      size_t best_row = j;                                                                 \
+      T best = -1;                                                                         \
+      for(size_t i = j + id; i < n; i += nt) {                                             \
+         T v = (T) fabs((double) a[i*n + j]);                                              \
+         if(v > best) { best = v; best_row = i; }                                          \
+      }                                                                                    \
+      t->cand_row[id] = best_row;                                                          \
+      t->cand_val[id] = best;                                                              \
+      pthread_barrier_wait(&t->barrier);                                                   \
+                                                                                           \
+      if(id == 0) {                                                                        \
+         size_t p = t->cand_row[0];                                                        \
+         T v = t->cand_val[0];                                                             \
+         for(size_t q = 1; q < nt; q++)                                                    \
+            if(t->cand_val[q] > v || (t->cand_val[q] == v && t->cand_row[q] < p)) {        \
+               v = t->cand_val[q];                                                         \
+               p = t->cand_row[q];                                                         \
+            }                                                                              \
+                                                                                           \
+         t->pivot_ok = (v > 0);                                                            \
+         if(!t->pivot_ok)                                                                  \
+            t->singular = 1;                                                               \
+         else if(p != j) {                                                                 \
+            T* rj = a + j*n;                                                               \
+            T* rp = a + p*n;                                                               \
+            for(size_t c = 0; c < n; c++) {                                                \
+               T tmp = rj[c]; rj[c] = rp[c]; rp[c] = tmp;                                  \
+            }                                                                              \
+            size_t tp = t->perm[j]; t->perm[j] = t->perm[p]; t->perm[p] = tp;              \
+            t->sign = -t->sign;                                                            \
+         }                                                                                 \
+      }                                                                                    \
+      pthread_barrier_wait(&t->barrier);                                                   \
+                                                                                           \
+      if(t->pivot_ok) {                                                                    \
+         const T* restrict pivot_row = a + j*n;                                            \
+         T inv = 1 / pivot_row[j];                                                         \
+         for(size_t i = j + 1 + id; i < n; i += nt) {                                      \
+            T* restrict row = a + i*n;                                                     \
+            T l = row[j] *= inv;                                                           \
+            for(size_t c = j + 1; c < k + kb; c++)                                         \
+               row[c] -= l * pivot_row[c];                                                 \
+         }                                                                                 \
+      }                                                                                    \
+   }                                                                                       \
+}                                                                                          \
+                                                                                           \
+static void lu_block_row_##T(lu_team_##T* t, size_t id, size_t k, size_t kb)               \
+{                                                                                          \
+   size_t n = t->n, nt = t->num_threads;                                                   \
+   T* a = t->a;                                                                            \
+                                                                                           \
+   /* U12 = L11^-1 A12 on this thread's share of columns k+kb..n-1 */                      \
+   size_t width = n - k - kb;                                                              \
+   size_t first = k + kb + width * id / nt;                                                \
+   size_t last  = k + kb + width * (id + 1) / nt;                                          \
+   for(size_t i = k + 1; i < k + kb; i++) {                                                \
+      T* restrict row = a + i*n;                                                           \
+      for(size_t p = k; p < i; p++) {                                                      \
+         T l = row[p];                                                                     \
+         const T* restrict src = a + p*n;                                                  \
+         for(size_t c = first; c < last; c++)                                              \
+            row[c] -= l * src[c];                                                          \
+      }                                                                                    \
+   }                                                                                       \
+}                                                                                          \
+                                                                                           \
+static void lu_trailing_##T(lu_team_##T* t, size_t id, size_t k, size_t kb)                \
+{                                                                                          \
+   size_t n = t->n, nt = t->num_threads;                                                   \
+   T* a = t->a;                                                                            \
+                                                                                           \
+   /* A22 -= L21 * U12, IKJ order, rows k+kb+id, k+kb+id+nt, ... */                        \
+   for(size_t jb = k + kb; jb < n; jb += LU_COL_BLOCK) {                                   \
+      size_t je = MIN(jb + LU_COL_BLOCK, n);                                               \
+      for(size_t i = k + kb + id; i < n; i += nt) {                                        \
+         T* restrict row = a + i*n;                                                        \
+         for(size_t p = k; p < k + kb; p++) {                                              \
+            T l = row[p];                                                                  \
+            const T* restrict src = a + p*n;                                               \
+            for(size_t c = jb; c < je; c++)                                                \
+               row[c] -= l * src[c];                                                       \
+         }                                                                                 \
+      }                                                                                    \
+   }                                                                                       \
+}                                                                                          \
+                                                                                           \
+static void * lu_thread_##T(void * p_arg)                                                  \
+{                                                                                          \
+   lu_thread_arg_##T* p = p_arg;                                                           \
+   lu_team_##T* t = p->team;                                                               \
+   size_t id = p->id;                                                                      \
+   size_t n = t->n;                                                                        \
+                                                                                           \
+   for(size_t k = 0; k < n; k += LU_BLOCK) {                                               \
+      size_t kb = MIN(LU_BLOCK, n - k);                                                    \
+                                                                                           \
+      lu_panel_##T(t, id, k, kb);                                                          \
+      pthread_barrier_wait(&t->barrier);                                                   \
+                                                                                           \
+      if(k + kb < n) {                                                                     \
+         lu_block_row_##T(t, id, k, kb);                                                   \
+         pthread_barrier_wait(&t->barrier);                                                \
+         lu_trailing_##T(t, id, k, kb);                                                    \
+         pthread_barrier_wait(&t->barrier);                                                \
+      }                                                                                    \
+   }                                                                                       \
+                                                                                           \
+   return NULL;                                                                            \
+}                                                                                          \
+                                                                                           \
+/*                                                                                         \
+ * Factor the order x order matrix a, which is left unchanged.                             \
+ * Return the factorization or NULL if anything is wrong. A singular                       \
+ * matrix still yields a factorization, with singular set.                                 \
+ */                                                                                        \
+lu_##T* lu_decompose_##T##_threads(const T* a, size_t order, size_t num_threads)           \
+{                                                                                          \
+   if(a == NULL || order == 0 || num_threads == 0)                                         \
+      return NULL;                                                                         \
+                                                                                           \
+   /* adjust number of threads for small matrices */                                       \
+   num_threads = (order < num_threads) ? order : num_threads;                              \
+                                                                                           \
+   lu_##T* f = malloc(sizeof(lu_##T));                                                     \
+   if(f == NULL)                                                                           \
+      return NULL;                                                                         \
+   f->order = order;                                                                       \
+   f->lu = malloc(order*order*sizeof(T));                                                  \
+   f->perm = malloc(order*sizeof(size_t));                                                 \
+   size_t* cand_row = malloc(num_threads*sizeof(size_t));                                  \
+   T* cand_val = malloc(num_threads*sizeof(T));                                            \
+   if(f->lu == NULL || f->perm == NULL || cand_row == NULL || cand_val == NULL) {          \
+      free(cand_row);                                                                      \
+      free(cand_val);                                                                      \
+      free_lu_##T(f);                                                                      \
+      return NULL;                                                                         \
+   }                                                                                       \
+                                                                                           \
+   memcpy(f->lu, a, order*order*sizeof(T));                                                \
+   for(size_t i = 0; i < order; i++)                                                       \
+      f->perm[i] = i;                                                                      \
+                                                                                           \
+   lu_team_##T team = {.a = f->lu, .n = order, .num_threads = num_threads, .perm = f->perm, \
+                       .sign = 1, .cand_row = cand_row, .cand_val = cand_val};              \
+   pthread_barrier_init(&team.barrier, NULL, num_threads);                                 \
+                                                                                           \
+   pthread_t tid[num_threads];                                                             \
+   lu_thread_arg_##T args[num_threads];                                                    \
+   for(size_t i = 1; i < num_threads; i++) {                                               \
+      args[i] = (lu_thread_arg_##T){&team, i};                                             \
+      int status = pthread_create(&tid[i], NULL, lu_thread_##T, &args[i]);                 \
+      assert(status == 0); /* could have handled errors better */                          \
+   }                                                                                       \
+   args[0] = (lu_thread_arg_##T){&team, 0};                                                \
+   lu_thread_##T(&args[0]);                                                                \
+   for(size_t i = 1; i < num_threads; i++)                                                 \
+      pthread_join(tid[i], NULL);                                                          \
+                                                                                           \
+   pthread_barrier_destroy(&team.barrier);                                                 \
+   free(cand_row);                                                                         \
+   free(cand_val);                                                                         \
+                                                                                           \
+   f->sign = team.sign;                                                                    \
+   f->singular = team.singular;                                                            \
+   return f;                                                                               \
+}                                                                                          \
+                                                                                           \
+void free_lu_##T(lu_##T* f)                                                                \
+{                                                                                          \
+   if(f == NULL)                                                                           \
+      return;                                                                              \
+                                                                                           \
+   free(f->lu);                                                                            \
+   free(f->perm);                                                                          \
+   free(f);                                                                                \
+}                                                                                          \
+                                                                                           \
+/*                                                                                         \
+ * Return the determinant of the factored matrix, or NAN if f is NULL                      \
+ */                                                                                        \
+T lu_determinant_##T(lu_##T* f)                                                            \
+{                                                                                          \
+   if(f == NULL)                                                                           \
+      return NAN;                                                                          \
+   if(f->singular)                                                                         \
+      return 0;                                                                            \
+                                                                                           \
+   double det = f->sign;                                                                   \
+   for(size_t i = 0; i < f->order; i++)                                                    \
+      det *= f->lu[i*f->order + i];                                                        \
+                                                                                           \
+   return (T) det;                                                                         \
+}                                                                                          \
+                                                                                           \
+/*                                                                                         \
+ * Solve L x = x in place for the lower triangle of l, taking its                          \
+ * diagonal as ones if unit_diagonal is set                                                \
+ */                                                                                        \
+void solve_lower_triangular_##T(const T* l, size_t order, int unit_diagonal, T* x)         \
+{                                                                                          \
+   if(l == NULL || x == NULL)                                                              \
+      return;                                                                              \
+                                                                                           \
+   for(size_t i = 0; i < order; i++) {                                                     \
+      const T* restrict row = l + i*order;                                                 \
+      T sum = x[i];                                                                        \
+      for(size_t j = 0; j < i; j++)                                                        \
+         sum -= row[j] * x[j];                                                             \
+      x[i] = unit_diagonal ? sum : sum / row[i];                                           \
+   }                                                                                       \
+}                                                                                          \
+                                                                                           \
+/*                                                                                         \
+ * Solve U x = x in place for the upper triangle of u                                      \
+ */                                                                                        \
+void solve_upper_triangular_##T(const T* u, size_t order, T* x)                            \
+{                                                                                          \
+   if(u == NULL || x == NULL)                                                              \
+      return;                                                                              \
+                                                                                           \
+   for(size_t i = order; i > 0; i--) {                                                     \
+      const T* restrict row = u + (i-1)*order;                                             \
+      T sum = x[i-1];                                                                      \
+      for(size_t j = i; j < order; j++)                                                    \
+         sum -= row[j] * x[j];                                                             \
+      x[i-1] = sum / row[i-1];                                                             \
+   }                                                                                       \
+}                                                                                          \
+                                                                                           \
+/*                                                                                         \
+ * Solve A x = b with the factorization of A; x and b may be the same.                     \
+ * Return 0 on success, -1 if A is singular or anything is wrong.                          \
+ */                                                                                        \
+int lu_solve_##T(lu_##T* f, const T* b, T* x)                                              \
+{                                                                                          \
+   if(f == NULL || b == NULL || x == NULL || f->singular)                                  \
+      return -1;                                                                           \
+                                                                                           \
+   size_t n = f->order;                                                                    \
+   T* y = malloc(n*sizeof(T));                                                             \
+   if(y == NULL)                                                                           \
+      return -1;                                                                           \
+                                                                                           \
+   for(size_t i = 0; i < n; i++)                                                           \
+      y[i] = b[f->perm[i]];                                                                \
+   solve_lower_triangular_##T(f->lu, n, 1, y);                                             \
+   solve_upper_triangular_##T(f->lu, n, y);                                                \
+   memcpy(x, y, n*sizeof(T));                                                              \
+                                                                                           \
+   free(y);                                                                                \
+   return 0;                                                                               \
+}
+
+DEFINE_LU(float)
+DEFINE_LU(double)
+
+
+/*
+ * Factor an integer matrix in double precision.
+ * Return NULL if anything is wrong
+ */
+lu_double* lu_decompose_square_matrix_threads(square_matrix* m, size_t num_threads)
+{
+   if(m == NULL || m->order == 0)
+      return NULL;
+
+   size_t n = m->order;
+   double* a = malloc(n*n*sizeof(double));
+   if(a == NULL)
+      return NULL;
+
+   // rows are contiguously allocated
+   const matrix_element* src = &m->data[0][0];
+   for(size_t e = 0; e < n*n; e++)
+      a[e] = src[e];
+
+   lu_double* f = lu_decompose_double_threads(a, n, num_threads);
+   free(a);
+
+   return f;
+}
+
+/*
+ * Return the determinant of an integer matrix, or NAN if anything is
+ * wrong
+ */
+double determinant_square_matrix_threads(square_matrix* m, size_t num_threads)
+{
+   lu_double* f = lu_decompose_square_matrix_threads(m, num_threads);
+   if(f == NULL)
+      return NAN;
+
+   double det = lu_determinant_double(f);
+   free_lu_double(f);
+
+   return det;
+}
+
+/*
+ * Solve m x = b for an integer matrix m.
+ * Return 0 on success, -1 if m is singular or anything is wrong.
+ */
+int solve_square_matrix_threads(square_matrix* m, const double* b, double* x, size_t num_threads)
+{
+   lu_double* f = lu_decompose_square_matrix_threads(m, num_threads);
+   if(f == NULL)
+      return -1;
+
+   int status = lu_solve_double(f, b, x);
+   free_lu_double(f);
+
+   return status;
+}
@@ -0,0 +1,43 @@
+#ifndef __lu_matrix_h__
+#define __lu_matrix_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+
+// LU decomposition with partial pivoting, PA = LU, for float and double
+// matrices stored row-major in one buffer of order*order elements.
+//
+// Every floating-point type T provides
+//    lu_T  lu_decompose_T_threads(a, order, num_threads)
+//    free_lu_T(f), lu_determinant_T(f), lu_solve_T(f, b, x)
+//    solve_lower_triangular_T(l, order, unit_diagonal, x)
+//    solve_upper_triangular_T(u, order, x)
+//
+// The factorization keeps L (unit diagonal, not stored) below the
+// diagonal of lu and U on and above it; row i of PA is row perm[i] of A.
+
+#define DECLARE_LU(T)                                                                      \
+typedef struct {                                                                           \
+    size_t order;                                                                          \
+    T* lu;                                                                                 \
+    size_t* perm;                                                                          \
+    int sign;           /* of the permutation */                                           \
+    int singular;       /* a zero pivot was found */                                       \
+} lu_##T;                                                                                  \
+                                                                                           \
+lu_##T* lu_decompose_##T##_threads(const T* a, size_t order, size_t num_threads);          \
+void    free_lu_##T(lu_##T* f);                                                            \
+T       lu_determinant_##T(lu_##T* f);                                                     \
+int     lu_solve_##T(lu_##T* f, const T* b, T* x);                                         \
+void    solve_lower_triangular_##T(const T* l, size_t order, int unit_diagonal, T* x);     \
+void    solve_upper_triangular_##T(const T* u, size_t order, T* x);
+
+DECLARE_LU(float)
+DECLARE_LU(double)
+
+// The same for integer matrices, factored in double precision.
+lu_double* lu_decompose_square_matrix_threads(square_matrix* m, size_t num_threads);
+double determinant_square_matrix_threads(square_matrix* m, size_t num_threads);
+int    solve_square_matrix_threads(square_matrix* m, const double* b, double* x, size_t num_threads);
+
+#endif
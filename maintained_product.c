@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "maintained_product.h"
+#include "matrix_gemm.h"
+#include "matrix_threads.h"
+
+// recompute C from scratch once the queued terms reach order/RECOMPUTE_DIVISOR:
+// each term costs about three passes over an n x n matrix, and the
+// packed multiply is a few times faster per operation than those passes
+#define RECOMPUTE_DIVISOR 8
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
+// rank-1 terms u[t] v[t], each vector n elements at u + t*n and v + t*n
+typedef struct {
+   size_t count, capacity;
+   matrix_element *u, *v;
+} term_list;
+
+struct maintained_product {
+   size_t order, num_threads;
+   square_matrix *a, *b, *c;
+   term_list da, db;      // changes of A and B not yet applied to C
+   int stale;             // too many changes were queued: C must be recomputed
+};
+
+/*
+ * Append a term to the list and return pointers to its u and v through
+ * pu and pv, zeroed. Return 0 on success, -1 if anything is wrong.
+ */
+static int push_term(term_list* l, size_t n, matrix_element** pu, matrix_element** pv)
+{
+   if(l->count == l->capacity) {
+      size_t capacity = l->capacity ? 2 * l->capacity : 4;
+      matrix_element* u = realloc(l->u, capacity * n * sizeof(matrix_element));
+      if(u == NULL)
+         return -1;
+      l->u = u;
+      matrix_element* v = realloc(l->v, capacity * n * sizeof(matrix_element));
+      if(v == NULL)
+         return -1;
+      l->v = v;
+      l->capacity = capacity;
+   }
+
+   *pu = l->u + l->count * n;
+   *pv = l->v + l->count * n;
+   memset(*pu, 0, n * sizeof(matrix_element));
+   memset(*pv, 0, n * sizeof(matrix_element));
+   l->count++;
+
+   return 0;
+}
+
+/*
+ * Once recomputing C is cheaper than applying the queued terms, drop
+ * them and remember to recompute, so a long batch of changes needs no
+ * more memory than a short one.
+ */
+static void check_queue(maintained_product* p)
+{
+   if(p->stale || (p->da.count + p->db.count) * RECOMPUTE_DIVISOR >= p->order) {
+      p->da.count = p->db.count = 0;
+      p->stale = 1;
+   }
+}
+
+/*
+ * Create a maintained product of copies of a and b. Return NULL if
+ * anything is wrong.
+ */
+maintained_product* new_maintained_product(square_matrix* a, square_matrix* b, size_t num_threads)
+{
+   if(a == NULL || b == NULL || a->order != b->order || num_threads == 0)
+      return NULL;
+
+   maintained_product* p = calloc(1, sizeof(maintained_product));
+   if(p == NULL)
+      return NULL;
+
+   p->order = a->order;
+   p->num_threads = num_threads;
+   p->a = duplicate_square_matrix(a);
+   p->b = duplicate_square_matrix(b);
+   p->c = gemm_square_matrices_threads(a, MATRIX_NO_TRANS, b, MATRIX_NO_TRANS, num_threads);
+
+   if(p->a == NULL || p->b == NULL || p->c == NULL) {
+      free_maintained_product(p);
+      return NULL;
+   }
+
+   return p;
+}
+
+/*
+ * Deallocate a maintained product and its matrices.
+ */
+void free_maintained_product(maintained_product* p)
+{
+   if(p == NULL)
+      return;
+
+   free_square_matrix(p->a);
+   free_square_matrix(p->b);
+   free_square_matrix(p->c);
+   free(p->da.u);
+   free(p->da.v);
+   free(p->db.u);
+   free(p->db.v);
+   free(p);
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Updates                         //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * Replace row i of m and queue the change as the term e_i (row - old).
+ * Return 0 on success, -1 if anything is wrong.
+ */
+static int set_row(maintained_product* p, square_matrix* m, term_list* l, size_t i, const matrix_element* row)
+{
+   size_t n = p->order;
+   if(row == NULL || i >= n || make_square_matrix_writable(m) != 0)
+      return -1;
+
+   matrix_element *u, *v;
+   if(push_term(l, n, &u, &v) != 0)
+      return -1;
+
+   u[i] = 1;
+   for(size_t j = 0; j < n; j++) {
+      v[j] = row[j] - m->data[i][j];
+      m->data[i][j] = row[j];
+   }
+   check_queue(p);
+
+   return 0;
+}
+
+/*
+ * Replace column j of m and queue the change as the term (col - old) e_j.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+static int set_column(maintained_product* p, square_matrix* m, term_list* l, size_t j, const matrix_element* col)
+{
+   size_t n = p->order;
+   if(col == NULL || j >= n || make_square_matrix_writable(m) != 0)
+      return -1;
+
+   matrix_element *u, *v;
+   if(push_term(l, n, &u, &v) != 0)
+      return -1;
+
+   v[j] = 1;
+   for(size_t i = 0; i < n; i++) {
+      u[i] = col[i] - m->data[i][j];
+      m->data[i][j] = col[i];
+   }
+   check_queue(p);
+
+   return 0;
+}
+
+int maintained_product_set_row_a(maintained_product* p, size_t i, const matrix_element* row)
+{
+   return p ? set_row(p, p->a, &p->da, i, row) : -1;
+}
+
+int maintained_product_set_column_a(maintained_product* p, size_t j, const matrix_element* col)
+{
+   return p ? set_column(p, p->a, &p->da, j, col) : -1;
+}
+
+int maintained_product_set_row_b(maintained_product* p, size_t i, const matrix_element* row)
+{
+   return p ? set_row(p, p->b, &p->db, i, row) : -1;
+}
+
+int maintained_product_set_column_b(maintained_product* p, size_t j, const matrix_element* col)
+{
+   return p ? set_column(p, p->b, &p->db, j, col) : -1;
+}
+
+
+typedef struct {
+   size_t id, num_threads;
+   maintained_product* p;
+   square_matrix* m;                 // matrix changed by update_rows
+   const matrix_element *u, *v;      // terms of update_rows
+   size_t k;
+   matrix_element *t1, *w, *x;       // flush work space
+} thread_arg_t_maint;
+
+DEFINE_RUN_THREADS(thread_arg_t_maint)
+
+/*
+ * m += U V, thread id doing rows id, id + num_threads, ...; zero
+ * entries of U are skipped, so unit vectors cost one row each.
+ */
+static void * thread_update_rows(void * p_arg)
+{
+   thread_arg_t_maint *p = p_arg;
+   size_t n = p->m->order;
+
+   for(size_t i = p->id; i < n; i += p->num_threads) {
+      matrix_element* restrict row = p->m->data[i];
+      for(size_t r = 0; r < p->k; r++) {
+         matrix_element x = p->u[r*n + i];
+         if(x == 0)
+            continue;
+         const matrix_element* restrict src = p->v + r*n;
+         for(size_t j = 0; j < n; j++)
+            row[j] += x * src[j];
+      }
+   }
+
+   return NULL;
+}
+
+/*
+ * m += U V and queue the k terms. Return 0 on success, -1 if anything
+ * is wrong.
+ */
+static int update(maintained_product* p, square_matrix* m, term_list* l,
+                  const matrix_element* u, const matrix_element* v, size_t k)
+{
+   size_t n = p->order;
+   if(u == NULL || v == NULL || make_square_matrix_writable(m) != 0)
+      return -1;
+
+   size_t queued = l->count;
+   for(size_t r = 0; r < k; r++) {
+      matrix_element *tu, *tv;
+      if(push_term(l, n, &tu, &tv) != 0) {
+         l->count = queued;
+         return -1;
+      }
+      memcpy(tu, u + r*n, n * sizeof(matrix_element));
+      memcpy(tv, v + r*n, n * sizeof(matrix_element));
+   }
+
+   size_t num_threads = MIN(n ? n : 1, p->num_threads);
+   run_threads(thread_update_rows, (thread_arg_t_maint){.m = m, .u = u, .v = v, .k = k}, num_threads);
+   check_queue(p);
+
+   return 0;
+}
+
+int maintained_product_update_a(maintained_product* p, const matrix_element* u, const matrix_element* v, size_t k)
+{
+   return p ? update(p, p->a, &p->da, u, v, k) : -1;
+}
+
+int maintained_product_update_b(maintained_product* p, const matrix_element* u, const matrix_element* v, size_t k)
+{
+   return p ? update(p, p->b, &p->db, u, v, k) : -1;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Flush                           //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * With A and B already changed to A1 = A0 + dA and B1 = B0 + dB,
+ *
+ *    A1 B1 - A0 B0 = dA B1 + (A1 - dA) dB
+ *
+ * and with dA = sum ua[r] va[r], dB = sum ub[s] vb[s], that is
+ *
+ *    sum over r of ua[r] (va[r] B1)
+ *  + sum over s of (A1 ub[s] - sum over r of ua[r] (va[r] . ub[s])) vb[s]
+ *
+ * Phase one computes the rows t1[r] = va[r] B1, each thread a range of
+ * columns, and the columns w[s] = A1 ub[s] - ..., each thread rows id,
+ * id + num_threads, ...; x[r][s] = va[r] . ub[s] is computed before.
+ * Phase two adds both sums to the rows of C.
+ */
+static void * thread_flush_terms(void * p_arg)
+{
+   thread_arg_t_maint *p = p_arg;
+   maintained_product* mp = p->p;
+   size_t n = mp->order, ka = mp->da.count, kb = mp->db.count;
+   matrix_element** b = mp->b->data;
+   matrix_element** a = mp->a->data;
+
+   size_t j0 = n * p->id / p->num_threads, j1 = n * (p->id + 1) / p->num_threads;
+   for(size_t r = 0; r < ka; r++)
+      memset(p->t1 + r*n + j0, 0, (j1 - j0) * sizeof(matrix_element));
+   for(size_t k = 0; k < n; k++)
+      for(size_t r = 0; r < ka; r++) {
+         matrix_element y = mp->da.v[r*n + k];
+         if(y == 0)
+            continue;
+         matrix_element* restrict dst = p->t1 + r*n;
+         const matrix_element* restrict src = b[k];
+         for(size_t j = j0; j < j1; j++)
+            dst[j] += y * src[j];
+      }
+
+   for(size_t i = p->id; i < n; i += p->num_threads)
+      for(size_t s = 0; s < kb; s++) {
+         const matrix_element* restrict ub = mp->db.u + s*n;
+         matrix_element sum = 0;
+         for(size_t j = 0; j < n; j++)
+            sum += a[i][j] * ub[j];
+         for(size_t r = 0; r < ka; r++)
+            sum -= mp->da.u[r*n + i] * p->x[r*kb + s];
+         p->w[s*n + i] = sum;
+      }
+
+   return NULL;
+}
+
+static void * thread_flush_apply(void * p_arg)
+{
+   thread_arg_t_maint *p = p_arg;
+   maintained_product* mp = p->p;
+   size_t n = mp->order, ka = mp->da.count, kb = mp->db.count;
+
+   for(size_t i = p->id; i < n; i += p->num_threads) {
+      matrix_element* restrict row = mp->c->data[i];
+      for(size_t r = 0; r < ka; r++) {
+         matrix_element y = mp->da.u[r*n + i];
+         if(y == 0)
+            continue;
+         const matrix_element* restrict src = p->t1 + r*n;
+         for(size_t j = 0; j < n; j++)
+            row[j] += y * src[j];
+      }
+      for(size_t s = 0; s < kb; s++) {
+         matrix_element y = p->w[s*n + i];
+         if(y == 0)
+            continue;
+         const matrix_element* restrict src = mp->db.v + s*n;
+         for(size_t j = 0; j < n; j++)
+            row[j] += y * src[j];
+      }
+   }
+
+   return NULL;
+}
+
+/*
+ * Return the number of terms queued since the last flush, or the order
+ * if the next flush will recompute C.
+ */
+size_t maintained_product_pending(maintained_product* p)
+{
+   if(p == NULL)
+      return 0;
+
+   return p->stale ? p->order : p->da.count + p->db.count;
+}
+
+/*
+ * Bring C up to date with A and B.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int maintained_product_flush(maintained_product* p)
+{
+   if(p == NULL)
+      return -1;
+
+   size_t n = p->order, ka = p->da.count, kb = p->db.count;
+   if(ka + kb == 0 && !p->stale)
+      return 0;
+
+   int r = 0;
+   if(p->stale)
+      r = gemm_square_matrices_into_threads(p->a, MATRIX_NO_TRANS, p->b, MATRIX_NO_TRANS, p->c, 0, p->num_threads);
+   else {
+      matrix_element* t1 = malloc((ka ? ka : 1) * n * sizeof(matrix_element));
+      matrix_element* w = malloc((kb ? kb : 1) * n * sizeof(matrix_element));
+      matrix_element* x = malloc((ka && kb ? ka * kb : 1) * sizeof(matrix_element));
+      if(t1 == NULL || w == NULL || x == NULL || make_square_matrix_writable(p->c) != 0)
+         r = -1;
+
+      if(r == 0) {
+         for(size_t i = 0; i < ka; i++)
+            for(size_t s = 0; s < kb; s++) {
+               matrix_element sum = 0;
+               for(size_t j = 0; j < n; j++)
+                  sum += p->da.v[i*n + j] * p->db.u[s*n + j];
+               x[i*kb + s] = sum;
+            }
+
+         size_t num_threads = MIN(n, p->num_threads);
+         thread_arg_t_maint proto = {.p = p, .t1 = t1, .w = w, .x = x};
+         run_threads(thread_flush_terms, proto, num_threads);
+         run_threads(thread_flush_apply, proto, num_threads);
+      }
+
+      free(t1);
+      free(w);
+      free(x);
+   }
+
+   if(r == 0) {
+      p->da.count = p->db.count = 0;
+      p->stale = 0;
+   }
+
+   return r;
+}
+
+/*
+ * Flush and return C, shared with p. Return NULL if anything is wrong.
+ */
+square_matrix* maintained_product_result(maintained_product* p)
+{
+   if(maintained_product_flush(p) != 0)
+      return NULL;
+
+   return share_square_matrix(p->c);
+}
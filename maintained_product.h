@@ -0,0 +1,38 @@
+#ifndef __maintained_product_h__
+#define __maintained_product_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+
+// A maintained product holds C = A * B while rows, columns or low-rank
+// terms of A and B change. Every change is a sum of rank-1 terms u v
+// (u a column, v a row); changes are applied to A and B at once but
+// queued for C, and a flush patches C with all queued terms together in
+// O(k n^2) time for k terms. When k is large enough that recomputing is
+// cheaper, the flush multiplies A * B from scratch instead.
+
+typedef struct maintained_product maintained_product;
+
+// A and B are shared, not copied, until either side changes them
+maintained_product* new_maintained_product(square_matrix* a, square_matrix* b, size_t num_threads);
+void free_maintained_product(maintained_product* p);
+
+int maintained_product_set_row_a(maintained_product* p, size_t i, const matrix_element* row);
+int maintained_product_set_column_a(maintained_product* p, size_t j, const matrix_element* col);
+int maintained_product_set_row_b(maintained_product* p, size_t i, const matrix_element* row);
+int maintained_product_set_column_b(maintained_product* p, size_t j, const matrix_element* col);
+
+// A += U V or B += U V, where U is n x k and V is k x n. Column r of U
+// is u[r*n .. r*n + n-1] and row r of V is v[r*n .. r*n + n-1].
+int maintained_product_update_a(maintained_product* p, const matrix_element* u, const matrix_element* v, size_t k);
+int maintained_product_update_b(maintained_product* p, const matrix_element* u, const matrix_element* v, size_t k);
+
+// queued terms, and applying them to C
+size_t maintained_product_pending(maintained_product* p);
+int maintained_product_flush(maintained_product* p);
+
+// flush and return C, shared with p (see share_square_matrix());
+// the caller frees it
+square_matrix* maintained_product_result(maintained_product* p);
+
+#endif
@@ -0,0 +1,279 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include "matrix_async.h"
+#include "square_matrix_ws.h"
+
+typedef enum {
+   ASYNC_ADD,
+   ASYNC_MUL,
+   ASYNC_TRANSPOSE,
+   ASYNC_CALL
+} async_op;
+
+struct matrix_future {
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   int done;
+   int taken;                  // result handed to the caller by matrix_future_wait()
+   atomic_int refs;            // the caller's handle and the queued operation
+   square_matrix* result;
+   matrix_callback callback;
+   void* user;
+
+   // the operation to run
+   async_op op;
+   square_matrix *m1, *m2;
+   square_matrix* (*func)(void*);
+   void* arg;
+};
+
+
+/////////////////////////////////////
+//                                 //
+// Library worker pool             //
+//                                 //
+/////////////////////////////////////
+
+static ws_pool* async_pool = NULL;
+static pthread_mutex_t async_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Return the pool that runs asynchronous operations, creating it with
+ * one worker per online processor on first use.
+ */
+ws_pool* matrix_async_pool(void)
+{
+   pthread_mutex_lock(&async_pool_lock);
+   if(async_pool == NULL) {
+      long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      async_pool = ws_pool_create(num_cpus > 0 ? (size_t) num_cpus : 1);
+   }
+   ws_pool* pool = async_pool;
+   pthread_mutex_unlock(&async_pool_lock);
+
+   return pool;
+}
+
+/*
+ * Stop the library's workers. All futures must be ready before calling
+ * this; the pool is created again by the next asynchronous call.
+ */
+void matrix_async_shutdown(void)
+{
+   pthread_mutex_lock(&async_pool_lock);
+   ws_pool_destroy(async_pool);
+   async_pool = NULL;
+   pthread_mutex_unlock(&async_pool_lock);
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Futures                         //
+//                                 //
+/////////////////////////////////////
+
+static void release_future(matrix_future* f)
+{
+   if(atomic_fetch_sub(&f->refs, 1) != 1)
+      return;
+
+   if(!f->taken)
+      free_square_matrix(f->result);
+   pthread_mutex_destroy(&f->lock);
+   pthread_cond_destroy(&f->cond);
+   free(f);
+}
+
+static void future_task(void* p_arg)
+{
+   matrix_future* f = p_arg;
+   ws_pool* pool = matrix_async_pool();
+
+   // the kernels fork and join on the pool this task is running on
+   square_matrix* res = NULL;
+   switch(f->op) {
+      case ASYNC_ADD:       res = add_square_matrices_ws(f->m1, f->m2, pool); break;
+      case ASYNC_MUL:       res = mul_square_matrices_ws(f->m1, f->m2, pool); break;
+      case ASYNC_TRANSPOSE: res = transpose_square_matrix_ws(f->m1, pool);    break;
+      case ASYNC_CALL:      res = f->func(f->arg);                            break;
+   }
+
+   pthread_mutex_lock(&f->lock);
+   f->result = res;
+   f->done = 1;
+   matrix_callback callback = f->callback;
+   void* user = f->user;
+   pthread_cond_broadcast(&f->cond);
+   pthread_mutex_unlock(&f->lock);
+
+   if(callback)
+      callback(f, user);
+
+   release_future(f);
+}
+
+static matrix_future* submit_future(async_op op, square_matrix* m1, square_matrix* m2,
+                                    square_matrix* (*func)(void*), void* arg)
+{
+   ws_pool* pool = matrix_async_pool();
+   if(pool == NULL)
+      return NULL;
+
+   matrix_future* f = calloc(1, sizeof(matrix_future));
+   if(f == NULL)
+      return NULL;
+
+   pthread_mutex_init(&f->lock, NULL);
+   pthread_cond_init(&f->cond, NULL);
+   atomic_init(&f->refs, 2);
+   f->op = op;
+   f->m1 = m1;
+   f->m2 = m2;
+   f->func = func;
+   f->arg = arg;
+
+   if(ws_pool_submit(pool, future_task, f) != 0) {
+      pthread_mutex_destroy(&f->lock);
+      pthread_cond_destroy(&f->cond);
+      free(f);
+      return NULL;
+   }
+
+   return f;
+}
+
+
+/*
+ * Queue the sum of two square matrices. Return a future for the result
+ * or NULL if anything is wrong
+ */
+matrix_future* add_square_matrices_async(square_matrix* m1, square_matrix* m2)
+{
+   if(m1 == NULL || m2 == NULL || m1->order != m2->order)
+      return NULL;
+
+   return submit_future(ASYNC_ADD, m1, m2, NULL, NULL);
+}
+
+/*
+ * Queue the product of two square matrices. Return a future for the
+ * result or NULL if anything is wrong
+ */
+matrix_future* mul_square_matrices_async(square_matrix* m1, square_matrix* m2)
+{
+   if(m1 == NULL || m2 == NULL || m1->order != m2->order)
+      return NULL;
+
+   return submit_future(ASYNC_MUL, m1, m2, NULL, NULL);
+}
+
+/*
+ * Queue the transpose of a square matrix. Return a future for the
+ * result or NULL if anything is wrong
+ */
+matrix_future* transpose_square_matrix_async(square_matrix* m)
+{
+   if(m == NULL)
+      return NULL;
+
+   return submit_future(ASYNC_TRANSPOSE, m, NULL, NULL, NULL);
+}
+
+/*
+ * Queue func(arg) on the library's workers, for operations without an
+ * asynchronous variant of their own. Return a future for the matrix it
+ * returns or NULL if anything is wrong
+ */
+matrix_future* matrix_async_call(square_matrix* (*func)(void* arg), void* arg)
+{
+   if(func == NULL)
+      return NULL;
+
+   return submit_future(ASYNC_CALL, NULL, NULL, func, arg);
+}
+
+
+/*
+ * Return non-zero if the operation has finished, without blocking.
+ */
+int matrix_future_ready(matrix_future* f)
+{
+   if(f == NULL)
+      return 0;
+
+   pthread_mutex_lock(&f->lock);
+   int done = f->done;
+   pthread_mutex_unlock(&f->lock);
+
+   return done;
+}
+
+/*
+ * Block until the operation has finished and return its result, which
+ * from then on belongs to the caller. Return NULL if the operation
+ * failed or anything is wrong.
+ */
+square_matrix* matrix_future_wait(matrix_future* f)
+{
+   if(f == NULL)
+      return NULL;
+
+   pthread_mutex_lock(&f->lock);
+   while(!f->done)
+      pthread_cond_wait(&f->cond, &f->lock);
+   f->taken = 1;
+   square_matrix* res = f->result;
+   pthread_mutex_unlock(&f->lock);
+
+   return res;
+}
+
+/*
+ * Have callback(f, user) called once the operation has finished: on the
+ * worker that ran it, or right away on the calling thread if it is
+ * already finished. The callback may take the result with
+ * matrix_future_wait(), which will not block. Return 0 on success, -1
+ * if anything is wrong or a callback is already attached.
+ */
+int matrix_future_then(matrix_future* f, matrix_callback callback, void* user)
+{
+   if(f == NULL || callback == NULL)
+      return -1;
+
+   pthread_mutex_lock(&f->lock);
+   if(f->callback != NULL) {
+      pthread_mutex_unlock(&f->lock);
+      return -1;
+   }
+
+   // recorded even when finished, so that a second callback is refused
+   int done = f->done;
+   f->callback = callback;
+   f->user = user;
+   pthread_mutex_unlock(&f->lock);
+
+   if(done)
+      callback(f, user);
+
+   return 0;
+}
+
+/*
+ * Release the caller's handle to a future. A result that was never
+ * taken with matrix_future_wait() is freed as well, once the operation
+ * has finished.
+ */
+void free_matrix_future(matrix_future* f)
+{
+   if(f == NULL)
+      return;
+
+   release_future(f);
+}
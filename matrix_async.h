@@ -0,0 +1,29 @@
+#ifndef __matrix_async_h__
+#define __matrix_async_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+#include "work_stealing.h"
+
+// Asynchronous matrix operations. Each call queues the operation on the
+// library's worker pool and returns at once with a future for its result.
+// The operands must stay alive and unchanged until the future is ready.
+
+typedef struct matrix_future matrix_future;
+
+typedef void (*matrix_callback)(matrix_future* f, void* user);
+
+ws_pool* matrix_async_pool(void);
+void     matrix_async_shutdown(void);
+
+matrix_future* add_square_matrices_async(square_matrix* m1, square_matrix* m2);
+matrix_future* mul_square_matrices_async(square_matrix* m1, square_matrix* m2);
+matrix_future* transpose_square_matrix_async(square_matrix* m);
+matrix_future* matrix_async_call(square_matrix* (*func)(void* arg), void* arg);
+
+int            matrix_future_ready(matrix_future* f);
+square_matrix* matrix_future_wait(matrix_future* f);
+int            matrix_future_then(matrix_future* f, matrix_callback callback, void* user);
+void           free_matrix_future(matrix_future* f);
+
+#endif
@@ -0,0 +1,629 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "matrix_dist.h"
+#include "matrix_gemm.h"
+
+#define CONNECT_RETRIES  100
+#define CONNECT_DELAY_US 100000
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
+
+/////////////////////////////////////
+//                                 //
+// Socket transport                //
+//                                 //
+/////////////////////////////////////
+
+typedef struct {
+   int* fds;            // one connected socket per peer, -1 for self
+   pid_t* children;     // processes to wait for when the transport is freed
+   int num_children;
+} socket_transport;
+
+static int write_all(int fd, const void* buf, size_t len)
+{
+   const char* p = buf;
+   while(len > 0) {
+      ssize_t w = send(fd, p, len, MSG_NOSIGNAL);
+      if(w < 0 && errno == EINTR)
+         continue;
+      if(w <= 0)
+         return -1;
+      p += w;
+      len -= w;
+   }
+   return 0;
+}
+
+static int read_all(int fd, void* buf, size_t len)
+{
+   char* p = buf;
+   while(len > 0) {
+      ssize_t r = recv(fd, p, len, 0);
+      if(r < 0 && errno == EINTR)
+         continue;
+      if(r <= 0)
+         return -1;
+      p += r;
+      len -= r;
+   }
+   return 0;
+}
+
+static int socket_send(matrix_transport* t, int peer, const void* buf, size_t len)
+{
+   socket_transport* s = t->impl;
+   if(peer < 0 || peer >= t->size || s->fds[peer] < 0)
+      return -1;
+   return write_all(s->fds[peer], buf, len);
+}
+
+static int socket_recv(matrix_transport* t, int peer, void* buf, size_t len)
+{
+   socket_transport* s = t->impl;
+   if(peer < 0 || peer >= t->size || s->fds[peer] < 0)
+      return -1;
+   return read_all(s->fds[peer], buf, len);
+}
+
+static void socket_close(matrix_transport* t)
+{
+   socket_transport* s = t->impl;
+
+   for(int p = 0; p < t->size; p++)
+      if(s->fds[p] >= 0)
+         close(s->fds[p]);
+
+   for(int c = 0; c < s->num_children; c++)
+      waitpid(s->children[c], NULL, 0);
+
+   free(s->fds);
+   free(s->children);
+   free(s);
+}
+
+/*
+ * Wrap one connected stream socket per peer in a transport.
+ * Return NULL if anything is wrong.
+ */
+matrix_transport* new_socket_transport(int rank, int size, const int* fds)
+{
+   if(fds == NULL || size <= 0 || rank < 0 || rank >= size)
+      return NULL;
+
+   matrix_transport* t = malloc(sizeof(matrix_transport));
+   socket_transport* s = malloc(sizeof(socket_transport));
+   int* copy = malloc(size * sizeof(int));
+   if(t == NULL || s == NULL || copy == NULL) {
+      free(t);
+      free(s);
+      free(copy);
+      return NULL;
+   }
+
+   for(int p = 0; p < size; p++)
+      copy[p] = p == rank ? -1 : fds[p];
+
+   *s = (socket_transport){.fds = copy};
+   *t = (matrix_transport){.rank = rank, .size = size, .send = socket_send, .recv = socket_recv,
+                           .close = socket_close, .impl = s};
+
+   return t;
+}
+
+/*
+ * Connect to host:port, retrying while nothing listens there yet.
+ * Return the socket or -1.
+ */
+static int tcp_connect(const char* host, unsigned short port)
+{
+   char service[8];
+   snprintf(service, sizeof(service), "%u", port);
+   struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+
+   for(int attempt = 0; attempt < CONNECT_RETRIES; attempt++) {
+      struct addrinfo* res;
+      if(getaddrinfo(host, service, &hints, &res) != 0)
+         return -1;
+
+      for(struct addrinfo* ai = res; ai != NULL; ai = ai->ai_next) {
+         int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+         if(fd < 0)
+            continue;
+         if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            freeaddrinfo(res);
+            return fd;
+         }
+         close(fd);
+      }
+
+      freeaddrinfo(res);
+      usleep(CONNECT_DELAY_US);
+   }
+
+   return -1;
+}
+
+/*
+ * Listen on port of every local address: IPv6 and, through mapped
+ * addresses, IPv4 where the host has IPv6, plain IPv4 where it has not.
+ * Return the socket or -1.
+ */
+static int tcp_listen(unsigned short port, int backlog)
+{
+   int on = 1, off = 0;
+
+   int fd = socket(AF_INET6, SOCK_STREAM, 0);
+   if(fd >= 0) {
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+      struct sockaddr_in6 addr = {.sin6_family = AF_INET6, .sin6_port = htons(port), .sin6_addr = in6addr_any};
+      if(bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0 && listen(fd, backlog) == 0)
+         return fd;
+      close(fd);
+   }
+
+   // IPv6 disabled or not available
+   fd = socket(AF_INET, SOCK_STREAM, 0);
+   if(fd < 0)
+      return -1;
+
+   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+   struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_ANY)};
+   if(bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, backlog) != 0) {
+      close(fd);
+      return -1;
+   }
+
+   return fd;
+}
+
+/*
+ * Build a full mesh of TCP connections. Each rank connects to the lower
+ * ranks and announces its rank, then accepts the higher ranks; a
+ * connection completes in the listen backlog even before the peer
+ * accepts it, so no rank waits on another in a cycle.
+ * Return NULL if anything is wrong.
+ */
+matrix_transport* new_tcp_transport(int rank, int size, const char* const* hosts, const unsigned short* ports)
+{
+   if(hosts == NULL || ports == NULL || size <= 0 || rank < 0 || rank >= size)
+      return NULL;
+
+   int fds[size];
+   for(int p = 0; p < size; p++)
+      fds[p] = -1;
+
+   int listener = tcp_listen(ports[rank], size);
+   if(listener < 0)
+      return NULL;
+
+   int32_t me = rank;
+   for(int p = 0; p < rank; p++) {
+      fds[p] = tcp_connect(hosts[p], ports[p]);
+      if(fds[p] < 0 || write_all(fds[p], &me, sizeof(me)) != 0)
+         goto fail;
+   }
+
+   for(int accepted = rank + 1; accepted < size; accepted++) {
+      int fd = accept(listener, NULL, NULL);
+      int32_t peer;
+      if(fd < 0)
+         goto fail;
+      if(read_all(fd, &peer, sizeof(peer)) != 0 || peer <= rank || peer >= size || fds[peer] >= 0) {
+         close(fd);
+         goto fail;
+      }
+      fds[peer] = fd;
+   }
+
+   close(listener);
+   listener = -1;
+
+   // blocks are sent whole, so Nagle's algorithm would only delay the tails
+   int on = 1;
+   for(int p = 0; p < size; p++)
+      if(fds[p] >= 0)
+         setsockopt(fds[p], IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+   matrix_transport* t = new_socket_transport(rank, size, fds);
+   if(t != NULL)
+      return t;
+
+fail:
+   if(listener >= 0)
+      close(listener);
+   for(int p = 0; p < size; p++)
+      if(fds[p] >= 0)
+         close(fds[p]);
+   return NULL;
+}
+
+/*
+ * Fork size-1 children, every pair of the size processes sharing a
+ * Unix-domain socket pair. Call it before any threads are started.
+ * Return the rank of the calling process, or -1 if anything is wrong.
+ */
+int spawn_local_processes(int size, matrix_transport** t)
+{
+   if(size <= 0 || t == NULL)
+      return -1;
+
+   // pairs[i*size + j], i < j: i's end is [0], j's end is [1]
+   int (*pairs)[2] = malloc(size * size * sizeof(*pairs));
+   pid_t* children = malloc(size * sizeof(pid_t));
+   if(pairs == NULL || children == NULL) {
+      free(pairs);
+      free(children);
+      return -1;
+   }
+
+   int ok = 1;
+   for(int e = 0; e < size * size; e++)
+      pairs[e][0] = pairs[e][1] = -1;
+   for(int i = 0; i < size && ok; i++)
+      for(int j = i + 1; j < size && ok; j++)
+         ok = socketpair(AF_UNIX, SOCK_STREAM, 0, pairs[i*size + j]) == 0;
+
+   int rank = 0, num_children = 0;
+   for(int r = 1; r < size && ok; r++) {
+      pid_t pid = fork();
+      if(pid == 0) {
+         rank = r;
+         num_children = 0;
+         break;
+      }
+      if(pid < 0)
+         ok = 0;
+      else
+         children[num_children++] = pid;
+   }
+
+   // keep this rank's ends, close everything else
+   int fds[size];
+   for(int p = 0; p < size; p++)
+      fds[p] = -1;
+   for(int i = 0; i < size; i++)
+      for(int j = i + 1; j < size; j++) {
+         int* pr = pairs[i*size + j];
+         if(pr[0] < 0)
+            continue;
+         if(i == rank)      { fds[j] = pr[0]; close(pr[1]); }
+         else if(j == rank) { fds[i] = pr[1]; close(pr[0]); }
+         else               { close(pr[0]); close(pr[1]); }
+      }
+   free(pairs);
+
+   // on failure the children see their sockets close and give up
+   *t = ok ? new_socket_transport(rank, size, fds) : NULL;
+   if(*t == NULL) {
+      for(int p = 0; p < size; p++)
+         if(fds[p] >= 0)
+            close(fds[p]);
+      for(int c = 0; c < num_children; c++)
+         waitpid(children[c], NULL, 0);
+      free(children);
+      if(rank != 0)
+         _exit(1);
+      return -1;
+   }
+
+   socket_transport* st = (*t)->impl;
+   st->children = children;
+   st->num_children = num_children;
+
+   return rank;
+}
+
+/*
+ * Close a transport; on the rank that spawned local processes, also
+ * wait for them to exit.
+ */
+void free_matrix_transport(matrix_transport* t)
+{
+   if(t == NULL)
+      return;
+
+   t->close(t);
+   free(t);
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Block distribution              //
+//                                 //
+/////////////////////////////////////
+
+// side of the process grid, or 0 if size is not a square
+static size_t grid_side(matrix_transport* t)
+{
+   size_t q = 1;
+   while(q * q < (size_t) t->size)
+      q++;
+   return q * q == (size_t) t->size ? q : 0;
+}
+
+size_t dist_block_order(matrix_transport* t, size_t n)
+{
+   size_t q = t ? grid_side(t) : 0;
+   return q ? (n + q - 1) / q : 0;
+}
+
+static int send_block(matrix_transport* t, int peer, square_matrix* m)
+{
+   return t->send(t, peer, m->data[0], m->order * m->order * sizeof(matrix_element));
+}
+
+static int recv_block(matrix_transport* t, int peer, square_matrix* m)
+{
+   return t->recv(t, peer, m->data[0], m->order * m->order * sizeof(matrix_element));
+}
+
+// copy block (bi,bj) of m into block, zero padded; or back if to_block is 0
+static void copy_block(square_matrix* m, square_matrix* block, size_t bi, size_t bj, int to_block)
+{
+   size_t n = m->order, nb = block->order;
+   size_t i0 = bi * nb, j0 = bj * nb;
+
+   if(to_block)
+      memset(block->data[0], 0, nb * nb * sizeof(matrix_element));
+
+   for(size_t i = i0; i < MIN(i0 + nb, n); i++) {
+      size_t cols = j0 < n ? MIN(nb, n - j0) : 0;
+      if(to_block)
+         memcpy(block->data[i - i0], m->data[i] + j0, cols * sizeof(matrix_element));
+      else
+         memcpy(m->data[i] + j0, block->data[i - i0], cols * sizeof(matrix_element));
+   }
+}
+
+/*
+ * Send every rank its block of m from rank 0.
+ * Return the caller's block or NULL if anything is wrong.
+ */
+square_matrix* scatter_square_matrix_dist(matrix_transport* t, square_matrix* m, size_t n)
+{
+   size_t nb = dist_block_order(t, n);
+   if(nb == 0 || (t->rank == 0 && (m == NULL || m->order != n)))
+      return NULL;
+
+   size_t q = grid_side(t);
+   square_matrix* block = new_square_matrix(nb);
+   if(block == NULL)
+      return NULL;
+
+   int r = 0;
+   if(t->rank == 0) {
+      for(int p = t->size - 1; p >= 0 && r == 0; p--) {
+         copy_block(m, block, p / q, p % q, 1);
+         if(p > 0) r = send_block(t, p, block);
+      }
+   }
+   else
+      r = recv_block(t, 0, block);
+
+   if(r != 0) {
+      free_square_matrix(block);
+      return NULL;
+   }
+
+   return block;
+}
+
+/*
+ * Collect the blocks of every rank on rank 0 and assemble the order n
+ * matrix in *res there. Return 0 on success, -1 if anything is wrong.
+ */
+int gather_square_matrix_dist(matrix_transport* t, square_matrix* block, size_t n, square_matrix** res)
+{
+   size_t nb = dist_block_order(t, n);
+   if(nb == 0 || block == NULL || block->order != nb || (t->rank == 0 && res == NULL))
+      return -1;
+
+   if(t->rank != 0)
+      return send_block(t, 0, block);
+
+   size_t q = grid_side(t);
+   square_matrix* m = new_square_matrix(n);
+   square_matrix* tmp = new_square_matrix(nb);
+   int r = (m == NULL || tmp == NULL) ? -1 : 0;
+
+   if(r == 0)
+      copy_block(m, block, 0, 0, 0);
+   for(int p = 1; p < t->size && r == 0; p++) {
+      r = recv_block(t, p, tmp);
+      if(r == 0) copy_block(m, tmp, p / q, p % q, 0);
+   }
+
+   free_square_matrix(tmp);
+   if(r != 0) {
+      free_square_matrix(m);
+      return -1;
+   }
+
+   *res = m;
+   return 0;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// SUMMA                           //
+//                                 //
+/////////////////////////////////////
+
+typedef struct {
+   matrix_transport* t;
+   size_t q, row, col;
+   square_matrix *a, *b;                // this rank's blocks
+   square_matrix *abuf[2], *bbuf[2];    // received panels, double buffered
+   square_matrix *apanel[2], *bpanel[2];
+   size_t ready;      // steps whose panels are in place
+   size_t consumed;   // steps multiplied
+   int error;
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+} summa_state;
+
+/*
+ * Step k needs block (row,k) of A, owned by rank (row,k) and broadcast
+ * along the grid row, and block (k,col) of B, broadcast along the grid
+ * column. All ranks send and receive the A panels before the B panels
+ * and steps in order, and within a phase a rank either only sends or
+ * only receives from one sender, so the exchange cannot deadlock. The
+ * panels of step k go to buffer k % 2 as soon as step k-2 has been
+ * multiplied, so they travel while step k-1 computes.
+ */
+static void * thread_summa_comm(void * p_arg)
+{
+   summa_state* s = p_arg;
+   matrix_transport* t = s->t;
+   int err = 0;
+
+   for(size_t k = 0; k < s->q && !err; k++) {
+      size_t slot = k % 2;
+
+      pthread_mutex_lock(&s->lock);
+      while(s->consumed + 2 <= k && !s->error)
+         pthread_cond_wait(&s->cond, &s->lock);
+      err = s->error;
+      pthread_mutex_unlock(&s->lock);
+      if(err)
+         break;
+
+      if(s->col == k) {
+         s->apanel[slot] = s->a;
+         for(size_t c = 0; c < s->q && !err; c++)
+            if(c != k) err = send_block(t, s->row*s->q + c, s->a);
+      }
+      else {
+         s->apanel[slot] = s->abuf[slot];
+         err = recv_block(t, s->row*s->q + k, s->abuf[slot]);
+      }
+
+      if(s->row == k) {
+         s->bpanel[slot] = s->b;
+         for(size_t r = 0; r < s->q && !err; r++)
+            if(r != k) err = send_block(t, r*s->q + s->col, s->b);
+      }
+      else if(!err) {
+         s->bpanel[slot] = s->bbuf[slot];
+         err = recv_block(t, k*s->q + s->col, s->bbuf[slot]);
+      }
+
+      pthread_mutex_lock(&s->lock);
+      if(err)
+         s->error = 1;
+      else
+         s->ready = k + 1;
+      pthread_cond_broadcast(&s->cond);
+      pthread_mutex_unlock(&s->lock);
+   }
+
+   return NULL;
+}
+
+/*
+ * Compute this rank's block of C = A * B. The caller's thread
+ * multiplies with the packed kernel on num_threads threads while a
+ * second thread moves the panels of the next step.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int mul_square_matrices_summa(matrix_transport* t, square_matrix* a, square_matrix* b, square_matrix* c, size_t num_threads)
+{
+   size_t q = t ? grid_side(t) : 0;
+   if(q == 0 || a == NULL || b == NULL || c == NULL || num_threads == 0 ||
+      a->order != b->order || a->order != c->order || c == a || c == b)
+      return -1;
+
+   size_t nb = a->order;
+   summa_state s = {.t = t, .q = q, .row = t->rank / q, .col = t->rank % q, .a = a, .b = b};
+   int r = 0;
+
+   for(int i = 0; i < 2; i++) {
+      s.abuf[i] = new_square_matrix(nb);
+      s.bbuf[i] = new_square_matrix(nb);
+      if(s.abuf[i] == NULL || s.bbuf[i] == NULL) r = -1;
+   }
+
+   if(r == 0) {
+      pthread_mutex_init(&s.lock, NULL);
+      pthread_cond_init(&s.cond, NULL);
+
+      pthread_t comm;
+      int status = pthread_create(&comm, NULL, thread_summa_comm, &s);
+      assert(status == 0); // could have handled errors better
+
+      for(size_t k = 0; k < q; k++) {
+         pthread_mutex_lock(&s.lock);
+         while(s.ready <= k && !s.error)
+            pthread_cond_wait(&s.cond, &s.lock);
+         int err = s.error;
+         pthread_mutex_unlock(&s.lock);
+
+         if(!err && gemm_square_matrices_into_threads(s.apanel[k % 2], MATRIX_NO_TRANS, s.bpanel[k % 2],
+                                                      MATRIX_NO_TRANS, c, k > 0, num_threads) != 0)
+            err = 1;
+
+         pthread_mutex_lock(&s.lock);
+         if(err)
+            s.error = 1;
+         else
+            s.consumed = k + 1;
+         pthread_cond_broadcast(&s.cond);
+         pthread_mutex_unlock(&s.lock);
+
+         if(err)
+            break;
+      }
+
+      pthread_join(comm, NULL);
+      pthread_mutex_destroy(&s.lock);
+      pthread_cond_destroy(&s.cond);
+      r = s.error ? -1 : 0;
+   }
+
+   for(int i = 0; i < 2; i++) {
+      free_square_matrix(s.abuf[i]);
+      free_square_matrix(s.bbuf[i]);
+   }
+
+   return r;
+}
+
+/*
+ * Multiply two order n matrices held by rank 0 on the whole group.
+ * Every rank must call it; *res is set on rank 0.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int mul_square_matrices_dist(matrix_transport* t, square_matrix* m1, square_matrix* m2, size_t n,
+                             square_matrix** res, size_t num_threads)
+{
+   square_matrix* a = scatter_square_matrix_dist(t, m1, n);
+   square_matrix* b = a ? scatter_square_matrix_dist(t, m2, n) : NULL;
+   square_matrix* c = b ? new_square_matrix(a->order) : NULL;
+
+   int r = c ? mul_square_matrices_summa(t, a, b, c, num_threads) : -1;
+   if(r == 0)
+      r = gather_square_matrix_dist(t, c, n, res);
+
+   free_square_matrix(a);
+   free_square_matrix(b);
+   free_square_matrix(c);
+
+   return r;
+}
@@ -0,0 +1,59 @@
+#ifndef __matrix_dist_h__
+#define __matrix_dist_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+
+// Distributed multiplication over a group of processes. The size
+// processes of a group are numbered 0 .. size-1 and exchange messages
+// through a transport; the multiply needs size = q*q and arranges them
+// as a q x q grid, rank = row*q + col.
+//
+// Elements travel in the sender's byte order, so every process of a
+// group must run on the same architecture.
+
+typedef struct matrix_transport {
+    int rank, size;
+    // send or receive exactly len bytes to or from peer;
+    // return 0 on success, -1 on error
+    int  (*send)(struct matrix_transport* t, int peer, const void* buf, size_t len);
+    int  (*recv)(struct matrix_transport* t, int peer, void* buf, size_t len);
+    void (*close)(struct matrix_transport* t);
+    void* impl;
+} matrix_transport;
+
+// a transport over one connected stream socket per peer, fds[rank] unused;
+// the transport closes the sockets
+matrix_transport* new_socket_transport(int rank, int size, const int* fds);
+
+// rank listens on ports[rank] and connects to hosts[p]:ports[p] of
+// every lower rank p, retrying while those are not up yet
+matrix_transport* new_tcp_transport(int rank, int size, const char* const* hosts, const unsigned short* ports);
+
+// fork size-1 children connected to the caller and each other by
+// Unix-domain socket pairs; return the new process's rank, 0 in the
+// caller, or -1 on error. Freeing rank 0's transport waits for the
+// children, which should exit once they have freed theirs.
+int spawn_local_processes(int size, matrix_transport** t);
+
+void free_matrix_transport(matrix_transport* t);
+
+// order of the blocks an order n matrix is cut into on a group
+size_t dist_block_order(matrix_transport* t, size_t n);
+
+// Block distribution: rank 0 passes the whole order n matrix m, the
+// others NULL, and each rank gets its block back, zero padded.
+// gather is the reverse and sets *res on rank 0 only.
+square_matrix* scatter_square_matrix_dist(matrix_transport* t, square_matrix* m, size_t n);
+int gather_square_matrix_dist(matrix_transport* t, square_matrix* block, size_t n, square_matrix** res);
+
+// C = A * B for block-distributed matrices by SUMMA; every rank passes
+// its blocks of A, B and C
+int mul_square_matrices_summa(matrix_transport* t, square_matrix* a, square_matrix* b, square_matrix* c, size_t num_threads);
+
+// scatter, multiply and gather: rank 0 passes m1 and m2 and receives
+// the product in *res
+int mul_square_matrices_dist(matrix_transport* t, square_matrix* m1, square_matrix* m2, size_t n,
+                             square_matrix** res, size_t num_threads);
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "matrix_gemm.h"
+#include "matrix_trace.h"
+#include "matrix_threads.h"
+
+// register block of C computed by the micro-kernel
+#define GEMM_MR  4
+#define GEMM_NR  32
+
+// cache blocks: an MC x KC block of A stays in L2, a KC x NC panel of B
+// in L3, and a KC x NR strip of the panel in L1
+#define GEMM_MC  64
+#define GEMM_KC  256
+#define GEMM_NC  1024
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
+typedef struct {
+   size_t id, num_threads;
+   square_matrix *a, *b, *c;
+   matrix_transpose trans_a, trans_b;
+   int accumulate;
+} thread_arg_t_gemm;
+
+DEFINE_RUN_THREADS(thread_arg_t_gemm)
+
+
+/*
+ * Copy rows i0..i0+mc-1, columns k0..k0+kc-1 of op(A) into pa as strips
+ * of GEMM_MR rows stored column by column, padding the last strip with
+ * zeros. Element (i,k) of transpose(A) is a[k][i], so a transposed A is
+ * read along its rows here instead of being transposed beforehand.
+ */
+static void pack_a(matrix_element** a, matrix_transpose trans, size_t i0, size_t mc,
+                   size_t k0, size_t kc, matrix_element* restrict pa)
+{
+   for(size_t ir = 0; ir < mc; ir += GEMM_MR) {
+      size_t mr = MIN(GEMM_MR, mc - ir);
+      matrix_element* restrict strip = pa + ir*kc;
+
+      if(trans == MATRIX_NO_TRANS) {
+         for(size_t r = 0; r < GEMM_MR; r++) {
+            const matrix_element* src = r < mr ? a[i0 + ir + r] + k0 : NULL;
+            for(size_t k = 0; k < kc; k++)
+               strip[k*GEMM_MR + r] = src ? src[k] : 0;
+         }
+      }
+      else {
+         for(size_t k = 0; k < kc; k++) {
+            const matrix_element* src = a[k0 + k] + i0 + ir;
+            for(size_t r = 0; r < GEMM_MR; r++)
+               strip[k*GEMM_MR + r] = r < mr ? src[r] : 0;
+         }
+      }
+   }
+}
+
+/*
+ * Copy rows k0..k0+kc-1, columns j0..j0+nc-1 of op(B) into pb as strips
+ * of GEMM_NR columns stored row by row, padding the last strip with
+ * zeros. Element (k,j) of transpose(B) is b[j][k].
+ */
+static void pack_b(matrix_element** b, matrix_transpose trans, size_t k0, size_t kc,
+                   size_t j0, size_t nc, matrix_element* restrict pb)
+{
+   for(size_t jr = 0; jr < nc; jr += GEMM_NR) {
+      size_t nr = MIN(GEMM_NR, nc - jr);
+      matrix_element* restrict strip = pb + jr*kc;
+
+      if(trans == MATRIX_NO_TRANS) {
+         for(size_t k = 0; k < kc; k++) {
+            const matrix_element* src = b[k0 + k] + j0 + jr;
+            for(size_t c = 0; c < GEMM_NR; c++)
+               strip[k*GEMM_NR + c] = c < nr ? src[c] : 0;
+         }
+      }
+      else {
+         for(size_t c = 0; c < GEMM_NR; c++) {
+            const matrix_element* src = c < nr ? b[j0 + jr + c] + k0 : NULL;
+            for(size_t k = 0; k < kc; k++)
+               strip[k*GEMM_NR + c] = src ? src[k] : 0;
+         }
+      }
+   }
+}
+
+/*
+ * C block (mr x nr at row i, column j) = or += the product of a packed
+ * strip of A and a packed strip of B. The GEMM_MR x GEMM_NR accumulator
+ * has fixed bounds so that it stays in vector registers.
+ */
+static void micro_kernel(size_t kc, const matrix_element* restrict pa, const matrix_element* restrict pb,
+                         matrix_element** c, size_t i, size_t j, size_t mr, size_t nr, int add)
+{
+   matrix_element acc[GEMM_MR][GEMM_NR] = {{0}};
+
+   for(size_t k = 0; k < kc; k++)
+      for(size_t r = 0; r < GEMM_MR; r++) {
+         matrix_element x = pa[k*GEMM_MR + r];
+         for(size_t s = 0; s < GEMM_NR; s++)
+            acc[r][s] += x * pb[k*GEMM_NR + s];
+      }
+
+   for(size_t r = 0; r < mr; r++) {
+      matrix_element* row = c[i + r] + j;
+      if(add)
+         for(size_t s = 0; s < nr; s++) row[s] += acc[r][s];
+      else
+         for(size_t s = 0; s < nr; s++) row[s] = acc[r][s];
+   }
+}
+
+/*
+ * Each thread takes the GEMM_MC-row blocks of C id, id + num_threads,
+ * ... and packs its own panels of B, so threads never wait for each
+ * other; the extra packing is O(n^2) per thread against O(n^3 /
+ * num_threads) arithmetic.
+ */
+static void * thread_gemm(void * p_arg)
+{
+   thread_arg_t_gemm *p = p_arg;
+   size_t n = p->c->order;
+   matrix_element** a = p->a->data;
+   matrix_element** b = p->b->data;
+   matrix_element** c = p->c->data;
+
+   size_t nc_max = MIN(GEMM_NC, (n + GEMM_NR - 1) / GEMM_NR * GEMM_NR);
+   size_t kc_max = MIN(GEMM_KC, n);
+   size_t mc_max = (GEMM_MC + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+   matrix_element* pa = malloc(mc_max * kc_max * sizeof(matrix_element));
+   matrix_element* pb = malloc(nc_max * kc_max * sizeof(matrix_element));
+   assert(pa != NULL && pb != NULL); // could have handled errors better
+
+   size_t num_blocks = (n + GEMM_MC - 1) / GEMM_MC;
+
+   for(size_t j0 = 0; j0 < n; j0 += GEMM_NC) {
+      size_t nc = MIN(GEMM_NC, n - j0);
+
+      for(size_t k0 = 0; k0 < n; k0 += GEMM_KC) {
+         size_t kc = MIN(GEMM_KC, n - k0);
+         int add = p->accumulate || k0 > 0;
+
+         pack_b(b, p->trans_b, k0, kc, j0, nc, pb);
+
+         for(size_t blk = p->id; blk < num_blocks; blk += p->num_threads) {
+            size_t i0 = blk * GEMM_MC;
+            size_t mc = MIN(GEMM_MC, n - i0);
+
+            MATRIX_TRACE_BEGIN(t0);
+            pack_a(a, p->trans_a, i0, mc, k0, kc, pa);
+
+            for(size_t jr = 0; jr < nc; jr += GEMM_NR)
+               for(size_t ir = 0; ir < mc; ir += GEMM_MR)
+                  micro_kernel(kc, pa + ir*kc, pb + jr*kc, c, i0 + ir, j0 + jr,
+                               MIN(GEMM_MR, mc - ir), MIN(GEMM_NR, nc - jr), add);
+            MATRIX_TRACE_END("gemm_block", t0, mc);
+         }
+      }
+   }
+
+   free(pa);
+   free(pb);
+
+   return NULL;
+}
+
+
+/*
+ * Compute op(a) * op(b) into c, which must be a different matrix of the
+ * same order, or add it to c if accumulate is set.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int gemm_square_matrices_into_threads(square_matrix* a, matrix_transpose trans_a,
+                                      square_matrix* b, matrix_transpose trans_b,
+                                      square_matrix* c, int accumulate, size_t num_threads)
+{
+   if(a == NULL || b == NULL || c == NULL || a->order != b->order || a->order != c->order ||
+      c == a || c == b || num_threads == 0 || make_square_matrix_writable(c) != 0)
+      return -1;
+
+   size_t n = c->order;
+   if(n == 0)
+      return 0;
+
+   // adjust number of threads for small matrices
+   size_t num_blocks = (n + GEMM_MC - 1) / GEMM_MC;
+   run_threads(thread_gemm, (thread_arg_t_gemm){.a = a, .b = b, .c = c, .trans_a = trans_a, .trans_b = trans_b,
+                                                .accumulate = accumulate},
+               clamp_threads(num_blocks, num_threads));
+
+   return 0;
+}
+
+/*
+ * Compute op(a) * op(b). Return a pointer to the newly allocated result
+ * matrix or NULL if anything is wrong
+ */
+square_matrix* gemm_square_matrices_threads(square_matrix* a, matrix_transpose trans_a,
+                                            square_matrix* b, matrix_transpose trans_b,
+                                            size_t num_threads)
+{
+   if(a == NULL || b == NULL || a->order != b->order || num_threads == 0)
+      return NULL;
+
+   square_matrix* res = new_square_matrix(a->order);
+   if(res == NULL)
+      return NULL;
+
+   if(gemm_square_matrices_into_threads(a, trans_a, b, trans_b, res, 0, num_threads) != 0) {
+      free_square_matrix(res);
+      return NULL;
+   }
+
+   return res;
+}
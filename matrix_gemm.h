@@ -0,0 +1,27 @@
+#ifndef __matrix_gemm_h__
+#define __matrix_gemm_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+
+// Blocked, packed matrix multiplication C = op(A) * op(B), where op(X)
+// is X or transpose(X). Blocks of both operands are copied into small
+// contiguous buffers before they are multiplied, and a transposed
+// operand is simply read in the other direction while it is copied, so
+// A*transpose(B) and transpose(A)*B cost the same as A*B and never
+// build the transpose.
+
+typedef enum {
+    MATRIX_NO_TRANS = 0,
+    MATRIX_TRANS    = 1
+} matrix_transpose;
+
+square_matrix* gemm_square_matrices_threads(square_matrix* a, matrix_transpose trans_a,
+                                            square_matrix* b, matrix_transpose trans_b,
+                                            size_t num_threads);
+
+int gemm_square_matrices_into_threads(square_matrix* a, matrix_transpose trans_a,
+                                      square_matrix* b, matrix_transpose trans_b,
+                                      square_matrix* c, int accumulate, size_t num_threads);
+
+#endif
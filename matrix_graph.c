@@ -0,0 +1,515 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include "matrix_graph.h"
+
+#define GRAPH_BAND 64       // rows of a node computed by one task
+
+typedef enum {
+   NODE_INPUT,
+   NODE_ADD,
+   NODE_MUL,
+   NODE_TRANSPOSE,
+   NODE_NORM
+} node_kind;
+
+typedef struct {
+   ws_task task;
+   matrix_node* node;
+   size_t index;
+   atomic_size_t deps;         // unfinished bands or nodes this band waits for
+} graph_band;
+
+typedef struct {
+   matrix_node* node;
+   int all;                    // the consumer needs every band, not just the matching one
+} graph_edge;
+
+struct matrix_node {
+   matrix_graph* graph;
+   node_kind kind;
+   size_t order;
+   matrix_node* in[2];
+   size_t num_inputs;
+
+   square_matrix* result;
+   int keep;
+   int taken;
+   long double norm;
+   long double* col_sums;      // NODE_NORM: sums of squares per band and column
+
+   graph_edge* consumers;
+   size_t num_consumers;
+   size_t num_bands;
+   graph_band* bands;
+   atomic_size_t bands_left;
+   atomic_size_t readers_left; // consumers that have not finished yet
+};
+
+struct matrix_graph {
+   matrix_node** nodes;
+   size_t num_nodes;
+   size_t capacity;
+   int ran;
+   atomic_int failed;
+   pthread_mutex_t lock;
+};
+
+
+/////////////////////////////////////
+//                                 //
+// Graph construction              //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * Create an empty graph. Return NULL if anything is wrong
+ */
+matrix_graph* new_matrix_graph(void)
+{
+   matrix_graph* g = calloc(1, sizeof(matrix_graph));
+   if(g == NULL)
+      return NULL;
+
+   pthread_mutex_init(&g->lock, NULL);
+   return g;
+}
+
+/*
+ * Free a graph, its nodes and every result that was not taken with
+ * matrix_graph_result(). Input matrices belong to the caller.
+ */
+void free_matrix_graph(matrix_graph* g)
+{
+   if(g == NULL)
+      return;
+
+   for(size_t i = 0; i < g->num_nodes; i++) {
+      matrix_node* node = g->nodes[i];
+      if(node->kind != NODE_INPUT && !node->taken)
+         free_square_matrix(node->result);
+      free(node->col_sums);
+      free(node->consumers);
+      free(node->bands);
+      free(node);
+   }
+
+   pthread_mutex_destroy(&g->lock);
+   free(g->nodes);
+   free(g);
+}
+
+static int add_edge(matrix_node* from, matrix_node* to, int all)
+{
+   graph_edge* e = realloc(from->consumers, (from->num_consumers + 1) * sizeof(graph_edge));
+   if(e == NULL)
+      return -1;
+
+   from->consumers = e;
+   from->consumers[from->num_consumers++] = (graph_edge){to, all};
+   return 0;
+}
+
+static matrix_node* new_node(matrix_graph* g, node_kind kind, size_t order,
+                             matrix_node* a, int a_all, matrix_node* b, int b_all)
+{
+   if(g->ran)
+      return NULL;
+
+   if(g->num_nodes == g->capacity) {
+      size_t capacity = g->capacity ? 2 * g->capacity : 8;
+      matrix_node** nodes = realloc(g->nodes, capacity * sizeof(matrix_node*));
+      if(nodes == NULL)
+         return NULL;
+      g->nodes = nodes;
+      g->capacity = capacity;
+   }
+
+   matrix_node* node = calloc(1, sizeof(matrix_node));
+   if(node == NULL)
+      return NULL;
+
+   node->graph = g;
+   node->kind = kind;
+   node->order = order;
+   node->num_bands = (order + GRAPH_BAND - 1) / GRAPH_BAND;
+
+   if(a != NULL) {
+      if(add_edge(a, node, a_all) != 0) {
+         free(node);
+         return NULL;
+      }
+      node->in[node->num_inputs++] = a;
+   }
+   if(b != NULL) {
+      if(add_edge(b, node, b_all) != 0) {
+         a->num_consumers--;
+         free(node);
+         return NULL;
+      }
+      node->in[node->num_inputs++] = b;
+   }
+
+   g->nodes[g->num_nodes++] = node;
+   return node;
+}
+
+/*
+ * Add a matrix supplied by the caller. It must stay alive and unchanged
+ * until the graph has run. Return NULL if anything is wrong
+ */
+matrix_node* matrix_graph_input(matrix_graph* g, square_matrix* m)
+{
+   if(g == NULL || m == NULL)
+      return NULL;
+
+   matrix_node* node = new_node(g, NODE_INPUT, m->order, NULL, 0, NULL, 0);
+   if(node)
+      node->result = m;
+
+   return node;
+}
+
+/*
+ * Add the sum a + b; band i reads band i of both operands.
+ * Return NULL if anything is wrong
+ */
+matrix_node* matrix_graph_add(matrix_graph* g, matrix_node* a, matrix_node* b)
+{
+   if(g == NULL || a == NULL || b == NULL || a->order != b->order || a->kind == NODE_NORM || b->kind == NODE_NORM)
+      return NULL;
+
+   return new_node(g, NODE_ADD, a->order, a, 0, b, 0);
+}
+
+/*
+ * Add the product a * b; band i reads band i of a and all of b.
+ * Return NULL if anything is wrong
+ */
+matrix_node* matrix_graph_mul(matrix_graph* g, matrix_node* a, matrix_node* b)
+{
+   if(g == NULL || a == NULL || b == NULL || a->order != b->order || a->kind == NODE_NORM || b->kind == NODE_NORM)
+      return NULL;
+
+   return new_node(g, NODE_MUL, a->order, a, 0, b, 1);
+}
+
+/*
+ * Add the transpose of a, which needs all of a.
+ * Return NULL if anything is wrong
+ */
+matrix_node* matrix_graph_transpose(matrix_graph* g, matrix_node* a)
+{
+   if(g == NULL || a == NULL || a->kind == NODE_NORM)
+      return NULL;
+
+   return new_node(g, NODE_TRANSPOSE, a->order, a, 1, NULL, 0);
+}
+
+/*
+ * Add the L2,1 norm of a; band i reads band i of a.
+ * Return NULL if anything is wrong
+ */
+matrix_node* matrix_graph_norm(matrix_graph* g, matrix_node* a)
+{
+   if(g == NULL || a == NULL || a->kind == NODE_NORM)
+      return NULL;
+
+   matrix_node* node = new_node(g, NODE_NORM, a->order, a, 0, NULL, 0);
+   if(node)
+      node->norm = NAN;
+
+   return node;
+}
+
+/*
+ * Keep the result of a node after its consumers have finished, so that
+ * it can be read with matrix_graph_result() once the graph has run.
+ */
+void matrix_graph_keep(matrix_node* node)
+{
+   if(node)
+      node->keep = 1;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Band kernels                    //
+//                                 //
+/////////////////////////////////////
+
+static void add_band(matrix_node* node, size_t first, size_t last)
+{
+   size_t n = node->order;
+   matrix_element** data1 = node->in[0]->result->data;
+   matrix_element** data2 = node->in[1]->result->data;
+   matrix_element** data  = node->result->data;
+
+   for(size_t i = first; i < last; i++)
+      for(size_t j = 0; j < n; j++)
+         data[i][j] = data1[i][j] + data2[i][j];
+}
+
+static void mul_band(matrix_node* node, size_t first, size_t last)
+{
+   size_t n = node->order;
+   matrix_element** data1 = node->in[0]->result->data;
+   matrix_element** data2 = node->in[1]->result->data;
+   matrix_element** data  = node->result->data;
+
+   // Use IKJ order for best cache performance
+   memset(data[first], 0, (last - first)*n*sizeof(matrix_element));
+   for(size_t i = first; i < last; i++)
+      for(size_t k = 0; k < n; k++) {
+         matrix_element a = data1[i][k];
+         matrix_element* restrict row = data[i];
+         const matrix_element* restrict src = data2[k];
+         for(size_t j = 0; j < n; j++)
+            row[j] += a * src[j];
+      }
+}
+
+static void transpose_band(matrix_node* node, size_t first, size_t last)
+{
+   size_t n = node->order;
+   matrix_element** src = node->in[0]->result->data;
+   matrix_element** dst = node->result->data;
+
+   // rows first..last-1 of the result are columns first..last-1 of the input
+   for(size_t j = 0; j < n; j++)
+      for(size_t i = first; i < last; i++)
+         dst[i][j] = src[j][i];
+}
+
+static void norm_band(matrix_node* node, size_t band, size_t first, size_t last)
+{
+   size_t n = node->order;
+   matrix_element** data = node->in[0]->result->data;
+   long double* sq_sum = node->col_sums + band*n;
+
+   for(size_t i = first; i < last; i++)
+      for(size_t j = 0; j < n; j++)
+         sq_sum[j] += (long double) data[i][j] * data[i][j];
+}
+
+static void finish_norm(matrix_node* node)
+{
+   if(node->col_sums == NULL)
+      return;
+
+   size_t n = node->order;
+   long double norm = 0.0;
+   for(size_t j = 0; j < n; j++) {
+      long double val = 0.0;
+      for(size_t b = 0; b < node->num_bands; b++)
+         val += node->col_sums[b*n + j];
+      norm += sqrtl(val);
+   }
+   node->norm = norm;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Scheduling                      //
+//                                 //
+/////////////////////////////////////
+
+static void release_band(graph_band* band)
+{
+   if(atomic_fetch_sub(&band->deps, 1) == 1)
+      ws_spawn(&band->task);
+}
+
+static void release_result(matrix_node* node)
+{
+   if(node->kind != NODE_INPUT && !node->keep) {
+      free_square_matrix(node->result);
+      node->result = NULL;
+   }
+}
+
+/*
+ * Make sure the output of a node exists before one of its bands writes
+ * to it. Return 0 on success, -1 if it could not be allocated.
+ */
+static int ensure_output(matrix_node* node)
+{
+   matrix_graph* g = node->graph;
+   int status = 0;
+
+   pthread_mutex_lock(&g->lock);
+   if(node->kind == NODE_NORM) {
+      if(node->col_sums == NULL)
+         node->col_sums = calloc(node->num_bands * node->order, sizeof(long double));
+      status = node->col_sums ? 0 : -1;
+   }
+   else {
+      if(node->result == NULL)
+         node->result = new_square_matrix(node->order);
+      status = node->result ? 0 : -1;
+   }
+   pthread_mutex_unlock(&g->lock);
+
+   return status;
+}
+
+static void node_finished(matrix_node* node)
+{
+   if(node->kind == NODE_NORM)
+      finish_norm(node);
+
+   // consumers that need the whole node
+   for(size_t c = 0; c < node->num_consumers; c++)
+      if(node->consumers[c].all) {
+         matrix_node* consumer = node->consumers[c].node;
+         for(size_t b = 0; b < consumer->num_bands; b++)
+            release_band(&consumer->bands[b]);
+      }
+
+   // this node was the last reader of an input
+   for(size_t i = 0; i < node->num_inputs; i++)
+      if(atomic_fetch_sub(&node->in[i]->readers_left, 1) == 1)
+         release_result(node->in[i]);
+
+   if(node->num_consumers == 0 && node->kind != NODE_NORM)
+      release_result(node);
+}
+
+static void band_task(void* p_arg)
+{
+   graph_band* band = p_arg;
+   matrix_node* node = band->node;
+   size_t first = band->index * GRAPH_BAND;
+   size_t last = first + GRAPH_BAND < node->order ? first + GRAPH_BAND : node->order;
+
+   int ok = ensure_output(node) == 0;
+   for(size_t i = 0; i < node->num_inputs; i++)
+      if(node->in[i]->result == NULL)
+         ok = 0;
+
+   if(ok) {
+      switch(node->kind) {
+         case NODE_ADD:       add_band(node, first, last);                   break;
+         case NODE_MUL:       mul_band(node, first, last);                   break;
+         case NODE_TRANSPOSE: transpose_band(node, first, last);             break;
+         case NODE_NORM:      norm_band(node, band->index, first, last);     break;
+         case NODE_INPUT:                                                    break;
+      }
+   }
+   else
+      atomic_store(&node->graph->failed, 1);
+
+   // consumers that only need this band
+   for(size_t c = 0; c < node->num_consumers; c++)
+      if(!node->consumers[c].all)
+         release_band(&node->consumers[c].node->bands[band->index]);
+
+   if(atomic_fetch_sub(&node->bands_left, 1) == 1)
+      node_finished(node);
+}
+
+static void graph_root(void* p_arg)
+{
+   matrix_graph* g = p_arg;
+
+   for(size_t i = 0; i < g->num_nodes; i++) {
+      matrix_node* node = g->nodes[i];
+      if(node->kind == NODE_INPUT)
+         continue;
+      for(size_t b = 0; b < node->num_bands; b++)
+         if(atomic_load(&node->bands[b].deps) == 0)
+            ws_spawn(&node->bands[b].task);
+   }
+
+   // every band is spawned once its last dependency finishes; joining
+   // them all keeps this worker busy with graph work until the end
+   for(size_t i = 0; i < g->num_nodes; i++) {
+      matrix_node* node = g->nodes[i];
+      if(node->kind == NODE_INPUT)
+         continue;
+      for(size_t b = 0; b < node->num_bands; b++)
+         ws_join(&node->bands[b].task);
+   }
+}
+
+/*
+ * Run every node of the graph on a work-stealing pool and wait for the
+ * graph to finish. A graph runs only once.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int matrix_graph_run(matrix_graph* g, ws_pool* pool)
+{
+   if(g == NULL || pool == NULL || g->ran)
+      return -1;
+
+   g->ran = 1;
+
+   for(size_t i = 0; i < g->num_nodes; i++) {
+      matrix_node* node = g->nodes[i];
+      if(node->kind == NODE_INPUT)
+         continue;
+      node->bands = calloc(node->num_bands, sizeof(graph_band));
+      if(node->bands == NULL)
+         return -1;
+   }
+
+   // all counters are set before the first band is spawned
+   for(size_t i = 0; i < g->num_nodes; i++) {
+      matrix_node* node = g->nodes[i];
+      atomic_init(&node->readers_left, node->num_consumers);
+      atomic_init(&node->bands_left, node->num_bands);
+      if(node->kind == NODE_INPUT)
+         continue;
+
+      for(size_t b = 0; b < node->num_bands; b++) {
+         graph_band* band = &node->bands[b];
+         size_t deps = 0;
+         for(size_t k = 0; k < node->num_inputs; k++)
+            if(node->in[k]->kind != NODE_INPUT)
+               deps++;
+         band->node = node;
+         band->index = b;
+         atomic_init(&band->deps, deps);
+         ws_task_init(&band->task, band_task, band);
+      }
+   }
+
+   ws_pool_run(pool, graph_root, g);
+
+   return atomic_load(&g->failed) ? -1 : 0;
+}
+
+
+/*
+ * Return the result of a node kept with matrix_graph_keep() or of an
+ * input, after the graph has run. A computed result from then on
+ * belongs to the caller. Return NULL if anything is wrong.
+ */
+square_matrix* matrix_graph_result(matrix_node* node)
+{
+   if(node == NULL || node->kind == NODE_NORM)
+      return NULL;
+
+   if(node->kind != NODE_INPUT)
+      node->taken = 1;
+
+   return node->result;
+}
+
+/*
+ * Return the value of a norm node after the graph has run, or NAN if
+ * anything is wrong.
+ */
+long double matrix_graph_norm_value(matrix_node* node)
+{
+   if(node == NULL || node->kind != NODE_NORM)
+      return NAN;
+
+   return node->norm;
+}
@@ -0,0 +1,35 @@
+#ifndef __matrix_graph_h__
+#define __matrix_graph_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+#include "work_stealing.h"
+
+// Task graphs of matrix operations. Nodes are added in dependency order
+// and the whole graph then runs on a work-stealing pool. Every node is
+// split into bands of rows; a band starts as soon as the bands it reads
+// are finished, so independent nodes run concurrently and a consumer
+// that reads its input band by band (addition, the left operand of a
+// product, the norm) follows its producer through memory while the band
+// is still in cache. Intermediate matrices are freed as soon as their
+// last consumer finishes, unless kept with matrix_graph_keep().
+
+typedef struct matrix_graph matrix_graph;
+typedef struct matrix_node matrix_node;
+
+matrix_graph* new_matrix_graph(void);
+void free_matrix_graph(matrix_graph* g);
+
+matrix_node* matrix_graph_input(matrix_graph* g, square_matrix* m);
+matrix_node* matrix_graph_add(matrix_graph* g, matrix_node* a, matrix_node* b);
+matrix_node* matrix_graph_mul(matrix_graph* g, matrix_node* a, matrix_node* b);
+matrix_node* matrix_graph_transpose(matrix_graph* g, matrix_node* a);
+matrix_node* matrix_graph_norm(matrix_graph* g, matrix_node* a);
+
+void matrix_graph_keep(matrix_node* node);
+int  matrix_graph_run(matrix_graph* g, ws_pool* pool);
+
+square_matrix* matrix_graph_result(matrix_node* node);
+long double    matrix_graph_norm_value(matrix_node* node);
+
+#endif
@@ -0,0 +1,533 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <assert.h>
+#include "matrix_io.h"
+#include "matrix_threads.h"
+
+#define WRITE_BAND_BYTES  (1 << 20)    // bytes each thread formats per round
+#define READ_MIN_RANGE    (1 << 16)    // fewest bytes worth a parsing thread
+#define MAX_ELEMENT_CHARS 12           // "-2147483648" and a separator
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+#define MAX(x,y) ((x)>(y) ? (x) : (y))
+
+#define MARKET_BANNER "%%MatrixMarket"
+
+typedef struct {
+   size_t id, num_threads;
+   matrix_format format;
+   int coordinate;              // MATRIX_MARKET body of "i j v" lines
+   // writing
+   square_matrix *m;
+   size_t first, last;          // lines of this round
+   size_t band;                 // lines per thread and round
+   char **bufs;
+   size_t *lens;
+   // reading
+   square_matrix *res;
+   const char **bounds;         // thread i parses bounds[i] .. bounds[i+1]-1
+   size_t *lines;               // lines in each range, then the first line of each
+   int *errors;
+} thread_arg_t_io;
+
+DEFINE_RUN_THREADS(thread_arg_t_io)
+
+
+/////////////////////////////////////
+//                                 //
+// Writing                         //
+//                                 //
+/////////////////////////////////////
+
+static const char digit_pairs[201] =
+   "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+   "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+   "8081828384858687888990919293949596979899";
+
+/*
+ * Format v in decimal at out, two digits at a time from the right, and
+ * return the position after it.
+ */
+static inline char* format_element(char* out, matrix_element v)
+{
+   uint32_t u = (uint32_t) v;
+   if(v < 0) {
+      *out++ = '-';
+      u = -u;
+   }
+
+   size_t len = 1;
+   for(uint32_t t = u; t >= 10; t /= 10)
+      len++;
+
+   char* p = out + len;
+   while(u >= 100) {
+      p -= 2;
+      memcpy(p, digit_pairs + 2 * (u % 100), 2);
+      u /= 100;
+   }
+   if(u >= 10) {
+      p -= 2;
+      memcpy(p, digit_pairs + 2 * u, 2);
+   }
+   else
+      *--p = '0' + u;
+
+   return out + len;
+}
+
+/*
+ * Format this thread's lines of the round into its buffer. A line is a
+ * row, or a column with one element per line for MATRIX_MARKET.
+ */
+static void * thread_format(void * p_arg)
+{
+   thread_arg_t_io *p = p_arg;
+   size_t n = p->m->order;
+   matrix_element** data = p->m->data;
+   size_t first = MIN(p->first + p->id * p->band, p->last);
+   size_t last = MIN(first + p->band, p->last);
+   char* out = p->bufs[p->id];
+
+   for(size_t l = first; l < last; l++) {
+      if(p->format == MATRIX_MARKET) {
+         for(size_t i = 0; i < n; i++) {
+            out = format_element(out, data[i][l]);
+            *out++ = '\n';
+         }
+      }
+      else {
+         char sep = p->format == MATRIX_CSV ? ',' : ' ';
+         for(size_t j = 0; j < n; j++) {
+            out = format_element(out, data[l][j]);
+            *out++ = sep;
+         }
+         out[-1] = '\n';
+      }
+   }
+
+   p->lens[p->id] = out - p->bufs[p->id];
+
+   return NULL;
+}
+
+/*
+ * Write all len bytes of buf to fd. Return 0 on success, -1 otherwise.
+ */
+static int write_all(int fd, const char* buf, size_t len)
+{
+   while(len > 0) {
+      ssize_t w = write(fd, buf, len);
+      if(w < 0) {
+         if(errno == EINTR)
+            continue;
+         return -1;
+      }
+      buf += w;
+      len -= w;
+   }
+   return 0;
+}
+
+/*
+ * Write m to fd in format. Each round the threads format consecutive
+ * bands of about WRITE_BAND_BYTES into their own buffers, which are then
+ * written in order, so a round costs a write() per thread.
+ * Return 0 on success, -1 otherwise.
+ */
+int write_square_matrix_fd(int fd, square_matrix* m, matrix_format format, size_t num_threads)
+{
+   if(m == NULL || m->data == NULL || m->order == 0 || num_threads == 0)
+      return -1;
+   if(format != MATRIX_TEXT && format != MATRIX_CSV && format != MATRIX_MARKET)
+      return -1;
+
+   size_t n = m->order;
+
+   if(format == MATRIX_MARKET) {
+      char header[128];
+      int len = snprintf(header, sizeof(header), "%s matrix array integer general\n%zu %zu\n", MARKET_BANNER, n, n);
+      if(write_all(fd, header, len) != 0)
+         return -1;
+   }
+
+   size_t line_bytes = n * MAX_ELEMENT_CHARS;
+   size_t band = MAX(WRITE_BAND_BYTES / line_bytes, 1);
+   num_threads = clamp_threads((n + band - 1) / band, num_threads);
+
+   char* bufs[num_threads];
+   size_t lens[num_threads];
+   int r = 0;
+   for(size_t i = 0; i < num_threads; i++) {
+      bufs[i] = malloc(band * line_bytes);
+      if(bufs[i] == NULL)
+         r = -1;
+   }
+
+   thread_arg_t_io proto = {.format = format, .m = m, .band = band, .bufs = bufs, .lens = lens};
+   for(size_t first = 0; first < n && r == 0; first += band * num_threads) {
+      proto.first = first;
+      proto.last = MIN(first + band * num_threads, n);
+      run_threads(thread_format, proto, num_threads);
+
+      for(size_t i = 0; i < num_threads && r == 0; i++)
+         r = write_all(fd, bufs[i], lens[i]);
+   }
+
+   for(size_t i = 0; i < num_threads; i++)
+      free(bufs[i]);
+
+   return r;
+}
+
+/*
+ * Write m to a file created or truncated at path.
+ * Return 0 on success, -1 otherwise.
+ */
+int save_square_matrix(const char* path, square_matrix* m, matrix_format format, size_t num_threads)
+{
+   if(path == NULL)
+      return -1;
+
+   int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if(fd < 0)
+      return -1;
+
+   int r = write_square_matrix_fd(fd, m, format, num_threads);
+   if(close(fd) != 0)
+      r = -1;
+
+   return r;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Reading                         //
+//                                 //
+/////////////////////////////////////
+
+static inline int is_blank(char c)
+{
+   return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* skip_blanks(const char* p, const char* end)
+{
+   while(p < end && is_blank(*p))
+      p++;
+   return p;
+}
+
+/*
+ * Parse an optionally signed decimal integer at p into v. Return the
+ * position after it, or NULL if there is none or it does not fit.
+ */
+static inline const char* parse_element(const char* p, const char* end, matrix_element* v)
+{
+   int neg = 0;
+   if(p < end && (*p == '-' || *p == '+'))
+      neg = *p++ == '-';
+
+   const char* digits = p;
+   uint64_t x = 0;
+   while(p < end && (unsigned char) (*p - '0') < 10) {
+      x = x * 10 + (*p++ - '0');
+      if(x > (uint64_t) INT_MAX + 1)
+         return NULL;
+   }
+   if(p == digits || (!neg && x > INT_MAX))
+      return NULL;
+
+   *v = neg ? (matrix_element) -(int64_t) x : (matrix_element) x;
+   return p;
+}
+
+/*
+ * Parse line l, [p, eol), into the result. Return 0 on success.
+ */
+static int parse_line(thread_arg_t_io* p, size_t l, const char* s, const char* eol)
+{
+   size_t n = p->res->order;
+   matrix_element** data = p->res->data;
+   matrix_element v, i, j;
+
+   switch(p->format) {
+      case MATRIX_TEXT:
+         for(size_t c = 0; c < n; c++) {
+            s = parse_element(skip_blanks(s, eol), eol, &data[l][c]);
+            if(s == NULL || (s < eol && !is_blank(*s)))
+               return -1;
+         }
+         break;
+
+      case MATRIX_CSV:
+         for(size_t c = 0; c < n; c++) {
+            s = parse_element(skip_blanks(s, eol), eol, &data[l][c]);
+            if(s == NULL)
+               return -1;
+            s = skip_blanks(s, eol);
+            if(c + 1 < n && (s == eol || *s++ != ','))
+               return -1;
+         }
+         break;
+
+      default:
+         if(!p->coordinate) {
+            s = parse_element(skip_blanks(s, eol), eol, &v);
+            if(s == NULL)
+               return -1;
+            data[l % n][l / n] = v;
+            break;
+         }
+         if((s = parse_element(skip_blanks(s, eol), eol, &i)) == NULL ||
+            (s = parse_element(skip_blanks(s, eol), eol, &j)) == NULL ||
+            (s = parse_element(skip_blanks(s, eol), eol, &v)) == NULL)
+            return -1;
+         if(i < 1 || (size_t) i > n || j < 1 || (size_t) j > n)
+            return -1;
+         data[i - 1][j - 1] = v;
+   }
+
+   return skip_blanks(s, eol) == eol ? 0 : -1;
+}
+
+/*
+ * Count the lines in this thread's range; the range that ends the body
+ * has a last line without a newline.
+ */
+static void * thread_count_lines(void * p_arg)
+{
+   thread_arg_t_io *p = p_arg;
+   const char* s = p->bounds[p->id];
+   const char* end = p->bounds[p->id + 1];
+   size_t lines = 0;
+
+   while(s < end && (s = memchr(s, '\n', end - s)) != NULL) {
+      lines++;
+      s++;
+   }
+   if(p->id + 1 == p->num_threads && p->bounds[p->id] < end)
+      lines++;
+
+   p->lines[p->id] = lines;
+
+   return NULL;
+}
+
+static void * thread_parse_lines(void * p_arg)
+{
+   thread_arg_t_io *p = p_arg;
+   const char* s = p->bounds[p->id];
+   const char* end = p->bounds[p->id + 1];
+   size_t l = p->lines[p->id];
+
+   for(; s < end; l++) {
+      const char* eol = memchr(s, '\n', end - s);
+      if(eol == NULL)
+         eol = end;
+      if(parse_line(p, l, s, eol) != 0) {
+         p->errors[p->id] = 1;
+         break;
+      }
+      s = eol + 1;
+   }
+
+   return NULL;
+}
+
+/*
+ * Compare the next word at *s, case-insensitively, with word and move
+ * past it. Return 1 if they match.
+ */
+static int match_word(const char** s, const char* end, const char* word)
+{
+   const char* p = skip_blanks(*s, end);
+   size_t len = strlen(word);
+   if((size_t) (end - p) < len || strncasecmp(p, word, len) != 0)
+      return 0;
+   if(p + len < end && !is_blank(p[len]) && p[len] != '\n')
+      return 0;
+   *s = p + len;
+   return 1;
+}
+
+/*
+ * Read the Matrix Market banner and size line at *s. Set the order, the
+ * number of body lines and whether the body is coordinate entries, and
+ * move *s to the first body line. Return 0 on success.
+ */
+static int parse_market_header(const char** s, const char* end, size_t* n, size_t* lines, int* coordinate)
+{
+   const char* p = *s;
+   if(!match_word(&p, end, MARKET_BANNER) || !match_word(&p, end, "matrix"))
+      return -1;
+   if(match_word(&p, end, "coordinate"))
+      *coordinate = 1;
+   else if(match_word(&p, end, "array"))
+      *coordinate = 0;
+   else
+      return -1;
+   if(!match_word(&p, end, "integer") || !match_word(&p, end, "general"))
+      return -1;
+
+   // skip the rest of the banner, comments and blank lines
+   do {
+      p = memchr(p, '\n', end - p);
+      if(p == NULL)
+         return -1;
+      p = skip_blanks(p + 1, end);
+   } while(p < end && (*p == '%' || *p == '\n'));
+
+   // no size line
+   if(p >= end)
+      return -1;
+
+   const char* eol = memchr(p, '\n', end - p);
+   if(eol == NULL)
+      eol = end;
+   matrix_element rows, cols, nnz = 0;
+   if((p = parse_element(p, eol, &rows)) == NULL ||
+      (p = parse_element(skip_blanks(p, eol), eol, &cols)) == NULL)
+      return -1;
+   if(*coordinate && (p = parse_element(skip_blanks(p, eol), eol, &nnz)) == NULL)
+      return -1;
+   if(skip_blanks(p, eol) != eol || rows < 1 || rows != cols || nnz < 0)
+      return -1;
+
+   *n = rows;
+   *lines = *coordinate ? (size_t) nnz : *n * *n;
+   *s = eol < end ? eol + 1 : end;
+
+   return 0;
+}
+
+/*
+ * Parse len bytes of buf in format into a new matrix. The body is split
+ * into one range of whole lines per thread; a first pass counts the
+ * lines in each range so that every thread knows where its rows go, and
+ * a second pass parses them. Return NULL on malformed input.
+ */
+square_matrix* read_square_matrix_buffer(const char* buf, size_t len, matrix_format format, size_t num_threads)
+{
+   if(buf == NULL || num_threads == 0)
+      return NULL;
+   if(format != MATRIX_TEXT && format != MATRIX_CSV && format != MATRIX_MARKET)
+      return NULL;
+
+   const char* body = buf;
+   const char* end = buf + len;
+   while(end > body && (is_blank(end[-1]) || end[-1] == '\n'))
+      end--;
+
+   size_t n = 0, expected = 0;
+   int coordinate = 0;
+   if(format == MATRIX_MARKET) {
+      if(parse_market_header(&body, end, &n, &expected, &coordinate) != 0)
+         return NULL;
+   }
+   else {
+      // the order is the number of elements on the first line
+      const char* eol = memchr(body, '\n', end - body);
+      if(eol == NULL)
+         eol = end;
+      for(const char* s = skip_blanks(body, eol); s < eol; s = skip_blanks(s, eol)) {
+         n++;
+         while(s < eol && !is_blank(*s) && (format != MATRIX_CSV || *s != ','))
+            s++;
+         if(format == MATRIX_CSV && s < eol && *s == ',')
+            s++;
+      }
+      expected = n;
+   }
+   if(n == 0 || n > SIZE_MAX / n / sizeof(matrix_element))
+      return NULL;
+
+   // ranges of whole lines
+   num_threads = clamp_threads((end - body) / READ_MIN_RANGE, num_threads);
+   const char* bounds[num_threads + 1];
+   size_t lines[num_threads];
+   int errors[num_threads];
+   bounds[0] = body;
+   bounds[num_threads] = end;
+   for(size_t i = 1; i < num_threads; i++) {
+      const char* s = MAX(body + (end - body) * i / num_threads, bounds[i - 1]);
+      if(s > body && s < end && s[-1] != '\n') {
+         s = memchr(s, '\n', end - s);
+         s = s ? s + 1 : end;
+      }
+      bounds[i] = s;
+      errors[i] = 0;
+   }
+   errors[0] = 0;
+
+   thread_arg_t_io proto = {.format = format, .coordinate = coordinate, .bounds = bounds, .lines = lines, .errors = errors};
+   run_threads(thread_count_lines, proto, num_threads);
+
+   size_t total = 0;
+   for(size_t i = 0; i < num_threads; i++) {
+      size_t count = lines[i];
+      lines[i] = total;
+      total += count;
+   }
+   if(total != expected)
+      return NULL;
+
+   square_matrix* res = new_square_matrix(n);
+   if(res == NULL)
+      return NULL;
+   if(coordinate)
+      memset(res->data[0], 0, n * n * sizeof(matrix_element));
+
+   proto.res = res;
+   run_threads(thread_parse_lines, proto, num_threads);
+
+   for(size_t i = 0; i < num_threads; i++)
+      if(errors[i]) {
+         free_square_matrix(res);
+         return NULL;
+      }
+
+   return res;
+}
+
+/*
+ * Map the file at path and parse it. Return NULL on any error.
+ */
+square_matrix* load_square_matrix(const char* path, matrix_format format, size_t num_threads)
+{
+   if(path == NULL)
+      return NULL;
+
+   int fd = open(path, O_RDONLY);
+   if(fd < 0)
+      return NULL;
+
+   struct stat st;
+   if(fstat(fd, &st) != 0 || st.st_size <= 0) {
+      close(fd);
+      return NULL;
+   }
+
+   size_t len = st.st_size;
+   void* buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if(buf == MAP_FAILED)
+      return NULL;
+   madvise(buf, len, MADV_WILLNEED);
+
+   square_matrix* res = read_square_matrix_buffer(buf, len, format, num_threads);
+   munmap(buf, len);
+
+   return res;
+}
@@ -0,0 +1,31 @@
+#ifndef __matrix_io_h__
+#define __matrix_io_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+
+// Text formats for square matrices.
+//   MATRIX_TEXT    one row per line, elements separated by blanks; this
+//                  reads what print_square_matrix prints
+//   MATRIX_CSV     one row per line, elements separated by commas
+//   MATRIX_MARKET  Matrix Market integer general; written as "array"
+//                  (column-major, one element per line), read as
+//                  "array" or "coordinate" (1-based "i j v" lines,
+//                  missing elements are 0)
+typedef enum {
+   MATRIX_TEXT,
+   MATRIX_CSV,
+   MATRIX_MARKET
+} matrix_format;
+
+// Format m with num_threads threads into large buffers written with
+// write(); return 0 on success, -1 on any error
+int write_square_matrix_fd(int fd, square_matrix* m, matrix_format format, size_t num_threads);
+int save_square_matrix(const char* path, square_matrix* m, matrix_format format, size_t num_threads);
+
+// Parse len bytes with num_threads threads, each taking a range of
+// whole lines; return NULL on malformed input or any other error
+square_matrix* read_square_matrix_buffer(const char* buf, size_t len, matrix_format format, size_t num_threads);
+square_matrix* load_square_matrix(const char* path, matrix_format format, size_t num_threads);
+
+#endif
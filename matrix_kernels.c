@@ -0,0 +1,667 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <assert.h>
+#include "matrix_kernels.h"
+#include "square_matrix_ws.h"
+#include "matrix_async.h"
+#include "matrix_gemm.h"
+#include "matrix_threads.h"
+#include "chunk_sched.h"
+
+#define MATRIX_MAX_KERNELS  32
+#define MATRIX_SIZE_CLASSES 40      // size class c holds orders 2^(c-1)+1 .. 2^c
+#define TUNE_MIN_CLASS      4       // smallest size class benchmarked by matrix_kernels_tune()
+#define TUNE_MIN_SECONDS    0.02    // repeat small benchmarks until they take this long
+#define KERNEL_BAND_SIZE    128     // rows per band of the banded threaded transpose, as in mtran2.c
+
+typedef struct {
+   size_t id, num_threads;
+   square_matrix *m1, *m2, *res;
+   chunk_sched* sched;
+} thread_arg_t_kernel;
+
+typedef void * (*kernel_thread_fn)(void *);
+
+
+/////////////////////////////////////
+//                                 //
+// Kernels                         //
+//                                 //
+/////////////////////////////////////
+
+DEFINE_RUN_THREADS(thread_arg_t_kernel)
+
+/*
+ * Run fn on the threads for a result of the order of m1, with size
+ * units of work shared out in guided chunks of at least min_chunk.
+ */
+static square_matrix* run_binary(kernel_thread_fn fn, square_matrix* m1, square_matrix* m2,
+                                 size_t num_threads, size_t size, size_t min_chunk)
+{
+   if(m1 == NULL || m2 == NULL || m1->order != m2->order)
+      return NULL;
+
+   square_matrix* res = new_square_matrix(m1->order);
+   if(res == NULL)
+      return NULL;
+
+   // adjust number of threads for small matrices
+   num_threads = clamp_threads(size, num_threads ? num_threads : 1);
+   chunk_sched sched;
+   chunk_sched_init(&sched, size, num_threads, min_chunk, CHUNK_GUIDED);
+   run_threads(fn, (thread_arg_t_kernel){.m1 = m1, .m2 = m2, .res = res, .sched = &sched}, num_threads);
+
+   return res;
+}
+
+
+// madd.c: threads claim chunks of elements
+static void * thread_add_flat(void * p_arg)
+{
+   thread_arg_t_kernel *p = p_arg;
+
+   // rows are contiguously allocated
+   const matrix_element* restrict data1 = p->m1->data[0];
+   const matrix_element* restrict data2 = p->m2->data[0];
+   matrix_element* restrict data = p->res->data[0];
+
+   size_t first, last;
+   while(chunk_sched_next(p->sched, &first, &last))
+      for(size_t e = first; e < last; e++)
+         data[e] = data1[e] + data2[e];
+
+   return NULL;
+}
+
+static square_matrix* add_flat_threads(square_matrix* m1, square_matrix* m2, size_t num_threads)
+{
+   size_t n = m1 ? m1->order : 0;
+   return run_binary(thread_add_flat, m1, m2, num_threads, n * n, MIN_CHUNK_WORK);
+}
+
+// mmul.c: threads claim chunks of elements, each computed as a dot product
+static void * thread_mul_elements(void * p_arg)
+{
+   thread_arg_t_kernel *p = p_arg;
+   size_t n = p->m1->order;
+   matrix_element** data1 = p->m1->data;
+   matrix_element** data2 = p->m2->data;
+   matrix_element** data  = p->res->data;
+
+   size_t first, last;
+   while(chunk_sched_next(p->sched, &first, &last))
+      for(size_t e = first; e < last; e++) {
+         size_t i = e / n, j = e % n;
+         matrix_element sum = 0;
+         for(size_t k = 0; k < n; k++)
+            sum += data1[i][k] * data2[k][j];
+         data[i][j] = sum;
+      }
+
+   return NULL;
+}
+
+static square_matrix* mul_elements_threads(square_matrix* m1, square_matrix* m2, size_t num_threads)
+{
+   size_t n = m1 ? m1->order : 0;
+   return run_binary(thread_mul_elements, m1, m2, num_threads, n * n, chunk_min_units(n, MIN_CHUNK_WORK));
+}
+
+// mtran2.c: threads claim chunks of bands of KERNEL_BAND_SIZE rows and
+// copy each band column by column
+static void * thread_tran_row_block(void * p_arg)
+{
+   thread_arg_t_kernel *p = p_arg;
+   size_t n = p->m1->order;
+   matrix_element** data  = p->m1->data;
+   matrix_element** data2 = p->res->data;
+
+   size_t first, last;
+   while(chunk_sched_next(p->sched, &first, &last))
+      for(size_t band = first; band < last; band++) {
+         size_t band_first_row = band * KERNEL_BAND_SIZE;
+         size_t band_last_row = band_first_row + KERNEL_BAND_SIZE < n ? band_first_row + KERNEL_BAND_SIZE : n;
+         for(size_t j = 0; j < n; j++)
+            for(size_t i = band_first_row; i < band_last_row; i++)
+               data2[j][i] = data[i][j];
+      }
+
+   return NULL;
+}
+
+// mtran.c: each thread copies one fixed block of rows, row by row
+static void * thread_tran_rowwise(void * p_arg)
+{
+   thread_arg_t_kernel *p = p_arg;
+   size_t n = p->m1->order;
+   size_t first = n * p->id / p->num_threads;
+   size_t last  = n * (p->id + 1) / p->num_threads;
+   matrix_element** data  = p->m1->data;
+   matrix_element** data2 = p->res->data;
+
+   for(size_t i = first; i < last; i++)
+      for(size_t j = 0; j < n; j++)
+         data2[j][i] = data[i][j];
+
+   return NULL;
+}
+
+static square_matrix* transpose_row_blocks_threads(square_matrix* m, size_t num_threads)
+{
+   size_t n = m ? m->order : 0;
+   return run_binary(thread_tran_row_block, m, m, num_threads, (n + KERNEL_BAND_SIZE - 1) / KERNEL_BAND_SIZE, 1);
+}
+
+static square_matrix* transpose_rowwise_threads(square_matrix* m, size_t num_threads)
+{
+   return run_binary(thread_tran_rowwise, m, m, num_threads, m ? m->order : 0, 1);
+}
+
+
+// adapters for the kernels of square_matrix3.c and square_matrix_ws.c
+static square_matrix* add_seq(square_matrix* m1, square_matrix* m2, size_t num_threads)
+{
+   (void) num_threads;
+   return add_square_matrices(m1, m2);
+}
+
+static square_matrix* add_ws(square_matrix* m1, square_matrix* m2, size_t num_threads)
+{
+   (void) num_threads;
+   return add_square_matrices_ws(m1, m2, matrix_async_pool());
+}
+
+static square_matrix* mul_seq(square_matrix* m1, square_matrix* m2, size_t num_threads)
+{
+   (void) num_threads;
+   return mul_square_matrices(m1, m2);
+}
+
+static square_matrix* mul_ws(square_matrix* m1, square_matrix* m2, size_t num_threads)
+{
+   (void) num_threads;
+   return mul_square_matrices_ws(m1, m2, matrix_async_pool());
+}
+
+static square_matrix* mul_strassen_ws(square_matrix* m1, square_matrix* m2, size_t num_threads)
+{
+   (void) num_threads;
+   return mul_square_matrices_strassen_ws(m1, m2, matrix_async_pool());
+}
+
+static square_matrix* mul_packed_threads(square_matrix* m1, square_matrix* m2, size_t num_threads)
+{
+   return gemm_square_matrices_threads(m1, MATRIX_NO_TRANS, m2, MATRIX_NO_TRANS, num_threads);
+}
+
+static square_matrix* transpose_seq(square_matrix* m, size_t num_threads)
+{
+   (void) num_threads;
+   return transpose_square_matrix(m);
+}
+
+static square_matrix* transpose_banded(square_matrix* m, size_t num_threads)
+{
+   (void) num_threads;
+   return transpose_square_matrix_banded(m);
+}
+
+static square_matrix* transpose_ws(square_matrix* m, size_t num_threads)
+{
+   (void) num_threads;
+   return transpose_square_matrix_ws(m, matrix_async_pool());
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Registry                        //
+//                                 //
+/////////////////////////////////////
+
+static const matrix_kernel builtin_kernels[] = {
+   {"add_seq",                      MATRIX_OP_ADD,       0, add_seq,                     NULL},
+   {"add_rows_threads",             MATRIX_OP_ADD,       1, add_square_matrices_threads, NULL},
+   {"add_flat_threads",             MATRIX_OP_ADD,       1, add_flat_threads,            NULL},
+   {"add_ws",                       MATRIX_OP_ADD,       0, add_ws,                      NULL},
+   {"mul_seq",                      MATRIX_OP_MUL,       0, mul_seq,                     NULL},
+   {"mul_rows_threads",             MATRIX_OP_MUL,       1, mul_square_matrices_threads, NULL},
+   {"mul_elements_threads",         MATRIX_OP_MUL,       1, mul_elements_threads,        NULL},
+   {"mul_ws",                       MATRIX_OP_MUL,       0, mul_ws,                      NULL},
+   {"mul_strassen_ws",              MATRIX_OP_MUL,       0, mul_strassen_ws,             NULL},
+   {"mul_packed_threads",           MATRIX_OP_MUL,       1, mul_packed_threads,          NULL},
+   {"transpose_seq",                MATRIX_OP_TRANSPOSE, 0, NULL, transpose_seq},
+   {"transpose_banded",             MATRIX_OP_TRANSPOSE, 0, NULL, transpose_banded},
+   {"transpose_bands_threads",      MATRIX_OP_TRANSPOSE, 1, NULL, transpose_square_matrix_threads},
+   {"transpose_row_blocks_threads", MATRIX_OP_TRANSPOSE, 1, NULL, transpose_row_blocks_threads},
+   {"transpose_rowwise_threads",    MATRIX_OP_TRANSPOSE, 1, NULL, transpose_rowwise_threads},
+   {"transpose_ws",                 MATRIX_OP_TRANSPOSE, 0, NULL, transpose_ws},
+};
+
+static matrix_kernel registry[MATRIX_MAX_KERNELS];
+static size_t num_kernels = 0;
+
+typedef struct {
+   const matrix_kernel* kernel;     // NULL: no tuning data for this size class
+   size_t num_threads;
+} tuning_entry;
+
+static tuning_entry tuning[MATRIX_NUM_OPS][MATRIX_SIZE_CLASSES];
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+static pthread_once_t tuning_once = PTHREAD_ONCE_INIT;
+
+static const char* op_names[MATRIX_NUM_OPS] = {"add", "mul", "transpose"};
+
+static void init_registry(void)
+{
+   num_kernels = sizeof(builtin_kernels) / sizeof(builtin_kernels[0]);
+   memcpy(registry, builtin_kernels, sizeof(builtin_kernels));
+}
+
+
+/*
+ * Add a kernel to the registry. The strings and functions it points to
+ * must stay valid. Return 0 on success, -1 if anything is wrong.
+ */
+int matrix_kernel_register(const matrix_kernel* k)
+{
+   pthread_once(&registry_once, init_registry);
+
+   if(k == NULL || k->name == NULL || k->op >= MATRIX_NUM_OPS ||
+      (k->op == MATRIX_OP_TRANSPOSE ? k->unary == NULL : k->binary == NULL))
+      return -1;
+
+   int status = -1;
+   pthread_mutex_lock(&registry_lock);
+   if(num_kernels < MATRIX_MAX_KERNELS) {
+      registry[num_kernels++] = *k;
+      status = 0;
+   }
+   pthread_mutex_unlock(&registry_lock);
+
+   return status;
+}
+
+/*
+ * Return the number of kernels registered for an operation
+ */
+size_t matrix_kernel_count(matrix_op op)
+{
+   pthread_once(&registry_once, init_registry);
+
+   size_t count = 0;
+
+   pthread_mutex_lock(&registry_lock);
+   for(size_t i = 0; i < num_kernels; i++)
+      if(registry[i].op == op)
+         count++;
+   pthread_mutex_unlock(&registry_lock);
+
+   return count;
+}
+
+/*
+ * Return the i-th kernel registered for an operation, or NULL
+ */
+const matrix_kernel* matrix_kernel_at(matrix_op op, size_t i)
+{
+   pthread_once(&registry_once, init_registry);
+
+   const matrix_kernel* k = NULL;
+
+   pthread_mutex_lock(&registry_lock);
+   for(size_t r = 0; r < num_kernels && k == NULL; r++)
+      if(registry[r].op == op && i-- == 0)
+         k = &registry[r];
+   pthread_mutex_unlock(&registry_lock);
+
+   return k;
+}
+
+/*
+ * Return the kernel registered under name, or NULL
+ */
+const matrix_kernel* matrix_kernel_find(const char* name)
+{
+   pthread_once(&registry_once, init_registry);
+
+   if(name == NULL)
+      return NULL;
+
+   const matrix_kernel* k = NULL;
+
+   pthread_mutex_lock(&registry_lock);
+   for(size_t r = 0; r < num_kernels && k == NULL; r++)
+      if(strcmp(registry[r].name, name) == 0)
+         k = &registry[r];
+   pthread_mutex_unlock(&registry_lock);
+
+   return k;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Dispatcher                      //
+//                                 //
+/////////////////////////////////////
+
+static size_t size_class(size_t order)
+{
+   size_t c = 0;
+   while(c < MATRIX_SIZE_CLASSES - 1 && ((size_t) 1 << c) < order)
+      c++;
+
+   return c;
+}
+
+// read once: sysconf() reads /sys, which costs more than a small kernel
+static size_t num_cpus;
+static pthread_once_t cpus_once = PTHREAD_ONCE_INIT;
+
+static void count_processors(void)
+{
+   long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+   num_cpus = cpus > 0 ? (size_t) cpus : 1;
+}
+
+static size_t online_processors(void)
+{
+   pthread_once(&cpus_once, count_processors);
+   return num_cpus;
+}
+
+/*
+ * Rules of thumb for orders without tuning data: stay sequential until
+ * a matrix no longer fits in the private caches, then use every
+ * processor, giving each thread at least a few pages of work. Cheap
+ * operations go to the work-stealing pool, whose threads already exist,
+ * rather than paying for pthread_create on every call.
+ */
+static const matrix_kernel* default_kernel(matrix_op op, size_t n, size_t* num_threads)
+{
+   size_t cpus = online_processors();
+   size_t elems = n * n;
+
+   switch(op) {
+      case MATRIX_OP_ADD:
+         if(cpus == 1 || elems < ((size_t) 1 << 16)) {
+            *num_threads = 1;
+            return matrix_kernel_find("add_seq");
+         }
+         *num_threads = 1;
+         return matrix_kernel_find("add_ws");
+
+      case MATRIX_OP_MUL:
+         if(n <= 64 || (cpus == 1 && n < 128)) {
+            *num_threads = 1;
+            return matrix_kernel_find("mul_seq");
+         }
+         if(n < 128) {
+            *num_threads = clamp_threads(n / 16, cpus);
+            return matrix_kernel_find("mul_rows_threads");
+         }
+         *num_threads = clamp_threads(n / 64, cpus);
+         return matrix_kernel_find("mul_packed_threads");
+
+      case MATRIX_OP_TRANSPOSE:
+         if(n < 64) {
+            *num_threads = 1;
+            return matrix_kernel_find("transpose_seq");
+         }
+         if(cpus == 1 || elems < ((size_t) 1 << 18)) {
+            *num_threads = 1;
+            return matrix_kernel_find("transpose_banded");
+         }
+         *num_threads = clamp_threads((n + 255) / 256, cpus);
+         return matrix_kernel_find("transpose_bands_threads");
+
+      default:
+         return NULL;
+   }
+}
+
+static void load_tuning_from_env(void)
+{
+   const char* path = getenv("MATRIX_TUNING_FILE");
+   if(path && *path)
+      matrix_kernels_load_tuning(path);
+}
+
+/*
+ * Choose the kernel and thread count for an operation on matrices of
+ * the given order. Return the kernel, or NULL if anything is wrong.
+ */
+const matrix_kernel* matrix_kernel_select(matrix_op op, size_t order, size_t* num_threads)
+{
+   if(op >= MATRIX_NUM_OPS || num_threads == NULL)
+      return NULL;
+
+   pthread_once(&tuning_once, load_tuning_from_env);
+
+   pthread_mutex_lock(&registry_lock);
+   tuning_entry e = tuning[op][size_class(order)];
+   pthread_mutex_unlock(&registry_lock);
+
+   if(e.kernel) {
+      *num_threads = e.num_threads;
+      return e.kernel;
+   }
+
+   return default_kernel(op, order, num_threads);
+}
+
+
+/*
+ * Compute the sum of two square matrices with the kernel chosen for
+ * their order. Return a pointer to the newly allocated result matrix or
+ * NULL if anything is wrong
+ */
+square_matrix* add_square_matrices_dispatch(square_matrix* m1, square_matrix* m2)
+{
+   if(m1 == NULL || m2 == NULL || m1->order != m2->order)
+      return NULL;
+
+   size_t num_threads;
+   const matrix_kernel* k = matrix_kernel_select(MATRIX_OP_ADD, m1->order, &num_threads);
+
+   return k ? k->binary(m1, m2, num_threads) : NULL;
+}
+
+/*
+ * Compute the product of two square matrices with the kernel chosen for
+ * their order. Return a pointer to the newly allocated result matrix or
+ * NULL if anything is wrong
+ */
+square_matrix* mul_square_matrices_dispatch(square_matrix* m1, square_matrix* m2)
+{
+   if(m1 == NULL || m2 == NULL || m1->order != m2->order)
+      return NULL;
+
+   size_t num_threads;
+   const matrix_kernel* k = matrix_kernel_select(MATRIX_OP_MUL, m1->order, &num_threads);
+
+   return k ? k->binary(m1, m2, num_threads) : NULL;
+}
+
+/*
+ * Compute the transpose of a square matrix with the kernel chosen for
+ * its order. Return a pointer to the newly allocated result matrix or
+ * NULL if anything is wrong
+ */
+square_matrix* transpose_square_matrix_dispatch(square_matrix* m)
+{
+   if(m == NULL)
+      return NULL;
+
+   size_t num_threads;
+   const matrix_kernel* k = matrix_kernel_select(MATRIX_OP_TRANSPOSE, m->order, &num_threads);
+
+   return k ? k->unary(m, num_threads) : NULL;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Tuning                          //
+//                                 //
+/////////////////////////////////////
+
+static double now_seconds(void)
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*
+ * Return the time of one call of k with num_threads threads, the best
+ * of enough calls to measure it
+ */
+static double time_kernel(const matrix_kernel* k, square_matrix* m1, square_matrix* m2, size_t num_threads)
+{
+   double best = -1.0, total = 0.0;
+
+   for(int reps = 0; reps < 3 || total < TUNE_MIN_SECONDS; reps++) {
+      double start = now_seconds();
+      square_matrix* res = k->op == MATRIX_OP_TRANSPOSE ? k->unary(m1, num_threads)
+                                                         : k->binary(m1, m2, num_threads);
+      double t = now_seconds() - start;
+      free_square_matrix(res);
+
+      total += t;
+      if(best < 0.0 || t < best)
+         best = t;
+   }
+
+   return best;
+}
+
+/*
+ * Benchmark every kernel of an operation with 1, 2, 4, ... up to
+ * max_threads threads on one order from each size class up to
+ * max_order, and record the fastest choice for each class.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int matrix_kernels_tune(matrix_op op, size_t max_order, size_t max_threads)
+{
+   if(op >= MATRIX_NUM_OPS || max_threads == 0)
+      return -1;
+
+   size_t count = matrix_kernel_count(op);
+
+   for(size_t c = TUNE_MIN_CLASS; c < MATRIX_SIZE_CLASSES && ((size_t) 1 << (c - 1)) < max_order; c++) {
+      // an order in the middle of the class, away from the power of two
+      size_t n = ((size_t) 1 << (c - 1)) + ((size_t) 1 << (c - 2));
+
+      square_matrix* m1 = new_square_matrix(n);
+      square_matrix* m2 = new_square_matrix(n);
+      if(m1 == NULL || m2 == NULL) {
+         free_square_matrix(m1);
+         free_square_matrix(m2);
+         return -1;
+      }
+      for(size_t e = 0; e < n*n; e++) {
+         m1->data[0][e] = (matrix_element)(e % 7);
+         m2->data[0][e] = (matrix_element)(e % 5);
+      }
+
+      tuning_entry best = {NULL, 1};
+      double best_time = -1.0;
+      for(size_t i = 0; i < count; i++) {
+         const matrix_kernel* k = matrix_kernel_at(op, i);
+         for(size_t t = 1; t <= max_threads; t = (2*t > max_threads && t < max_threads ? max_threads : 2*t)) {
+            double time = time_kernel(k, m1, m2, t);
+            if(best_time < 0.0 || time < best_time) {
+               best_time = time;
+               best = (tuning_entry){k, t};
+            }
+            if(!k->threaded)
+               break;
+         }
+      }
+
+      pthread_mutex_lock(&registry_lock);
+      tuning[op][c] = best;
+      pthread_mutex_unlock(&registry_lock);
+
+      free_square_matrix(m1);
+      free_square_matrix(m2);
+   }
+
+   return 0;
+}
+
+/*
+ * Forget all tuning data; the rules of thumb apply again
+ */
+void matrix_kernels_clear_tuning(void)
+{
+   pthread_mutex_lock(&registry_lock);
+   memset(tuning, 0, sizeof(tuning));
+   pthread_mutex_unlock(&registry_lock);
+}
+
+/*
+ * Write the tuning tables to a text file, one line per operation and
+ * size class: the operation, the largest order of the class, the
+ * kernel name and the thread count.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int matrix_kernels_save_tuning(const char* path)
+{
+   FILE* f = path ? fopen(path, "w") : NULL;
+   if(f == NULL)
+      return -1;
+
+   fprintf(f, "# operation max_order kernel threads\n");
+   pthread_mutex_lock(&registry_lock);
+   for(size_t op = 0; op < MATRIX_NUM_OPS; op++)
+      for(size_t c = 0; c < MATRIX_SIZE_CLASSES; c++)
+         if(tuning[op][c].kernel)
+            fprintf(f, "%s %zu %s %zu\n", op_names[op], (size_t) 1 << c,
+                    tuning[op][c].kernel->name, tuning[op][c].num_threads);
+   pthread_mutex_unlock(&registry_lock);
+
+   return fclose(f) == 0 ? 0 : -1;
+}
+
+/*
+ * Read tuning tables written by matrix_kernels_save_tuning(). Lines
+ * naming unknown operations or kernels are skipped, so a file stays
+ * usable when kernels come and go.
+ * Return 0 on success, -1 if the file cannot be read.
+ */
+int matrix_kernels_load_tuning(const char* path)
+{
+   FILE* f = path ? fopen(path, "r") : NULL;
+   if(f == NULL)
+      return -1;
+
+   char line[256], op_name[32], name[128];
+   size_t order, num_threads;
+   while(fgets(line, sizeof(line), f)) {
+      if(line[0] == '#' || sscanf(line, "%31s %zu %127s %zu", op_name, &order, name, &num_threads) != 4)
+         continue;
+
+      size_t op = 0;
+      while(op < MATRIX_NUM_OPS && strcmp(op_names[op], op_name) != 0)
+         op++;
+      const matrix_kernel* k = matrix_kernel_find(name);
+      if(op == MATRIX_NUM_OPS || k == NULL || k->op != op || num_threads == 0)
+         continue;
+
+      pthread_mutex_lock(&registry_lock);
+      tuning[op][size_class(order)] = (tuning_entry){k, num_threads};
+      pthread_mutex_unlock(&registry_lock);
+   }
+
+   fclose(f);
+   return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef __matrix_kernels_h__
+#define __matrix_kernels_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+
+// Registry of every implementation of the basic operations, and a
+// dispatcher that picks one of them, with a thread count, for each call.
+//
+// The registry holds the kernels of square_matrix3.c, the work-stealing
+// kernels, and the thread splits of madd.c, mmul.c, mtran.c and
+// mtran2.c, which cannot be linked next to square_matrix3.c and are
+// carried here as private copies. More kernels can be registered at run
+// time.
+//
+// The dispatcher looks up the tuning table for the operation and the
+// power-of-two size class of the order. Without an entry it falls back
+// on rules of thumb from the order and the number of online processors.
+// Tuning tables come from matrix_kernels_tune(), or from a file saved by
+// matrix_kernels_save_tuning() and named by MATRIX_TUNING_FILE, which is
+// loaded on first use.
+
+typedef enum {
+    MATRIX_OP_ADD,
+    MATRIX_OP_MUL,
+    MATRIX_OP_TRANSPOSE,
+    MATRIX_NUM_OPS
+} matrix_op;
+
+typedef struct {
+    const char* name;
+    matrix_op op;
+    int threaded;       // takes a thread count; otherwise sequential or on the library's pool
+    square_matrix* (*binary)(square_matrix* m1, square_matrix* m2, size_t num_threads);    // add, mul
+    square_matrix* (*unary)(square_matrix* m, size_t num_threads);                         // transpose
+} matrix_kernel;
+
+int                  matrix_kernel_register(const matrix_kernel* k);
+size_t               matrix_kernel_count(matrix_op op);
+const matrix_kernel* matrix_kernel_at(matrix_op op, size_t i);
+const matrix_kernel* matrix_kernel_find(const char* name);
+
+const matrix_kernel* matrix_kernel_select(matrix_op op, size_t order, size_t* num_threads);
+
+int  matrix_kernels_tune(matrix_op op, size_t max_order, size_t max_threads);
+int  matrix_kernels_load_tuning(const char* path);
+int  matrix_kernels_save_tuning(const char* path);
+void matrix_kernels_clear_tuning(void);
+
+square_matrix* add_square_matrices_dispatch(square_matrix* m1, square_matrix* m2);
+square_matrix* mul_square_matrices_dispatch(square_matrix* m1, square_matrix* m2);
+square_matrix* transpose_square_matrix_dispatch(square_matrix* m);
+
+#endif
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "matrix_pool.h"
+
+typedef struct {
+   size_t order;
+   size_t count;
+   size_t capacity;
+   square_matrix** items;      // stack: the most recently freed matrix is reused first
+} pool_bucket;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pool_bucket* buckets = NULL;
+static size_t num_buckets = 0;
+static size_t max_per_order = MATRIX_POOL_DEFAULT_PER_ORDER;
+static size_t max_bytes = MATRIX_POOL_DEFAULT_BYTES;
+static int drain_at_exit = 0;
+static matrix_pool_stats stats;
+
+
+static size_t matrix_bytes(size_t n)
+{
+   return sizeof(square_matrix) + n * sizeof(matrix_element*) + n * n * sizeof(matrix_element);
+}
+
+// free the three allocations of new_square_matrix()
+static void release_matrix(square_matrix* m)
+{
+   free(m->data[0]);
+   free(m->data);
+   free(m);
+}
+
+static pool_bucket* find_bucket(size_t order)
+{
+   for(size_t b = 0; b < num_buckets; b++)
+      if(buckets[b].order == order)
+         return &buckets[b];
+
+   return NULL;
+}
+
+/*
+ * Free pooled matrices, largest orders first, until every bucket holds
+ * at most per_order matrices and the pool at most bytes bytes. Call
+ * with pool_lock held.
+ */
+static void trim_pool(size_t per_order, size_t bytes)
+{
+   for(size_t b = 0; b < num_buckets; b++)
+      while(buckets[b].count > per_order) {
+         release_matrix(buckets[b].items[--buckets[b].count]);
+         stats.cached_matrices--;
+         stats.cached_bytes -= matrix_bytes(buckets[b].order);
+      }
+
+   while(stats.cached_bytes > bytes) {
+      pool_bucket* largest = NULL;
+      for(size_t b = 0; b < num_buckets; b++)
+         if(buckets[b].count && (largest == NULL || buckets[b].order > largest->order))
+            largest = &buckets[b];
+      assert(largest != NULL);
+
+      release_matrix(largest->items[--largest->count]);
+      stats.cached_matrices--;
+      stats.cached_bytes -= matrix_bytes(largest->order);
+   }
+}
+
+
+/*
+ * Set how many matrices of each order, and how many bytes in total,
+ * the pool may keep. Matrices beyond the new limits are freed at once.
+ * Limits of zero turn pooling off.
+ */
+void matrix_pool_set_limits(size_t per_order, size_t bytes)
+{
+   pthread_mutex_lock(&pool_lock);
+   max_per_order = per_order;
+   max_bytes = bytes;
+   trim_pool(per_order, bytes);
+   pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Free every matrix held by the pool. The limits stay as they are.
+ */
+void matrix_pool_drain(void)
+{
+   pthread_mutex_lock(&pool_lock);
+   trim_pool(0, 0);
+   for(size_t b = 0; b < num_buckets; b++)
+      free(buckets[b].items);
+   free(buckets);
+   buckets = NULL;
+   num_buckets = 0;
+   pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Copy the pool counters into stats
+ */
+void matrix_pool_get_stats(matrix_pool_stats* s)
+{
+   if(s == NULL)
+      return;
+
+   pthread_mutex_lock(&pool_lock);
+   *s = stats;
+   pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Zero the hit, miss, recycled and discarded counters
+ */
+void matrix_pool_reset_stats(void)
+{
+   pthread_mutex_lock(&pool_lock);
+   stats.hits = stats.misses = stats.recycled = stats.discarded = 0;
+   pthread_mutex_unlock(&pool_lock);
+}
+
+
+/*
+ * Return a pooled matrix of the given order, or NULL if there is none
+ * and the caller has to allocate one.
+ */
+square_matrix* matrix_pool_take(size_t order)
+{
+   square_matrix* m = NULL;
+
+   pthread_mutex_lock(&pool_lock);
+   pool_bucket* bucket = find_bucket(order);
+   if(bucket && bucket->count) {
+      m = bucket->items[--bucket->count];
+      stats.cached_matrices--;
+      stats.cached_bytes -= matrix_bytes(order);
+      stats.hits++;
+   }
+   else
+      stats.misses++;
+   pthread_mutex_unlock(&pool_lock);
+
+   return m;
+}
+
+/*
+ * Offer a matrix allocated by new_square_matrix() to the pool.
+ * Return 1 if the pool kept it, 0 if the caller has to free it.
+ */
+int matrix_pool_give(square_matrix* m)
+{
+   if(m == NULL || m->data == NULL || m->order == 0)
+      return 0;
+
+   size_t bytes = matrix_bytes(m->order);
+   int kept = 0;
+
+   pthread_mutex_lock(&pool_lock);
+   if(bytes <= max_bytes && max_per_order > 0) {
+      pool_bucket* bucket = find_bucket(m->order);
+      if(bucket == NULL) {
+         pool_bucket* more = realloc(buckets, (num_buckets + 1) * sizeof(pool_bucket));
+         if(more) {
+            buckets = more;
+            bucket = &buckets[num_buckets++];
+            *bucket = (pool_bucket){m->order, 0, 0, NULL};
+         }
+      }
+
+      if(bucket && bucket->count == bucket->capacity && bucket->capacity < max_per_order) {
+         size_t capacity = bucket->capacity ? 2 * bucket->capacity : 1;
+         if(capacity > max_per_order)
+            capacity = max_per_order;
+         square_matrix** items = realloc(bucket->items, capacity * sizeof(square_matrix*));
+         if(items) {
+            bucket->items = items;
+            bucket->capacity = capacity;
+         }
+      }
+
+      if(bucket && bucket->count < bucket->capacity && bucket->count < max_per_order) {
+         // make room by dropping larger matrices of other orders first
+         if(stats.cached_bytes + bytes > max_bytes)
+            trim_pool(max_per_order, max_bytes - bytes);
+
+         bucket->items[bucket->count++] = m;
+         stats.cached_matrices++;
+         stats.cached_bytes += bytes;
+         kept = 1;
+      }
+   }
+
+   if(kept) {
+      stats.recycled++;
+      if(!drain_at_exit) {
+         // give the memory back at exit so that leak checkers stay quiet
+         atexit(matrix_pool_drain);
+         drain_at_exit = 1;
+      }
+   }
+   else
+      stats.discarded++;
+   pthread_mutex_unlock(&pool_lock);
+
+   return kept;
+}
@@ -0,0 +1,35 @@
+#ifndef __matrix_pool_h__
+#define __matrix_pool_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+
+// Pool of freed matrices, keyed by order. free_square_matrix() hands
+// matrices to the pool while it is within its retention limits, and
+// new_square_matrix() takes one of the same order back before it calls
+// malloc, so the struct, the row pointers and the element storage (with
+// its pages already mapped) are all reused. A recycled matrix holds
+// whatever its last user left in it, like fresh malloc'd memory.
+
+#define MATRIX_POOL_DEFAULT_PER_ORDER 4                    // matrices kept per order
+#define MATRIX_POOL_DEFAULT_BYTES     ((size_t) 256 << 20) // bytes kept in total
+
+typedef struct {
+    size_t hits;            // new_square_matrix() calls served from the pool
+    size_t misses;          // new_square_matrix() calls that had to allocate
+    size_t recycled;        // free_square_matrix() calls that kept the matrix
+    size_t discarded;       // free_square_matrix() calls that freed it, over the limits
+    size_t cached_matrices; // matrices held by the pool now
+    size_t cached_bytes;    // and their total size
+} matrix_pool_stats;
+
+void matrix_pool_set_limits(size_t max_per_order, size_t max_bytes);
+void matrix_pool_drain(void);
+void matrix_pool_get_stats(matrix_pool_stats* stats);
+void matrix_pool_reset_stats(void);
+
+// used by new_square_matrix() and free_square_matrix()
+square_matrix* matrix_pool_take(size_t order);
+int            matrix_pool_give(square_matrix* m);
+
+#endif
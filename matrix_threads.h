@@ -0,0 +1,69 @@
+#ifndef __matrix_threads_h__
+#define __matrix_threads_h__
+
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+// Fork-join helpers shared by the threaded kernels. A kernel's thread
+// argument struct starts with the fields of thread_ids; every thread
+// gets its own copy of a prototype struct with those two filled in.
+//
+// Usage, in a module with argument struct thread_arg_t_x:
+//    DEFINE_RUN_THREADS(thread_arg_t_x)
+//    ...
+//    run_threads(thread_fn, (thread_arg_t_x){.m1 = m1, .m2 = m2, .res = res}, num_threads);
+
+typedef struct {
+   size_t id, num_threads;
+} thread_ids;
+
+/*
+ * Run fn on num_threads threads. Thread i gets args + i*arg_size, a
+ * copy of proto numbered i; the caller can inspect the copies once all
+ * threads have finished.
+ */
+static inline void run_thread_copies(void * (*fn)(void *), const void* proto, void* args,
+                                     size_t arg_size, size_t num_threads)
+{
+   pthread_t tid[num_threads];
+
+   // prepare args and create threads
+   for(size_t i = 0; i < num_threads; i ++) {
+      thread_ids* arg = (thread_ids*) ((char*) args + i*arg_size);
+      memcpy(arg, proto, arg_size);
+      arg->id = i;
+      arg->num_threads = num_threads;
+      int status = pthread_create(&tid[i], NULL, fn, arg);
+      assert(status == 0); // could have handled errors better
+   }
+
+   // wait for threads to terminate
+   for(size_t i = 0; i < num_threads; i ++)
+      pthread_join(tid[i], NULL);
+}
+
+// a static run_threads(fn, proto, num_threads) for arguments of type ARG_TYPE
+#define DEFINE_RUN_THREADS(ARG_TYPE)                                                 \
+static void run_threads(void * (*fn)(void *), ARG_TYPE proto, size_t num_threads)   \
+{                                                                                    \
+   ARG_TYPE args[num_threads];                                                       \
+   run_thread_copies(fn, &proto, args, sizeof(ARG_TYPE), num_threads);               \
+}
+
+// the same, run_threads_into(fn, proto, args, num_threads), for callers
+// that read results back from the copies in args[num_threads]
+#define DEFINE_RUN_THREADS_INTO(ARG_TYPE)                                                          \
+static void run_threads_into(void * (*fn)(void *), ARG_TYPE proto, ARG_TYPE* args, size_t num_threads) \
+{                                                                                                  \
+   run_thread_copies(fn, &proto, args, sizeof(ARG_TYPE), num_threads);                             \
+}
+
+// threads for a job of size units: at most num_threads, at least one
+static inline size_t clamp_threads(size_t size, size_t num_threads)
+{
+   return (size < num_threads) ? (size ? size : 1) : num_threads;
+}
+
+#endif
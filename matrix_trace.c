@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "matrix_trace.h"
+
+#define TRACE_FIRST_EVENTS 64          // events in a new thread buffer
+#define TRACE_MAX_EVENTS   (1 << 20)   // events kept per thread, later ones are dropped
+#define TRACE_MAX_NAMES    64          // kernels told apart by the summary
+
+typedef struct {
+   const char* name;
+   uint64_t begin, end;
+   size_t size;                 // units of work in the chunk
+   size_t thread;               // the thread that ran it, numbered from 1
+} trace_event;
+
+// A thread's events. Only the owning thread appends; buffers are linked
+// into a list once and stay there. When its thread exits a buffer is
+// released, events and all, to the next new thread, so the short-lived
+// workers of successive kernel calls share a few timeline rows.
+typedef struct trace_buffer {
+   struct trace_buffer* next;
+   atomic_int owned;
+   size_t row;                  // tid in the exported trace
+   size_t count, capacity, dropped;
+   trace_event* events;
+} trace_buffer;
+
+static atomic_int enabled;
+static _Atomic(trace_buffer*) buffers;
+static atomic_size_t num_buffers;
+static atomic_size_t num_threads;
+static __thread trace_buffer* local;
+static __thread size_t local_thread;
+static pthread_key_t release_key;
+static pthread_once_t release_once = PTHREAD_ONCE_INIT;
+
+void matrix_trace_enable(int on)
+{
+   atomic_store(&enabled, on != 0);
+}
+
+int matrix_trace_enabled(void)
+{
+   return atomic_load_explicit(&enabled, memory_order_relaxed);
+}
+
+uint64_t matrix_trace_now(void)
+{
+   if(!matrix_trace_enabled())
+      return 0;
+
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// runs at thread exit for threads that hold a buffer
+static void release_buffer(void* p)
+{
+   trace_buffer* b = p;
+   atomic_store(&b->owned, 0);
+}
+
+static void create_release_key(void)
+{
+   pthread_key_create(&release_key, release_buffer);
+}
+
+/*
+ * Return the calling thread's buffer: a released one if there is any,
+ * otherwise a new one linked into the list. Return NULL if it cannot be
+ * allocated.
+ */
+static trace_buffer* local_buffer(void)
+{
+   if(local)
+      return local;
+
+   pthread_once(&release_once, create_release_key);
+
+   trace_buffer* b;
+   for(b = atomic_load(&buffers); b; b = b->next) {
+      int expected = 0;
+      if(atomic_compare_exchange_strong(&b->owned, &expected, 1))
+         break;
+   }
+
+   if(b == NULL) {
+      b = calloc(1, sizeof(trace_buffer));
+      if(b == NULL)
+         return NULL;
+      b->owned = 1;
+      b->row = atomic_fetch_add(&num_buffers, 1) + 1;
+
+      trace_buffer* head = atomic_load(&buffers);
+      do
+         b->next = head;
+      while(!atomic_compare_exchange_weak(&buffers, &head, b));
+   }
+
+   pthread_setspecific(release_key, b);
+   local_thread = atomic_fetch_add(&num_threads, 1) + 1;
+   return local = b;
+}
+
+/*
+ * Append an event to the calling thread's buffer, growing it up to
+ * TRACE_MAX_EVENTS.
+ */
+void matrix_trace_record(const char* name, uint64_t begin, uint64_t end, size_t size)
+{
+   if(!matrix_trace_enabled())
+      return;
+
+   trace_buffer* b = local_buffer();
+   if(b == NULL)
+      return;
+
+   if(b->count == b->capacity) {
+      size_t capacity = b->capacity ? 2 * b->capacity : TRACE_FIRST_EVENTS;
+      trace_event* events = capacity <= TRACE_MAX_EVENTS ? realloc(b->events, capacity * sizeof(trace_event)) : NULL;
+      if(events == NULL) {
+         b->dropped++;
+         return;
+      }
+      b->events = events;
+      b->capacity = capacity;
+   }
+
+   b->events[b->count++] = (trace_event){name, begin, end, size, local_thread};
+}
+
+// earliest recorded begin, the origin of exported times
+static uint64_t trace_origin(void)
+{
+   uint64_t origin = UINT64_MAX;
+   for(trace_buffer* b = atomic_load(&buffers); b; b = b->next)
+      for(size_t i = 0; i < b->count; i++)
+         if(b->events[i].begin < origin)
+            origin = b->events[i].begin;
+   return origin;
+}
+
+/*
+ * Write all events as Chrome trace JSON, complete ("X") events in
+ * microseconds with a name for every row. Threads that shared a buffer
+ * share its row; each event names its own thread.
+ * Return 0 on success, -1 otherwise.
+ */
+int matrix_trace_export(const char* path)
+{
+   FILE* f = path ? fopen(path, "w") : NULL;
+   if(f == NULL)
+      return -1;
+
+   uint64_t origin = trace_origin();
+   int pid = getpid();
+   const char* sep = "";
+
+   fprintf(f, "{\"traceEvents\":[\n");
+   for(trace_buffer* b = atomic_load(&buffers); b; b = b->next) {
+      fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%zu,\"args\":{\"name\":\"worker %zu\"}}",
+              sep, pid, b->row, b->row);
+      sep = ",\n";
+
+      for(size_t i = 0; i < b->count; i++) {
+         trace_event* e = &b->events[i];
+         fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"size\":%zu,\"thread\":%zu}}",
+                 e->name, pid, b->row, (e->begin - origin) / 1e3, (e->end - e->begin) / 1e3, e->size, e->thread);
+      }
+      if(b->dropped)
+         fprintf(f, ",\n{\"name\":\"dropped %zu events\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%zu,\"ts\":0}",
+                 b->dropped, pid, b->row);
+   }
+   fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+   return fclose(f) == 0 ? 0 : -1;
+}
+
+// (thread, busy time) of one event in the summary
+typedef struct {
+   size_t thread;
+   uint64_t busy;
+} trace_busy;
+
+static int compare_busy(const void* x, const void* y)
+{
+   const trace_busy *a = x, *b = y;
+   return (a->thread > b->thread) - (a->thread < b->thread);
+}
+
+/*
+ * For every kernel name print the threads that ran it and their busy
+ * time: the largest, the mean, and their ratio, which is 1.00 for a
+ * perfectly balanced kernel.
+ */
+void matrix_trace_print_summary(FILE* f)
+{
+   const char* names[TRACE_MAX_NAMES];
+   size_t num_names = 0;
+
+   for(trace_buffer* b = atomic_load(&buffers); b; b = b->next)
+      for(size_t i = 0; i < b->count; i++) {
+         size_t k = 0;
+         while(k < num_names && strcmp(names[k], b->events[i].name) != 0)
+            k++;
+         if(k == num_names && num_names < TRACE_MAX_NAMES)
+            names[num_names++] = b->events[i].name;
+      }
+
+   trace_busy* busy = malloc(matrix_trace_count() * sizeof(trace_busy));
+   if(busy == NULL)
+      return;
+
+   for(size_t k = 0; k < num_names; k++) {
+      size_t chunks = 0;
+      for(trace_buffer* b = atomic_load(&buffers); b; b = b->next)
+         for(size_t i = 0; i < b->count; i++)
+            if(strcmp(names[k], b->events[i].name) == 0)
+               busy[chunks++] = (trace_busy){b->events[i].thread, b->events[i].end - b->events[i].begin};
+
+      // add up each thread's chunks
+      qsort(busy, chunks, sizeof(trace_busy), compare_busy);
+      size_t threads = 0;
+      uint64_t total = 0, max = 0;
+      for(size_t i = 0; i < chunks; ) {
+         uint64_t sum = 0;
+         size_t thread = busy[i].thread;
+         for(; i < chunks && busy[i].thread == thread; i++)
+            sum += busy[i].busy;
+         threads++;
+         total += sum;
+         max = sum > max ? sum : max;
+      }
+
+      double mean = (double) total / threads;
+      fprintf(f, "%-20s %4zu threads %8zu chunks  busy max %10.6lf sec, mean %10.6lf sec, imbalance %.2lf\n",
+              names[k], threads, chunks, max / 1e9, mean / 1e9, mean > 0 ? max / mean : 1.0);
+   }
+
+   free(busy);
+}
+
+size_t matrix_trace_count(void)
+{
+   size_t count = 0;
+   for(trace_buffer* b = atomic_load(&buffers); b; b = b->next)
+      count += b->count;
+   return count;
+}
+
+/*
+ * Drop all recorded events. The buffers stay linked, since live threads
+ * may hold them.
+ */
+void matrix_trace_reset(void)
+{
+   for(trace_buffer* b = atomic_load(&buffers); b; b = b->next)
+      b->count = b->dropped = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef __matrix_trace_h__
+#define __matrix_trace_h__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Timeline tracing of threaded kernels. Each thread appends chunk
+// events (name, begin, end, size) to its own buffer with no locks;
+// the buffers are exported as Chrome trace JSON, which chrome://tracing
+// or Perfetto shows as one row per thread.
+//
+// Kernels mark chunks with the macros below. They compile to nothing
+// unless MATRIX_TRACE is defined, and record nothing until
+// matrix_trace_enable(1) is called.
+
+void matrix_trace_enable(int on);
+int  matrix_trace_enabled(void);
+
+// nanoseconds on a monotonic clock, 0 while tracing is disabled
+uint64_t matrix_trace_now(void);
+void matrix_trace_record(const char* name, uint64_t begin, uint64_t end, size_t size);
+
+// Export, summarize and drop recorded events. Call these only while no
+// traced kernel is running.
+int  matrix_trace_export(const char* path);
+void matrix_trace_print_summary(FILE* f);
+size_t matrix_trace_count(void);
+void matrix_trace_reset(void);
+
+#ifdef MATRIX_TRACE
+#define MATRIX_TRACE_BEGIN(t)           uint64_t t = matrix_trace_now()
+#define MATRIX_TRACE_END(name, t, size) do { if(t) matrix_trace_record(name, t, matrix_trace_now(), size); } while(0)
+#else
+#define MATRIX_TRACE_BEGIN(t)           do { } while(0)
+#define MATRIX_TRACE_END(name, t, size) do { } while(0)
+#endif
+
+#endif
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "matrix_vector.h"
+
+// rows of the matrix handled together; a ROW_BLOCK x COL_BLOCK tile
+// of the matrix (128KB) stays in L2 while it is applied to every vector
+#define ROW_BLOCK 32
+#define COL_BLOCK 1024
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
+/*
+ * Allocate space for a vector of n elements.
+ * Return NULL if the allocation is not successful.
+ */
+matrix_element* new_matrix_vector(size_t n)
+{
+   return malloc((n ? n : 1) * sizeof(matrix_element));
+}
+
+/*
+ * Deallocate a vector allocated by new_matrix_vector().
+ */
+void free_matrix_vector(matrix_element* v)
+{
+   free(v);
+}
+
+#define MODULUS 7
+/*
+ * Fill given vector with random values
+ */
+void fill_matrix_vector(matrix_element* v, size_t n)
+{
+   for(size_t i = 0; i < n; i ++)
+      v[i] = (matrix_element) rand() % MODULUS;
+}
+
+/*
+ * Compare two vectors, return 0 if they are the same,
+ * non-zero values otherwise.
+ */
+int compare_matrix_vectors(matrix_element* v1, matrix_element* v2, size_t n)
+{
+   if(v1 == NULL || v2 == NULL)
+      return -1;
+
+   for(size_t i = 0; i < n; i ++)
+      if(v1[i] != v2[i]) {
+         fprintf(stderr, "Mismatch found for element %lu: %d vs %d\n", i, v1[i], v2[i]);
+         return 1;
+      }
+
+   return 0;
+}
+
+
+//////////////////////////////////////////
+//                                      //
+// Sequential matrix-vector product     //
+//                                      //
+//////////////////////////////////////////
+
+
+/*
+ * Compute the product of a square matrix and a vector of matching
+ * length. Return a pointer to the newly allocated result vector or
+ * NULL if anything is wrong.
+ */
+matrix_element* gemv_square_matrix(square_matrix* m, matrix_element* x)
+{
+   if(m == NULL || x == NULL)
+      return NULL;
+
+   size_t n = m->order;
+   matrix_element** data = m->data;
+
+   matrix_element* y = new_matrix_vector(n);
+   if(y == NULL)
+      return NULL;
+
+   for(size_t i = 0; i < n; i++) {
+      matrix_element sum = 0;
+      for(size_t j = 0; j < n; j++)
+         sum += data[i][j] * x[j];
+      y[i] = sum;
+   }
+
+   return y;
+}
+
+
+////////////////////////////////////////////////////
+//                                                //
+// Multi-threaded batched matrix-vector product   //
+//                                                //
+////////////////////////////////////////////////////
+
+typedef struct {
+   size_t id, num_threads;
+   square_matrix* m;
+   matrix_element *x, *y;
+   size_t num_vectors;
+} thread_arg_t_gemv;
+
+
+/*
+ * Add the dot products of four consecutive matrix rows with x,
+ * restricted to columns first..last-1, to y[0..3]. Loading each
+ * element of x once for four rows halves the loads of the naive
+ * loop, and the four independent sums let the compiler vectorize
+ * the J loop.
+ */
+static void dot4(matrix_element** rows, const matrix_element* restrict x,
+                 size_t first, size_t last, matrix_element* restrict y)
+{
+   const matrix_element* restrict r0 = rows[0];
+   const matrix_element* restrict r1 = rows[1];
+   const matrix_element* restrict r2 = rows[2];
+   const matrix_element* restrict r3 = rows[3];
+   matrix_element s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+   for(size_t j = first; j < last; j++) {
+      matrix_element xj = x[j];
+      s0 += r0[j] * xj;
+      s1 += r1[j] * xj;
+      s2 += r2[j] * xj;
+      s3 += r3[j] * xj;
+   }
+
+   y[0] += s0;
+   y[1] += s1;
+   y[2] += s2;
+   y[3] += s3;
+}
+
+static matrix_element dot1(const matrix_element* restrict r, const matrix_element* restrict x,
+                           size_t first, size_t last)
+{
+   matrix_element s = 0;
+   for(size_t j = first; j < last; j++)
+      s += r[j] * x[j];
+   return s;
+}
+
+
+static void * thread_gemv(void * p_arg)
+{
+   thread_arg_t_gemv *p = p_arg;
+
+   size_t id = p->id;
+   size_t num_threads = p->num_threads;
+   size_t n = p->m->order;
+   size_t num_vectors = p->num_vectors;
+   matrix_element** data = p->m->data;
+
+   // each thread works on blocks of ROW_BLOCK rows:
+   // block id, id + num_threads, id + 2*num_threads, ...
+   for(size_t first_row = id*ROW_BLOCK; first_row < n; first_row += num_threads*ROW_BLOCK) {
+      size_t last_row = MIN(first_row + ROW_BLOCK, n);
+
+      for(size_t v = 0; v < num_vectors; v++)
+         memset(p->y + v*n + first_row, 0, (last_row - first_row)*sizeof(matrix_element));
+
+      // apply each cache-resident tile of the row block to all the vectors
+      for(size_t first_col = 0; first_col < n; first_col += COL_BLOCK) {
+         size_t last_col = MIN(first_col + COL_BLOCK, n);
+
+         for(size_t v = 0; v < num_vectors; v++) {
+            const matrix_element* x = p->x + v*n;
+            matrix_element* y = p->y + v*n;
+
+            size_t i = first_row;
+            for(; i + 4 <= last_row; i += 4)
+               dot4(&data[i], x, first_col, last_col, &y[i]);
+            for(; i < last_row; i++)
+               y[i] += dot1(data[i], x, first_col, last_col);
+         }
+      }
+   }
+
+   pthread_exit(NULL);
+}
+
+
+/*
+ * Multiply a square matrix by each of num_vectors vectors stored
+ * back to back in x. Return a pointer to the newly allocated block
+ * of result vectors, in the same layout, or NULL if anything is wrong.
+ *
+ * The matrix is read once per call no matter how many vectors there
+ * are, so the whole batch costs O(n^2) memory traffic.
+ */
+matrix_element* gemv_batched_square_matrix_threads(square_matrix* m, matrix_element* x, size_t num_vectors, size_t num_threads)
+{
+   if(m == NULL || x == NULL || num_vectors == 0 || num_threads == 0)
+      return NULL;
+
+   size_t n = m->order;
+
+   matrix_element* y = new_matrix_vector(num_vectors * n);
+   if(y == NULL)
+      return NULL;
+
+   // adjust number of threads so that every thread gets a row block
+   size_t num_blocks = (n + ROW_BLOCK - 1) / ROW_BLOCK;
+   num_threads = (num_blocks < num_threads) ? num_blocks : num_threads;
+   if(num_threads == 0)
+      return y;
+
+   pthread_t tid[num_threads];
+   thread_arg_t_gemv args[num_threads];
+
+   // prepare args and create threads
+   for(size_t i = 0; i < num_threads; i ++) {
+      args[i] = (thread_arg_t_gemv){i, num_threads, m, x, y, num_vectors};
+      int status = pthread_create(&tid[i], NULL, thread_gemv, &args[i]);
+      assert(status == 0); // could have handled errors better
+   }
+
+   // wait for threads to terminate
+   for(size_t i = 0; i < num_threads; i ++)
+      pthread_join(tid[i], NULL);
+
+   return y;
+}
+
+/*
+ * Compute the product of a square matrix and a vector of matching
+ * length. Return a pointer to the newly allocated result vector or
+ * NULL if anything is wrong.
+ *
+ * Similar to gemv_square_matrix() but blocked and using multi-threading.
+ */
+matrix_element* gemv_square_matrix_threads(square_matrix* m, matrix_element* x, size_t num_threads)
+{
+   return gemv_batched_square_matrix_threads(m, x, 1, num_threads);
+}
@@ -0,0 +1,20 @@
+#ifndef __matrix_vector_h__
+#define __matrix_vector_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+
+// A vector of length n is a plain array of n matrix elements.
+// A block of k vectors of length n is one array of k*n elements,
+// vector v starting at element v*n.
+
+matrix_element* new_matrix_vector(size_t n);
+void free_matrix_vector(matrix_element* v);
+void fill_matrix_vector(matrix_element* v, size_t n);
+int  compare_matrix_vectors(matrix_element* v1, matrix_element* v2, size_t n);
+
+matrix_element* gemv_square_matrix(square_matrix* m, matrix_element* x);
+matrix_element* gemv_square_matrix_threads(square_matrix* m, matrix_element* x, size_t num_threads);
+matrix_element* gemv_batched_square_matrix_threads(square_matrix* m, matrix_element* x, size_t num_vectors, size_t num_threads);
+
+#endif
@@ -3,17 +3,16 @@
 #include <string.h>
 #include <assert.h>
 #include "square_matrix.h"
+#include "matrix_trace.h"
+#include "chunk_sched.h"
 
 ///////////////////////////////////////////////////////////////////////
 
 // Define any necessary macros, types, and additional functions here
 // TODO
 typedef struct{
-   unsigned int row_start;
-   unsigned int column_start;
-   unsigned int row_end;
-   unsigned int column_end;
    unsigned int n;
+   chunk_sched* sched;
    matrix_element** m1_data;
    matrix_element** m2_data;
    matrix_element** mul_data;
@@ -22,28 +21,27 @@ typedef struct{
 
 void* mul_matrix(void* arg){
    threadinfo* argument = (threadinfo*)arg;
-   unsigned int row_start = argument->row_start;
-   unsigned int column_start = argument->column_start;
-   unsigned int row_end = argument->row_end;
-   unsigned int column_end = argument->column_end;
    unsigned int n = argument->n;
+   chunk_sched* sched = argument->sched;
    matrix_element** m1_data = argument->m1_data;
    matrix_element** m2_data = argument->m2_data;
    matrix_element** mul_data = argument->mul_data;
-   int i = row_start;
-   int j = column_start;
-   while(i < n){
-      while(j < n){
+   // claim chunks of elements first..last-1 in row-major order until none are left
+   size_t first, last;
+   while(chunk_sched_next(sched, &first, &last)){
+      MATRIX_TRACE_BEGIN(t0);
+      size_t i = first / n;
+      size_t j = first % n;
+      for(size_t e = first; e < last; e++){
          for(size_t k = 0; k < n; k++){
             mul_data[i][j] += m1_data[i][k] * m2_data[k][j];
          }
-         if(row_end == i && column_end == j){
-            pthread_exit(NULL);
+         if(++j == n){
+            j = 0;
+            i++;
          }
-         j++;
       }
-      j = 0;
-      i++;
+      MATRIX_TRACE_END("mul_threads", t0, last - first);
    }
    pthread_exit(NULL);
 }
@@ -65,29 +63,10 @@ square_matrix* mul_square_matrices_threads(square_matrix *m1, square_matrix *m2,
    square_matrix* mul = new_square_matrix(n);
    matrix_element** mul_data = mul->data;
    unsigned int num_elems = n * n;
-   unsigned int start_row = 0;
-   unsigned int end_row = 0;
-   unsigned int start_column = 0;
-   unsigned int end_column = 0;
-   unsigned int accum = 0;
-   unsigned int elems_per_thread = num_elems/num_threads;
+   chunk_sched sched;
+   chunk_sched_init(&sched, num_elems, num_threads, chunk_min_units(n, MIN_CHUNK_WORK), CHUNK_GUIDED);
    for(size_t thread = 0; thread < num_threads; thread++){
-      start_row = accum/n;
-      start_column = accum%n;
-      accum += elems_per_thread;
-      if(thread == (num_threads - 1)){
-         //printf("ifstatement 1\n");
-         accum = num_elems;
-         end_row = n-1;
-         end_column = n-1;
-      }
-      else{
-         //printf("ifstatement 2\n");
-         end_row = (accum-1)/n;
-         end_column = (accum-1)%n;
-      }
-      //printf("SR: %d ER: %d - SC: %d EC: %d - accum: %d\n", start_row, end_row, start_column, end_column, accum);
-      arg[thread] = (threadinfo){start_row, start_column, end_row, end_column, n, m1_data, m2_data, mul_data};
+      arg[thread] = (threadinfo){n, &sched, m1_data, m2_data, mul_data};
       pthread_create(&tid[thread], NULL, mul_matrix, (void*)&arg[thread]);
    }
    for(int i = 0; i < num_threads; i++){
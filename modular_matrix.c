@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <assert.h>
+#include "modular_matrix.h"
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
+/*
+ * Precomputed constants for Barrett reduction modulo p:
+ * mu = floor(2^64 / p), so that for any 64-bit x the quotient
+ * estimate (x * mu) >> 64 is off by at most one and a single
+ * conditional subtraction finishes the reduction.
+ */
+typedef struct {
+   uint64_t p;
+   uint64_t mu;
+} barrett_t;
+
+static barrett_t barrett_init(matrix_element p)
+{
+   barrett_t b;
+   b.p  = (uint64_t) p;
+   b.mu = (uint64_t) (((unsigned __int128) 1 << 64) / b.p);
+   return b;
+}
+
+static inline uint64_t barrett_reduce(uint64_t x, barrett_t b)
+{
+   uint64_t q = (uint64_t) (((unsigned __int128) x * b.mu) >> 64);
+   uint64_t r = x - q * b.p;
+   return (r >= b.p) ? r - b.p : r;
+}
+
+static inline matrix_element reduce_element(matrix_element x, matrix_element p)
+{
+   x %= p;
+   return (x < 0) ? x + p : x;
+}
+
+/*
+ * Return 1 if all elements of m are already in 0..p-1.
+ */
+static int is_reduced(square_matrix* m, matrix_element p)
+{
+   size_t n = m->order;
+   matrix_element* data = m->data[0];
+   int ok = 1;
+
+   // no early exit so that the loop vectorizes
+   for(size_t e = 0; e < n*n; e++)
+      ok &= (data[e] >= 0) & (data[e] < p);
+
+   return ok;
+}
+
+
+/*
+ * Return a copy of m with every element reduced to 0..p-1,
+ * or NULL if anything is wrong.
+ */
+square_matrix* reduce_square_matrix_mod(square_matrix* m, matrix_element p)
+{
+   if(m == NULL || p < 2)
+      return NULL;
+
+   size_t n = m->order;
+
+   square_matrix* res = new_square_matrix(n);
+   if(res == NULL)
+      return NULL;
+
+   matrix_element** data  = m->data;
+   matrix_element** data2 = res->data;
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++)
+         data2[i][j] = reduce_element(data[i][j], p);
+
+   return res;
+}
+
+/*
+ * Return m itself if its elements are already reduced mod p,
+ * otherwise a reduced copy that the caller has to free.
+ */
+static square_matrix* reduced_operand(square_matrix* m, matrix_element p)
+{
+   return is_reduced(m, p) ? m : reduce_square_matrix_mod(m, p);
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Modular matrix addition         //
+//                                 //
+/////////////////////////////////////
+
+
+/*
+ * Compute the sum of two square matrices mod p. Return a pointer to the
+ * newly allocated result matrix or NULL if anything is wrong
+ */
+square_matrix* add_square_matrices_mod(square_matrix* m1, square_matrix* m2, matrix_element p)
+{
+   if(m1 == NULL || m2 == NULL || m1->order != m2->order || p < 2)
+      return NULL;
+
+   size_t n = m1->order;
+
+   square_matrix* a = reduced_operand(m1, p);
+   square_matrix* b = reduced_operand(m2, p);
+   square_matrix* res = (a != NULL && b != NULL) ? new_square_matrix(n) : NULL;
+
+   if(res != NULL) {
+      const matrix_element* restrict data1 = a->data[0];
+      const matrix_element* restrict data2 = b->data[0];
+      matrix_element* restrict data = res->data[0];
+
+      // both operands are below p, so the sum is below 2p < 2^32 and
+      // one branch-free conditional subtraction reduces it
+      for(size_t e = 0; e < n*n; e++) {
+         uint32_t s = (uint32_t) data1[e] + (uint32_t) data2[e];
+         data[e] = (matrix_element) (s >= (uint32_t) p ? s - (uint32_t) p : s);
+      }
+   }
+
+   if(a != m1) free_square_matrix(a);
+   if(b != m2) free_square_matrix(b);
+
+   return res;
+}
+
+
+/////////////////////////////////////////////
+//                                         //
+// Multi-threaded modular multiplication   //
+//                                         //
+/////////////////////////////////////////////
+
+typedef struct {
+   size_t id, num_threads;
+   square_matrix *m1, *m2, *res;
+   barrett_t barrett;
+   size_t lazy_steps;      // products that can be accumulated before reducing
+} thread_arg_t_mod;
+
+
+static void * thread_mul_mod(void * p_arg)
+{
+   thread_arg_t_mod *p = p_arg;
+
+   size_t id = p->id;
+   size_t num_threads = p->num_threads;
+   size_t n = p->m1->order;
+   matrix_element** data1 = p->m1->data;
+   matrix_element** data2 = p->m2->data;
+   matrix_element** data  = p->res->data;
+   barrett_t barrett = p->barrett;
+   size_t lazy_steps = p->lazy_steps;
+
+   uint64_t* acc = malloc((n ? n : 1) * sizeof(uint64_t));
+   assert(acc != NULL); // could have handled errors better
+
+   // thread id will do rows:
+   // id, id + num_threads, id + 2*num_threads, ...
+   for(size_t i = id; i < n; i += num_threads) {
+      memset(acc, 0, n*sizeof(uint64_t));
+
+      // IKJ order accumulating 64-bit sums; the J loop is a plain
+      // 32x32->64 multiply-add that the compiler vectorizes, and the
+      // accumulator is only reduced when the next lazy_steps products
+      // could overflow it
+      for(size_t k0 = 0; k0 < n; k0 += lazy_steps) {
+         size_t k1 = MIN(k0 + lazy_steps, n);
+
+         for(size_t k = k0; k < k1; k++) {
+            uint64_t a = (uint32_t) data1[i][k];
+            if(a == 0)
+               continue;
+            const matrix_element* restrict row = data2[k];
+            for(size_t j = 0; j < n; j++)
+               acc[j] += a * (uint32_t) row[j];
+         }
+
+         if(k1 < n)
+            for(size_t j = 0; j < n; j++)
+               acc[j] = barrett_reduce(acc[j], barrett);
+      }
+
+      for(size_t j = 0; j < n; j++)
+         data[i][j] = (matrix_element) barrett_reduce(acc[j], barrett);
+   }
+
+   free(acc);
+   pthread_exit(NULL);
+}
+
+
+/*
+ * Multiply two matrices with elements already reduced mod p into res,
+ * which must be a different matrix of the same order.
+ */
+static void mul_mod_into(square_matrix* m1, square_matrix* m2, square_matrix* res,
+                         matrix_element p, size_t num_threads)
+{
+   size_t n = m1->order;
+
+   // after a reduction the accumulator is below p <= (p-1)^2, so it can take
+   // floor((2^64-1) / (p-1)^2) - 1 more products of reduced elements
+   uint64_t max_product = (uint64_t) (p - 1) * (uint64_t) (p - 1);
+   uint64_t lazy_steps = (max_product == 1) ? UINT64_MAX : UINT64_MAX / max_product - 1;
+   if(lazy_steps > n) lazy_steps = n ? n : 1;
+
+   // adjust number of threads for small matrices
+   num_threads = (n < num_threads) ? n : num_threads;
+   if(num_threads == 0)
+      return;
+
+   pthread_t tid[num_threads];
+   thread_arg_t_mod args[num_threads];
+
+   // prepare args and create threads
+   for(size_t i = 0; i < num_threads; i ++) {
+      args[i] = (thread_arg_t_mod){i, num_threads, m1, m2, res, barrett_init(p), (size_t) lazy_steps};
+      int status = pthread_create(&tid[i], NULL, thread_mul_mod, &args[i]);
+      assert(status == 0); // could have handled errors better
+   }
+
+   // wait for threads to terminate
+   for(size_t i = 0; i < num_threads; i ++)
+      pthread_join(tid[i], NULL);
+}
+
+
+/*
+ * Compute the product of two square matrices mod p. Return a pointer to
+ * the newly allocated result matrix or NULL if anything is wrong
+ */
+square_matrix* mul_square_matrices_mod_threads(square_matrix* m1, square_matrix* m2, matrix_element p, size_t num_threads)
+{
+   if(m1 == NULL || m2 == NULL || m1->order != m2->order || p < 2 || num_threads == 0)
+      return NULL;
+
+   square_matrix* a = reduced_operand(m1, p);
+   square_matrix* b = reduced_operand(m2, p);
+   square_matrix* res = (a != NULL && b != NULL) ? new_square_matrix(m1->order) : NULL;
+
+   if(res != NULL)
+      mul_mod_into(a, b, res, p, num_threads);
+
+   if(a != m1) free_square_matrix(a);
+   if(b != m2) free_square_matrix(b);
+
+   return res;
+}
+
+/*
+ * Compute the product of two square matrices mod p. Return a pointer to
+ * the newly allocated result matrix or NULL if anything is wrong
+ */
+square_matrix* mul_square_matrices_mod(square_matrix* m1, square_matrix* m2, matrix_element p)
+{
+   return mul_square_matrices_mod_threads(m1, m2, p, 1);
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Modular matrix power            //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * Compute m^k mod p by repeated squaring. Return a pointer to the
+ * newly allocated result matrix or NULL if anything is wrong.
+ *
+ * Only three matrices are allocated regardless of k: the running
+ * result, the running square and one scratch buffer that products
+ * are written to before the roles are swapped.
+ */
+square_matrix* pow_square_matrix_mod_threads(square_matrix* m, unsigned long k, matrix_element p, size_t num_threads)
+{
+   if(m == NULL || p < 2 || num_threads == 0)
+      return NULL;
+
+   size_t n = m->order;
+
+   square_matrix* res  = new_square_matrix(n);
+   square_matrix* base = reduce_square_matrix_mod(m, p);
+   square_matrix* tmp  = new_square_matrix(n);
+   if(res == NULL || base == NULL || tmp == NULL) {
+      free_square_matrix(res);
+      free_square_matrix(base);
+      free_square_matrix(tmp);
+      return NULL;
+   }
+
+   // start from the identity
+   memset(&res->data[0][0], 0, n*n*sizeof(matrix_element));
+   for(size_t i = 0; i < n; i++)
+      res->data[i][i] = 1;
+
+   while(k) {
+      if(k & 1) {
+         mul_mod_into(res, base, tmp, p, num_threads);
+         SWAP_MATRICES(res, tmp);
+      }
+      k >>= 1;
+      if(k) {
+         mul_mod_into(base, base, tmp, p, num_threads);
+         SWAP_MATRICES(base, tmp);
+      }
+   }
+
+   free_square_matrix(base);
+   free_square_matrix(tmp);
+
+   return res;
+}
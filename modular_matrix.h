@@ -0,0 +1,19 @@
+#ifndef __modular_matrix_h__
+#define __modular_matrix_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+
+// All functions below take a modulus p with 2 <= p <= INT_MAX, accept
+// arbitrary (also negative) input elements and return matrices whose
+// elements are reduced to 0..p-1. They return NULL if anything is wrong.
+
+square_matrix* reduce_square_matrix_mod(square_matrix* m, matrix_element p);
+
+square_matrix* add_square_matrices_mod(square_matrix* m1, square_matrix* m2, matrix_element p);
+square_matrix* mul_square_matrices_mod(square_matrix* m1, square_matrix* m2, matrix_element p);
+
+square_matrix* mul_square_matrices_mod_threads(square_matrix* m1, square_matrix* m2, matrix_element p, size_t num_threads);
+square_matrix* pow_square_matrix_mod_threads(square_matrix* m, unsigned long k, matrix_element p, size_t num_threads);
+
+#endif
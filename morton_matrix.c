@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "morton_matrix.h"
+#include "matrix_threads.h"
+
+#define TILE_ELEMS (MORTON_TILE * MORTON_TILE)
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
+/*
+ * Allocate a zeroed Morton matrix of order n.
+ * Return NULL if the allocation is not successful.
+ */
+morton_matrix* new_morton_matrix(size_t n)
+{
+   morton_matrix* z = malloc(sizeof(morton_matrix));
+   if(z == NULL)
+      return NULL;
+
+   size_t padded = MORTON_TILE;
+   while(padded < n)
+      padded *= 2;
+
+   // padding must be zero, the kernels rely on it
+   z->data = calloc(padded * padded, sizeof(matrix_element));
+   if(z->data == NULL) {
+      free(z);
+      return NULL;
+   }
+
+   z->order = n;
+   z->padded = padded;
+
+   return z;
+}
+
+/*
+ * Deallocate the dynamic memory allocated for the given Morton matrix.
+ */
+void free_morton_matrix(morton_matrix* z)
+{
+   if(z == NULL)
+      return;
+
+   free(z->data);
+   free(z);
+}
+
+/*
+ * Compare two Morton matrices, return 0 if they are the same,
+ * non-zero values otherwise.
+ */
+int compare_morton_matrices(morton_matrix* z1, morton_matrix* z2)
+{
+   if(z1 == NULL || z2 == NULL)
+      return -1;
+
+   if(z1->order != z2->order)
+      return -2;
+
+   size_t n = z1->order;
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++) {
+         size_t e = MORTON_INDEX(i, j);
+         if(z1->data[e] != z2->data[e]) {
+            fprintf(stderr, "Mismatch found for element (%lu, %lu): %d vs %d\n",
+                    i, j, z1->data[e], z2->data[e]);
+            return 1;
+         }
+      }
+
+   return 0;
+}
+
+
+typedef struct {
+   size_t id, num_threads;
+   morton_matrix *z1, *z2, *zres;
+   square_matrix *m;
+   size_t block;   // side, in tiles, of the blocks of C handed out for multiplication
+} thread_arg_t_morton;
+
+DEFINE_RUN_THREADS(thread_arg_t_morton)
+
+// number of tiles holding at least one element of an order n matrix, per side
+static size_t used_tiles(size_t n)
+{
+   return (n + MORTON_TILE - 1) / MORTON_TILE;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Conversions                     //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * Each thread takes tiles id, id + num_threads, ... of the used part of
+ * the matrix in row-major tile order and copies them one tile row at a
+ * time, so both sides are read and written in runs of MORTON_TILE.
+ */
+static void * thread_to_morton(void * p_arg)
+{
+   thread_arg_t_morton *p = p_arg;
+   size_t n = p->m->order;
+   size_t tiles = used_tiles(n);
+   matrix_element** src = p->m->data;
+
+   for(size_t t = p->id; t < tiles * tiles; t += p->num_threads) {
+      size_t ti = t / tiles, tj = t % tiles;
+      size_t i0 = ti * MORTON_TILE, j0 = tj * MORTON_TILE;
+      size_t rows = MIN(MORTON_TILE, n - i0), cols = MIN(MORTON_TILE, n - j0);
+      matrix_element* dst = p->zres->data + morton_code(ti, tj) * TILE_ELEMS;
+
+      for(size_t r = 0; r < rows; r++)
+         memcpy(dst + r*MORTON_TILE, src[i0 + r] + j0, cols * sizeof(matrix_element));
+   }
+
+   return NULL;
+}
+
+static void * thread_from_morton(void * p_arg)
+{
+   thread_arg_t_morton *p = p_arg;
+   size_t n = p->z1->order;
+   size_t tiles = used_tiles(n);
+   matrix_element** dst = p->m->data;
+
+   for(size_t t = p->id; t < tiles * tiles; t += p->num_threads) {
+      size_t ti = t / tiles, tj = t % tiles;
+      size_t i0 = ti * MORTON_TILE, j0 = tj * MORTON_TILE;
+      size_t rows = MIN(MORTON_TILE, n - i0), cols = MIN(MORTON_TILE, n - j0);
+      const matrix_element* src = p->z1->data + morton_code(ti, tj) * TILE_ELEMS;
+
+      for(size_t r = 0; r < rows; r++)
+         memcpy(dst[i0 + r] + j0, src + r*MORTON_TILE, cols * sizeof(matrix_element));
+   }
+
+   return NULL;
+}
+
+/*
+ * Convert a row-major matrix to the Morton layout. Return a pointer to
+ * the newly allocated matrix or NULL if anything is wrong
+ */
+morton_matrix* square_to_morton_matrix_threads(square_matrix* m, size_t num_threads)
+{
+   if(m == NULL || num_threads == 0)
+      return NULL;
+
+   morton_matrix* z = new_morton_matrix(m->order);
+   if(z == NULL)
+      return NULL;
+
+   // adjust number of threads for small matrices
+   size_t tiles = used_tiles(m->order);
+   num_threads = (tiles * tiles < num_threads) ? (tiles ? tiles * tiles : 1) : num_threads;
+
+   run_threads(thread_to_morton, (thread_arg_t_morton){.m = m, .zres = z}, num_threads);
+
+   return z;
+}
+
+/*
+ * Convert a Morton matrix back to row-major. Return a pointer to the
+ * newly allocated matrix or NULL if anything is wrong
+ */
+square_matrix* morton_to_square_matrix_threads(morton_matrix* z, size_t num_threads)
+{
+   if(z == NULL || num_threads == 0)
+      return NULL;
+
+   square_matrix* m = new_square_matrix(z->order);
+   if(m == NULL)
+      return NULL;
+
+   // adjust number of threads for small matrices
+   size_t tiles = used_tiles(z->order);
+   num_threads = (tiles * tiles < num_threads) ? (tiles ? tiles * tiles : 1) : num_threads;
+
+   run_threads(thread_from_morton, (thread_arg_t_morton){.z1 = z, .m = m}, num_threads);
+
+   return m;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Addition                        //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * Each thread adds a contiguous range of the used tiles, taken in
+ * row-major tile order; tiles entirely in the padding stay zero.
+ */
+static void * thread_add_morton(void * p_arg)
+{
+   thread_arg_t_morton *p = p_arg;
+   size_t tiles = used_tiles(p->zres->order);
+   size_t first = tiles * tiles * p->id / p->num_threads;
+   size_t last  = tiles * tiles * (p->id + 1) / p->num_threads;
+
+   for(size_t t = first; t < last; t++) {
+      size_t offset = morton_code(t / tiles, t % tiles) * TILE_ELEMS;
+      const matrix_element* restrict data1 = p->z1->data + offset;
+      const matrix_element* restrict data2 = p->z2->data + offset;
+      matrix_element* restrict data = p->zres->data + offset;
+
+      for(size_t e = 0; e < TILE_ELEMS; e++)
+         data[e] = data1[e] + data2[e];
+   }
+
+   return NULL;
+}
+
+/*
+ * Compute the sum of two Morton matrices. Return a pointer to the newly
+ * allocated result or NULL if anything is wrong
+ */
+morton_matrix* add_morton_matrices_threads(morton_matrix* z1, morton_matrix* z2, size_t num_threads)
+{
+   if(z1 == NULL || z2 == NULL || z1->order != z2->order || num_threads == 0)
+      return NULL;
+
+   morton_matrix* res = new_morton_matrix(z1->order);
+   if(res == NULL)
+      return NULL;
+
+   // adjust number of threads for small matrices
+   size_t tiles = used_tiles(z1->order);
+   num_threads = (tiles * tiles < num_threads) ? (tiles ? tiles * tiles : 1) : num_threads;
+
+   run_threads(thread_add_morton, (thread_arg_t_morton){.z1 = z1, .z2 = z2, .zres = res}, num_threads);
+
+   return res;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Transpose                       //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * Tile (ti,tj) of the transpose is tile (tj,ti) transposed. A tile is
+ * 4 KiB, so both the source and the destination tile stay in L1 while
+ * it is transposed.
+ */
+static void * thread_transpose_morton(void * p_arg)
+{
+   thread_arg_t_morton *p = p_arg;
+   size_t tiles = used_tiles(p->z1->order);
+
+   for(size_t t = p->id; t < tiles * tiles; t += p->num_threads) {
+      size_t ti = t / tiles, tj = t % tiles;
+      const matrix_element* restrict src = p->z1->data + morton_code(tj, ti) * TILE_ELEMS;
+      matrix_element* restrict dst = p->zres->data + morton_code(ti, tj) * TILE_ELEMS;
+
+      for(size_t r = 0; r < MORTON_TILE; r++)
+         for(size_t c = 0; c < MORTON_TILE; c++)
+            dst[r*MORTON_TILE + c] = src[c*MORTON_TILE + r];
+   }
+
+   return NULL;
+}
+
+/*
+ * Compute the transpose of a Morton matrix. Return a pointer to the
+ * newly allocated result or NULL if anything is wrong
+ */
+morton_matrix* transpose_morton_matrix_threads(morton_matrix* z, size_t num_threads)
+{
+   if(z == NULL || num_threads == 0)
+      return NULL;
+
+   morton_matrix* res = new_morton_matrix(z->order);
+   if(res == NULL)
+      return NULL;
+
+   // adjust number of threads for small matrices
+   size_t tiles = used_tiles(z->order);
+   num_threads = (tiles * tiles < num_threads) ? (tiles ? tiles * tiles : 1) : num_threads;
+
+   run_threads(thread_transpose_morton, (thread_arg_t_morton){.z1 = z, .zres = res}, num_threads);
+
+   return res;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Multiplication                  //
+//                                 //
+/////////////////////////////////////
+
+// c += a * b for single tiles, in IKJ order
+static void mul_tile(const matrix_element* restrict a, const matrix_element* restrict b, matrix_element* restrict c)
+{
+   for(size_t i = 0; i < MORTON_TILE; i++) {
+      matrix_element* restrict row = c + i*MORTON_TILE;
+      for(size_t k = 0; k < MORTON_TILE; k++) {
+         matrix_element x = a[i*MORTON_TILE + k];
+         const matrix_element* restrict src = b + k*MORTON_TILE;
+         for(size_t j = 0; j < MORTON_TILE; j++)
+            row[j] += x * src[j];
+      }
+   }
+}
+
+/*
+ * c += a * b for blocks of tiles x tiles tiles whose top left elements
+ * are at rows i0 and k0 of A and columns k0 and j0 of B. The quadrants
+ * of a block are its four contiguous quarters, in the order 00, 01, 10,
+ * 11, so the recursion needs no index arithmetic beyond offsets, and
+ * every level works on blocks a quarter the size of the level above:
+ * each fits a smaller cache, with no tuning for any particular one.
+ * Quadrants that lie entirely in the padding are skipped.
+ */
+static void mul_block(const matrix_element* a, const matrix_element* b, matrix_element* c, size_t tiles,
+                      size_t n, size_t i0, size_t k0, size_t j0)
+{
+   if(i0 >= n || k0 >= n || j0 >= n)
+      return;
+
+   if(tiles == 1) {
+      mul_tile(a, b, c);
+      return;
+   }
+
+   size_t h = tiles / 2;
+   size_t q = h * h * TILE_ELEMS;
+   size_t s = h * MORTON_TILE;
+
+   mul_block(a,       b,       c,       h, n, i0,     k0,     j0);
+   mul_block(a + q,   b + 2*q, c,       h, n, i0,     k0 + s, j0);
+   mul_block(a,       b + q,   c + q,   h, n, i0,     k0,     j0 + s);
+   mul_block(a + q,   b + 3*q, c + q,   h, n, i0,     k0 + s, j0 + s);
+   mul_block(a + 2*q, b,       c + 2*q, h, n, i0 + s, k0,     j0);
+   mul_block(a + 3*q, b + 2*q, c + 2*q, h, n, i0 + s, k0 + s, j0);
+   mul_block(a + 2*q, b + q,   c + 3*q, h, n, i0 + s, k0,     j0 + s);
+   mul_block(a + 3*q, b + 3*q, c + 3*q, h, n, i0 + s, k0 + s, j0 + s);
+}
+
+/*
+ * C is cut into blocks of p->block x p->block tiles, and thread id
+ * computes blocks id, id + num_threads, ... in row-major block order.
+ * Block (bi,bj) of C is the sum over bk of block (bi,bk) of A times
+ * block (bk,bj) of B; each block is contiguous at its Morton position.
+ */
+static void * thread_mul_morton(void * p_arg)
+{
+   thread_arg_t_morton *p = p_arg;
+   size_t n = p->z1->order;
+   size_t blocks = p->z1->padded / MORTON_TILE / p->block;
+   size_t block_elems = p->block * p->block * TILE_ELEMS;
+   size_t side = p->block * MORTON_TILE;
+
+   for(size_t t = p->id; t < blocks * blocks; t += p->num_threads) {
+      size_t bi = t / blocks, bj = t % blocks;
+      matrix_element* c = p->zres->data + morton_code(bi, bj) * block_elems;
+
+      for(size_t bk = 0; bk < blocks; bk++)
+         mul_block(p->z1->data + morton_code(bi, bk) * block_elems,
+                   p->z2->data + morton_code(bk, bj) * block_elems,
+                   c, p->block, n, bi * side, bk * side, bj * side);
+   }
+
+   return NULL;
+}
+
+/*
+ * Compute the product of two Morton matrices. Return a pointer to the
+ * newly allocated result or NULL if anything is wrong
+ */
+morton_matrix* mul_morton_matrices_threads(morton_matrix* z1, morton_matrix* z2, size_t num_threads)
+{
+   if(z1 == NULL || z2 == NULL || z1->order != z2->order || num_threads == 0)
+      return NULL;
+
+   morton_matrix* res = new_morton_matrix(z1->order);
+   if(res == NULL)
+      return NULL;
+
+   // halve the blocks until there are at least four per thread
+   size_t tiles = z1->padded / MORTON_TILE;
+   size_t block = tiles;
+   while(block > 1 && (tiles / block) * (tiles / block) < 4 * num_threads)
+      block /= 2;
+
+   // adjust number of threads for small matrices
+   size_t blocks = (tiles / block) * (tiles / block);
+   num_threads = (blocks < num_threads) ? blocks : num_threads;
+
+   run_threads(thread_mul_morton, (thread_arg_t_morton){.z1 = z1, .z2 = z2, .zres = res, .block = block}, num_threads);
+
+   return res;
+}
@@ -0,0 +1,54 @@
+#ifndef __morton_matrix_h__
+#define __morton_matrix_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "square_matrix3.h"
+
+// Order of the row-major tiles at the leaves of the Morton layout
+#define MORTON_TILE 32
+
+// A Morton matrix of order n is padded with zeros to padded = MORTON_TILE
+// * 2^k >= n. It is cut into MORTON_TILE x MORTON_TILE tiles, each stored
+// row by row, and the tiles are laid out in Z order: tile (ti,tj) starts
+// at element morton_code(ti,tj) * MORTON_TILE^2. Every quadrant, at any
+// level of recursion, is then one contiguous quarter of its parent.
+typedef struct {
+    size_t order;
+    size_t padded;
+    matrix_element* data;   // padded*padded elements
+} morton_matrix;
+
+// interleave the bits of row and column, the row bit above the column bit
+static inline uint64_t morton_code(uint32_t row, uint32_t col)
+{
+    uint64_t r = row, c = col;
+    r = (r | (r << 16)) & 0x0000FFFF0000FFFFull;
+    r = (r | (r << 8))  & 0x00FF00FF00FF00FFull;
+    r = (r | (r << 4))  & 0x0F0F0F0F0F0F0F0Full;
+    r = (r | (r << 2))  & 0x3333333333333333ull;
+    r = (r | (r << 1))  & 0x5555555555555555ull;
+    c = (c | (c << 16)) & 0x0000FFFF0000FFFFull;
+    c = (c | (c << 8))  & 0x00FF00FF00FF00FFull;
+    c = (c | (c << 4))  & 0x0F0F0F0F0F0F0F0Full;
+    c = (c | (c << 2))  & 0x3333333333333333ull;
+    c = (c | (c << 1))  & 0x5555555555555555ull;
+    return (r << 1) | c;
+}
+
+// position of element (i,j) in the data of a Morton matrix
+#define MORTON_INDEX(i,j) (morton_code((i) / MORTON_TILE, (j) / MORTON_TILE) * MORTON_TILE * MORTON_TILE \
+                           + ((i) % MORTON_TILE) * MORTON_TILE + (j) % MORTON_TILE)
+
+morton_matrix* new_morton_matrix(size_t order);
+void free_morton_matrix(morton_matrix* z);
+int  compare_morton_matrices(morton_matrix* z1, morton_matrix* z2);
+
+morton_matrix* square_to_morton_matrix_threads(square_matrix* m, size_t num_threads);
+square_matrix* morton_to_square_matrix_threads(morton_matrix* z, size_t num_threads);
+
+morton_matrix* add_morton_matrices_threads(morton_matrix* z1, morton_matrix* z2, size_t num_threads);
+morton_matrix* mul_morton_matrices_threads(morton_matrix* z1, morton_matrix* z2, size_t num_threads);
+morton_matrix* transpose_morton_matrix_threads(morton_matrix* z, size_t num_threads);
+
+#endif
@@ -4,6 +4,8 @@
 #include <string.h>
 #include <assert.h>
 #include "square_matrix.h"
+#include "matrix_trace.h"
+#include "chunk_sched.h"
 #define BAND_SIZE 128
 
 ///////////////////////////////////////////////////////////////////////
@@ -17,8 +19,7 @@
  * Similar to transpose_square_matrix, but with multi-threading.
  */
 typedef struct{
-   size_t band_first_row;
-   size_t band_last_row;
+   chunk_sched* sched;          // bands of BAND_SIZE rows
    size_t n;
    matrix_element** data;
    matrix_element** data2;
@@ -27,16 +28,26 @@ typedef struct{
 
 void* threadf(void* arg){
    thread_info* thread = (thread_info*)arg;
-   size_t band_first_row = thread->band_first_row;
-   size_t band_last_row = thread->band_last_row;
+   chunk_sched* sched = thread->sched;
    size_t n = thread->n;
    matrix_element** data = thread->data;
    matrix_element** data2 = thread->data2;
 
-   // copy to the transpose  matrix rows band_first_row..band_last_row-1
-   for(size_t j = 0; j < n; j++)
-      for(size_t i = band_first_row; i < band_last_row; i++)
-         data2[j][i] = data[i][j];
+   // claim chunks of bands first..last-1 until none are left
+   size_t first, last;
+   while(chunk_sched_next(sched, &first, &last)){
+      MATRIX_TRACE_BEGIN(t0);
+      for(size_t band = first; band < last; band++){
+         size_t band_first_row = band * BAND_SIZE;
+         size_t band_last_row = band_first_row + BAND_SIZE < n ? band_first_row + BAND_SIZE : n;
+
+         // copy to the transpose  matrix rows band_first_row..band_last_row-1
+         for(size_t j = 0; j < n; j++)
+            for(size_t i = band_first_row; i < band_last_row; i++)
+               data2[j][i] = data[i][j];
+      }
+      MATRIX_TRACE_END("transpose_threads", t0, last - first);
+   }
    pthread_exit(NULL);
 }
 
@@ -55,23 +66,13 @@ square_matrix* transpose_square_matrix_threads(square_matrix* m, size_t num_thre
    matrix_element** data  = m->data;
    matrix_element** data2 = res->data;
 
-   size_t band_first_row = 0;
-   size_t band_last_row = 0;
-
    pthread_t tid[num_threads];
    thread_info arg[num_threads];
 
-   size_t per_thread = n/num_threads;
+   chunk_sched sched;
+   chunk_sched_init(&sched, (n + BAND_SIZE - 1) / BAND_SIZE, num_threads, 1, CHUNK_GUIDED);
    for(size_t i = 0; i < num_threads; i++){
-      band_first_row = band_last_row;
-      if(i == num_threads-1){
-         band_last_row = n;
-      }
-      else{
-         band_last_row += per_thread;
-      }
-      arg[i] = (thread_info){band_first_row, band_last_row, n, data, data2};
-      //printf("THREADS start: %ld end: %ld\n", band_first_row, band_last_row);
+      arg[i] = (thread_info){&sched, n, data, data2};
       pthread_create(&tid[i], NULL, threadf, (void*)&arg[i]);
    }
    for(size_t i = 0; i < num_threads; i++){
@@ -6,6 +6,8 @@
 #include <assert.h>
 #include <math.h>
 #include "square_matrix.h"
+#include "matrix_trace.h"
+#include "chunk_sched.h"
 
 ///////////////////////////////////////////////////////////////////////
 
@@ -27,8 +29,7 @@
 
 
 typedef struct{
-    size_t start_row;
-    size_t end_row;
+    chunk_sched* sched;
     size_t n;
     long double* sq_sum;
     matrix_element** data;
@@ -36,16 +37,21 @@ typedef struct{
 
 void* threadf(void* arg){
     thread_info* thread = (thread_info*)arg;
-    size_t start_row = thread->start_row;
-    size_t end_row = thread->end_row;
+    chunk_sched* sched = thread->sched;
     size_t n = thread->n;
     long double* sq_sum = thread->sq_sum;
     matrix_element** data = thread->data;
     //printf("Start row: %ld End row: %ld Total rows: %ld\n", start_row, end_row, n);
-    for(size_t i = start_row; i < end_row; i++) {
-        for(size_t j = 0; j < n; j++){
-            sq_sum[j] += data[i][j] * data[i][j];
+    // claim chunks of rows start_row..end_row-1 until none are left
+    size_t start_row, end_row;
+    while(chunk_sched_next(sched, &start_row, &end_row)) {
+        MATRIX_TRACE_BEGIN(t0);
+        for(size_t i = start_row; i < end_row; i++) {
+            for(size_t j = 0; j < n; j++){
+                sq_sum[j] += data[i][j] * data[i][j];
+            }
         }
+        MATRIX_TRACE_END("norm_threads", t0, end_row - start_row);
     }
     pthread_exit(NULL);
 }
@@ -63,23 +69,15 @@ long double matrixNorm_threads(square_matrix* m, size_t num_threads)
     //long double *sq_sum = calloc(n, sizeof(long double)); // initializes with zeros
 
     // row-by-row processing for better spatial locality
-    size_t start_row = 0;
-    size_t end_row = 0;
-    size_t per_thread = n/num_threads;
+    chunk_sched sched;
+    chunk_sched_init(&sched, n, num_threads, chunk_min_units(n, MIN_CHUNK_WORK), CHUNK_GUIDED);
     thread_info arg[num_threads];
     pthread_t tid[num_threads];
     long double** sq_sums = calloc(num_threads, sizeof(long double));
 
     for(size_t i = 0; i < num_threads; i++){
-        start_row = end_row;
-        if(i == num_threads-1){
-            end_row = n;
-        }
-        else{
-            end_row += per_thread;
-        }
         sq_sums[i] = (long double*)calloc(n, sizeof(long double));
-        arg[i] = (thread_info){start_row, end_row, n, sq_sums[i], data};
+        arg[i] = (thread_info){&sched, n, sq_sums[i], data};
         pthread_create(&tid[i], NULL, threadf, (void*)&arg[i]);
     }
     for(size_t i = 0; i < num_threads; i++){
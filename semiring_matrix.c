@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "semiring_matrix.h"
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+#define MAX(x,y) ((x)>(y) ? (x) : (y))
+#define PLUS(x,y)  ((x) + (y))
+#define TIMES(x,y) ((x) * (y))
+
+// + that keeps an infinite operand infinite even when the other one is
+// negative; written as a select so that it still vectorizes
+#define PLUS_INF(x,y)     (((x) >= SEMIRING_INF || (y) >= SEMIRING_INF) ? SEMIRING_INF : (x) + (y))
+#define PLUS_NEG_INF(x,y) (((x) <= SEMIRING_NEG_INF || (y) <= SEMIRING_NEG_INF) ? SEMIRING_NEG_INF : (x) + (y))
+
+typedef struct {
+   size_t id, num_threads;
+   square_matrix *m1, *m2, *res;
+} thread_arg_t_semiring;
+
+typedef void * (*semiring_thread_fn)(void *);
+
+
+/*
+ * Run a semiring product kernel into res with the row-cyclic thread
+ * split of mul_square_matrices_threads().
+ */
+static void semiring_mul_into(semiring_thread_fn fn, square_matrix* m1, square_matrix* m2,
+                              square_matrix* res, size_t num_threads)
+{
+   size_t n = m1->order;
+
+   // adjust number of threads for small matrices
+   num_threads = (n < num_threads) ? n : num_threads;
+   if(num_threads == 0)
+      return;
+
+   pthread_t tid[num_threads];
+   thread_arg_t_semiring args[num_threads];
+
+   // prepare args and create threads
+   for(size_t i = 0; i < num_threads; i ++) {
+      args[i] = (thread_arg_t_semiring){i, num_threads, m1, m2, res};
+      int status = pthread_create(&tid[i], NULL, fn, &args[i]);
+      assert(status == 0); // could have handled errors better
+   }
+
+   // wait for threads to terminate
+   for(size_t i = 0; i < num_threads; i ++)
+      pthread_join(tid[i], NULL);
+}
+
+
+/*
+ * Define the kernel and public functions of the semiring NAME with
+ * additive identity ZERO and operations ADD and MUL. The kernel is the
+ * IKJ loop of thread_mul() in square_matrix3.c with the operations
+ * substituted at compile time, so the J loop vectorizes the same way
+ * (min/max become vector min/max instructions).
+ */
+#define DEFINE_SEMIRING_MUL(NAME, ZERO, ADD, MUL)                                            \
+static void * thread_mul_##NAME(void * p_arg)                                                \
+{                                                                                            \
+   thread_arg_t_semiring *p = p_arg;                                                         \
+                                                                                             \
+   size_t id = p->id;                                                                        \
+   size_t num_threads = p->num_threads;                                                      \
+   size_t n = p->m1->order;                                                                  \
+   matrix_element** data1 = p->m1->data;                                                     \
+   matrix_element** data2 = p->m2->data;                                                     \
+   matrix_element** data  = p->res->data;                                                    \
+                                                                                             \
+   /* thread id will do rows id, id + num_threads, id + 2*num_threads, ... */                \
+   for(size_t i = id; i < n; i += num_threads) {                                             \
+      matrix_element* restrict row = data[i];                                                \
+      for(size_t j = 0; j < n; j++)                                                          \
+         row[j] = (ZERO);                                                                    \
+                                                                                             \
+      for(size_t k = 0; k < n; k++) {                                                        \
+         matrix_element a = data1[i][k];                                                     \
+         const matrix_element* restrict src = data2[k];                                      \
+         for(size_t j = 0; j < n; j++)                                                       \
+            row[j] = ADD(row[j], MUL(a, src[j]));                                            \
+      }                                                                                      \
+   }                                                                                         \
+                                                                                             \
+   pthread_exit(NULL);                                                                       \
+}                                                                                            \
+                                                                                             \
+square_matrix* mul_square_matrices_##NAME##_threads(square_matrix* m1, square_matrix* m2,   \
+                                                    size_t num_threads)                      \
+{                                                                                            \
+   if(m1 == NULL || m2 == NULL || m1->order != m2->order || num_threads == 0)                \
+      return NULL;                                                                           \
+                                                                                             \
+   square_matrix* res = new_square_matrix(m1->order);                                        \
+   if(res == NULL)                                                                           \
+      return NULL;                                                                           \
+                                                                                             \
+   semiring_mul_into(thread_mul_##NAME, m1, m2, res, num_threads);                           \
+   return res;                                                                               \
+}                                                                                            \
+                                                                                             \
+square_matrix* mul_square_matrices_##NAME(square_matrix* m1, square_matrix* m2)             \
+{                                                                                            \
+   return mul_square_matrices_##NAME##_threads(m1, m2, 1);                                   \
+}
+
+DEFINE_SEMIRING_MUL(plus_times, 0,                PLUS, TIMES)
+DEFINE_SEMIRING_MUL(min_plus,   SEMIRING_INF,     MIN,  PLUS_INF)
+DEFINE_SEMIRING_MUL(max_plus,   SEMIRING_NEG_INF, MAX,  PLUS_NEG_INF)
+DEFINE_SEMIRING_MUL(max_min,    SEMIRING_NEG_INF, MAX,  MIN)
+DEFINE_SEMIRING_MUL(min_max,    SEMIRING_INF,     MIN,  MAX)
+
+
+/////////////////////////////////////
+//                                 //
+// Semiring closures               //
+//                                 //
+/////////////////////////////////////
+
+
+/*
+ * Square m (after merging the multiplicative identity ONE into its
+ * diagonal with ADD) until it stops changing. Each squaring doubles
+ * the length of the paths taken into account, so at most ceil(log2(n))
+ * products are needed. Two buffers are swapped between the products.
+ */
+static square_matrix* semiring_closure(semiring_thread_fn fn, matrix_element one, int add_is_min,
+                                       square_matrix* m, size_t num_threads)
+{
+   if(m == NULL || num_threads == 0)
+      return NULL;
+
+   size_t n = m->order;
+
+   square_matrix* res = duplicate_square_matrix(m);
+   square_matrix* tmp = new_square_matrix(n);
+   if(res == NULL || tmp == NULL) {
+      free_square_matrix(res);
+      free_square_matrix(tmp);
+      return NULL;
+   }
+
+   for(size_t i = 0; i < n; i++)
+      res->data[i][i] = add_is_min ? MIN(res->data[i][i], one) : MAX(res->data[i][i], one);
+
+   for(size_t covered = 1; covered < n; covered *= 2) {
+      semiring_mul_into(fn, res, res, tmp, num_threads);
+
+      SWAP_MATRICES(res, tmp);
+      if(memcmp(res->data[0], tmp->data[0], n*n*sizeof(matrix_element)) == 0)
+         break;
+   }
+
+   free_square_matrix(tmp);
+   return res;
+}
+
+/*
+ * Compute the lengths of the shortest paths between all pairs of
+ * vertices of the graph with edge weights m (SEMIRING_INF for no edge).
+ * Return a pointer to the newly allocated result or NULL if anything is
+ * wrong. The graph must not have negative cycles.
+ */
+square_matrix* min_plus_closure_square_matrix_threads(square_matrix* m, size_t num_threads)
+{
+   return semiring_closure(thread_mul_min_plus, 0, 1, m, num_threads);
+}
+
+/*
+ * Compute the capacities of the widest paths between all pairs of
+ * vertices of the graph with edge capacities m (SEMIRING_NEG_INF for no
+ * edge). Return a pointer to the newly allocated result or NULL if
+ * anything is wrong.
+ */
+square_matrix* max_min_closure_square_matrix_threads(square_matrix* m, size_t num_threads)
+{
+   return semiring_closure(thread_mul_max_min, SEMIRING_INF, 0, m, num_threads);
+}
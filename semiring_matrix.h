@@ -0,0 +1,40 @@
+#ifndef __semiring_matrix_h__
+#define __semiring_matrix_h__
+
+#include <stddef.h>
+#include <limits.h>
+#include "square_matrix3.h"
+
+// Infinite elements for the path semirings. The + of min-plus and
+// max-plus keeps infinite operands infinite; finite elements must stay
+// strictly between the two infinities so that sums cannot overflow.
+#define SEMIRING_INF     (INT_MAX / 2)
+#define SEMIRING_NEG_INF (-(INT_MAX / 2))
+
+// Every semiring NAME provides
+//    mul_square_matrices_NAME(m1, m2)
+//    mul_square_matrices_NAME_threads(m1, m2, num_threads)
+// computing c[i][j] = ADD over k of MUL(m1[i][k], m2[k][j]):
+//
+//    plus_times   ADD = +,   MUL = *     the ordinary product
+//    min_plus     ADD = min, MUL = +     shortest paths, no edge = SEMIRING_INF
+//    max_plus     ADD = max, MUL = +     longest paths, no edge = SEMIRING_NEG_INF
+//    max_min      ADD = max, MUL = min   widest (bottleneck) paths, no edge = SEMIRING_NEG_INF
+//    min_max      ADD = min, MUL = max   minimax paths, no edge = SEMIRING_INF
+
+#define DECLARE_SEMIRING_MUL(NAME)                                                                        \
+square_matrix* mul_square_matrices_##NAME(square_matrix* m1, square_matrix* m2);                          \
+square_matrix* mul_square_matrices_##NAME##_threads(square_matrix* m1, square_matrix* m2, size_t num_threads);
+
+DECLARE_SEMIRING_MUL(plus_times)
+DECLARE_SEMIRING_MUL(min_plus)
+DECLARE_SEMIRING_MUL(max_plus)
+DECLARE_SEMIRING_MUL(max_min)
+DECLARE_SEMIRING_MUL(min_max)
+
+// Closures by repeated squaring: all-pairs shortest path lengths
+// (no negative cycles allowed) and all-pairs widest path capacities.
+square_matrix* min_plus_closure_square_matrix_threads(square_matrix* m, size_t num_threads);
+square_matrix* max_min_closure_square_matrix_threads(square_matrix* m, size_t num_threads);
+
+#endif
@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shared_matrix.h"
+
+// the elements start on the second page, so they are page aligned too
+#define HEADER_BYTES ((size_t) sysconf(_SC_PAGESIZE))
+
+typedef struct {
+   matrix_storage base;          // first, so the storage pointer converts back
+   shared_matrix_header* header;
+   size_t map_bytes;
+} shared_storage;
+
+static void release_shared_storage(matrix_storage* s)
+{
+   shared_storage* ss = (shared_storage*) s;
+
+   munmap(ss->header, ss->map_bytes);
+   free(s->rows);
+   free(ss);
+}
+
+// header of a shared matrix, NULL for any other matrix
+static shared_matrix_header* header_of(square_matrix* m)
+{
+   if(m == NULL || m->storage == NULL || m->storage->release != release_shared_storage)
+      return NULL;
+
+   return ((shared_storage*) m->storage)->header;
+}
+
+/*
+ * Wrap the mapping of a segment in a square matrix.
+ * Return NULL if anything is wrong.
+ */
+static square_matrix* wrap_mapping(shared_matrix_header* h, size_t map_bytes)
+{
+   size_t n = h->order;
+   square_matrix* m = malloc(sizeof(square_matrix));
+   shared_storage* s = malloc(sizeof(shared_storage));
+   matrix_element** rows = malloc((n ? n : 1) * sizeof(matrix_element*));
+   if(m == NULL || s == NULL || rows == NULL) {
+      free(m);
+      free(s);
+      free(rows);
+      return NULL;
+   }
+
+   matrix_element* elements = (matrix_element*) ((char*) h + HEADER_BYTES);
+   for(size_t i = 0; i < n; i++)
+      rows[i] = elements + i * n;
+   rows[0] = elements;   // also for order 0
+
+   atomic_init(&s->base.refs, 1);
+   s->base.rows = rows;
+   s->base.release = release_shared_storage;
+   s->header = h;
+   s->map_bytes = map_bytes;
+
+   m->order = n;
+   m->data = rows;
+   m->storage = &s->base;
+
+   return m;
+}
+
+/*
+ * Create the shared-memory segment name, which must not exist yet, for
+ * a zeroed matrix of order n, and map it.
+ * Return the matrix or NULL if anything is wrong.
+ */
+square_matrix* create_shared_square_matrix(const char* name, size_t n)
+{
+   if(name == NULL)
+      return NULL;
+
+   size_t map_bytes = HEADER_BYTES + n * n * sizeof(matrix_element);
+
+   int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+   if(fd < 0)
+      return NULL;
+
+   // a new segment reads as zeros
+   void* p = ftruncate(fd, map_bytes) == 0 ?
+             mmap(NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+   close(fd);
+   if(p == MAP_FAILED) {
+      shm_unlink(name);
+      return NULL;
+   }
+
+   shared_matrix_header* h = p;
+   h->dtype = SHARED_MATRIX_DTYPE_INT;
+   h->element_size = sizeof(matrix_element);
+   h->order = n;
+   atomic_init(&h->seq, 0);
+
+   // attaching processes check the magic number last
+   atomic_thread_fence(memory_order_release);
+   h->magic = SHARED_MATRIX_MAGIC;
+
+   square_matrix* m = wrap_mapping(h, map_bytes);
+   if(m == NULL) {
+      munmap(p, map_bytes);
+      shm_unlink(name);
+   }
+
+   return m;
+}
+
+/*
+ * Map the existing shared matrix name.
+ * Return the matrix or NULL if anything is wrong, including a segment
+ * that does not hold a matrix of this element type.
+ */
+square_matrix* attach_shared_square_matrix(const char* name)
+{
+   if(name == NULL)
+      return NULL;
+
+   int fd = shm_open(name, O_RDWR, 0);
+   if(fd < 0)
+      return NULL;
+
+   struct stat st;
+   void* p = MAP_FAILED;
+   if(fstat(fd, &st) == 0 && (size_t) st.st_size >= HEADER_BYTES)
+      p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if(p == MAP_FAILED)
+      return NULL;
+
+   shared_matrix_header* h = p;
+   size_t map_bytes = st.st_size;
+   int valid = h->magic == SHARED_MATRIX_MAGIC;
+   atomic_thread_fence(memory_order_acquire);
+   valid = valid && h->dtype == SHARED_MATRIX_DTYPE_INT && h->element_size == sizeof(matrix_element) &&
+           h->order <= (map_bytes - HEADER_BYTES) / sizeof(matrix_element) / (h->order ? h->order : 1);
+
+   square_matrix* m = valid ? wrap_mapping(h, map_bytes) : NULL;
+   if(m == NULL)
+      munmap(p, map_bytes);
+
+   return m;
+}
+
+/*
+ * Remove the segment name; mapped matrices stay valid until freed.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int unlink_shared_square_matrix(const char* name)
+{
+   if(name == NULL)
+      return -1;
+
+   return shm_unlink(name) == 0 ? 0 : -1;
+}
+
+/*
+ * Return 1 if m is still backed by a shared-memory segment, 0 if not.
+ */
+int is_shared_square_matrix(square_matrix* m)
+{
+   return header_of(m) != NULL;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Sequence lock                   //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * Make seq odd, waiting while another writer holds it odd.
+ * Return 0 on success, -1 if m is not a shared matrix.
+ */
+int shared_matrix_write_begin(square_matrix* m)
+{
+   shared_matrix_header* h = header_of(m);
+   if(h == NULL)
+      return -1;
+
+   uint64_t seq = atomic_load_explicit(&h->seq, memory_order_relaxed);
+   for(;;) {
+      if(seq % 2 == 0 &&
+         atomic_compare_exchange_weak_explicit(&h->seq, &seq, seq + 1,
+                                               memory_order_acquire, memory_order_relaxed))
+         break;
+      if(seq % 2)
+         sched_yield();
+      seq = atomic_load_explicit(&h->seq, memory_order_relaxed);
+   }
+
+   // no element store may move above the odd value
+   atomic_thread_fence(memory_order_release);
+
+   return 0;
+}
+
+/*
+ * Publish the changes by making seq even again.
+ * Return 0 on success, -1 if m is not a shared matrix.
+ */
+int shared_matrix_write_end(square_matrix* m)
+{
+   shared_matrix_header* h = header_of(m);
+   if(h == NULL)
+      return -1;
+
+   atomic_fetch_add_explicit(&h->seq, 1, memory_order_release);
+
+   return 0;
+}
+
+/*
+ * Wait until no write is in progress and return the sequence number to
+ * pass to shared_matrix_read_retry(), or 0 if m is not a shared matrix.
+ */
+uint64_t shared_matrix_read_begin(square_matrix* m)
+{
+   shared_matrix_header* h = header_of(m);
+   if(h == NULL)
+      return 0;
+
+   uint64_t seq;
+   while((seq = atomic_load_explicit(&h->seq, memory_order_acquire)) % 2)
+      sched_yield();
+
+   return seq;
+}
+
+/*
+ * Return non-zero if a write started since shared_matrix_read_begin()
+ * returned seq, so what was read may be torn, and 0 if it is consistent.
+ */
+int shared_matrix_read_retry(square_matrix* m, uint64_t seq)
+{
+   shared_matrix_header* h = header_of(m);
+   if(h == NULL)
+      return 1;
+
+   // no element load may move below the second look at seq
+   atomic_thread_fence(memory_order_acquire);
+
+   return atomic_load_explicit(&h->seq, memory_order_relaxed) != seq;
+}
+
+/*
+ * Return the number of writes completed on m, 0 for other matrices.
+ */
+uint64_t shared_matrix_version(square_matrix* m)
+{
+   shared_matrix_header* h = header_of(m);
+
+   return h ? atomic_load_explicit(&h->seq, memory_order_acquire) / 2 : 0;
+}
+
+/*
+ * Copy src into the shared matrix as one write.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int publish_shared_square_matrix(square_matrix* shared, square_matrix* src)
+{
+   if(src == NULL || shared == NULL || src->order != shared->order || header_of(shared) == NULL ||
+      make_square_matrix_writable(shared) != 0)
+      return -1;
+
+   size_t n = src->order;
+   shared_matrix_write_begin(shared);
+   memcpy(shared->data[0], src->data[0], n * n * sizeof(matrix_element));
+   shared_matrix_write_end(shared);
+
+   return 0;
+}
+
+/*
+ * Copy a consistent version of the shared matrix into dst, retrying
+ * while writes overlap the copy.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int snapshot_shared_square_matrix(square_matrix* shared, square_matrix* dst)
+{
+   if(dst == NULL || shared == NULL || dst->order != shared->order || header_of(shared) == NULL ||
+      dst == shared || make_square_matrix_writable(dst) != 0)
+      return -1;
+
+   size_t n = dst->order;
+   uint64_t seq;
+   do {
+      seq = shared_matrix_read_begin(shared);
+      memcpy(dst->data[0], shared->data[0], n * n * sizeof(matrix_element));
+   } while(shared_matrix_read_retry(shared, seq));
+
+   return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef __shared_matrix_h__
+#define __shared_matrix_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "square_matrix3.h"
+
+#define SHARED_MATRIX_MAGIC      0x584d5153u   // "SQMX"
+#define SHARED_MATRIX_DTYPE_INT  1             // matrix_element is int
+
+// A shared matrix lives in a named POSIX shared-memory segment: this
+// header in the first page, then the order*order elements row by row.
+// seq is a sequence lock: odd while a writer is changing the elements,
+// advanced by two for every completed write.
+typedef struct {
+    uint32_t magic;
+    uint32_t dtype;
+    uint32_t element_size;
+    uint32_t reserved;
+    uint64_t order;
+    atomic_uint_least64_t seq;
+} shared_matrix_header;
+
+// The returned matrices are ordinary square matrices whose storage is
+// the mapping; free_square_matrix() unmaps it. Duplicates are private
+// copies, so writes to a shared matrix always reach the segment and
+// never show through a duplicate. The segment itself remains until it
+// is unlinked.
+square_matrix* create_shared_square_matrix(const char* name, size_t order);
+square_matrix* attach_shared_square_matrix(const char* name);
+int unlink_shared_square_matrix(const char* name);
+int is_shared_square_matrix(square_matrix* m);
+
+// Writers bracket changes with write_begin/write_end; write_begin
+// waits for any other writer. Readers take seq = read_begin(), read,
+// and start over while read_retry(seq) says a write overlapped.
+int shared_matrix_write_begin(square_matrix* m);
+int shared_matrix_write_end(square_matrix* m);
+uint64_t shared_matrix_read_begin(square_matrix* m);
+int shared_matrix_read_retry(square_matrix* m, uint64_t seq);
+uint64_t shared_matrix_version(square_matrix* m);
+
+// copy a whole matrix in or out under the sequence lock
+int publish_shared_square_matrix(square_matrix* shared, square_matrix* src);
+int snapshot_shared_square_matrix(square_matrix* shared, square_matrix* dst);
+
+#endif
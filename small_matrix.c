@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "small_matrix.h"
+
+// Number of matrices processed side by side. Element (i,j) of LANES
+// consecutive matrices is stored contiguously in the interleaved
+// buffers, so the innermost loop of every kernel runs across the batch
+// and vectorizes without depending on the matrix order.
+#define LANES 8
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
+/*
+ * Allocate space for a batch of count matrices of the given order.
+ * Return NULL if the allocation is not successful.
+ */
+matrix_element* new_small_matrix_batch(size_t order, size_t count)
+{
+   size_t num_elems = count * order * order;
+   return malloc((num_elems ? num_elems : 1) * sizeof(matrix_element));
+}
+
+/*
+ * Deallocate a batch allocated by new_small_matrix_batch().
+ */
+void free_small_matrix_batch(matrix_element* batch)
+{
+   free(batch);
+}
+
+#define MODULUS 7
+/*
+ * Fill given batch with random values
+ */
+void fill_small_matrix_batch(matrix_element* batch, size_t order, size_t count)
+{
+   size_t num_elems = count * order * order;
+   for(size_t e = 0; e < num_elems; e++)
+      batch[e] = (matrix_element) rand() % MODULUS;
+}
+
+
+/////////////////////////////////////////////
+//                                         //
+// Fixed-order interleaved kernels         //
+//                                         //
+/////////////////////////////////////////////
+
+typedef void (*small_mul_kernel)(const matrix_element* restrict a,
+                                 const matrix_element* restrict b,
+                                 matrix_element* restrict c);
+
+/*
+ * Define the kernel multiplying LANES interleaved matrices of order N.
+ * Row i of each product is accumulated in N x LANES registers in IKJ
+ * order, so every loaded element of b feeds one multiply-add. With N a
+ * compile-time constant the K loop is unrolled completely and the J and
+ * lane loops become straight-line vector code.
+ */
+#define DEFINE_SMALL_MUL_KERNEL(N)                                                   \
+static void small_mul_##N(const matrix_element* restrict a,                         \
+                          const matrix_element* restrict b,                         \
+                          matrix_element* restrict c)                               \
+{                                                                                   \
+   for(size_t i = 0; i < N; i++) {                                                  \
+      matrix_element acc[N][LANES] = {{0}};                                         \
+      _Pragma("GCC unroll 16")                                                      \
+      for(size_t k = 0; k < N; k++)                                                 \
+         for(size_t j = 0; j < N; j++)                                              \
+            for(size_t l = 0; l < LANES; l++)                                       \
+               acc[j][l] += a[(i*N + k)*LANES + l] * b[(k*N + j)*LANES + l];        \
+      memcpy(&c[i*N*LANES], acc, sizeof(acc));                                      \
+   }                                                                                \
+}
+
+DEFINE_SMALL_MUL_KERNEL(1)
+DEFINE_SMALL_MUL_KERNEL(2)
+DEFINE_SMALL_MUL_KERNEL(3)
+DEFINE_SMALL_MUL_KERNEL(4)
+DEFINE_SMALL_MUL_KERNEL(5)
+DEFINE_SMALL_MUL_KERNEL(6)
+DEFINE_SMALL_MUL_KERNEL(7)
+DEFINE_SMALL_MUL_KERNEL(8)
+DEFINE_SMALL_MUL_KERNEL(9)
+DEFINE_SMALL_MUL_KERNEL(10)
+DEFINE_SMALL_MUL_KERNEL(11)
+DEFINE_SMALL_MUL_KERNEL(12)
+DEFINE_SMALL_MUL_KERNEL(13)
+DEFINE_SMALL_MUL_KERNEL(14)
+DEFINE_SMALL_MUL_KERNEL(15)
+DEFINE_SMALL_MUL_KERNEL(16)
+
+static const small_mul_kernel small_mul_kernels[SMALL_MATRIX_MAX_ORDER + 1] = {
+   NULL,
+   small_mul_1,  small_mul_2,  small_mul_3,  small_mul_4,
+   small_mul_5,  small_mul_6,  small_mul_7,  small_mul_8,
+   small_mul_9,  small_mul_10, small_mul_11, small_mul_12,
+   small_mul_13, small_mul_14, small_mul_15, small_mul_16
+};
+
+
+/*
+ * Copy up to LANES consecutive matrices of the batch into interleaved
+ * form, padding missing lanes with zeros.
+ */
+static void interleave(const matrix_element* restrict src, size_t num_elems, size_t lanes,
+                       matrix_element* restrict dst)
+{
+   if(lanes < LANES) {
+      memset(dst, 0, num_elems*LANES*sizeof(matrix_element));
+      for(size_t e = 0; e < num_elems; e++)
+         for(size_t l = 0; l < lanes; l++)
+            dst[e*LANES + l] = src[l*num_elems + e];
+      return;
+   }
+
+   // full group: transpose 8x8 blocks of (lane, element) through a small
+   // buffer so both the loads and the stores are contiguous
+   size_t e0 = 0;
+   for(; e0 + 8 <= num_elems; e0 += 8) {
+      matrix_element block[LANES][8];
+      for(size_t l = 0; l < LANES; l++)
+         memcpy(block[l], &src[l*num_elems + e0], sizeof(block[l]));
+      for(size_t e = 0; e < 8; e++)
+         for(size_t l = 0; l < LANES; l++)
+            dst[(e0 + e)*LANES + l] = block[l][e];
+   }
+   for(; e0 < num_elems; e0++)
+      for(size_t l = 0; l < LANES; l++)
+         dst[e0*LANES + l] = src[l*num_elems + e0];
+}
+
+static void deinterleave(const matrix_element* restrict src, size_t num_elems, size_t lanes,
+                         matrix_element* restrict dst)
+{
+   if(lanes < LANES) {
+      for(size_t e = 0; e < num_elems; e++)
+         for(size_t l = 0; l < lanes; l++)
+            dst[l*num_elems + e] = src[e*LANES + l];
+      return;
+   }
+
+   size_t e0 = 0;
+   for(; e0 + 8 <= num_elems; e0 += 8) {
+      matrix_element block[LANES][8];
+      for(size_t e = 0; e < 8; e++)
+         for(size_t l = 0; l < LANES; l++)
+            block[l][e] = src[(e0 + e)*LANES + l];
+      for(size_t l = 0; l < LANES; l++)
+         memcpy(&dst[l*num_elems + e0], block[l], sizeof(block[l]));
+   }
+   for(; e0 < num_elems; e0++)
+      for(size_t l = 0; l < LANES; l++)
+         dst[l*num_elems + e0] = src[e0*LANES + l];
+}
+
+
+/////////////////////////////////////////////
+//                                         //
+// Multi-threaded batched multiplication   //
+//                                         //
+/////////////////////////////////////////////
+
+typedef struct {
+   size_t first, last;     // matrices first..last-1 of the batch
+   size_t order;
+   const matrix_element *a, *b;
+   matrix_element* c;
+} thread_arg_t_small;
+
+
+static void * thread_small_mul(void * p_arg)
+{
+   thread_arg_t_small *p = p_arg;
+
+   size_t n = p->order;
+   size_t num_elems = n * n;
+
+   if(n > SMALL_MATRIX_MAX_ORDER) {
+      // no specialized kernel: IKJ order on each matrix in turn
+      for(size_t m = p->first; m < p->last; m++) {
+         const matrix_element* a = p->a + m*num_elems;
+         const matrix_element* b = p->b + m*num_elems;
+         matrix_element* c = p->c + m*num_elems;
+         memset(c, 0, num_elems*sizeof(matrix_element));
+         for(size_t i = 0; i < n; i++)
+            for(size_t k = 0; k < n; k++)
+               for(size_t j = 0; j < n; j++)
+                  c[i*n + j] += a[i*n + k] * b[k*n + j];
+      }
+      pthread_exit(NULL);
+   }
+
+   small_mul_kernel kernel = small_mul_kernels[n];
+   matrix_element ia[SMALL_MATRIX_MAX_ORDER*SMALL_MATRIX_MAX_ORDER*LANES];
+   matrix_element ib[SMALL_MATRIX_MAX_ORDER*SMALL_MATRIX_MAX_ORDER*LANES];
+   matrix_element ic[SMALL_MATRIX_MAX_ORDER*SMALL_MATRIX_MAX_ORDER*LANES];
+
+   for(size_t m = p->first; m < p->last; m += LANES) {
+      size_t lanes = MIN(LANES, p->last - m);
+      interleave(p->a + m*num_elems, num_elems, lanes, ia);
+      interleave(p->b + m*num_elems, num_elems, lanes, ib);
+      kernel(ia, ib, ic);
+      deinterleave(ic, num_elems, lanes, p->c + m*num_elems);
+   }
+
+   pthread_exit(NULL);
+}
+
+
+/*
+ * Compute the products a[m] * b[m] for every matrix m of two batches of
+ * count matrices of the given order. Return a pointer to the newly
+ * allocated batch of results or NULL if anything is wrong.
+ *
+ * The batch is split into contiguous ranges, one per thread, with range
+ * boundaries on multiples of LANES so that only the last range may use
+ * a partially filled group.
+ */
+matrix_element* mul_small_matrices_batch(size_t order, size_t count, matrix_element* a, matrix_element* b, size_t num_threads)
+{
+   if(a == NULL || b == NULL || num_threads == 0)
+      return NULL;
+
+   matrix_element* c = new_small_matrix_batch(order, count);
+   if(c == NULL)
+      return NULL;
+
+   // adjust number of threads for small batches; empty matrices need
+   // no work, and there is no kernel for order 0
+   size_t num_groups = (count + LANES - 1) / LANES;
+   num_threads = (num_groups < num_threads) ? num_groups : num_threads;
+   if(num_threads == 0 || order == 0)
+      return c;
+
+   pthread_t tid[num_threads];
+   thread_arg_t_small args[num_threads];
+
+   size_t first = 0;
+   for(size_t i = 0; i < num_threads; i ++) {
+      size_t last = (i == num_threads - 1) ? count : (num_groups * (i + 1) / num_threads) * LANES;
+      args[i] = (thread_arg_t_small){first, last, order, a, b, c};
+      int status = pthread_create(&tid[i], NULL, thread_small_mul, &args[i]);
+      assert(status == 0); // could have handled errors better
+      first = last;
+   }
+
+   // wait for threads to terminate
+   for(size_t i = 0; i < num_threads; i ++)
+      pthread_join(tid[i], NULL);
+
+   return c;
+}
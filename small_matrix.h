@@ -0,0 +1,20 @@
+#ifndef __small_matrix_h__
+#define __small_matrix_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+
+// Largest order with a specialized kernel; larger orders use a generic loop
+#define SMALL_MATRIX_MAX_ORDER 16
+
+// A batch of count small matrices of the same order is one contiguous
+// array of count*order*order elements: matrix b occupies elements
+// b*order*order .. (b+1)*order*order - 1, stored row by row.
+
+matrix_element* new_small_matrix_batch(size_t order, size_t count);
+void free_small_matrix_batch(matrix_element* batch);
+void fill_small_matrix_batch(matrix_element* batch, size_t order, size_t count);
+
+matrix_element* mul_small_matrices_batch(size_t order, size_t count, matrix_element* a, matrix_element* b, size_t num_threads);
+
+#endif
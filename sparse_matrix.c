@@ -0,0 +1,625 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "sparse_matrix.h"
+
+/*
+ * Allocate space for a sparse matrix of order n with room for nnz
+ * stored elements. The ptr array is zeroed; idx and val are left
+ * uninitialized. Return NULL if the allocation is not successful.
+ */
+sparse_matrix* new_sparse_matrix(size_t n, size_t nnz, sparse_format format)
+{
+   sparse_matrix* s = malloc(sizeof(sparse_matrix));
+   if(s == NULL)
+      return NULL;
+
+   s->ptr = calloc(n + 1, sizeof(size_t));
+   // always allocate at least one element so that an empty matrix is not confused with a failure
+   s->idx = malloc((nnz ? nnz : 1) * sizeof(size_t));
+   s->val = malloc((nnz ? nnz : 1) * sizeof(matrix_element));
+   if(s->ptr == NULL || s->idx == NULL || s->val == NULL) {
+      free_sparse_matrix(s);
+      return NULL;
+   }
+
+   s->order  = n;
+   s->nnz    = nnz;
+   s->format = format;
+
+   return s;
+}
+
+/*
+ * Deallocate the dynamic memory allocated for the given sparse matrix.
+ */
+void free_sparse_matrix(sparse_matrix* s)
+{
+   if(s == NULL)
+      return;
+
+   free(s->ptr);
+   free(s->idx);
+   free(s->val);
+   free(s);
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Conversions                     //
+//                                 //
+/////////////////////////////////////
+
+
+/*
+ * Build a sparse copy of a square matrix in the requested format.
+ * Return NULL if anything is wrong.
+ */
+sparse_matrix* square_to_sparse_matrix(square_matrix* m, sparse_format format)
+{
+   if(m == NULL)
+      return NULL;
+
+   size_t n = m->order;
+   matrix_element** data = m->data;
+
+   size_t nnz = 0;
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++)
+         nnz += (data[i][j] != 0);
+
+   sparse_matrix* s = new_sparse_matrix(n, nnz, format);
+   if(s == NULL)
+      return NULL;
+
+   size_t pos = 0;
+   if(format == SPARSE_CSR) {
+      for(size_t i = 0; i < n; i++) {
+         for(size_t j = 0; j < n; j++)
+            if(data[i][j] != 0) {
+               s->idx[pos] = j;
+               s->val[pos] = data[i][j];
+               pos++;
+            }
+         s->ptr[i+1] = pos;
+      }
+   }
+   else {
+      // count elements per column first so that rows are scanned in cache-friendly order
+      for(size_t i = 0; i < n; i++)
+         for(size_t j = 0; j < n; j++)
+            s->ptr[j+1] += (data[i][j] != 0);
+      for(size_t j = 0; j < n; j++)
+         s->ptr[j+1] += s->ptr[j];
+
+      size_t* next = malloc((n ? n : 1) * sizeof(size_t));
+      if(next == NULL) {
+         free_sparse_matrix(s);
+         return NULL;
+      }
+      memcpy(next, s->ptr, n * sizeof(size_t));
+
+      for(size_t i = 0; i < n; i++)
+         for(size_t j = 0; j < n; j++)
+            if(data[i][j] != 0) {
+               pos = next[j]++;
+               s->idx[pos] = i;
+               s->val[pos] = data[i][j];
+            }
+      free(next);
+   }
+
+   return s;
+}
+
+/*
+ * Expand a sparse matrix into a newly allocated square matrix.
+ * Return NULL if anything is wrong.
+ */
+square_matrix* sparse_to_square_matrix(sparse_matrix* s)
+{
+   if(s == NULL)
+      return NULL;
+
+   size_t n = s->order;
+
+   square_matrix* res = new_square_matrix(n);
+   if(res == NULL)
+      return NULL;
+
+   matrix_element** data = res->data;
+   memset(&data[0][0], 0, n*n*sizeof(matrix_element));
+
+   for(size_t r = 0; r < n; r++)
+      for(size_t p = s->ptr[r]; p < s->ptr[r+1]; p++) {
+         if(s->format == SPARSE_CSR)
+            data[r][s->idx[p]] = s->val[p];
+         else
+            data[s->idx[p]][r] = s->val[p];
+      }
+
+   return res;
+}
+
+/*
+ * Return a copy of the sparse matrix in the requested format.
+ * Switching between CSR and CSC is a counting sort over the stored
+ * elements and takes O(n + nnz) time.
+ */
+sparse_matrix* convert_sparse_matrix(sparse_matrix* s, sparse_format format)
+{
+   if(s == NULL)
+      return NULL;
+
+   size_t n = s->order;
+   size_t nnz = s->nnz;
+
+   sparse_matrix* res = new_sparse_matrix(n, nnz, format);
+   if(res == NULL)
+      return NULL;
+
+   if(s->format == format) {
+      memcpy(res->ptr, s->ptr, (n + 1) * sizeof(size_t));
+      memcpy(res->idx, s->idx, nnz * sizeof(size_t));
+      memcpy(res->val, s->val, nnz * sizeof(matrix_element));
+      return res;
+   }
+
+   for(size_t p = 0; p < nnz; p++)
+      res->ptr[s->idx[p] + 1]++;
+   for(size_t r = 0; r < n; r++)
+      res->ptr[r+1] += res->ptr[r];
+
+   size_t* next = malloc((n ? n : 1) * sizeof(size_t));
+   if(next == NULL) {
+      free_sparse_matrix(res);
+      return NULL;
+   }
+   memcpy(next, res->ptr, n * sizeof(size_t));
+
+   // scanning the source in order keeps the indices of the result sorted
+   for(size_t r = 0; r < n; r++)
+      for(size_t p = s->ptr[r]; p < s->ptr[r+1]; p++) {
+         size_t q = next[s->idx[p]]++;
+         res->idx[q] = r;
+         res->val[q] = s->val[p];
+      }
+
+   free(next);
+   return res;
+}
+
+/*
+ * Return the fraction of nonzero elements in the given matrix,
+ * or a negative value if anything is wrong.
+ */
+double square_matrix_density(square_matrix* m)
+{
+   if(m == NULL)
+      return -1.0;
+
+   size_t n = m->order;
+   if(n == 0)
+      return 0.0;
+
+   matrix_element** data = m->data;
+   size_t nnz = 0;
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++)
+         nnz += (data[i][j] != 0);
+
+   return (double) nnz / ((double) n * n);
+}
+
+
+/////////////////////////////////////////
+//                                     //
+// Multi-threaded sparse x dense       //
+//                                     //
+/////////////////////////////////////////
+
+typedef struct {
+   size_t first_row, last_row;
+   sparse_matrix* s;
+   square_matrix *m, *res;
+} thread_arg_t_spmm;
+
+
+/*
+ * Find the first row of a CSR matrix whose elements start at or
+ * after the given position. Used to split rows so that each thread
+ * gets about the same number of nonzeros rather than the same number
+ * of rows.
+ */
+static size_t row_for_nnz(sparse_matrix* s, size_t pos)
+{
+   size_t lo = 0, hi = s->order;
+   while(lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if(s->ptr[mid] < pos)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return lo;
+}
+
+
+static void * thread_spmm(void * p_arg)
+{
+   thread_arg_t_spmm *p = p_arg;
+
+   sparse_matrix* s = p->s;
+   size_t n = s->order;
+   matrix_element** data2 = p->m->data;
+   matrix_element** data  = p->res->data;
+
+   // row i of the product is a combination of the rows of m
+   // selected by the nonzeros in row i of s
+   for(size_t i = p->first_row; i < p->last_row; i++) {
+      matrix_element* restrict row = data[i];
+      memset(row, 0, n*sizeof(matrix_element));
+
+      for(size_t q = s->ptr[i]; q < s->ptr[i+1]; q++) {
+         matrix_element v = s->val[q];
+         const matrix_element* restrict src = data2[s->idx[q]];
+         for(size_t j = 0; j < n; j++)
+            row[j] += v * src[j];
+      }
+   }
+
+   pthread_exit(NULL);
+}
+
+
+/*
+ * Compute the product of a sparse and a dense matrix. Return a pointer
+ * to the newly allocated dense result or NULL if anything is wrong.
+ *
+ * Rows are split into contiguous ranges holding about the same number
+ * of nonzeros each.
+ */
+square_matrix* mul_sparse_dense_matrices_threads(sparse_matrix* s, square_matrix* m, size_t num_threads)
+{
+   if(s == NULL || m == NULL || s->order != m->order || num_threads == 0)
+      return NULL;
+
+   // scattering columns of a CSC matrix would make threads race on the result
+   sparse_matrix* csr = (s->format == SPARSE_CSR) ? s : convert_sparse_matrix(s, SPARSE_CSR);
+   if(csr == NULL)
+      return NULL;
+
+   size_t n = s->order;
+
+   square_matrix* res = new_square_matrix(n);
+   if(res == NULL) {
+      if(csr != s) free_sparse_matrix(csr);
+      return NULL;
+   }
+
+   // adjust number of threads for small matrices
+   num_threads = (n < num_threads) ? n : num_threads;
+   pthread_t tid[num_threads];
+   thread_arg_t_spmm args[num_threads];
+
+   size_t first_row = 0;
+   for(size_t i = 0; i < num_threads; i ++) {
+      size_t last_row = (i == num_threads - 1) ? n : row_for_nnz(csr, csr->nnz * (i + 1) / num_threads);
+      if(last_row < first_row) last_row = first_row;
+      args[i] = (thread_arg_t_spmm){first_row, last_row, csr, m, res};
+      int status = pthread_create(&tid[i], NULL, thread_spmm, &args[i]);
+      assert(status == 0); // could have handled errors better
+      first_row = last_row;
+   }
+
+   // wait for threads to terminate
+   for(size_t i = 0; i < num_threads; i ++)
+      pthread_join(tid[i], NULL);
+
+   if(csr != s)
+      free_sparse_matrix(csr);
+
+   return res;
+}
+
+
+/////////////////////////////////////////
+//                                     //
+// Multi-threaded dense x sparse       //
+//                                     //
+/////////////////////////////////////////
+
+typedef struct {
+   size_t id, num_threads;
+   square_matrix *m, *res;
+   sparse_matrix* s;
+} thread_arg_t_dsmm;
+
+
+static void * thread_dsmm(void * p_arg)
+{
+   thread_arg_t_dsmm *p = p_arg;
+
+   size_t id = p->id;
+   size_t num_threads = p->num_threads;
+   sparse_matrix* s = p->s;
+   size_t n = s->order;
+   matrix_element** data1 = p->m->data;
+   matrix_element** data  = p->res->data;
+
+   // thread id will do rows:
+   // id, id + num_threads, id + 2*num_threads, ...
+   for(size_t i = id; i < n; i += num_threads) {
+      matrix_element* restrict row = data[i];
+      memset(row, 0, n*sizeof(matrix_element));
+
+      // IKJ order where the J loop only visits the nonzeros of row k of s
+      for(size_t k = 0; k < n; k++) {
+         matrix_element a = data1[i][k];
+         if(a == 0)
+            continue;
+         for(size_t q = s->ptr[k]; q < s->ptr[k+1]; q++)
+            row[s->idx[q]] += a * s->val[q];
+      }
+   }
+
+   pthread_exit(NULL);
+}
+
+
+/*
+ * Compute the product of a dense and a sparse matrix. Return a pointer
+ * to the newly allocated dense result or NULL if anything is wrong.
+ */
+square_matrix* mul_dense_sparse_matrices_threads(square_matrix* m, sparse_matrix* s, size_t num_threads)
+{
+   if(s == NULL || m == NULL || s->order != m->order || num_threads == 0)
+      return NULL;
+
+   sparse_matrix* csr = (s->format == SPARSE_CSR) ? s : convert_sparse_matrix(s, SPARSE_CSR);
+   if(csr == NULL)
+      return NULL;
+
+   size_t n = s->order;
+
+   square_matrix* res = new_square_matrix(n);
+   if(res == NULL) {
+      if(csr != s) free_sparse_matrix(csr);
+      return NULL;
+   }
+
+   // adjust number of threads for small matrices
+   num_threads = (n < num_threads) ? n : num_threads;
+   pthread_t tid[num_threads];
+   thread_arg_t_dsmm args[num_threads];
+
+   // prepare args and create threads
+   for(size_t i = 0; i < num_threads; i ++) {
+      args[i] = (thread_arg_t_dsmm){i, num_threads, m, res, csr};
+      int status = pthread_create(&tid[i], NULL, thread_dsmm, &args[i]);
+      assert(status == 0); // could have handled errors better
+   }
+
+   // wait for threads to terminate
+   for(size_t i = 0; i < num_threads; i ++)
+      pthread_join(tid[i], NULL);
+
+   if(csr != s)
+      free_sparse_matrix(csr);
+
+   return res;
+}
+
+
+/////////////////////////////////////////
+//                                     //
+// Multi-threaded sparse x sparse      //
+//                                     //
+/////////////////////////////////////////
+
+typedef struct {
+   size_t id, num_threads;
+   sparse_matrix *s1, *s2, *res;
+   size_t* row_nnz;        // nonzeros per result row, filled in by the counting pass
+   int numeric;            // 0 for the counting pass, 1 for the filling pass
+} thread_arg_t_spgemm;
+
+
+static int compare_index(const void* a, const void* b)
+{
+   size_t x = *(const size_t*) a, y = *(const size_t*) b;
+   return (x > y) - (x < y);
+}
+
+
+/*
+ * Gustavson's row-by-row algorithm. Each thread keeps a dense
+ * accumulator for one result row and a list of the columns touched.
+ * The same routine is run twice: once to count the nonzeros of every
+ * result row and once to store them, so no per-row temporaries have
+ * to be kept between the passes.
+ */
+static void * thread_spgemm(void * p_arg)
+{
+   thread_arg_t_spgemm *p = p_arg;
+
+   size_t id = p->id;
+   size_t num_threads = p->num_threads;
+   sparse_matrix* s1 = p->s1;
+   sparse_matrix* s2 = p->s2;
+   size_t n = s1->order;
+
+   matrix_element* acc = calloc(n ? n : 1, sizeof(matrix_element));
+   unsigned char* used = calloc(n ? n : 1, 1);
+   size_t* cols = malloc((n ? n : 1) * sizeof(size_t));
+   assert(acc != NULL && used != NULL && cols != NULL); // could have handled errors better
+
+   // thread id will do rows:
+   // id, id + num_threads, id + 2*num_threads, ...
+   for(size_t i = id; i < n; i += num_threads) {
+      size_t count = 0;
+
+      for(size_t q1 = s1->ptr[i]; q1 < s1->ptr[i+1]; q1++) {
+         size_t k = s1->idx[q1];
+         matrix_element a = s1->val[q1];
+         for(size_t q2 = s2->ptr[k]; q2 < s2->ptr[k+1]; q2++) {
+            size_t j = s2->idx[q2];
+            if(!used[j]) {
+               used[j] = 1;
+               cols[count++] = j;
+            }
+            acc[j] += a * s2->val[q2];
+         }
+      }
+
+      if(p->numeric)
+         qsort(cols, count, sizeof(size_t), compare_index);
+
+      // emit the row, dropping elements that cancelled out, and reset the accumulator
+      size_t pos = p->numeric ? p->res->ptr[i] : 0;
+      size_t kept = 0;
+      for(size_t c = 0; c < count; c++) {
+         size_t j = cols[c];
+         if(acc[j] != 0) {
+            if(p->numeric) {
+               p->res->idx[pos + kept] = j;
+               p->res->val[pos + kept] = acc[j];
+            }
+            kept++;
+         }
+         acc[j] = 0;
+         used[j] = 0;
+      }
+
+      if(!p->numeric)
+         p->row_nnz[i] = kept;
+   }
+
+   free(acc);
+   free(used);
+   free(cols);
+
+   pthread_exit(NULL);
+}
+
+
+static void run_spgemm_pass(thread_arg_t_spgemm* proto, size_t num_threads)
+{
+   pthread_t tid[num_threads];
+   thread_arg_t_spgemm args[num_threads];
+
+   for(size_t i = 0; i < num_threads; i ++) {
+      args[i] = *proto;
+      args[i].id = i;
+      args[i].num_threads = num_threads;
+      int status = pthread_create(&tid[i], NULL, thread_spgemm, &args[i]);
+      assert(status == 0); // could have handled errors better
+   }
+
+   for(size_t i = 0; i < num_threads; i ++)
+      pthread_join(tid[i], NULL);
+}
+
+
+/*
+ * Compute the product of two sparse matrices. Return a pointer to the
+ * newly allocated CSR result or NULL if anything is wrong.
+ */
+sparse_matrix* mul_sparse_matrices_threads(sparse_matrix* s1, sparse_matrix* s2, size_t num_threads)
+{
+   if(s1 == NULL || s2 == NULL || s1->order != s2->order || num_threads == 0)
+      return NULL;
+
+   size_t n = s1->order;
+
+   sparse_matrix* a = (s1->format == SPARSE_CSR) ? s1 : convert_sparse_matrix(s1, SPARSE_CSR);
+   sparse_matrix* b = (s2->format == SPARSE_CSR) ? s2 : convert_sparse_matrix(s2, SPARSE_CSR);
+   size_t* row_nnz = malloc((n ? n : 1) * sizeof(size_t));
+   sparse_matrix* res = NULL;
+
+   if(a == NULL || b == NULL || row_nnz == NULL)
+      goto cleanup;
+
+   // adjust number of threads for small matrices
+   num_threads = (n < num_threads) ? n : num_threads;
+   if(num_threads == 0)
+      num_threads = 1;
+
+   thread_arg_t_spgemm proto = {0, num_threads, a, b, NULL, row_nnz, 0};
+   run_spgemm_pass(&proto, num_threads);
+
+   size_t nnz = 0;
+   for(size_t i = 0; i < n; i++)
+      nnz += row_nnz[i];
+
+   res = new_sparse_matrix(n, nnz, SPARSE_CSR);
+   if(res == NULL)
+      goto cleanup;
+
+   for(size_t i = 0; i < n; i++)
+      res->ptr[i+1] = res->ptr[i] + row_nnz[i];
+
+   proto.res = res;
+   proto.numeric = 1;
+   run_spgemm_pass(&proto, num_threads);
+
+cleanup:
+   if(a != NULL && a != s1) free_sparse_matrix(a);
+   if(b != NULL && b != s2) free_sparse_matrix(b);
+   free(row_nnz);
+
+   return res;
+}
+
+
+/////////////////////////////////////////
+//                                     //
+// Density-based algorithm selection   //
+//                                     //
+/////////////////////////////////////////
+
+
+/*
+ * Compute the product of two square matrices, choosing the sparse or
+ * dense kernels based on the density of each operand. Return a pointer
+ * to the newly allocated result matrix or NULL if anything is wrong.
+ */
+square_matrix* mul_square_matrices_auto(square_matrix* m1, square_matrix* m2, size_t num_threads)
+{
+   if(m1 == NULL || m2 == NULL || m1->order != m2->order || num_threads == 0)
+      return NULL;
+
+   int sparse1 = square_matrix_density(m1) < SPARSE_DENSITY_THRESHOLD;
+   int sparse2 = square_matrix_density(m2) < SPARSE_DENSITY_THRESHOLD;
+
+   if(!sparse1 && !sparse2)
+      return mul_square_matrices_threads(m1, m2, num_threads);
+
+   sparse_matrix* s1 = sparse1 ? square_to_sparse_matrix(m1, SPARSE_CSR) : NULL;
+   sparse_matrix* s2 = sparse2 ? square_to_sparse_matrix(m2, SPARSE_CSR) : NULL;
+   square_matrix* res = NULL;
+
+   if(sparse1 && sparse2) {
+      if(s1 != NULL && s2 != NULL) {
+         sparse_matrix* prod = mul_sparse_matrices_threads(s1, s2, num_threads);
+         res = sparse_to_square_matrix(prod);
+         free_sparse_matrix(prod);
+      }
+   }
+   else if(sparse1) {
+      if(s1 != NULL)
+         res = mul_sparse_dense_matrices_threads(s1, m2, num_threads);
+   }
+   else {
+      if(s2 != NULL)
+         res = mul_dense_sparse_matrices_threads(m1, s2, num_threads);
+   }
+
+   free_sparse_matrix(s1);
+   free_sparse_matrix(s2);
+
+   return res;
+}
@@ -0,0 +1,40 @@
+#ifndef __sparse_matrix_h__
+#define __sparse_matrix_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+
+// Matrices with a smaller fraction of nonzero elements than this are
+// multiplied using the sparse kernels by mul_square_matrices_auto()
+#define SPARSE_DENSITY_THRESHOLD 0.10
+
+typedef enum {
+    SPARSE_CSR,     // compressed sparse rows
+    SPARSE_CSC      // compressed sparse columns
+} sparse_format;
+
+typedef struct {
+    size_t order;
+    size_t nnz;
+    sparse_format format;
+    size_t* ptr;            // order+1 offsets into idx and val, one per row (CSR) or column (CSC)
+    size_t* idx;            // column (CSR) or row (CSC) of each stored element
+    matrix_element* val;    // stored nonzero elements
+} sparse_matrix;
+
+sparse_matrix* new_sparse_matrix(size_t order, size_t nnz, sparse_format format);
+void free_sparse_matrix(sparse_matrix* s);
+
+sparse_matrix* square_to_sparse_matrix(square_matrix* m, sparse_format format);
+square_matrix* sparse_to_square_matrix(sparse_matrix* s);
+sparse_matrix* convert_sparse_matrix(sparse_matrix* s, sparse_format format);
+
+double square_matrix_density(square_matrix* m);
+
+square_matrix* mul_sparse_dense_matrices_threads(sparse_matrix* s, square_matrix* m, size_t num_threads);
+square_matrix* mul_dense_sparse_matrices_threads(square_matrix* m, sparse_matrix* s, size_t num_threads);
+sparse_matrix* mul_sparse_matrices_threads(sparse_matrix* s1, sparse_matrix* s2, size_t num_threads);
+
+square_matrix* mul_square_matrices_auto(square_matrix* m1, square_matrix* m2, size_t num_threads);
+
+#endif
@@ -4,6 +4,9 @@
 #include <pthread.h>
 #include <assert.h>
 #include "square_matrix3.h"
+#include "matrix_pool.h"
+#include "matrix_trace.h"
+#include "chunk_sched.h"
 
 #define BAND_SIZE 256
 
@@ -17,12 +20,17 @@
  */
 square_matrix* new_square_matrix(size_t n)
 {
+   // reuse a freed matrix of the same order if the pool has one
+   square_matrix* pooled = matrix_pool_take(n);
+   if(pooled)
+      return pooled;
+
    // allocate matrix struct
    square_matrix* new_m = malloc(sizeof(square_matrix));
    if(new_m == NULL)
       return NULL;
 
-   matrix_element** data = malloc(n * sizeof(matrix_element*)); // array of row pointers
+   matrix_element** data = malloc((n ? n : 1) * sizeof(matrix_element*)); // array of row pointers
    if(data == NULL) {
       free(new_m);
       return NULL;
@@ -39,13 +47,32 @@ square_matrix* new_square_matrix(size_t n)
    // set row array pointers
    for(size_t i = 0; i < n; i++)
        data[i] = storage + i * n;
+   data[0] = storage;   // also for order 0, so that data[0] is always the elements
 
    new_m->order = n;
    new_m->data  = data;
+   atomic_init(&new_m->storage, NULL);
 
    return new_m;
 }
 
+/*
+ * Drop one reference to shared storage, releasing it with the last one
+ */
+static void release_storage(matrix_storage* s)
+{
+   if(atomic_fetch_sub(&s->refs, 1) != 1)
+      return;
+
+   if(s->release)
+      s->release(s);
+   else {
+      free(s->rows[0]);
+      free(s->rows);
+      free(s);
+   }
+}
+
 /*
  * Deallocate the dynamic memory allocated for the given matrix.
  */
@@ -54,6 +81,16 @@ void free_square_matrix(square_matrix* m)
    if(m == NULL)
         return;
 
+   if(m->storage) {
+      release_storage(m->storage);
+      free(m);
+      return;
+   }
+
+   // keep it for the next new_square_matrix() of the same order
+   if(matrix_pool_give(m))
+      return;
+
    if(m->data) {
       free(m->data[0]);  // free the storage allocated for data
       free(m->data);     // free array of row pointers
@@ -74,12 +111,101 @@ square_matrix* duplicate_square_matrix(square_matrix* m)
    if(copy == NULL)
       return NULL;
 
-   // copy all elements with one memset since rows are contiguously allocated
+   // copy all elements with one memcpy since rows are contiguously allocated
    memcpy(copy->data[0], m->data[0], m->order * m->order * sizeof(matrix_element) );
 
    return copy;
 }
 
+/*
+ * Make a copy of a given square matrix that shares the storage of m, so
+ * sharing takes O(1) time and no memory for elements. Both matrices
+ * read the same elements until make_square_matrix_writable() gives one
+ * of them a private copy. Several threads may share the same matrix at
+ * once. Storage with a release function, such as shared memory, is
+ * pinned to its matrix and never shared: the copy gets its own elements
+ * at once. Return NULL if anything is wrong.
+ */
+square_matrix* share_square_matrix(square_matrix* m)
+{
+   if(m == NULL)
+      return NULL;
+
+   matrix_storage* s = atomic_load(&m->storage);
+   if(s && s->release)
+      return duplicate_square_matrix(m);
+
+   square_matrix* copy = malloc(sizeof(square_matrix));
+   if(copy == NULL)
+      return NULL;
+
+   if(s == NULL) {
+      // first share: m hands its buffers over to shared storage, unless
+      // another thread sharing m at the same time gets there first
+      matrix_storage* fresh = malloc(sizeof(matrix_storage));
+      if(fresh == NULL) {
+         free(copy);
+         return NULL;
+      }
+      atomic_init(&fresh->refs, 1);
+      fresh->rows = m->data;
+      fresh->release = NULL;
+      if(atomic_compare_exchange_strong(&m->storage, &s, fresh))
+         s = fresh;
+      else
+         free(fresh);
+   }
+
+   atomic_fetch_add(&s->refs, 1);
+   copy->order = m->order;
+   copy->data = m->data;
+   atomic_init(&copy->storage, s);
+
+   return copy;
+}
+
+/*
+ * Give m storage of its own before its elements are changed in place,
+ * copying the elements if other matrices still share them. Every
+ * function that writes to an existing matrix calls this first, and so
+ * must callers writing to data directly.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int make_square_matrix_writable(square_matrix* m)
+{
+   if(m == NULL)
+      return -1;
+
+   matrix_storage* s = m->storage;
+   if(s == NULL)
+      return 0;
+
+   // pinned storage is never shared, so it is always written in place
+   if(s->release)
+      return 0;
+
+   // sole owner: write in place, taking the heap buffers back
+   if(atomic_load(&s->refs) == 1) {
+      free(s);
+      m->storage = NULL;
+      return 0;
+   }
+
+   square_matrix* tmp = new_square_matrix(m->order);
+   if(tmp == NULL)
+      return -1;
+
+   // copy all elements with one memcpy since rows are contiguously allocated
+   memcpy(tmp->data[0], m->data[0], m->order * m->order * sizeof(matrix_element) );
+
+   m->data = tmp->data;
+   m->storage = NULL;
+   free(tmp);
+   release_storage(s);
+
+   return 0;
+}
+
 #define MODULUS 7
 /*
  *  Fill given matrix with random values
@@ -94,6 +220,9 @@ void fill_square_matrix(square_matrix* m)
       first = 0;
    }
 
+   if(make_square_matrix_writable(m) != 0)
+      return;
+
    size_t n = m->order;
    matrix_element** data = m->data;
 
@@ -192,6 +321,7 @@ square_matrix* add_square_matrices(square_matrix* m1, square_matrix* m2)
 typedef struct {
    size_t id, num_threads;
    square_matrix *m1, *m2, *res;
+   chunk_sched *sched;          // rows, shared by all threads
 } thread_arg_t;
 
 
@@ -199,19 +329,20 @@ static void * thread_add(void * p_arg)
 {
    thread_arg_t *p = p_arg;
 
-   size_t id = p->id;
-   size_t num_threads = p->num_threads;
    size_t n = p->m1->order;
    matrix_element** data1 = p->m1->data;
    matrix_element** data2 = p->m2->data;
    matrix_element** data  = p->res->data;
 
-    // thread id will do rows:
-    // id, id + num_threads, id + 2*num_threads, ...
-
-    for(size_t i = id; i < n; i += num_threads)
-       for(size_t j = 0; j < n; j ++)
-          data[i][j] = data1[i][j] + data2[i][j];
+    // each thread claims chunks of rows first..last-1 until none are left
+    size_t first, last;
+    while(chunk_sched_next(p->sched, &first, &last)) {
+       MATRIX_TRACE_BEGIN(t0);
+       for(size_t i = first; i < last; i++)
+          for(size_t j = 0; j < n; j ++)
+             data[i][j] = data1[i][j] + data2[i][j];
+       MATRIX_TRACE_END("add_threads", t0, last - first);
+    }
 
     pthread_exit(NULL);
 }
@@ -239,10 +370,12 @@ square_matrix* add_square_matrices_threads(square_matrix *m1, square_matrix *m2,
    num_threads = (n < num_threads) ? n : num_threads;
    pthread_t tid[num_threads];
    thread_arg_t args[num_threads];
+   chunk_sched sched;
+   chunk_sched_init(&sched, n, num_threads, chunk_min_units(n, MIN_CHUNK_WORK), CHUNK_GUIDED);
 
    // prepare args and create threads
    for(size_t i = 0; i < num_threads; i ++) {
-      args[i] = (thread_arg_t){i, num_threads, m1, m2, res};
+      args[i] = (thread_arg_t){i, num_threads, m1, m2, res, &sched};
       int status = pthread_create(&tid[i], NULL, thread_add, &args[i]);
       assert(status == 0); // could have handled errors better
    }
@@ -302,25 +435,26 @@ static void * thread_mul(void * p_arg)
 {
    thread_arg_t *p = p_arg;
 
-   size_t id = p->id;
-   size_t num_threads = p->num_threads;
    size_t n = p->m1->order;
    matrix_element** data1 = p->m1->data;
    matrix_element** data2 = p->m2->data;
    matrix_element** data  = p->res->data;
 
-   // thread id will do rows:
-   // id, id + num_threads, id + 2*num_threads, ...
-
-   for(size_t i = id; i < n; i += num_threads) {
-      // zero out row i
-      memset( &(data[i][0]), 0, n*sizeof(matrix_element) );
-
-      // compute row i of product
-      // Use IKJ order for best cache performance
-      for(size_t k=0; k < n; k++)
-         for(size_t j=0; j < n; j++)
-            data[i][j] += data1[i][k] * data2[k][j];
+   // each thread claims chunks of rows first..last-1 until none are left
+   size_t first, last;
+   while(chunk_sched_next(p->sched, &first, &last)) {
+      MATRIX_TRACE_BEGIN(t0);
+      for(size_t i = first; i < last; i++) {
+         // zero out row i
+         memset( &(data[i][0]), 0, n*sizeof(matrix_element) );
+
+         // compute row i of product
+         // Use IKJ order for best cache performance
+         for(size_t k=0; k < n; k++)
+            for(size_t j=0; j < n; j++)
+               data[i][j] += data1[i][k] * data2[k][j];
+      }
+      MATRIX_TRACE_END("mul_threads", t0, last - first);
     }
 
     pthread_exit(NULL);
@@ -345,14 +479,42 @@ square_matrix* mul_square_matrices_threads(square_matrix *m1, square_matrix *m2,
    if(res == NULL)
       return NULL;
 
+   if(mul_square_matrices_into_threads(m1, m2, res, num_threads) != 0) {
+      free_square_matrix(res);
+      return NULL;
+   }
+
+   return res;
+}
+
+
+/*
+ * Compute the product of two square matrices into res, which must be
+ * a different matrix of the same order. Return 0 on success, -1 if
+ * anything is wrong.
+ *
+ * Lets callers that multiply repeatedly reuse their buffers.
+ */
+int mul_square_matrices_into_threads(square_matrix* m1, square_matrix* m2, square_matrix* res, size_t num_threads)
+{
+   if(m1 == NULL || m2 == NULL || res == NULL || m1->order != m2->order || m1->order != res->order ||
+      res == m1 || res == m2 || num_threads == 0 || make_square_matrix_writable(res) != 0)
+      return -1;
+
+   size_t n = m1->order;
+   if(n == 0)
+      return 0;
+
    // adjust number of threads for small matrices
    num_threads = (n < num_threads) ? n : num_threads;
    pthread_t tid[num_threads];
    thread_arg_t args[num_threads];
+   chunk_sched sched;
+   chunk_sched_init(&sched, n, num_threads, chunk_min_units(n * n, MIN_CHUNK_WORK), CHUNK_GUIDED);
 
    // prepare args and create threads
    for(size_t i = 0; i < num_threads; i ++) {
-      args[i] = (thread_arg_t){i, num_threads, m1, m2, res};
+      args[i] = (thread_arg_t){i, num_threads, m1, m2, res, &sched};
       int status = pthread_create(&tid[i], NULL, thread_mul, &args[i]);
       assert(status == 0); // could have handled errors better
    }
@@ -361,6 +523,82 @@ square_matrix* mul_square_matrices_threads(square_matrix *m1, square_matrix *m2,
    for(size_t i = 0; i < num_threads; i ++)
       pthread_join(tid[i], NULL);
 
+   return 0;
+}
+
+
+//////////////////////////////////
+//                              //
+// Matrix power                 //
+//                              //
+//////////////////////////////////
+
+/*
+ * Compute m to the power k by repeated squaring, with
+ * mul_square_matrices_into_threads() for every product. Return a
+ * pointer to the newly allocated result matrix or NULL if anything is
+ * wrong.
+ *
+ * Takes about 2*log2(k) products and only three matrices however large
+ * k is: the running result, the running square and one scratch buffer
+ * that products are written to before the roles are swapped. The first
+ * factor of the result is copied instead of multiplied by the identity.
+ */
+square_matrix* pow_square_matrix_threads(square_matrix* m, unsigned long k, size_t num_threads)
+{
+   if(m == NULL || num_threads == 0)
+      return NULL;
+
+   size_t n = m->order;
+
+   square_matrix* res = new_square_matrix(n);
+   if(res == NULL || n == 0)
+      return res;
+
+   if(k == 0) {
+      memset(&res->data[0][0], 0, n*n*sizeof(matrix_element));
+      for(size_t i = 0; i < n; i++)
+         res->data[i][i] = 1;
+      return res;
+   }
+
+   square_matrix* base = duplicate_square_matrix(m);
+   square_matrix* tmp  = new_square_matrix(n);
+   if(base == NULL || tmp == NULL) {
+      free_square_matrix(res);
+      free_square_matrix(base);
+      free_square_matrix(tmp);
+      return NULL;
+   }
+
+   int first = 1, r = 0;
+   while(k && r == 0) {
+      if(k & 1) {
+         if(first) {
+            // rows are contiguously allocated
+            memcpy(&res->data[0][0], &base->data[0][0], n*n*sizeof(matrix_element));
+            first = 0;
+         }
+         else {
+            r = mul_square_matrices_into_threads(res, base, tmp, num_threads);
+            SWAP_MATRICES(res, tmp);
+         }
+      }
+      k >>= 1;
+      if(k && r == 0) {
+         r = mul_square_matrices_into_threads(base, base, tmp, num_threads);
+         SWAP_MATRICES(base, tmp);
+      }
+   }
+
+   free_square_matrix(base);
+   free_square_matrix(tmp);
+
+   if(r != 0) {
+      free_square_matrix(res);
+      return NULL;
+   }
+
    return res;
 }
 
@@ -443,6 +681,7 @@ typedef struct {
    size_t id, num_threads;
    square_matrix* m;
    square_matrix* res;
+   chunk_sched* sched;          // bands of BAND_SIZE rows
 } thread_arg_t_mtran;
 
 
@@ -450,22 +689,26 @@ static void * thread_tran(void * p_arg)
 {
    thread_arg_t_mtran *p = p_arg;
 
-   size_t id = p->id;
-   size_t num_threads = p->num_threads;
    size_t n = p->m->order;
    matrix_element** data   = p->m->data;
    matrix_element** data2  = p->res->data;
 
-   // each thread works on bands of BAND_SIZE rows
-   for(size_t band_first_row = id*BAND_SIZE; band_first_row < n; band_first_row += num_threads*BAND_SIZE) {
-      size_t band_last_row = band_first_row + BAND_SIZE;
-      if(band_last_row > n) band_last_row = n;
-
-      // copy to the temporary matrix rows first..last-1
-      // for best cache performance, copy the band column-by-column
-      for(size_t j = 0; j < n; j++)
-         for(size_t i = band_first_row; i < band_last_row; i++)
-            data2[j][i] = data[i][j];
+   // each thread claims chunks of bands of BAND_SIZE rows
+   size_t first, last;
+   while(chunk_sched_next(p->sched, &first, &last)) {
+      MATRIX_TRACE_BEGIN(t0);
+      for(size_t band = first; band < last; band++) {
+         size_t band_first_row = band * BAND_SIZE;
+         size_t band_last_row = band_first_row + BAND_SIZE;
+         if(band_last_row > n) band_last_row = n;
+
+         // copy to the temporary matrix rows first..last-1
+         // for best cache performance, copy the band column-by-column
+         for(size_t j = 0; j < n; j++)
+            for(size_t i = band_first_row; i < band_last_row; i++)
+               data2[j][i] = data[i][j];
+      }
+      MATRIX_TRACE_END("transpose_threads", t0, last - first);
    }
 
    pthread_exit(NULL);
@@ -493,10 +736,12 @@ square_matrix* transpose_square_matrix_threads(square_matrix* m, size_t num_thre
    num_threads = (n < num_threads) ? n : num_threads;
    pthread_t tid[num_threads];
    thread_arg_t_mtran args[num_threads];
+   chunk_sched sched;
+   chunk_sched_init(&sched, (n + BAND_SIZE - 1) / BAND_SIZE, num_threads, 1, CHUNK_GUIDED);
 
    // prepare args and create threads
    for(size_t i = 0; i < num_threads; i ++) {
-      args[i] = (thread_arg_t_mtran){i, num_threads, m, res};
+      args[i] = (thread_arg_t_mtran){i, num_threads, m, res, &sched};
       int status = pthread_create(&tid[i], NULL, thread_tran, &args[i]);
       assert(status == 0); // could have handled errors better
    }
@@ -526,7 +771,7 @@ square_matrix* transpose_square_matrix_threads(square_matrix* m, size_t num_thre
  */
 void in_place_transpose_square_matrix_schooner(square_matrix* m)
 {
-   if(m == NULL)
+   if(make_square_matrix_writable(m) != 0)
       return;
 
    size_t n = m->order;
@@ -602,7 +847,7 @@ void swap_submatrices(
  */
 void in_place_transpose_square_matrix_tiled(square_matrix* m)
 {
-   if(m == NULL)
+   if(make_square_matrix_writable(m) != 0)
       return;
 
    size_t n = m->order;
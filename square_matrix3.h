@@ -1,18 +1,44 @@
 #ifndef __square_matrix3_h__
 #define __square_matrix3_h__
 
+#include <stddef.h>
+#include <stdatomic.h>
 
 typedef int matrix_element;
 
+// Element storage shared by read-only copies of a matrix made with
+// share_square_matrix(). rows[0] points to all order*order elements;
+// rows[i] to the start of row i. The storage is freed, or handed to
+// release() if that is set, with its last reference. Storage with
+// release() set is pinned: it is never shared, shares copy its
+// elements, and writes go to it in place.
+typedef struct matrix_storage {
+    atomic_size_t refs;
+    matrix_element** rows;
+    void (*release)(struct matrix_storage* s);
+} matrix_storage;
+
 typedef struct {
     size_t order;
     matrix_element** data;
+    _Atomic(matrix_storage*) storage;   // NULL until the matrix is first shared
 } square_matrix;
 
+// exchange two square_matrix* variables, as when a product written to a
+// scratch matrix takes the place of one of its factors
+#define SWAP_MATRICES(a,b) do { square_matrix* t_ = (a); (a) = (b); (b) = t_; } while(0)
+
 square_matrix* new_square_matrix(size_t order);
 void free_square_matrix(square_matrix* m);
 square_matrix* duplicate_square_matrix(square_matrix* m);
 
+// O(1) copy that reads the elements of m. Either matrix must be made
+// writable before anything writes to it, directly through data or
+// otherwise; the functions below that write to an existing matrix do
+// that themselves.
+square_matrix* share_square_matrix(square_matrix* m);
+int  make_square_matrix_writable(square_matrix* m);
+
 void fill_square_matrix(square_matrix* m);
 void print_square_matrix(square_matrix* m);
 int  compare_square_matrices(square_matrix* m1, square_matrix* m2);
@@ -22,6 +48,9 @@ square_matrix* mul_square_matrices(square_matrix* m1, square_matrix* m2);
 
 square_matrix* add_square_matrices_threads(square_matrix* m1, square_matrix* m2, size_t num_threads);
 square_matrix* mul_square_matrices_threads(square_matrix* m1, square_matrix* m2, size_t num_threads);
+int mul_square_matrices_into_threads(square_matrix* m1, square_matrix* m2, square_matrix* res, size_t num_threads);
+
+square_matrix* pow_square_matrix_threads(square_matrix* m, unsigned long k, size_t num_threads);
 
 square_matrix* transpose_square_matrix(square_matrix* m);
 square_matrix* transpose_square_matrix_banded(square_matrix* m);
@@ -0,0 +1,507 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "square_matrix_ws.h"
+
+#define ADD_GRAIN        16     // rows per leaf task of the addition
+#define MUL_LEAF         64     // largest block dimension multiplied without splitting
+#define TRANSPOSE_LEAF   32     // largest block dimension transposed without splitting
+#define STRASSEN_CUTOFF  128    // largest order multiplied with the classical algorithm
+
+#define SWAP(a,b) ((a)^=(b), (b)^=(a), (a)^=(b))
+
+
+/////////////////////////////////////
+//                                 //
+// Fork/join matrix addition       //
+//                                 //
+/////////////////////////////////////
+
+typedef struct {
+   square_matrix *m1, *m2, *res;
+} add_arg_t;
+
+static void add_rows(size_t first, size_t last, void* p_arg)
+{
+   add_arg_t* p = p_arg;
+   size_t n = p->m1->order;
+   matrix_element** data1 = p->m1->data;
+   matrix_element** data2 = p->m2->data;
+   matrix_element** data  = p->res->data;
+
+   for(size_t i = first; i < last; i++)
+      for(size_t j = 0; j < n; j++)
+         data[i][j] = data1[i][j] + data2[i][j];
+}
+
+static void add_root(void* p_arg)
+{
+   add_arg_t* p = p_arg;
+   ws_parallel_for(0, p->m1->order, ADD_GRAIN, add_rows, p);
+}
+
+/*
+ * Compute the sum of two square matrices on a work-stealing pool.
+ * Return a pointer to the newly allocated result matrix or NULL if
+ * anything is wrong
+ */
+square_matrix* add_square_matrices_ws(square_matrix* m1, square_matrix* m2, ws_pool* pool)
+{
+   if(m1 == NULL || m2 == NULL || m1->order != m2->order || pool == NULL)
+      return NULL;
+
+   square_matrix* res = new_square_matrix(m1->order);
+   if(res == NULL)
+      return NULL;
+
+   add_arg_t arg = {m1, m2, res};
+   ws_pool_run(pool, add_root, &arg);
+
+   return res;
+}
+
+
+/////////////////////////////////////////////
+//                                         //
+// Cache-oblivious matrix multiplication   //
+//                                         //
+/////////////////////////////////////////////
+
+typedef struct {
+   matrix_element **a, **b, **c;
+   size_t i0, i1, j0, j1, k0, k1;
+} mul_block_t;
+
+/*
+ * Add the product of rows i0..i1-1, columns k0..k1-1 of a and rows
+ * k0..k1-1, columns j0..j1-1 of b to the matching block of c. The
+ * largest of the three dimensions is halved until the block fits in
+ * cache; halves of I or J write disjoint parts of c and run in
+ * parallel, halves of K write the same part and run one after the other.
+ */
+static void mul_block_task(void* p_arg)
+{
+   mul_block_t* r = p_arg;
+   size_t di = r->i1 - r->i0, dj = r->j1 - r->j0, dk = r->k1 - r->k0;
+
+   if(di <= MUL_LEAF && dj <= MUL_LEAF && dk <= MUL_LEAF) {
+      // Use IKJ order for best cache performance
+      for(size_t i = r->i0; i < r->i1; i++)
+         for(size_t k = r->k0; k < r->k1; k++) {
+            matrix_element a = r->a[i][k];
+            matrix_element* restrict row = r->c[i];
+            const matrix_element* restrict src = r->b[k];
+            for(size_t j = r->j0; j < r->j1; j++)
+               row[j] += a * src[j];
+         }
+      return;
+   }
+
+   mul_block_t lo = *r, hi = *r;
+   if(dk > di && dk > dj) {
+      lo.k1 = hi.k0 = r->k0 + dk / 2;
+      mul_block_task(&lo);
+      mul_block_task(&hi);
+      return;
+   }
+
+   if(di >= dj)
+      lo.i1 = hi.i0 = r->i0 + di / 2;
+   else
+      lo.j1 = hi.j0 = r->j0 + dj / 2;
+
+   ws_task t;
+   ws_task_init(&t, mul_block_task, &hi);
+   ws_spawn(&t);
+   mul_block_task(&lo);
+   ws_join(&t);
+}
+
+/*
+ * Compute the product of two square matrices on a work-stealing pool
+ * with recursive divide and conquer. Return a pointer to the newly
+ * allocated result matrix or NULL if anything is wrong
+ */
+square_matrix* mul_square_matrices_ws(square_matrix* m1, square_matrix* m2, ws_pool* pool)
+{
+   if(m1 == NULL || m2 == NULL || m1->order != m2->order || pool == NULL)
+      return NULL;
+
+   size_t n = m1->order;
+
+   square_matrix* res = new_square_matrix(n);
+   if(res == NULL)
+      return NULL;
+
+   // zero out result matrix with one memset since rows are contiguously allocated
+   memset(&res->data[0][0], 0, n*n*sizeof(matrix_element));
+
+   mul_block_t root = {m1->data, m2->data, res->data, 0, n, 0, n, 0, n};
+   ws_pool_run(pool, mul_block_task, &root);
+
+   return res;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Strassen multiplication         //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * c = a * b for order-n blocks of row-major buffers with leading
+ * dimensions lda, ldb and ldc
+ */
+static void classical_mul(const matrix_element* a, size_t lda, const matrix_element* b, size_t ldb,
+                          matrix_element* c, size_t ldc, size_t n)
+{
+   for(size_t i = 0; i < n; i++) {
+      matrix_element* restrict row = c + i*ldc;
+      memset(row, 0, n*sizeof(matrix_element));
+      for(size_t k = 0; k < n; k++) {
+         matrix_element x = a[i*lda + k];
+         const matrix_element* restrict src = b + k*ldb;
+         for(size_t j = 0; j < n; j++)
+            row[j] += x * src[j];
+      }
+   }
+}
+
+/*
+ * dst = x + sign * y for order-n blocks; dst is contiguous
+ */
+static void combine_blocks(const matrix_element* x, const matrix_element* y, int sign, size_t ld,
+                           matrix_element* dst, size_t n)
+{
+   for(size_t i = 0; i < n; i++) {
+      const matrix_element* restrict xr = x + i*ld;
+      const matrix_element* restrict yr = y + i*ld;
+      matrix_element* restrict dr = dst + i*n;
+      if(sign > 0)
+         for(size_t j = 0; j < n; j++) dr[j] = xr[j] + yr[j];
+      else
+         for(size_t j = 0; j < n; j++) dr[j] = xr[j] - yr[j];
+   }
+}
+
+static void strassen(const matrix_element* a, size_t lda, const matrix_element* b, size_t ldb,
+                     matrix_element* c, size_t ldc, size_t n);
+
+// one of the seven half-size products: (a1 + sa*a2) * (b1 + sb*b2),
+// where a missing second operand (sa or sb zero) means just a1 or b1
+typedef struct {
+   const matrix_element *a1, *a2, *b1, *b2;
+   int sa, sb;
+   size_t lda, ldb, h;
+   matrix_element* out;
+} strassen_product_t;
+
+static void strassen_product_task(void* p_arg)
+{
+   strassen_product_t* p = p_arg;
+   size_t h = p->h;
+
+   const matrix_element* left = p->a1;
+   const matrix_element* right = p->b1;
+   size_t ldl = p->lda, ldr = p->ldb;
+   matrix_element *tmp_l = NULL, *tmp_r = NULL;
+
+   if(p->sa) {
+      tmp_l = malloc(h*h*sizeof(matrix_element));
+      assert(tmp_l != NULL); // could have handled errors better
+      combine_blocks(p->a1, p->a2, p->sa, p->lda, tmp_l, h);
+      left = tmp_l;
+      ldl = h;
+   }
+   if(p->sb) {
+      tmp_r = malloc(h*h*sizeof(matrix_element));
+      assert(tmp_r != NULL); // could have handled errors better
+      combine_blocks(p->b1, p->b2, p->sb, p->ldb, tmp_r, h);
+      right = tmp_r;
+      ldr = h;
+   }
+
+   strassen(left, ldl, right, ldr, p->out, h, h);
+
+   free(tmp_l);
+   free(tmp_r);
+}
+
+/*
+ * c = a * b with Strassen's seven-product recursion; n must be
+ * STRASSEN_CUTOFF or less, or an even number whose halves satisfy the
+ * same condition. The seven products run as parallel tasks.
+ */
+static void strassen(const matrix_element* a, size_t lda, const matrix_element* b, size_t ldb,
+                     matrix_element* c, size_t ldc, size_t n)
+{
+   if(n <= STRASSEN_CUTOFF) {
+      classical_mul(a, lda, b, ldb, c, ldc, n);
+      return;
+   }
+
+   size_t h = n / 2;
+   const matrix_element *a11 = a, *a12 = a + h, *a21 = a + h*lda, *a22 = a + h*lda + h;
+   const matrix_element *b11 = b, *b12 = b + h, *b21 = b + h*ldb, *b22 = b + h*ldb + h;
+
+   matrix_element* m = malloc(7*h*h*sizeof(matrix_element));
+   assert(m != NULL); // could have handled errors better
+
+   strassen_product_t prod[7] = {
+      {a11, a22,  b11, b22,  1,  1, lda, ldb, h, m + 0*h*h},   // M1 = (A11+A22)(B11+B22)
+      {a21, a22,  b11, NULL, 1,  0, lda, ldb, h, m + 1*h*h},   // M2 = (A21+A22) B11
+      {a11, NULL, b12, b22,  0, -1, lda, ldb, h, m + 2*h*h},   // M3 = A11 (B12-B22)
+      {a22, NULL, b21, b11,  0, -1, lda, ldb, h, m + 3*h*h},   // M4 = A22 (B21-B11)
+      {a11, a12,  b22, NULL, 1,  0, lda, ldb, h, m + 4*h*h},   // M5 = (A11+A12) B22
+      {a21, a11,  b11, b12, -1,  1, lda, ldb, h, m + 5*h*h},   // M6 = (A21-A11)(B11+B12)
+      {a12, a22,  b21, b22, -1,  1, lda, ldb, h, m + 6*h*h},   // M7 = (A12-A22)(B21+B22)
+   };
+
+   ws_task t[6];
+   for(size_t i = 0; i < 6; i++) {
+      ws_task_init(&t[i], strassen_product_task, &prod[i]);
+      ws_spawn(&t[i]);
+   }
+   strassen_product_task(&prod[6]);
+   for(size_t i = 6; i > 0; i--)
+      ws_join(&t[i-1]);
+
+   const matrix_element *m1 = m, *m2 = m + h*h, *m3 = m + 2*h*h, *m4 = m + 3*h*h,
+                        *m5 = m + 4*h*h, *m6 = m + 5*h*h, *m7 = m + 6*h*h;
+
+   for(size_t i = 0; i < h; i++)
+      for(size_t j = 0; j < h; j++) {
+         size_t e = i*h + j;
+         c[i*ldc + j]           = m1[e] + m4[e] - m5[e] + m7[e];   // C11
+         c[i*ldc + j + h]       = m3[e] + m5[e];                   // C12
+         c[(i+h)*ldc + j]       = m2[e] + m4[e];                   // C21
+         c[(i+h)*ldc + j + h]   = m1[e] - m2[e] + m3[e] + m6[e];   // C22
+      }
+
+   free(m);
+}
+
+typedef struct {
+   const matrix_element *a, *b;
+   matrix_element* c;
+   size_t n;
+} strassen_root_t;
+
+static void strassen_root(void* p_arg)
+{
+   strassen_root_t* r = p_arg;
+   strassen(r->a, r->n, r->b, r->n, r->c, r->n, r->n);
+}
+
+/*
+ * Copy a square matrix into the top-left corner of a zeroed m x m buffer
+ */
+static matrix_element* padded_copy(square_matrix* s, size_t m)
+{
+   size_t n = s->order;
+   matrix_element* buf = calloc(m*m, sizeof(matrix_element));
+   if(buf == NULL)
+      return NULL;
+
+   for(size_t i = 0; i < n; i++)
+      memcpy(buf + i*m, s->data[i], n*sizeof(matrix_element));
+
+   return buf;
+}
+
+/*
+ * Compute the product of two square matrices on a work-stealing pool
+ * with Strassen's algorithm. Return a pointer to the newly allocated
+ * result matrix or NULL if anything is wrong.
+ *
+ * Orders that do not halve evenly down to STRASSEN_CUTOFF are padded
+ * with zeros to the next order that does.
+ */
+square_matrix* mul_square_matrices_strassen_ws(square_matrix* m1, square_matrix* m2, ws_pool* pool)
+{
+   if(m1 == NULL || m2 == NULL || m1->order != m2->order || pool == NULL)
+      return NULL;
+
+   size_t n = m1->order;
+
+   square_matrix* res = new_square_matrix(n);
+   if(res == NULL)
+      return NULL;
+
+   // smallest m >= n of the form q * 2^levels with q <= STRASSEN_CUTOFF
+   size_t levels = 0;
+   while(((n + ((size_t)1 << levels) - 1) >> levels) > STRASSEN_CUTOFF)
+      levels++;
+   size_t m = ((n + ((size_t)1 << levels) - 1) >> levels) << levels;
+
+   if(m == n) {
+      // rows are contiguously allocated, so the matrices can be used in place
+      strassen_root_t root = {m1->data[0], m2->data[0], res->data[0], n};
+      ws_pool_run(pool, strassen_root, &root);
+      return res;
+   }
+
+   matrix_element* a = padded_copy(m1, m);
+   matrix_element* b = padded_copy(m2, m);
+   matrix_element* c = malloc(m*m*sizeof(matrix_element));
+   if(a == NULL || b == NULL || c == NULL) {
+      free(a);
+      free(b);
+      free(c);
+      free_square_matrix(res);
+      return NULL;
+   }
+
+   strassen_root_t root = {a, b, c, m};
+   ws_pool_run(pool, strassen_root, &root);
+
+   for(size_t i = 0; i < n; i++)
+      memcpy(res->data[i], c + i*m, n*sizeof(matrix_element));
+
+   free(a);
+   free(b);
+   free(c);
+
+   return res;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Cache-oblivious transpose       //
+//                                 //
+/////////////////////////////////////
+
+typedef struct {
+   matrix_element **src, **dst;
+   size_t i0, i1, j0, j1;
+} transpose_block_t;
+
+/*
+ * Copy the transpose of rows i0..i1-1, columns j0..j1-1 of src into
+ * dst, halving the longer side until the block fits in cache.
+ */
+static void transpose_block_task(void* p_arg)
+{
+   transpose_block_t* r = p_arg;
+   size_t di = r->i1 - r->i0, dj = r->j1 - r->j0;
+
+   if(di <= TRANSPOSE_LEAF && dj <= TRANSPOSE_LEAF) {
+      for(size_t i = r->i0; i < r->i1; i++)
+         for(size_t j = r->j0; j < r->j1; j++)
+            r->dst[j][i] = r->src[i][j];
+      return;
+   }
+
+   transpose_block_t lo = *r, hi = *r;
+   if(di >= dj)
+      lo.i1 = hi.i0 = r->i0 + di / 2;
+   else
+      lo.j1 = hi.j0 = r->j0 + dj / 2;
+
+   ws_task t;
+   ws_task_init(&t, transpose_block_task, &hi);
+   ws_spawn(&t);
+   transpose_block_task(&lo);
+   ws_join(&t);
+}
+
+/*
+ * Compute the transpose of a square matrix on a work-stealing pool.
+ * Return a pointer to the newly allocated result matrix or NULL if
+ * anything is wrong
+ */
+square_matrix* transpose_square_matrix_ws(square_matrix* m, ws_pool* pool)
+{
+   if(m == NULL || pool == NULL)
+      return NULL;
+
+   size_t n = m->order;
+
+   square_matrix* res = new_square_matrix(n);
+   if(res == NULL)
+      return NULL;
+
+   transpose_block_t root = {m->data, res->data, 0, n, 0, n};
+   ws_pool_run(pool, transpose_block_task, &root);
+
+   return res;
+}
+
+
+/*
+ * Swap the block in rows i0..i1-1, columns j0..j1-1 (entirely below
+ * the diagonal) with its mirror image above the diagonal.
+ */
+static void swap_block_task(void* p_arg)
+{
+   transpose_block_t* r = p_arg;
+   size_t di = r->i1 - r->i0, dj = r->j1 - r->j0;
+   matrix_element** data = r->src;
+
+   if(di <= TRANSPOSE_LEAF && dj <= TRANSPOSE_LEAF) {
+      for(size_t i = r->i0; i < r->i1; i++)
+         for(size_t j = r->j0; j < r->j1; j++)
+            SWAP(data[j][i], data[i][j]);
+      return;
+   }
+
+   transpose_block_t lo = *r, hi = *r;
+   if(di >= dj)
+      lo.i1 = hi.i0 = r->i0 + di / 2;
+   else
+      lo.j1 = hi.j0 = r->j0 + dj / 2;
+
+   ws_task t;
+   ws_task_init(&t, swap_block_task, &hi);
+   ws_spawn(&t);
+   swap_block_task(&lo);
+   ws_join(&t);
+}
+
+/*
+ * Transpose the diagonal block of rows and columns i0..i1-1 in place:
+ * transpose both diagonal halves and swap the off-diagonal quarter
+ * with its mirror, all three in parallel.
+ */
+static void transpose_diagonal_task(void* p_arg)
+{
+   transpose_block_t* r = p_arg;
+   size_t d = r->i1 - r->i0;
+   matrix_element** data = r->src;
+
+   if(d <= TRANSPOSE_LEAF) {
+      for(size_t i = r->i0; i < r->i1; i++)
+         for(size_t j = r->i0; j < i; j++)
+            SWAP(data[j][i], data[i][j]);
+      return;
+   }
+
+   size_t mid = r->i0 + d / 2;
+   transpose_block_t upper = {data, data, r->i0, mid, r->i0, mid};
+   transpose_block_t lower = {data, data, mid, r->i1, mid, r->i1};
+   transpose_block_t off   = {data, data, mid, r->i1, r->i0, mid};
+
+   ws_task t_upper, t_lower;
+   ws_task_init(&t_upper, transpose_diagonal_task, &upper);
+   ws_task_init(&t_lower, transpose_diagonal_task, &lower);
+   ws_spawn(&t_upper);
+   ws_spawn(&t_lower);
+   swap_block_task(&off);
+   ws_join(&t_lower);
+   ws_join(&t_upper);
+}
+
+/*
+ * Transpose a square matrix in place on a work-stealing pool.
+ */
+void in_place_transpose_square_matrix_ws(square_matrix* m, ws_pool* pool)
+{
+   if(m == NULL || pool == NULL || make_square_matrix_writable(m) != 0)
+      return;
+
+   transpose_block_t root = {m->data, m->data, 0, m->order, 0, m->order};
+   ws_pool_run(pool, transpose_diagonal_task, &root);
+}
@@ -0,0 +1,18 @@
+#ifndef __square_matrix_ws_h__
+#define __square_matrix_ws_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+#include "work_stealing.h"
+
+// Matrix kernels written as recursive fork/join tasks on a
+// work-stealing pool instead of static per-thread splits.
+
+square_matrix* add_square_matrices_ws(square_matrix* m1, square_matrix* m2, ws_pool* pool);
+square_matrix* mul_square_matrices_ws(square_matrix* m1, square_matrix* m2, ws_pool* pool);
+square_matrix* mul_square_matrices_strassen_ws(square_matrix* m1, square_matrix* m2, ws_pool* pool);
+
+square_matrix* transpose_square_matrix_ws(square_matrix* m, ws_pool* pool);
+void in_place_transpose_square_matrix_ws(square_matrix* m, ws_pool* pool);
+
+#endif
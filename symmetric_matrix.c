@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "symmetric_matrix.h"
+#include "matrix_threads.h"
+
+#define SYRK_BLOCK  32      // rows of A per block of the result triangle
+#define SYRK_DEPTH  512     // columns of A per pass over a block, to keep both row blocks in cache
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
+#define PACKED_SIZE(n) ((n)*((n)+1)/2)
+#define PACKED_ROW(s,i) ((s)->data + (i)*((i)+1)/2)
+
+/*
+ * Allocate space for a symmetric matrix of order n.
+ * Return NULL if the allocation is not successful.
+ */
+symmetric_matrix* new_symmetric_matrix(size_t n)
+{
+   symmetric_matrix* s = malloc(sizeof(symmetric_matrix));
+   if(s == NULL)
+      return NULL;
+
+   size_t size = PACKED_SIZE(n);
+   s->data = malloc((size ? size : 1) * sizeof(matrix_element));
+   if(s->data == NULL) {
+      free(s);
+      return NULL;
+   }
+
+   s->order = n;
+
+   return s;
+}
+
+/*
+ * Deallocate the dynamic memory allocated for the given symmetric matrix.
+ */
+void free_symmetric_matrix(symmetric_matrix* s)
+{
+   if(s == NULL)
+      return;
+
+   free(s->data);
+   free(s);
+}
+
+/*
+ * Pack the lower triangle of m, which is taken to be symmetric.
+ * Return NULL if anything is wrong.
+ */
+symmetric_matrix* square_to_symmetric_matrix(square_matrix* m)
+{
+   if(m == NULL)
+      return NULL;
+
+   size_t n = m->order;
+   symmetric_matrix* s = new_symmetric_matrix(n);
+   if(s == NULL)
+      return NULL;
+
+   for(size_t i = 0; i < n; i++)
+      memcpy(PACKED_ROW(s, i), m->data[i], (i + 1) * sizeof(matrix_element));
+
+   return s;
+}
+
+/*
+ * Unpack a symmetric matrix into both triangles of a square matrix.
+ * Return NULL if anything is wrong.
+ */
+square_matrix* symmetric_to_square_matrix(symmetric_matrix* s)
+{
+   if(s == NULL)
+      return NULL;
+
+   size_t n = s->order;
+   square_matrix* m = new_square_matrix(n);
+   if(m == NULL)
+      return NULL;
+
+   matrix_element** data = m->data;
+   for(size_t i = 0; i < n; i++) {
+      const matrix_element* row = PACKED_ROW(s, i);
+      for(size_t j = 0; j <= i; j++)
+         data[i][j] = data[j][i] = row[j];
+   }
+
+   return m;
+}
+
+/*
+ * Compare two symmetric matrices, return 0 if they are the same,
+ * non-zero values otherwise.
+ */
+int compare_symmetric_matrices(symmetric_matrix* s1, symmetric_matrix* s2)
+{
+   if(s1 == NULL || s2 == NULL)
+      return -1;
+
+   if(s1->order != s2->order)
+      return -2;
+
+   size_t size = PACKED_SIZE(s1->order);
+   for(size_t e = 0; e < size; e++)
+      if(s1->data[e] != s2->data[e]) {
+         fprintf(stderr, "Mismatch found for packed element %lu: %d vs %d\n",
+                 e, s1->data[e], s2->data[e]);
+         return 1;
+      }
+
+   return 0;
+}
+
+
+typedef struct {
+   size_t id, num_threads;
+   symmetric_matrix *s1, *s2, *sres;
+   square_matrix *m, *res;
+} thread_arg_t_sym;
+
+DEFINE_RUN_THREADS(thread_arg_t_sym)
+
+/////////////////////////////////////
+//                                 //
+// Symmetric addition              //
+//                                 //
+/////////////////////////////////////
+
+static void * thread_add_sym(void * p_arg)
+{
+   thread_arg_t_sym *p = p_arg;
+   size_t size = PACKED_SIZE(p->s1->order);
+   size_t first = size * p->id / p->num_threads;
+   size_t last  = size * (p->id + 1) / p->num_threads;
+
+   const matrix_element* restrict data1 = p->s1->data;
+   const matrix_element* restrict data2 = p->s2->data;
+   matrix_element* restrict data = p->sres->data;
+
+   for(size_t e = first; e < last; e++)
+      data[e] = data1[e] + data2[e];
+
+   return NULL;
+}
+
+/*
+ * Compute the sum of two symmetric matrices, touching only the packed
+ * triangles. Return a pointer to the newly allocated result or NULL if
+ * anything is wrong
+ */
+symmetric_matrix* add_symmetric_matrices_threads(symmetric_matrix* s1, symmetric_matrix* s2, size_t num_threads)
+{
+   if(s1 == NULL || s2 == NULL || s1->order != s2->order || num_threads == 0)
+      return NULL;
+
+   symmetric_matrix* res = new_symmetric_matrix(s1->order);
+   if(res == NULL)
+      return NULL;
+
+   // adjust number of threads for small matrices
+   size_t size = PACKED_SIZE(s1->order);
+   num_threads = (size < num_threads) ? (size ? size : 1) : num_threads;
+
+   run_threads(thread_add_sym, (thread_arg_t_sym){.s1 = s1, .s2 = s2, .sres = res}, num_threads);
+
+   return res;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Symmetric times square          //
+//                                 //
+/////////////////////////////////////
+
+static void * thread_mul_sym(void * p_arg)
+{
+   thread_arg_t_sym *p = p_arg;
+   size_t n = p->m->order;
+   matrix_element** data2 = p->m->data;
+   matrix_element** data  = p->res->data;
+   const matrix_element* packed = p->s1->data;
+
+   // thread id will do rows id, id + num_threads, id + 2*num_threads, ...
+   for(size_t i = p->id; i < n; i += p->num_threads) {
+      matrix_element* restrict row = data[i];
+      memset(row, 0, n*sizeof(matrix_element));
+
+      // Use IKJ order for best cache performance; s(i,k) comes from
+      // row i of the triangle for k <= i and from column i after that
+      const matrix_element* lower = PACKED_ROW(p->s1, i);
+      for(size_t k = 0; k < n; k++) {
+         matrix_element a = k <= i ? lower[k] : packed[k*(k+1)/2 + i];
+         const matrix_element* restrict src = data2[k];
+         for(size_t j = 0; j < n; j++)
+            row[j] += a * src[j];
+      }
+   }
+
+   return NULL;
+}
+
+/*
+ * Compute the product of a symmetric matrix and a square matrix.
+ * Return a pointer to the newly allocated result matrix or NULL if
+ * anything is wrong
+ */
+square_matrix* mul_symmetric_square_matrices_threads(symmetric_matrix* s, square_matrix* m, size_t num_threads)
+{
+   if(s == NULL || m == NULL || s->order != m->order || num_threads == 0)
+      return NULL;
+
+   size_t n = m->order;
+   square_matrix* res = new_square_matrix(n);
+   if(res == NULL)
+      return NULL;
+
+   // adjust number of threads for small matrices
+   num_threads = (n < num_threads) ? (n ? n : 1) : num_threads;
+
+   run_threads(thread_mul_sym, (thread_arg_t_sym){.s1 = s, .m = m, .res = res}, num_threads);
+
+   return res;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Symmetric rank-k update         //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * Entry (i,j) of A * transpose(A) is the dot product of rows i and j of
+ * A, so the rows are used as they are stored and no transpose is
+ * made. Only the lower triangle, j <= i, is computed: half the products
+ * of a full multiply. The triangle is cut into blocks of SYRK_BLOCK x
+ * SYRK_BLOCK; each thread takes block rows id, id + num_threads, ...
+ * and runs over the columns of A in passes of SYRK_DEPTH, so the two
+ * row blocks of a block stay in cache for the whole pass.
+ */
+static void * thread_syrk(void * p_arg)
+{
+   thread_arg_t_sym *p = p_arg;
+   size_t n = p->m->order;
+   matrix_element** a = p->m->data;
+   symmetric_matrix* c = p->sres;
+   size_t num_blocks = (n + SYRK_BLOCK - 1) / SYRK_BLOCK;
+
+   for(size_t bi = p->id; bi < num_blocks; bi += p->num_threads) {
+      size_t i0 = bi * SYRK_BLOCK, i1 = MIN(i0 + SYRK_BLOCK, n);
+
+      for(size_t i = i0; i < i1; i++)
+         memset(PACKED_ROW(c, i), 0, (i + 1) * sizeof(matrix_element));
+
+      for(size_t k0 = 0; k0 < n; k0 += SYRK_DEPTH) {
+         size_t k1 = MIN(k0 + SYRK_DEPTH, n);
+
+         for(size_t j0 = 0; j0 <= i0; j0 += SYRK_BLOCK) {
+            size_t j1 = MIN(j0 + SYRK_BLOCK, n);
+
+            for(size_t i = i0; i < i1; i++) {
+               const matrix_element* restrict ai = a[i];
+               matrix_element* restrict out = PACKED_ROW(c, i);
+               size_t jend = MIN(j1, i + 1);
+               for(size_t j = j0; j < jend; j++) {
+                  const matrix_element* restrict aj = a[j];
+                  matrix_element sum = 0;
+                  for(size_t k = k0; k < k1; k++)
+                     sum += ai[k] * aj[k];
+                  out[j] += sum;
+               }
+            }
+         }
+      }
+   }
+
+   return NULL;
+}
+
+/*
+ * Compute A * transpose(A) as a packed symmetric matrix. Return a
+ * pointer to the newly allocated result or NULL if anything is wrong
+ */
+symmetric_matrix* syrk_square_matrix_threads(square_matrix* a, size_t num_threads)
+{
+   if(a == NULL || num_threads == 0)
+      return NULL;
+
+   size_t n = a->order;
+   symmetric_matrix* res = new_symmetric_matrix(n);
+   if(res == NULL)
+      return NULL;
+
+   // adjust number of threads for small matrices
+   size_t num_blocks = (n + SYRK_BLOCK - 1) / SYRK_BLOCK;
+   num_threads = (num_blocks < num_threads) ? (num_blocks ? num_blocks : 1) : num_threads;
+
+   run_threads(thread_syrk, (thread_arg_t_sym){.m = a, .sres = res}, num_threads);
+
+   return res;
+}
@@ -0,0 +1,26 @@
+#ifndef __symmetric_matrix_h__
+#define __symmetric_matrix_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+
+typedef struct {
+    size_t order;
+    matrix_element* data;   // lower triangle by rows: element (i,j), j <= i, at i*(i+1)/2 + j
+} symmetric_matrix;
+
+// element (i,j) of a symmetric matrix, for either triangle
+#define SYMMETRIC_INDEX(i,j) ((i) >= (j) ? (i)*((i)+1)/2 + (j) : (j)*((j)+1)/2 + (i))
+
+symmetric_matrix* new_symmetric_matrix(size_t order);
+void free_symmetric_matrix(symmetric_matrix* s);
+
+symmetric_matrix* square_to_symmetric_matrix(square_matrix* m);
+square_matrix* symmetric_to_square_matrix(symmetric_matrix* s);
+int compare_symmetric_matrices(symmetric_matrix* s1, symmetric_matrix* s2);
+
+symmetric_matrix* add_symmetric_matrices_threads(symmetric_matrix* s1, symmetric_matrix* s2, size_t num_threads);
+square_matrix* mul_symmetric_square_matrices_threads(symmetric_matrix* s, square_matrix* m, size_t num_threads);
+symmetric_matrix* syrk_square_matrix_threads(square_matrix* a, size_t num_threads);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "matrix_async.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           200
+#define DEFAULT_NUM_FUTURES 8
+
+// a matrix_async_call() operation that does not finish until released
+typedef struct {
+   atomic_int released;
+   square_matrix* m;
+} gated_arg;
+
+static square_matrix* gated_transpose(void* p_arg)
+{
+   gated_arg* arg = p_arg;
+   while(!atomic_load(&arg->released))
+      ;
+   return transpose_square_matrix(arg->m);
+}
+
+typedef struct {
+   atomic_int calls;
+   atomic_int ready;           // the future was ready when the callback ran
+   pthread_t thread;           // the thread the callback ran on
+   square_matrix* result;      // taken by the callback
+} callback_record;
+
+static void record_callback(matrix_future* f, void* user)
+{
+   callback_record* rec = user;
+   rec->thread = pthread_self();
+   atomic_store(&rec->ready, matrix_future_ready(f));
+   rec->result = matrix_future_wait(f);
+   atomic_fetch_add(&rec->calls, 1);
+}
+
+static void count_callback(matrix_future* f, void* user)
+{
+   (void) f;
+   atomic_fetch_add((atomic_int*) user, 1);
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_futures = (argc < 3 ? DEFAULT_NUM_FUTURES : atol(argv[2]) );
+   n = n ? n : 1;
+   num_futures = num_futures ? num_futures : 1;
+
+   square_matrix* m1 = new_square_matrix(n);
+   square_matrix* m2 = new_square_matrix(n);
+   assert(m1 != NULL && m2 != NULL);
+   fill_square_matrix(m1);
+   fill_square_matrix(m2);
+
+   square_matrix* sum = add_square_matrices(m1, m2);
+   square_matrix* prod = mul_square_matrices(m1, m2);
+   square_matrix* tran = transpose_square_matrix(m1);
+   assert(sum != NULL && prod != NULL && tran != NULL);
+
+   int r = 0;
+
+   // many operations in flight at once, polled until all are ready
+   matrix_future* f[3 * num_futures];
+   start_timer();
+   for(size_t i = 0; i < num_futures; i++) {
+      f[3*i]     = add_square_matrices_async(m1, m2);
+      f[3*i + 1] = mul_square_matrices_async(m1, m2);
+      f[3*i + 2] = transpose_square_matrix_async(m1);
+   }
+   for(size_t left = 3 * num_futures; left > 0; ) {
+      left = 0;
+      for(size_t i = 0; i < 3 * num_futures; i++)
+         left += f[i] != NULL && !matrix_future_ready(f[i]);
+   }
+   printf("Asynchronous time for %lu add, mul, transpose: %lf sec\n", num_futures, clock_seconds());
+
+   square_matrix* expected[3] = {sum, prod, tran};
+   for(size_t i = 0; i < 3 * num_futures; i++) {
+      square_matrix* res = matrix_future_wait(f[i]);
+      if(res == NULL || compare_square_matrices(res, expected[i % 3]) != 0)
+         r = 1;
+      free_square_matrix(res);
+      free_matrix_future(f[i]);
+   }
+
+   // a callback attached before the operation finishes runs on a worker
+   callback_record early = {0};
+   gated_arg gate = {0, m1};
+   matrix_future* g = matrix_async_call(gated_transpose, &gate);
+   assert(g != NULL);
+   if(matrix_future_ready(g) || matrix_future_then(g, record_callback, &early) != 0 ||
+      matrix_future_then(g, record_callback, &early) != -1)
+      r = 1;
+   atomic_store(&gate.released, 1);
+   while(atomic_load(&early.calls) == 0)
+      ;
+   if(!atomic_load(&early.ready) || pthread_equal(early.thread, pthread_self()) ||
+      early.result == NULL || compare_square_matrices(early.result, tran) != 0)
+      r = 1;
+   free_square_matrix(early.result);
+   free_matrix_future(g);
+
+   // one attached after it finished runs at once on the caller, and only once
+   callback_record late = {0};
+   g = mul_square_matrices_async(m1, m2);
+   assert(g != NULL);
+   square_matrix* res = matrix_future_wait(g);
+   if(matrix_future_then(g, record_callback, &late) != 0 ||
+      matrix_future_then(g, record_callback, &late) != -1 ||
+      atomic_load(&late.calls) != 1 || !pthread_equal(late.thread, pthread_self()) ||
+      late.result != res || res == NULL || compare_square_matrices(res, prod) != 0)
+      r = 1;
+   free_square_matrix(res);
+   free_matrix_future(g);
+
+   // a future freed before it is ready still frees its result
+   atomic_int calls = 0;
+   gate.released = 0;
+   g = matrix_async_call(gated_transpose, &gate);
+   assert(g != NULL);
+   if(matrix_future_then(g, count_callback, &calls) != 0)
+      r = 1;
+   free_matrix_future(g);
+   atomic_store(&gate.released, 1);
+   while(atomic_load(&calls) == 0)
+      ;
+
+   if(matrix_future_then(NULL, record_callback, NULL) != -1 || matrix_future_wait(NULL) != NULL ||
+      add_square_matrices_async(m1, NULL) != NULL)
+      r = 1;
+
+   matrix_async_shutdown();
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free_square_matrix(m1);
+   free_square_matrix(m2);
+   free_square_matrix(sum);
+   free_square_matrix(prod);
+   free_square_matrix(tran);
+
+   return r;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "square_matrix3.h"
+#include "bool_matrix.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           300
+#define DEFAULT_NUM_THREADS 4
+
+// orders below, at and across the 64-bit word size, and the one given
+static size_t orders[] = {1, 7, 63, 64, 65, 130, DEFAULT_N};
+
+// about edges_per_row set elements in every row, so that paths are long
+static square_matrix* random_relation(size_t n, size_t edges_per_row)
+{
+   square_matrix* m = new_square_matrix(n);
+   assert(m != NULL);
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++)
+         m->data[i][j] = (size_t) rand() % n < edges_per_row ? rand() % 9 + 1 : 0;
+   return m;
+}
+
+static square_matrix* mul_bool_reference(square_matrix* m1, square_matrix* m2)
+{
+   size_t n = m1->order;
+   square_matrix* res = new_square_matrix(n);
+   assert(res != NULL);
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++) {
+         res->data[i][j] = 0;
+         for(size_t k = 0; k < n && !res->data[i][j]; k++)
+            res->data[i][j] = m1->data[i][k] && m2->data[k][j];
+      }
+   return res;
+}
+
+// Warshall's algorithm on a 0/1 copy of m
+static square_matrix* warshall(square_matrix* m, int reflexive)
+{
+   size_t n = m->order;
+   square_matrix* res = new_square_matrix(n);
+   assert(res != NULL);
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++)
+         res->data[i][j] = m->data[i][j] != 0 || (reflexive && i == j);
+
+   for(size_t k = 0; k < n; k++)
+      for(size_t i = 0; i < n; i++)
+         if(res->data[i][k])
+            for(size_t j = 0; j < n; j++)
+               res->data[i][j] |= res->data[k][j];
+   return res;
+}
+
+static int compare_bool_square(bool_matrix* b, square_matrix* expected)
+{
+   square_matrix* m = bool_to_square_matrix(b);
+   int r = m == NULL || compare_square_matrices(m, expected) != 0;
+   free_square_matrix(m);
+   return r;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   orders[sizeof(orders) / sizeof(orders[0]) - 1] = n ? n : 1;
+   num_threads = num_threads ? num_threads : 1;
+
+   int r = 0;
+   for(size_t k = 0; k < sizeof(orders) / sizeof(orders[0]); k++) {
+      size_t order = orders[k];
+      square_matrix* m1 = random_relation(order, 2);
+      square_matrix* m2 = random_relation(order, 8);
+      square_matrix* prod = mul_bool_reference(m1, m2);
+      square_matrix* closure = warshall(m1, 0);
+      square_matrix* refl_closure = warshall(m1, 1);
+
+      bool_matrix* b1 = square_to_bool_matrix(m1);
+      bool_matrix* b2 = square_to_bool_matrix(m2);
+      assert(b1 != NULL && b2 != NULL);
+
+      // conversion keeps exactly the nonzero elements
+      square_matrix* ones = new_square_matrix(order);
+      assert(ones != NULL);
+      for(size_t i = 0; i < order; i++)
+         for(size_t j = 0; j < order; j++)
+            ones->data[i][j] = m1->data[i][j] != 0;
+      int rc = compare_bool_square(b1, ones);
+      free_square_matrix(ones);
+
+      for(size_t t = 1; t <= num_threads; t = (2*t > num_threads && t < num_threads ? num_threads : 2*t) ) {
+         start_timer();
+         bool_matrix* bp = mul_bool_matrices_threads(b1, b2, t);
+         double tp = clock_seconds();
+         start_timer();
+         bool_matrix* bc = transitive_closure_bool_matrix_threads(b1, 0, t);
+         double tc = clock_seconds();
+         bool_matrix* brc = transitive_closure_bool_matrix_threads(b1, 1, t);
+
+         rc |= bp == NULL || compare_bool_square(bp, prod) != 0;
+         rc |= bc == NULL || compare_bool_square(bc, closure) != 0;
+         rc |= brc == NULL || compare_bool_square(brc, refl_closure) != 0;
+         if(order == n)
+            printf("   %lu threads: product %lf sec, closure %lf sec, %lu of %lu pairs connected\n",
+                   t, tp, tc, bc ? count_bool_matrix(bc) : 0, order * order);
+
+         free_bool_matrix(bp);
+         free_bool_matrix(bc);
+         free_bool_matrix(brc);
+      }
+      printf("   order %lu: %s\n", order, rc ? "differs" : "ok");
+      r |= rc;
+
+      free_bool_matrix(b1);
+      free_bool_matrix(b2);
+      free_square_matrix(m1);
+      free_square_matrix(m2);
+      free_square_matrix(prod);
+      free_square_matrix(closure);
+      free_square_matrix(refl_closure);
+   }
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   return r;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "compact_matrix.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           2000
+#define DEFAULT_NUM_THREADS 2
+
+/*
+ * Compare a compact result with the expected square matrix, print both
+ * times, and free both results. Return 0 if they match.
+ */
+static int report(const char* op, square_matrix* expected, double t_int, compact_matrix* c, double t_compact)
+{
+   assert(expected != NULL && c != NULL);
+   square_matrix* res = compact_to_square_matrix_threads(c, 1);
+   assert(res != NULL);
+   int r = compare_square_matrices(expected, res);
+
+   printf("%-10s int32 %lf sec, int%d %lf sec (%.2lfx)\n", op, t_int, 8 * (int) c->type, t_compact, t_int / t_compact);
+
+   free_square_matrix(res);
+   free_square_matrix(expected);
+   free_compact_matrix(c);
+
+   return r;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+
+   square_matrix* m1 = new_square_matrix(n);
+   square_matrix* m2 = new_square_matrix(n);
+   assert(m1 != NULL && m2 != NULL);
+   fill_square_matrix(m1);
+   fill_square_matrix(m2);
+
+   start_timer();
+   compact_matrix* c1 = square_to_compact_matrix_threads(m1, num_threads);
+   printf("Detection and conversion: %lf wall clock sec\n", clock_seconds() );
+   compact_matrix* c2 = square_to_compact_matrix_threads(m2, num_threads);
+   assert(c1 != NULL && c2 != NULL && c1->type == COMPACT_INT8);
+
+   double t_int, t_compact;
+   square_matrix* expected;
+   int r = 0;
+
+   start_timer();
+   expected = add_square_matrices_threads(m1, m2, num_threads);
+   t_int = clock_seconds();
+   start_timer();
+   compact_matrix* sum = add_compact_matrices_threads(c1, c2, num_threads);
+   t_compact = clock_seconds();
+   r = report("Addition", expected, t_int, sum, t_compact);
+
+   start_timer();
+   expected = transpose_square_matrix_threads(m1, num_threads);
+   t_int = clock_seconds();
+   start_timer();
+   compact_matrix* tr = transpose_compact_matrix_threads(c1, num_threads);
+   t_compact = clock_seconds();
+   if(r == 0) r = report("Transpose", expected, t_int, tr, t_compact);
+
+   start_timer();
+   expected = mul_square_matrices_threads(m1, m2, num_threads);
+   t_int = clock_seconds();
+   start_timer();
+   square_matrix* prod = mul_compact_matrices_threads(c1, c2, num_threads);
+   t_compact = clock_seconds();
+   printf("%-10s int32 %lf sec, int8 %lf sec (%.2lfx)\n", "Multiply", t_int, t_compact, t_int / t_compact);
+   if(r == 0) r = compare_square_matrices(expected, prod);
+
+   // mixed operand types are widened; the product does not change
+   compact_matrix* w2 = square_to_compact_matrix_as_threads(m2, COMPACT_INT16, num_threads);
+   assert(w2 != NULL);
+   square_matrix* mixed = mul_compact_matrices_threads(c1, w2, num_threads);
+   if(r == 0) r = compare_square_matrices(expected, mixed);
+
+   // sums that outgrow the operands' type widen the result
+   for(int i = 0; i < 16 && r == 0; i++) {
+      compact_matrix* next = add_compact_matrices_threads(w2, w2, num_threads);
+      assert(next != NULL && next->type >= w2->type);
+      free_compact_matrix(w2);
+      w2 = next;
+   }
+   square_matrix* grown = compact_to_square_matrix_threads(w2, num_threads);
+   assert(grown != NULL);
+   for(size_t e = 0; e < n * n && r == 0; e++)
+      r = grown->data[0][e] != m2->data[0][e] * 65536;
+   free_square_matrix(grown);
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free_square_matrix(expected);
+   free_square_matrix(prod);
+   free_square_matrix(mixed);
+   free_compact_matrix(w2);
+   free_compact_matrix(c1);
+   free_compact_matrix(c2);
+   free_square_matrix(m1);
+   free_square_matrix(m2);
+
+   return r;
+}
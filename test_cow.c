@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "square_matrix3.h"
+#include "matrix_gemm.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           300
+#define DEFAULT_NUM_THREADS 4
+#define SHARES_PER_THREAD   100
+
+// operands for the writers that compute into a matrix
+static square_matrix *a, *b;
+
+static void write_fill(square_matrix* m, size_t num_threads)
+{
+   (void) num_threads;
+   fill_square_matrix(m);
+}
+
+static void write_mul_into(square_matrix* m, size_t num_threads)
+{
+   assert(mul_square_matrices_into_threads(a, b, m, num_threads) == 0);
+}
+
+static void write_gemm_into(square_matrix* m, size_t num_threads)
+{
+   assert(gemm_square_matrices_into_threads(a, MATRIX_TRANS, b, MATRIX_NO_TRANS, m, 1, num_threads) == 0);
+}
+
+static void write_transpose_schooner(square_matrix* m, size_t num_threads)
+{
+   (void) num_threads;
+   in_place_transpose_square_matrix_schooner(m);
+}
+
+static void write_transpose_tiled(square_matrix* m, size_t num_threads)
+{
+   (void) num_threads;
+   in_place_transpose_square_matrix_tiled(m);
+}
+
+// what a caller writing to data directly has to do
+static void write_direct(square_matrix* m, size_t num_threads)
+{
+   (void) num_threads;
+   assert(make_square_matrix_writable(m) == 0);
+   for(size_t i = 0; i < m->order; i++)
+      m->data[i][m->order - 1 - i] += 1;
+}
+
+static const struct {
+   const char* name;
+   void (*write)(square_matrix* m, size_t num_threads);
+} writers[] = {
+   {"fill",               write_fill},
+   {"mul into",           write_mul_into},
+   {"gemm into",          write_gemm_into},
+   {"transpose schooner", write_transpose_schooner},
+   {"transpose tiled",    write_transpose_tiled},
+   {"direct",             write_direct},
+};
+
+static size_t refs_of(square_matrix* m)
+{
+   matrix_storage* s = atomic_load(&m->storage);
+   return s ? atomic_load(&s->refs) : 0;
+}
+
+/*
+ * Share m, write to the original or to the copy, and check that the
+ * other side still holds the old elements, that the writer has storage
+ * of its own, and that either can be freed first.
+ */
+static int check_writer(size_t w, size_t n, int write_original, int free_original_first, size_t num_threads)
+{
+   square_matrix* m = new_square_matrix(n);
+   assert(m != NULL);
+   fill_square_matrix(m);
+   square_matrix* expected = duplicate_square_matrix(m);
+   square_matrix* copy = share_square_matrix(m);
+   assert(expected != NULL && copy != NULL);
+
+   int r = copy->data != m->data || atomic_load(&m->storage) != atomic_load(&copy->storage) || refs_of(m) != 2;
+   r |= compare_square_matrices(copy, expected) != 0;
+
+   square_matrix* written = write_original ? m : copy;
+   square_matrix* kept = write_original ? copy : m;
+   writers[w].write(written, num_threads);
+
+   r |= written->data == kept->data || atomic_load(&written->storage) != NULL || refs_of(kept) != 1;
+   r |= compare_square_matrices(kept, expected) != 0;
+
+   // the matrix freed last still reads its own elements
+   square_matrix* last = free_original_first ? copy : m;
+   free_square_matrix(free_original_first ? m : copy);
+   if(last == kept)
+      r |= compare_square_matrices(last, expected) != 0;
+   free_square_matrix(last);
+
+   free_square_matrix(expected);
+   return r;
+}
+
+typedef struct {
+   square_matrix* m;
+   square_matrix* expected;
+   int r;
+} thread_arg_t_share;
+
+// share the same matrix repeatedly, racing the other threads
+static void * thread_share(void * p_arg)
+{
+   thread_arg_t_share* p = p_arg;
+   square_matrix* copies[SHARES_PER_THREAD];
+   for(size_t i = 0; i < SHARES_PER_THREAD; i++) {
+      copies[i] = share_square_matrix(p->m);
+      p->r |= copies[i] == NULL || copies[i]->data[0][0] != p->expected->data[0][0];
+   }
+   for(size_t i = 0; i < SHARES_PER_THREAD; i++)
+      free_square_matrix(copies[i]);
+   return NULL;
+}
+
+static int check_concurrent_shares(size_t n, size_t num_threads)
+{
+   square_matrix* m = new_square_matrix(n);
+   assert(m != NULL);
+   fill_square_matrix(m);
+   square_matrix* expected = duplicate_square_matrix(m);
+   assert(expected != NULL);
+
+   pthread_t tid[num_threads];
+   thread_arg_t_share args[num_threads];
+   for(size_t i = 0; i < num_threads; i ++) {
+      args[i] = (thread_arg_t_share){.m = m, .expected = expected, .r = 0};
+      int status = pthread_create(&tid[i], NULL, thread_share, &args[i]);
+      assert(status == 0); // could have handled errors better
+   }
+
+   int r = 0;
+   for(size_t i = 0; i < num_threads; i ++) {
+      pthread_join(tid[i], NULL);
+      r |= args[i].r;
+   }
+
+   // every copy is gone: one storage, referenced by m alone
+   r |= refs_of(m) != 1 || compare_square_matrices(m, expected) != 0;
+   free_square_matrix(m);
+   free_square_matrix(expected);
+   return r;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   n = n ? n : 1;
+   num_threads = num_threads ? num_threads : 1;
+
+   a = new_square_matrix(n);
+   b = new_square_matrix(n);
+   assert(a != NULL && b != NULL);
+   fill_square_matrix(a);
+   fill_square_matrix(b);
+
+   int r = 0;
+   for(size_t w = 0; w < sizeof(writers) / sizeof(writers[0]); w++) {
+      int rc = 0;
+      for(int side = 0; side < 2; side++)
+         for(int order = 0; order < 2; order++)
+            rc |= check_writer(w, n, side, order, num_threads);
+      printf("   %-18s %s\n", writers[w].name, rc ? "differs" : "ok");
+      r |= rc;
+   }
+
+   int rc = check_concurrent_shares(n, num_threads);
+   printf("   %-18s %s\n", "concurrent shares", rc ? "differs" : "ok");
+   r |= rc;
+
+   // what sharing saves over duplicating
+   square_matrix* copy;
+   start_timer();
+   copy = duplicate_square_matrix(a);
+   printf("Duplicate: %lf sec\n", clock_seconds());
+   free_square_matrix(copy);
+   start_timer();
+   copy = share_square_matrix(a);
+   printf("Share:     %lf sec\n", clock_seconds());
+   free_square_matrix(copy);
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free_square_matrix(a);
+   free_square_matrix(b);
+
+   return r;
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "matrix_kernels.h"
+#include "unixtimer.h"
+
+#define DEFAULT_MAX_N       640
+#define DEFAULT_NUM_THREADS 2
+#define FIRST_N             20
+#define REPEATS             7
+
+static const char* op_names[MATRIX_NUM_OPS] = {"Addition", "Multiplication", "Transpose"};
+
+static square_matrix* run_kernel(const matrix_kernel* k, square_matrix* m1, square_matrix* m2, size_t num_threads)
+{
+   return k->op == MATRIX_OP_TRANSPOSE ? k->unary(m1, num_threads) : k->binary(m1, m2, num_threads);
+}
+
+static square_matrix* run_dispatch(matrix_op op, square_matrix* m1, square_matrix* m2)
+{
+   switch(op) {
+      case MATRIX_OP_ADD: return add_square_matrices_dispatch(m1, m2);
+      case MATRIX_OP_MUL: return mul_square_matrices_dispatch(m1, m2);
+      default:            return transpose_square_matrix_dispatch(m1);
+   }
+}
+
+/*
+ * Time every kernel of an operation, each with a fixed thread count,
+ * and the dispatcher on the orders FIRST_N, 2*FIRST_N, ... up to max_n,
+ * taking the best of REPEATS rounds that run them all in turn. Print
+ * the total time of each over all the orders, and how the dispatcher
+ * compares with the best fixed choice; wall-clock times vary too much
+ * from run to run to fail on. Return 0 if every result matches.
+ */
+static int bench_op(matrix_op op, size_t max_n, size_t num_threads)
+{
+   size_t num_kernels = matrix_kernel_count(op);
+   double total[num_kernels + 1];
+   memset(total, 0, sizeof(total));
+
+   int r = 0;
+   for(size_t n = FIRST_N; n <= max_n; n *= 2) {
+      square_matrix* m1 = new_square_matrix(n);
+      square_matrix* m2 = new_square_matrix(n);
+      assert(m1 != NULL && m2 != NULL);
+      fill_square_matrix(m1);
+      fill_square_matrix(m2);
+
+      square_matrix* expected = NULL;
+      double best[num_kernels + 1];
+      for(int rep = 0; rep < REPEATS; rep++)
+         for(size_t i = 0; i <= num_kernels; i++) {
+            const matrix_kernel* k = i < num_kernels ? matrix_kernel_at(op, i) : NULL;
+            start_timer();
+            square_matrix* res = k ? run_kernel(k, m1, m2, num_threads) : run_dispatch(op, m1, m2);
+            double t = clock_seconds();
+            assert(res != NULL);
+            if(rep == 0 || t < best[i]) best[i] = t;
+
+            if(expected == NULL)
+               expected = res;
+            else {
+               if(r == 0) r = compare_square_matrices(expected, res);
+               free_square_matrix(res);
+            }
+         }
+      for(size_t i = 0; i <= num_kernels; i++)
+         total[i] += best[i];
+
+      free_square_matrix(expected);
+      free_square_matrix(m1);
+      free_square_matrix(m2);
+   }
+
+   printf("%s, orders %d..%lu:\n", op_names[op], FIRST_N, max_n);
+   size_t best_fixed = 0;
+   for(size_t i = 0; i < num_kernels; i++) {
+      printf("   %-30s %lf sec\n", matrix_kernel_at(op, i)->name, total[i]);
+      if(total[i] < total[best_fixed]) best_fixed = i;
+   }
+   printf("   %-30s %lf sec (best fixed choice: %s, %.2lfx, dispatch %s)\n", "dispatch", total[num_kernels],
+          matrix_kernel_at(op, best_fixed)->name, total[best_fixed] / total[num_kernels],
+          total[num_kernels] <= total[best_fixed] ? "wins" : "loses");
+
+   return r;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t max_n = (argc < 2 ? DEFAULT_MAX_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   int tune = (argc < 4 ? 0 : atoi(argv[3]) );
+
+   if(tune) {
+      start_timer();
+      for(matrix_op op = 0; op < MATRIX_NUM_OPS; op++)
+         assert(matrix_kernels_tune(op, max_n, num_threads) == 0);
+      printf("Tuning time: %lf wall clock sec\n", clock_seconds() );
+   }
+
+   int r = 0;
+   for(matrix_op op = 0; op < MATRIX_NUM_OPS; op++)
+      if(r == 0) r = bench_op(op, max_n, num_threads);
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   return r;
+}
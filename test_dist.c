@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/wait.h>
+#include "matrix_dist.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           600
+#define DEFAULT_NUM_PROCS   4
+#define DEFAULT_NUM_THREADS 1
+#define MAX_PROCS           64
+
+/*
+ * Start num_procs processes on this host connected over TCP on ports
+ * base_port, base_port + 1, ... Return the new process's rank.
+ */
+static int spawn_tcp_processes(int num_procs, unsigned short base_port, matrix_transport** t)
+{
+   const char* hosts[MAX_PROCS];
+   unsigned short ports[MAX_PROCS];
+   for(int p = 0; p < num_procs; p++) {
+      hosts[p] = "localhost";
+      ports[p] = base_port + p;
+   }
+
+   int rank = 0;
+   for(int r = 1; r < num_procs && rank == 0; r++)
+      if(fork() == 0)
+         rank = r;
+
+   *t = new_tcp_transport(rank, num_procs, hosts, ports);
+   assert(*t != NULL);
+
+   return rank;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   int num_procs = (argc < 3 ? DEFAULT_NUM_PROCS : atoi(argv[2]) );
+   size_t num_threads = (argc < 4 ? DEFAULT_NUM_THREADS : atol(argv[3]) );
+   unsigned short base_port = (argc < 5 ? 0 : atoi(argv[4]) );   // 0: Unix-domain sockets
+
+   assert(num_procs > 0 && num_procs <= MAX_PROCS);
+
+   matrix_transport* t;
+   int rank = base_port ? spawn_tcp_processes(num_procs, base_port, &t)
+                        : spawn_local_processes(num_procs, &t);
+   assert(rank >= 0);
+
+   square_matrix *m1 = NULL, *m2 = NULL, *res = NULL;
+   if(rank == 0) {
+      m1 = new_square_matrix(n);
+      m2 = new_square_matrix(n);
+      assert(m1 != NULL && m2 != NULL);
+      fill_square_matrix(m1);
+      fill_square_matrix(m2);
+   }
+
+   start_timer();
+   int r = mul_square_matrices_dist(t, m1, m2, n, &res, num_threads);
+   double t_dist = clock_seconds();
+   assert(r == 0);
+
+   if(rank == 0) {
+      printf("Distributed time on %d processes (%s): %lf wall clock sec\n",
+             num_procs, base_port ? "TCP" : "Unix-domain sockets", t_dist);
+
+      start_timer();
+      square_matrix* expected = mul_square_matrices_threads(m1, m2, num_threads);
+      printf("Single process time: %lf wall clock sec\n", clock_seconds() );
+      assert(expected != NULL);
+
+      r = compare_square_matrices(expected, res);
+      printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+      free_square_matrix(expected);
+      free_square_matrix(res);
+      free_square_matrix(m1);
+      free_square_matrix(m2);
+   }
+
+   free_matrix_transport(t);
+
+   if(rank == 0 && base_port)
+      while(wait(NULL) > 0)
+         ;
+
+   return r;
+}
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "square_matrix3.h"
+#include "matrix_gemm.h"
+#include "unixtimer.h"
+
+#define DEFAULT_NUM_THREADS 4
+
+// orders around the block sizes, and one with ragged edge blocks
+static const size_t orders[] = {1, 5, 63, 65, 257, 300};
+
+/*
+ * Compare op(a) * op(b), and op(a) * op(b) accumulated onto it, with the
+ * sequential product of explicit transposes. Return 0 if all match.
+ */
+static int check_gemm(square_matrix* a, square_matrix* b, size_t num_threads)
+{
+   square_matrix* op[2][2] = {{a, transpose_square_matrix(a)}, {b, transpose_square_matrix(b)}};
+   assert(op[0][1] != NULL && op[1][1] != NULL);
+
+   int r = 0;
+   for(int ta = 0; ta < 2; ta++)
+      for(int tb = 0; tb < 2; tb++) {
+         square_matrix* expected = mul_square_matrices(op[0][ta], op[1][tb]);
+         assert(expected != NULL);
+
+         start_timer();
+         square_matrix* res = gemm_square_matrices_threads(a, ta, b, tb, num_threads);
+         double t = clock_seconds();
+         assert(res != NULL);
+
+         int rc = compare_square_matrices(res, expected);
+
+         // accumulating the same product doubles it
+         square_matrix* twice = add_square_matrices(expected, expected);
+         assert(twice != NULL);
+         if(gemm_square_matrices_into_threads(a, ta, b, tb, res, 1, num_threads) != 0 ||
+            compare_square_matrices(res, twice) != 0)
+            rc = 1;
+
+         printf("   %4lu %s*%s  %lf sec  %s\n", a->order, ta ? "A'" : "A ", tb ? "B'" : "B ", t,
+                rc ? "differs" : "ok");
+         r |= rc;
+
+         free_square_matrix(expected);
+         free_square_matrix(res);
+         free_square_matrix(twice);
+      }
+
+   free_square_matrix(op[0][1]);
+   free_square_matrix(op[1][1]);
+   return r;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t num_threads = (argc < 2 ? DEFAULT_NUM_THREADS : atol(argv[1]) );
+   num_threads = num_threads ? num_threads : 1;
+
+   int r = 0;
+   for(size_t k = 0; k < sizeof(orders) / sizeof(orders[0]); k++) {
+      square_matrix* a = new_square_matrix(orders[k]);
+      square_matrix* b = new_square_matrix(orders[k]);
+      assert(a != NULL && b != NULL);
+      fill_square_matrix(a);
+      fill_square_matrix(b);
+
+      r |= check_gemm(a, b, num_threads);
+
+      free_square_matrix(a);
+      free_square_matrix(b);
+   }
+
+   // the operands must be distinct from the result and of one order
+   square_matrix* a = new_square_matrix(5);
+   square_matrix* b = new_square_matrix(6);
+   assert(a != NULL && b != NULL);
+   if(gemm_square_matrices_threads(a, MATRIX_NO_TRANS, b, MATRIX_NO_TRANS, num_threads) != NULL ||
+      gemm_square_matrices_threads(a, MATRIX_NO_TRANS, a, MATRIX_NO_TRANS, 0) != NULL ||
+      gemm_square_matrices_into_threads(a, MATRIX_NO_TRANS, a, MATRIX_NO_TRANS, a, 0, num_threads) != -1)
+      r = 1;
+   free_square_matrix(a);
+   free_square_matrix(b);
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   return r;
+}
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "matrix_vector.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           6
+#define DEFAULT_NUM_THREADS 2
+#define DEFAULT_NUM_VECTORS 4
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   size_t num_vectors = (argc < 4 ? DEFAULT_NUM_VECTORS : atol(argv[3]) );
+
+   square_matrix* m = new_square_matrix(n);
+   assert(m != NULL);
+   fill_square_matrix(m);
+
+   matrix_element* x = new_matrix_vector(num_vectors * n);
+   assert(x != NULL);
+   fill_matrix_vector(x, num_vectors * n);
+
+   matrix_element* res1 = new_matrix_vector(num_vectors * n);
+   assert(res1 != NULL);
+
+   start_timer();
+   start_clock();
+   for(size_t v = 0; v < num_vectors; v++) {
+      matrix_element* y = gemv_square_matrix(m, x + v*n);
+      assert(y != NULL);
+      memcpy(res1 + v*n, y, n * sizeof(matrix_element));
+      free_matrix_vector(y);
+   }
+   printf("Sequential time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+
+   start_timer();
+   start_clock();
+   matrix_element* res2 = gemv_batched_square_matrix_threads(m, x, num_vectors, num_threads);
+   printf("Batched threads time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+   assert(res2 != NULL);
+
+   start_timer();
+   start_clock();
+   matrix_element* res3 = gemv_square_matrix_threads(m, x, num_threads);
+   printf("Single vector threads time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+   assert(res3 != NULL);
+
+   int r = compare_matrix_vectors(res1, res2, num_vectors * n);
+   if(r == 0) r = compare_matrix_vectors(res1, res3, n);
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free_square_matrix(m);
+   free_matrix_vector(x);
+   free_matrix_vector(res1);
+   free_matrix_vector(res2);
+   free_matrix_vector(res3);
+
+   return r;
+}
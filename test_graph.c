@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "square_matrix3.h"
+#include "matrix_graph.h"
+#include "work_stealing.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           300
+#define DEFAULT_NUM_THREADS 4
+
+// L2,1 norm, the sum of the Euclidean norms of the columns
+static long double norm_square_matrix(square_matrix* m)
+{
+   long double norm = 0.0;
+   for(size_t j = 0; j < m->order; j++) {
+      long double sq_sum = 0.0;
+      for(size_t i = 0; i < m->order; i++)
+         sq_sum += (long double) m->data[i][j] * m->data[i][j];
+      norm += sqrtl(sq_sum);
+   }
+   return norm;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   num_threads = num_threads ? num_threads : 1;
+
+   square_matrix* a = new_square_matrix(n);
+   square_matrix* b = new_square_matrix(n);
+   square_matrix* c = new_square_matrix(n);
+   assert(a != NULL && b != NULL && c != NULL);
+   fill_square_matrix(a);
+   fill_square_matrix(b);
+   fill_square_matrix(c);
+
+   // S = B * transpose(A) + C, its norm, and nodes that read one node twice
+   start_timer();
+   square_matrix* t = transpose_square_matrix(a);
+   square_matrix* p = mul_square_matrices(b, t);
+   square_matrix* s = add_square_matrices(p, c);
+   square_matrix* tt = mul_square_matrices(t, t);
+   square_matrix* ss = add_square_matrices(s, s);
+   assert(t != NULL && p != NULL && s != NULL && tt != NULL && ss != NULL);
+   long double norm = norm_square_matrix(s);
+   printf("Sequential time: %lf sec\n", clock_seconds());
+
+   int r = 0;
+   for(size_t k = 1; k <= num_threads; k = (2*k > num_threads && k < num_threads ? num_threads : 2*k) ) {
+      ws_pool* pool = ws_pool_create(k);
+      matrix_graph* g = new_matrix_graph();
+      assert(pool != NULL && g != NULL);
+
+      matrix_node* na = matrix_graph_input(g, a);
+      matrix_node* nt = matrix_graph_transpose(g, na);
+      matrix_node* np = matrix_graph_mul(g, matrix_graph_input(g, b), nt);
+      matrix_node* ns = matrix_graph_add(g, np, matrix_graph_input(g, c));
+      matrix_node* nn = matrix_graph_norm(g, ns);
+      matrix_node* ntt = matrix_graph_mul(g, nt, nt);
+      matrix_node* nss = matrix_graph_add(g, ns, ns);
+      assert(nn != NULL && ntt != NULL && nss != NULL);
+      matrix_graph_keep(ns);
+      matrix_graph_keep(ntt);
+      matrix_graph_keep(nss);
+
+      start_timer();
+      int rc = matrix_graph_run(g, pool);
+      double sec = clock_seconds();
+
+      square_matrix* rs = matrix_graph_result(ns);
+      square_matrix* rtt = matrix_graph_result(ntt);
+      square_matrix* rss = matrix_graph_result(nss);
+      long double rn = matrix_graph_norm_value(nn);
+
+      // the norm adds up columns band by band, so allow for rounding
+      if(rc != 0 || rs == NULL || rtt == NULL || rss == NULL ||
+         compare_square_matrices(rs, s) != 0 || compare_square_matrices(rtt, tt) != 0 ||
+         compare_square_matrices(rss, ss) != 0 || !(fabsl(rn - norm) <= 1e-12L * (norm > 1 ? norm : 1)) ||
+         matrix_graph_result(na) != a || matrix_graph_result(nn) != NULL || matrix_graph_run(g, pool) != -1)
+         rc = 1;
+      printf("%lu threads: %lf sec, norm %Lf %s\n", k, sec, rn, rc ? "differs" : "ok");
+      r |= rc;
+
+      free_square_matrix(rs);
+      free_square_matrix(rtt);
+      free_square_matrix(rss);
+      free_matrix_graph(g);
+      ws_pool_destroy(pool);
+   }
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free_square_matrix(a);
+   free_square_matrix(b);
+   free_square_matrix(c);
+   free_square_matrix(t);
+   free_square_matrix(p);
+   free_square_matrix(s);
+   free_square_matrix(tt);
+   free_square_matrix(ss);
+
+   return r;
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include "matrix_io.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           2000
+#define DEFAULT_NUM_THREADS 2
+
+static const char* format_names[] = {"text", "CSV", "Market"};
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   n = n ? n : 1;
+
+   square_matrix* m = new_square_matrix(n);
+   assert(m != NULL);
+   fill_square_matrix(m);
+   // negative and wide elements too
+   for(size_t e = 0; e < n * n; e += 7)
+      m->data[0][e] = (e % 2 ? -1 : 1) * (matrix_element) (e * 2654435761u >> 1);
+
+   char path[] = "/tmp/test_io_XXXXXX";
+   int fd = mkstemp(path);
+   assert(fd >= 0);
+   close(fd);
+
+   int r = 0;
+   for(matrix_format f = MATRIX_TEXT; f <= MATRIX_MARKET && r == 0; f++) {
+      start_timer();
+      assert(save_square_matrix(path, m, f, num_threads) == 0);
+      double t_write = clock_seconds();
+
+      struct stat st;
+      assert(stat(path, &st) == 0);
+      double mb = st.st_size / 1e6;
+
+      start_timer();
+      square_matrix* res = load_square_matrix(path, f, num_threads);
+      double t_read = clock_seconds();
+      assert(res != NULL);
+
+      printf("%-6s %8.1lf MB: write %lf sec (%.0lf MB/s), read %lf sec (%.0lf MB/s)\n",
+             format_names[f], mb, t_write, mb / t_write, t_read, mb / t_read);
+
+      r = compare_square_matrices(m, res);
+      free_square_matrix(res);
+   }
+
+   // a sparse coordinate file, and malformed input
+   const char* coo = "%%MatrixMarket matrix coordinate integer general\n% comment\n3 3 2\n1 1 5\n3 2 -7\n";
+   square_matrix* s = read_square_matrix_buffer(coo, strlen(coo), MATRIX_MARKET, num_threads);
+   assert(s != NULL);
+   if(r == 0)
+      r = s->data[0][0] != 5 || s->data[2][1] != -7 || s->data[1][1] != 0;
+   free_square_matrix(s);
+
+   const char* bad[] = {"1 2\n3\n", "1,2\n3,x\n", "1 2\n3 4\n5 6\n", "99999999999\n"};
+   for(size_t i = 0; i < sizeof(bad) / sizeof(bad[0]) && r == 0; i++)
+      r = read_square_matrix_buffer(bad[i], strlen(bad[i]), i == 1 ? MATRIX_CSV : MATRIX_TEXT, num_threads) != NULL;
+
+   const char* no_size = "%%MatrixMarket matrix array integer general\n% only comments\n";
+   if(r == 0)
+      r = read_square_matrix_buffer(no_size, strlen(no_size), MATRIX_MARKET, num_threads) != NULL;
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   unlink(path);
+   free_square_matrix(m);
+
+   return r;
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "lu_matrix.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           6
+#define DEFAULT_NUM_THREADS 2
+#define TOLERANCE           1e-6
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+
+   square_matrix* m = new_square_matrix(n);
+   assert(m != NULL);
+   fill_square_matrix(m);
+
+   // b = m * x for a known x
+   double* x = malloc(n*sizeof(double));
+   double* b = malloc(n*sizeof(double));
+   double* sol = malloc(n*sizeof(double));
+   assert(x != NULL && b != NULL && sol != NULL);
+   for(size_t i = 0; i < n; i++)
+      x[i] = (double)(i % 7) - 3.0;
+   for(size_t i = 0; i < n; i++) {
+      b[i] = 0.0;
+      for(size_t j = 0; j < n; j++)
+         b[i] += m->data[i][j] * x[j];
+   }
+
+   start_timer();
+   start_clock();
+   lu_double* f1 = lu_decompose_square_matrix_threads(m, 1);
+   printf("Sequential LU time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+   assert(f1 != NULL);
+
+   start_timer();
+   start_clock();
+   lu_double* f2 = lu_decompose_square_matrix_threads(m, num_threads);
+   printf("Threads LU time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+   assert(f2 != NULL);
+
+   // the threads do the same operations in the same order
+   int r = memcmp(f1->lu, f2->lu, n*n*sizeof(double)) != 0 || memcmp(f1->perm, f2->perm, n*sizeof(size_t)) != 0;
+
+   printf("Determinant: %g\n", lu_determinant_double(f2));
+
+   if(r == 0 && !f2->singular) {
+      r = lu_solve_double(f2, b, sol);
+      double err = 0.0;
+      for(size_t i = 0; i < n; i++)
+         err = fmax(err, fabs(sol[i] - x[i]));
+      printf("Largest solution error: %g\n", err);
+      if(r == 0) r = !(err < TOLERANCE);
+   }
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free_lu_double(f1);
+   free_lu_double(f2);
+   free_square_matrix(m);
+   free(x);
+   free(b);
+   free(sol);
+
+   return r;
+}
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "maintained_product.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           1000
+#define DEFAULT_NUM_THREADS 2
+#define DEFAULT_NUM_ROUNDS  10
+#define CHANGES_PER_ROUND   4
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   size_t num_rounds = (argc < 4 ? DEFAULT_NUM_ROUNDS : atol(argv[3]) );
+   n = n ? n : 1;
+
+   square_matrix* a = new_square_matrix(n);
+   square_matrix* b = new_square_matrix(n);
+   assert(a != NULL && b != NULL);
+   fill_square_matrix(a);
+   fill_square_matrix(b);
+
+   maintained_product* p = new_maintained_product(a, b, num_threads);
+   assert(p != NULL);
+
+   matrix_element* u = malloc(2 * n * sizeof(matrix_element));
+   matrix_element* v = malloc(2 * n * sizeof(matrix_element));
+   assert(u != NULL && v != NULL);
+
+   double t_incremental = 0.0, t_scratch = 0.0;
+   int r = 0;
+   for(size_t round = 0; round < num_rounds && r == 0; round++) {
+      // the same changes to the maintained product and to a and b
+      start_timer();
+      for(size_t c = 0; c < CHANGES_PER_ROUND; c++) {
+         size_t i = rand() % n;
+         for(size_t j = 0; j < n; j++)
+            u[j] = rand() % 7;
+
+         switch((round + c) % 5) {
+            case 0:
+               assert(maintained_product_set_row_a(p, i, u) == 0);
+               memcpy(a->data[i], u, n * sizeof(matrix_element));
+               break;
+            case 1:
+               assert(maintained_product_set_column_a(p, i, u) == 0);
+               for(size_t j = 0; j < n; j++) a->data[j][i] = u[j];
+               break;
+            case 2:
+               assert(maintained_product_set_row_b(p, i, u) == 0);
+               memcpy(b->data[i], u, n * sizeof(matrix_element));
+               break;
+            case 3:
+               assert(maintained_product_set_column_b(p, i, u) == 0);
+               for(size_t j = 0; j < n; j++) b->data[j][i] = u[j];
+               break;
+            default:
+               // a rank-2 update of A
+               for(size_t j = 0; j < 2 * n; j++) {
+                  u[j] = rand() % 3 - 1;
+                  v[j] = rand() % 3 - 1;
+               }
+               assert(maintained_product_update_a(p, u, v, 2) == 0);
+               for(size_t x = 0; x < n; x++)
+                  for(size_t y = 0; y < n; y++)
+                     a->data[x][y] += u[x] * v[y] + u[n + x] * v[n + y];
+         }
+      }
+      square_matrix* c = maintained_product_result(p);
+      t_incremental += clock_seconds();
+      assert(c != NULL);
+
+      start_timer();
+      square_matrix* expected = mul_square_matrices_threads(a, b, num_threads);
+      t_scratch += clock_seconds();
+      assert(expected != NULL);
+
+      r = compare_square_matrices(expected, c);
+      free_square_matrix(expected);
+      free_square_matrix(c);
+   }
+
+   printf("%lu rounds of %d changes: incremental %lf sec, from scratch %lf sec\n",
+          num_rounds, CHANGES_PER_ROUND, t_incremental, t_scratch);
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free(u);
+   free(v);
+   free_maintained_product(p);
+   free_square_matrix(a);
+   free_square_matrix(b);
+
+   return r;
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include "square_matrix3.h"
+#include "modular_matrix.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           70
+#define DEFAULT_NUM_THREADS 4
+#define MAX_POWER           13
+
+static const matrix_element moduli[] = {2, 7, 65521, 1000003, 998244353, INT_MAX};
+
+// elements over the whole int range, negative ones included
+static void fill_signed_square_matrix(square_matrix* m)
+{
+   for(size_t i = 0; i < m->order; i++)
+      for(size_t j = 0; j < m->order; j++)
+         m->data[i][j] = (matrix_element) ((unsigned) rand() * 2654435761u);
+}
+
+static long long mod(long long x, long long p)
+{
+   x %= p;
+   return x < 0 ? x + p : x;
+}
+
+// the product with every term reduced, the obvious way
+static square_matrix* mul_mod_reference(square_matrix* m1, square_matrix* m2, long long p)
+{
+   size_t n = m1->order;
+   square_matrix* res = new_square_matrix(n);
+   assert(res != NULL);
+
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++) {
+         long long sum = 0;
+         for(size_t k = 0; k < n; k++)
+            sum = (sum + mod(m1->data[i][k], p) * mod(m2->data[k][j], p)) % p;
+         res->data[i][j] = (matrix_element) sum;
+      }
+   return res;
+}
+
+static int check_modulus(square_matrix* m1, square_matrix* m2, matrix_element p, size_t num_threads)
+{
+   size_t n = m1->order;
+   square_matrix* r1 = reduce_square_matrix_mod(m1, p);
+   square_matrix* sum = add_square_matrices_mod(m1, m2, p);
+   square_matrix* prod = mul_square_matrices_mod(m1, m2, p);
+   square_matrix* expected = mul_mod_reference(m1, m2, p);
+   assert(r1 != NULL && sum != NULL && prod != NULL);
+
+   int r = compare_square_matrices(prod, expected);
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++)
+         if(r1->data[i][j] != mod(m1->data[i][j], p) ||
+            sum->data[i][j] != mod(mod(m1->data[i][j], p) + mod(m2->data[i][j], p), p))
+            r = 1;
+
+   for(size_t t = 1; t <= num_threads; t++) {
+      square_matrix* res = mul_square_matrices_mod_threads(m1, m2, p, t);
+      r |= res == NULL || compare_square_matrices(res, expected) != 0;
+      free_square_matrix(res);
+   }
+
+   // m1^k against k-1 reference products
+   square_matrix* power = reduce_square_matrix_mod(m1, p);
+   for(unsigned long k = 1; k <= MAX_POWER; k++) {
+      square_matrix* res = pow_square_matrix_mod_threads(m1, k, p, num_threads);
+      r |= res == NULL || compare_square_matrices(res, power) != 0;
+      free_square_matrix(res);
+
+      square_matrix* next = mul_mod_reference(power, m1, p);
+      free_square_matrix(power);
+      power = next;
+   }
+   square_matrix* identity = pow_square_matrix_mod_threads(m1, 0, p, num_threads);
+   r |= identity == NULL;
+   for(size_t i = 0; identity && i < n; i++)
+      for(size_t j = 0; j < n; j++)
+         r |= identity->data[i][j] != (i == j);
+
+   free_square_matrix(r1);
+   free_square_matrix(sum);
+   free_square_matrix(prod);
+   free_square_matrix(expected);
+   free_square_matrix(power);
+   free_square_matrix(identity);
+   return r;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   num_threads = num_threads ? num_threads : 1;
+
+   square_matrix* m1 = new_square_matrix(n);
+   square_matrix* m2 = new_square_matrix(n);
+   assert(m1 != NULL && m2 != NULL);
+   fill_signed_square_matrix(m1);
+   fill_signed_square_matrix(m2);
+
+   int r = 0;
+   start_timer();
+   for(size_t k = 0; k < sizeof(moduli) / sizeof(moduli[0]); k++) {
+      int rc = check_modulus(m1, m2, moduli[k], num_threads);
+      printf("   mod %d: %s\n", moduli[k], rc ? "differs" : "ok");
+      r |= rc;
+   }
+   printf("Time: %lf sec\n", clock_seconds());
+
+   // moduli out of range are refused
+   if(mul_square_matrices_mod(m1, m2, 1) != NULL || add_square_matrices_mod(m1, m2, 0) != NULL ||
+      reduce_square_matrix_mod(m1, -7) != NULL)
+      r = 1;
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free_square_matrix(m1);
+   free_square_matrix(m2);
+
+   return r;
+}
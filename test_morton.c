@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "morton_matrix.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           1000
+#define DEFAULT_NUM_THREADS 2
+
+/*
+ * Check a Morton result against the row-major one, print both times,
+ * and free both results. Return 0 if they match.
+ */
+static int report(const char* op, square_matrix* expected, double t_rows, morton_matrix* z, double t_morton)
+{
+   assert(expected != NULL && z != NULL);
+   square_matrix* res = morton_to_square_matrix_threads(z, 1);
+   assert(res != NULL);
+   int r = compare_square_matrices(expected, res);
+
+   printf("%-10s row-major %lf sec, Morton %lf sec (%.2lfx)\n", op, t_rows, t_morton, t_rows / t_morton);
+
+   free_square_matrix(res);
+   free_square_matrix(expected);
+   free_morton_matrix(z);
+
+   return r;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+
+   square_matrix* m1 = new_square_matrix(n);
+   square_matrix* m2 = new_square_matrix(n);
+   assert(m1 != NULL && m2 != NULL);
+   fill_square_matrix(m1);
+   fill_square_matrix(m2);
+
+   start_timer();
+   morton_matrix* z1 = square_to_morton_matrix_threads(m1, num_threads);
+   double t_to = clock_seconds();
+   morton_matrix* z2 = square_to_morton_matrix_threads(m2, num_threads);
+   assert(z1 != NULL && z2 != NULL);
+
+   start_timer();
+   square_matrix* back = morton_to_square_matrix_threads(z1, num_threads);
+   double t_from = clock_seconds();
+   assert(back != NULL);
+   int r = compare_square_matrices(m1, back);
+   free_square_matrix(back);
+   printf("Conversion to Morton %lf sec, back %lf sec (padded order %lu)\n", t_to, t_from, z1->padded);
+
+   double t_rows, t_morton;
+   square_matrix* expected;
+   morton_matrix* z;
+
+   start_timer();
+   expected = add_square_matrices_threads(m1, m2, num_threads);
+   t_rows = clock_seconds();
+   start_timer();
+   z = add_morton_matrices_threads(z1, z2, num_threads);
+   t_morton = clock_seconds();
+   if(r == 0) r = report("Addition", expected, t_rows, z, t_morton);
+
+   start_timer();
+   expected = transpose_square_matrix_threads(m1, num_threads);
+   t_rows = clock_seconds();
+   start_timer();
+   z = transpose_morton_matrix_threads(z1, num_threads);
+   t_morton = clock_seconds();
+   if(r == 0) r = report("Transpose", expected, t_rows, z, t_morton);
+
+   start_timer();
+   expected = mul_square_matrices_threads(m1, m2, num_threads);
+   t_rows = clock_seconds();
+   start_timer();
+   z = mul_morton_matrices_threads(z1, z2, num_threads);
+   t_morton = clock_seconds();
+   if(r == 0) r = report("Multiply", expected, t_rows, z, t_morton);
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free_morton_matrix(z1);
+   free_morton_matrix(z2);
+   free_square_matrix(m1);
+   free_square_matrix(m2);
+
+   return r;
+}
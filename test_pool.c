@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "square_matrix3.h"
+#include "matrix_pool.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           100
+#define DEFAULT_NUM_THREADS 4
+#define ROUNDS              2000
+#define NUM_ORDERS          3
+
+// what the pool counts for a matrix of order n
+static size_t matrix_bytes(size_t n)
+{
+   return sizeof(square_matrix) + n * sizeof(matrix_element*) + n * n * sizeof(matrix_element);
+}
+
+// compare the counters with the expected values, printing the first difference
+static int check_stats(const char* what, size_t hits, size_t misses, size_t recycled, size_t discarded,
+                       size_t cached_matrices, size_t cached_bytes)
+{
+   matrix_pool_stats s;
+   matrix_pool_get_stats(&s);
+   int r = s.hits != hits || s.misses != misses || s.recycled != recycled || s.discarded != discarded ||
+           s.cached_matrices != cached_matrices || s.cached_bytes != cached_bytes;
+   if(r)
+      printf("   %s: %lu hits, %lu misses, %lu recycled, %lu discarded, %lu cached in %lu bytes\n",
+             what, s.hits, s.misses, s.recycled, s.discarded, s.cached_matrices, s.cached_bytes);
+   return r;
+}
+
+// start over from an empty pool with zero counters
+static void reset_pool(size_t per_order, size_t bytes)
+{
+   matrix_pool_drain();
+   matrix_pool_set_limits(per_order, bytes);
+   matrix_pool_reset_stats();
+}
+
+static int check_counts(size_t n)
+{
+   reset_pool(2, MATRIX_POOL_DEFAULT_BYTES);
+
+   // a freed matrix is the next one of its order
+   square_matrix* m = new_square_matrix(n);
+   assert(m != NULL);
+   free_square_matrix(m);
+   int r = check_stats("free", 0, 1, 1, 0, 1, matrix_bytes(n));
+   square_matrix* again = new_square_matrix(n);
+   r |= again != m || again->order != n;
+   r |= check_stats("take", 1, 1, 1, 0, 0, 0);
+   free_square_matrix(again);
+
+   // at most two of an order are kept, and only the same order is reused
+   square_matrix* ms[3];
+   for(size_t i = 0; i < 3; i++)
+      assert((ms[i] = new_square_matrix(n)) != NULL);
+   for(size_t i = 0; i < 3; i++)
+      free_square_matrix(ms[i]);
+   r |= check_stats("per order", 2, 3, 4, 1, 2, 2 * matrix_bytes(n));
+   m = new_square_matrix(n + 1);
+   r |= check_stats("other order", 2, 4, 4, 1, 2, 2 * matrix_bytes(n));
+   free_square_matrix(m);
+
+   // lowering the limit frees what is over it at once
+   matrix_pool_set_limits(1, MATRIX_POOL_DEFAULT_BYTES);
+   r |= check_stats("lower limit", 2, 4, 5, 1, 2, matrix_bytes(n) + matrix_bytes(n + 1));
+
+   // order 0 has nothing worth keeping, so it is not offered to the pool
+   m = new_square_matrix(0);
+   assert(m != NULL);
+   free_square_matrix(m);
+   r |= check_stats("order 0", 2, 5, 5, 1, 2, matrix_bytes(n) + matrix_bytes(n + 1));
+   return r;
+}
+
+static int check_byte_limit(size_t n)
+{
+   size_t small = n / 4 + 1, medium = n / 2 + 1, large = n;
+   reset_pool(4, matrix_bytes(small) + matrix_bytes(large));
+
+   square_matrix* s = new_square_matrix(small);
+   square_matrix* m = new_square_matrix(medium);
+   square_matrix* l = new_square_matrix(large);
+   assert(s != NULL && m != NULL && l != NULL);
+   free_square_matrix(s);
+   free_square_matrix(m);
+   int r = check_stats("small and medium", 0, 3, 2, 0, 2, matrix_bytes(small) + matrix_bytes(medium));
+
+   // room for the large one is made by evicting the medium one, not the small one
+   free_square_matrix(l);
+   r |= check_stats("large", 0, 3, 3, 0, 2, matrix_bytes(small) + matrix_bytes(large));
+   square_matrix* ms = new_square_matrix(medium);
+   square_matrix* ss = new_square_matrix(small);
+   square_matrix* ls = new_square_matrix(large);
+   r |= ss != s || ls != l;
+   r |= check_stats("after eviction", 2, 4, 3, 0, 0, 0);
+   free_square_matrix(ms);
+   free_square_matrix(ss);
+   free_square_matrix(ls);
+
+   // the large matrix again takes the medium one's place; tightening
+   // the byte limit then evicts it, the largest order, first
+   matrix_pool_set_limits(4, matrix_bytes(small) + matrix_bytes(medium));
+   r |= check_stats("tighter", 2, 4, 6, 0, 1, matrix_bytes(small));
+
+   // a matrix bigger than the whole pool is never kept
+   matrix_pool_set_limits(4, matrix_bytes(large) - 1);
+   l = new_square_matrix(large);
+   assert(l != NULL);
+   free_square_matrix(l);
+   r |= check_stats("too large", 2, 5, 6, 1, 1, matrix_bytes(small));
+   return r;
+}
+
+static int check_disabled(size_t n)
+{
+   reset_pool(MATRIX_POOL_DEFAULT_PER_ORDER, MATRIX_POOL_DEFAULT_BYTES);
+   square_matrix* m = new_square_matrix(n);
+   assert(m != NULL);
+   free_square_matrix(m);
+
+   // limits of zero empty the pool and keep nothing after
+   matrix_pool_set_limits(0, 0);
+   int r = check_stats("disable", 0, 1, 1, 0, 0, 0);
+   m = new_square_matrix(n);
+   assert(m != NULL);
+   free_square_matrix(m);
+   r |= check_stats("disabled", 0, 2, 1, 1, 0, 0);
+   return r;
+}
+
+typedef struct {
+   size_t id, n;
+   int r;
+} thread_arg_t_pool;
+
+/*
+ * Allocate, fill and free matrices of a few orders. A matrix handed to
+ * two threads at once would not keep the elements its thread wrote.
+ */
+static void * thread_churn(void * p_arg)
+{
+   thread_arg_t_pool *p = p_arg;
+   for(size_t round = 0; round < ROUNDS; round++) {
+      size_t order = p->n / (1 + (p->id + round) % NUM_ORDERS);
+      square_matrix* m = new_square_matrix(order);
+      if(m == NULL || m->order != order) {
+         p->r = 1;
+         return NULL;
+      }
+      for(size_t e = 0; e < order * order; e++)
+         m->data[0][e] = (matrix_element) p->id;
+      for(size_t e = 0; e < order * order; e++)
+         p->r |= m->data[0][e] != (matrix_element) p->id;
+      free_square_matrix(m);
+   }
+   return NULL;
+}
+
+static int check_threads(size_t n, size_t num_threads, double* seconds)
+{
+   pthread_t tid[num_threads];
+   thread_arg_t_pool args[num_threads];
+
+   start_timer();
+   for(size_t i = 0; i < num_threads; i ++) {
+      args[i] = (thread_arg_t_pool){.id = i, .n = n, .r = 0};
+      int status = pthread_create(&tid[i], NULL, thread_churn, &args[i]);
+      assert(status == 0); // could have handled errors better
+   }
+
+   int r = 0;
+   for(size_t i = 0; i < num_threads; i ++) {
+      pthread_join(tid[i], NULL);
+      r |= args[i].r;
+   }
+   *seconds = clock_seconds();
+
+   // every allocation and every free was counted once
+   matrix_pool_stats s;
+   matrix_pool_get_stats(&s);
+   r |= s.hits + s.misses != num_threads * ROUNDS || s.recycled + s.discarded != num_threads * ROUNDS;
+   r |= s.recycled != s.hits + s.cached_matrices;
+   return r;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   n = n < NUM_ORDERS ? NUM_ORDERS : n;
+   num_threads = num_threads ? num_threads : 1;
+
+   int r = 0, rc;
+   rc = check_counts(n);
+   printf("   counts:     %s\n", rc ? "differ" : "ok");
+   r |= rc;
+   rc = check_byte_limit(n);
+   printf("   byte limit: %s\n", rc ? "differs" : "ok");
+   r |= rc;
+   rc = check_disabled(n);
+   printf("   disabled:   %s\n", rc ? "differs" : "ok");
+   r |= rc;
+
+   double pooled, unpooled;
+   reset_pool(MATRIX_POOL_DEFAULT_PER_ORDER, MATRIX_POOL_DEFAULT_BYTES);
+   rc = check_threads(n, num_threads, &pooled);
+   reset_pool(0, 0);
+   rc |= check_threads(n, num_threads, &unpooled);
+   printf("   threads:    %s\n", rc ? "differ" : "ok");
+   r |= rc;
+   printf("%lu threads x %d matrices: pooled %lf sec, unpooled %lf sec\n", num_threads, ROUNDS, pooled, unpooled);
+
+   matrix_pool_set_limits(MATRIX_POOL_DEFAULT_PER_ORDER, MATRIX_POOL_DEFAULT_BYTES);
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   return r;
+}
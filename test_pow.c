@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "square_matrix3.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           100
+#define DEFAULT_NUM_THREADS 4
+#define DENSE_N             5
+
+// the first powers, one odd one, and one large enough for many squarings
+static const unsigned long powers[] = {0, 1, 2, 7, 1000};
+
+// a permutation matrix with random signs: its powers stay in {-1, 0, 1}
+static square_matrix* random_signed_permutation(size_t n)
+{
+   square_matrix* m = new_square_matrix(n);
+   size_t* perm = malloc((n ? n : 1) * sizeof(size_t));
+   assert(m != NULL && perm != NULL);
+
+   for(size_t i = 0; i < n; i++)
+      perm[i] = i;
+   for(size_t i = n; i > 1; i--) {
+      size_t j = (size_t) rand() % i, t = perm[i-1];
+      perm[i-1] = perm[j];
+      perm[j] = t;
+   }
+
+   for(size_t i = 0; i < n; i++) {
+      for(size_t j = 0; j < n; j++)
+         m->data[i][j] = 0;
+      m->data[i][perm[i]] = rand() % 2 ? 1 : -1;
+   }
+   free(perm);
+   return m;
+}
+
+static square_matrix* identity(size_t n)
+{
+   square_matrix* m = new_square_matrix(n);
+   assert(m != NULL);
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++)
+         m->data[i][j] = i == j;
+   return m;
+}
+
+/*
+ * Compare m^k for every k in powers up to max_k with k - 1 repeated
+ * products. Return 0 if they all match.
+ */
+static int check_powers(square_matrix* m, unsigned long max_k, size_t num_threads)
+{
+   int r = 0;
+   size_t next = 0;
+   square_matrix* expected = identity(m->order);
+
+   for(unsigned long k = 0; k <= max_k; k++) {
+      if(next < sizeof(powers) / sizeof(powers[0]) && powers[next] == k) {
+         for(size_t t = 1; t <= num_threads; t++) {
+            square_matrix* res = pow_square_matrix_threads(m, k, t);
+            r |= res == NULL || compare_square_matrices(res, expected) != 0;
+            free_square_matrix(res);
+         }
+         next++;
+      }
+
+      if(k < max_k) {
+         square_matrix* prod = mul_square_matrices(expected, m);
+         assert(prod != NULL);
+         free_square_matrix(expected);
+         expected = prod;
+      }
+   }
+
+   free_square_matrix(expected);
+   return r;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   num_threads = num_threads ? num_threads : 1;
+
+   // empty and small matrices, and the order given
+   size_t orders[] = {0, 1, 2, 17, n};
+   int r = 0;
+   for(size_t i = 0; i < sizeof(orders) / sizeof(orders[0]); i++) {
+      square_matrix* m = random_signed_permutation(orders[i]);
+      int rc = check_powers(m, powers[sizeof(powers) / sizeof(powers[0]) - 1], num_threads);
+      printf("   order %lu: %s\n", orders[i], rc ? "differs" : "ok");
+      r |= rc;
+      free_square_matrix(m);
+   }
+
+   // a dense matrix, small enough that its first powers do not overflow
+   square_matrix* m = new_square_matrix(DENSE_N);
+   assert(m != NULL);
+   for(size_t i = 0; i < DENSE_N; i++)
+      for(size_t j = 0; j < DENSE_N; j++)
+         m->data[i][j] = rand() % 5 - 2;
+   int rc = check_powers(m, powers[3], num_threads);
+   printf("   dense order %d: %s\n", DENSE_N, rc ? "differs" : "ok");
+   r |= rc;
+   free_square_matrix(m);
+
+   r |= pow_square_matrix_threads(NULL, 2, num_threads) != NULL;
+
+   m = random_signed_permutation(n);
+   r |= pow_square_matrix_threads(m, 2, 0) != NULL;
+   start_timer();
+   square_matrix* res = pow_square_matrix_threads(m, powers[sizeof(powers) / sizeof(powers[0]) - 1], num_threads);
+   printf("Power %lu of order %lu: %lf sec\n", powers[sizeof(powers) / sizeof(powers[0]) - 1], n, clock_seconds());
+   free_square_matrix(res);
+   free_square_matrix(m);
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   return r;
+}
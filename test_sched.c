@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include "square_matrix3.h"
+#include "chunk_sched.h"
+#include "matrix_threads.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           1000
+#define DEFAULT_NUM_THREADS 4
+#define DEFAULT_NUM_HOGS    1
+
+typedef struct {
+   size_t id, num_threads;
+   square_matrix *m1, *m2, *res;
+   chunk_sched *sched;          // NULL for a static split
+   atomic_int *claims;          // times each unit was claimed
+} thread_arg_t_sched;
+
+static atomic_int hogging;
+
+// keep a core busy, as a co-tenant would
+static void * thread_hog(void * p_arg)
+{
+   (void) p_arg;
+   volatile unsigned long x = 0;
+   while(atomic_load_explicit(&hogging, memory_order_relaxed))
+      x++;
+   return NULL;
+}
+
+// rows first..last-1 of the product, IKJ
+static void mul_rows(thread_arg_t_sched* p, size_t first, size_t last)
+{
+   size_t n = p->m1->order;
+   matrix_element** data1 = p->m1->data;
+   matrix_element** data2 = p->m2->data;
+   matrix_element** data  = p->res->data;
+
+   for(size_t i = first; i < last; i++) {
+      memset(data[i], 0, n * sizeof(matrix_element));
+      for(size_t k = 0; k < n; k++)
+         for(size_t j = 0; j < n; j++)
+            data[i][j] += data1[i][k] * data2[k][j];
+   }
+}
+
+static void * thread_mul(void * p_arg)
+{
+   thread_arg_t_sched *p = p_arg;
+   size_t n = p->m1->order;
+
+   if(p->sched == NULL) {
+      // contiguous blocks, the remainder on the last thread
+      size_t per_thread = n / p->num_threads;
+      size_t first = p->id * per_thread;
+      mul_rows(p, first, p->id + 1 == p->num_threads ? n : first + per_thread);
+   }
+   else {
+      size_t first, last;
+      while(chunk_sched_next(p->sched, &first, &last))
+         mul_rows(p, first, last);
+   }
+
+   return NULL;
+}
+
+static void * thread_claim(void * p_arg)
+{
+   thread_arg_t_sched *p = p_arg;
+   size_t first, last;
+   while(chunk_sched_next(p->sched, &first, &last))
+      for(size_t i = first; i < last; i++)
+         atomic_fetch_add(&p->claims[i], 1);
+   return NULL;
+}
+
+DEFINE_RUN_THREADS(thread_arg_t_sched)
+
+/*
+ * Claim size units with both policies and check each is claimed once.
+ */
+static int check_coverage(size_t size, size_t min_chunk, size_t num_threads)
+{
+   atomic_int* claims = calloc(size ? size : 1, sizeof(atomic_int));
+   assert(claims != NULL);
+   int r = 0;
+
+   for(chunk_policy policy = CHUNK_GUIDED; policy <= CHUNK_DYNAMIC && r == 0; policy++) {
+      memset(claims, 0, size * sizeof(atomic_int));
+      chunk_sched sched;
+      chunk_sched_init(&sched, size, num_threads, min_chunk, policy);
+      run_threads(thread_claim, (thread_arg_t_sched){.sched = &sched, .claims = claims}, num_threads);
+      for(size_t i = 0; i < size && r == 0; i++)
+         r = claims[i] != 1;
+   }
+
+   free(claims);
+   return r;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   size_t num_hogs = (argc < 4 ? DEFAULT_NUM_HOGS : atol(argv[3]) );
+   n = n ? n : 1;
+   num_threads = num_threads ? num_threads : 1;
+
+   int r = 0;
+   for(size_t size = 0; size < 5000 && r == 0; size = 3 * size + 7)
+      r = check_coverage(size, size % 5, num_threads);
+
+   square_matrix* m1 = new_square_matrix(n);
+   square_matrix* m2 = new_square_matrix(n);
+   square_matrix* res = new_square_matrix(n);
+   assert(m1 != NULL && m2 != NULL && res != NULL);
+   fill_square_matrix(m1);
+   fill_square_matrix(m2);
+
+   square_matrix* expected = mul_square_matrices(m1, m2);
+   assert(expected != NULL);
+
+   // the library kernels, which now schedule dynamically
+   square_matrix* prod = mul_square_matrices_threads(m1, m2, num_threads);
+   square_matrix* sum = add_square_matrices_threads(m1, m2, num_threads);
+   square_matrix* sum1 = add_square_matrices(m1, m2);
+   square_matrix* tr = transpose_square_matrix_threads(m1, num_threads);
+   square_matrix* tr1 = transpose_square_matrix(m1);
+   if(r == 0) r = compare_square_matrices(expected, prod);
+   if(r == 0) r = compare_square_matrices(sum1, sum);
+   if(r == 0) r = compare_square_matrices(tr1, tr);
+
+   // the same row kernel split three ways, with hogs on the cores
+   pthread_t hogs[num_hogs ? num_hogs : 1];
+   atomic_store(&hogging, 1);
+   for(size_t i = 0; i < num_hogs; i++) {
+      int status = pthread_create(&hogs[i], NULL, thread_hog, NULL);
+      assert(status == 0); // could have handled errors better
+   }
+
+   const char* names[] = {"static", "guided", "dynamic"};
+   for(int s = 0; s < 3 && r == 0; s++) {
+      chunk_sched sched;
+      chunk_sched_init(&sched, n, num_threads, 1, s == 1 ? CHUNK_GUIDED : CHUNK_DYNAMIC);
+
+      start_timer();
+      run_threads(thread_mul, (thread_arg_t_sched){.m1 = m1, .m2 = m2, .res = res, .sched = s ? &sched : NULL}, num_threads);
+      printf("%-8s %lu threads, %lu hogs: %lf wall clock sec\n", names[s], num_threads, num_hogs, clock_seconds());
+
+      r = compare_square_matrices(expected, res);
+   }
+
+   atomic_store(&hogging, 0);
+   for(size_t i = 0; i < num_hogs; i++)
+      pthread_join(hogs[i], NULL);
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free_square_matrix(expected);
+   free_square_matrix(prod);
+   free_square_matrix(sum);
+   free_square_matrix(sum1);
+   free_square_matrix(tr);
+   free_square_matrix(tr1);
+   free_square_matrix(res);
+   free_square_matrix(m1);
+   free_square_matrix(m2);
+
+   return r;
+}
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "square_matrix3.h"
+#include "semiring_matrix.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           200
+#define DEFAULT_NUM_THREADS 4
+#define MAX_WEIGHT          1000
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+typedef enum {
+   PLUS_TIMES,
+   MIN_PLUS,
+   MAX_PLUS,
+   MAX_MIN,
+   MIN_MAX
+} semiring;
+
+typedef square_matrix* (*semiring_mul)(square_matrix*, square_matrix*);
+typedef square_matrix* (*semiring_mul_threads)(square_matrix*, square_matrix*, size_t);
+
+static const struct {
+   const char* name;
+   semiring_mul mul;
+   semiring_mul_threads mul_threads;
+   matrix_element no_edge;
+} semirings[] = {
+   {"plus_times", mul_square_matrices_plus_times, mul_square_matrices_plus_times_threads, 0},
+   {"min_plus",   mul_square_matrices_min_plus,   mul_square_matrices_min_plus_threads,   SEMIRING_INF},
+   {"max_plus",   mul_square_matrices_max_plus,   mul_square_matrices_max_plus_threads,   SEMIRING_NEG_INF},
+   {"max_min",    mul_square_matrices_max_min,    mul_square_matrices_max_min_threads,    SEMIRING_NEG_INF},
+   {"min_max",    mul_square_matrices_min_max,    mul_square_matrices_min_max_threads,    SEMIRING_INF},
+};
+
+// edge weights 1..MAX_WEIGHT with probability density, no_edge otherwise
+static square_matrix* random_graph(size_t n, double density, matrix_element no_edge)
+{
+   square_matrix* m = new_square_matrix(n);
+   assert(m != NULL);
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++)
+         m->data[i][j] = rand() < density * RAND_MAX ? rand() % MAX_WEIGHT + 1 : no_edge;
+   return m;
+}
+
+static int is_inf(matrix_element x)
+{
+   return x >= SEMIRING_INF || x <= SEMIRING_NEG_INF;
+}
+
+// c[i][j] = ADD over k of MUL(m1[i][k], m2[k][j]), element by element
+static square_matrix* mul_reference(semiring s, square_matrix* m1, square_matrix* m2)
+{
+   size_t n = m1->order;
+   square_matrix* res = new_square_matrix(n);
+   assert(res != NULL);
+
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++) {
+         matrix_element acc = semirings[s].no_edge;
+         for(size_t k = 0; k < n; k++) {
+            matrix_element a = m1->data[i][k], b = m2->data[k][j];
+            switch(s) {
+               case PLUS_TIMES: acc += a * b; break;
+               case MIN_PLUS:   acc = MIN(acc, is_inf(a) || is_inf(b) ? SEMIRING_INF : a + b);     break;
+               case MAX_PLUS:   acc = MAX(acc, is_inf(a) || is_inf(b) ? SEMIRING_NEG_INF : a + b); break;
+               case MAX_MIN:    acc = MAX(acc, MIN(a, b)); break;
+               case MIN_MAX:    acc = MIN(acc, MAX(a, b)); break;
+            }
+         }
+         res->data[i][j] = acc;
+      }
+   return res;
+}
+
+// a copy of m, element by element
+static square_matrix* copy_graph(square_matrix* m)
+{
+   size_t n = m->order;
+   square_matrix* c = new_square_matrix(n);
+   assert(c != NULL);
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++)
+         c->data[i][j] = m->data[i][j];
+   return c;
+}
+
+// Floyd-Warshall shortest path lengths; a vertex is at distance 0 from itself
+static square_matrix* floyd_warshall(square_matrix* m)
+{
+   size_t n = m->order;
+   square_matrix* d = copy_graph(m);
+   for(size_t i = 0; i < n; i++)
+      d->data[i][i] = MIN(d->data[i][i], 0);
+
+   for(size_t k = 0; k < n; k++)
+      for(size_t i = 0; i < n; i++)
+         if(d->data[i][k] < SEMIRING_INF)
+            for(size_t j = 0; j < n; j++)
+               if(d->data[k][j] < SEMIRING_INF)
+                  d->data[i][j] = MIN(d->data[i][j], d->data[i][k] + d->data[k][j]);
+   return d;
+}
+
+// Floyd-Warshall widest path capacities; a vertex reaches itself unbounded
+static square_matrix* floyd_warshall_widest(square_matrix* m)
+{
+   size_t n = m->order;
+   square_matrix* w = copy_graph(m);
+   for(size_t i = 0; i < n; i++)
+      w->data[i][i] = SEMIRING_INF;
+
+   for(size_t k = 0; k < n; k++)
+      for(size_t i = 0; i < n; i++)
+         for(size_t j = 0; j < n; j++)
+            w->data[i][j] = MAX(w->data[i][j], MIN(w->data[i][k], w->data[k][j]));
+   return w;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   n = n ? n : 1;
+   num_threads = num_threads ? num_threads : 1;
+
+   int r = 0;
+   for(semiring s = PLUS_TIMES; s <= MIN_MAX; s++) {
+      square_matrix* m1 = random_graph(n, 0.3, semirings[s].no_edge);
+      square_matrix* m2 = random_graph(n, 0.3, semirings[s].no_edge);
+      square_matrix* expected = mul_reference(s, m1, m2);
+
+      square_matrix* res = semirings[s].mul(m1, m2);
+      int rc = res == NULL || compare_square_matrices(res, expected) != 0;
+      free_square_matrix(res);
+
+      for(size_t t = 1; t <= num_threads; t++) {
+         res = semirings[s].mul_threads(m1, m2, t);
+         rc |= res == NULL || compare_square_matrices(res, expected) != 0;
+         free_square_matrix(res);
+      }
+      printf("   %-10s product: %s\n", semirings[s].name, rc ? "differs" : "ok");
+      r |= rc;
+
+      free_square_matrix(m1);
+      free_square_matrix(m2);
+      free_square_matrix(expected);
+   }
+
+   // sparse graphs, so that the closures need several squarings
+   square_matrix* g = random_graph(n, 3.0 / n, SEMIRING_INF);
+   square_matrix* dist = floyd_warshall(g);
+   start_timer();
+   square_matrix* res = min_plus_closure_square_matrix_threads(g, num_threads);
+   printf("   shortest paths: %lf sec, %s\n", clock_seconds(),
+          res && compare_square_matrices(res, dist) == 0 ? "ok" : "differs");
+   r |= res == NULL || compare_square_matrices(res, dist) != 0;
+   free_square_matrix(res);
+   free_square_matrix(dist);
+   free_square_matrix(g);
+
+   g = random_graph(n, 3.0 / n, SEMIRING_NEG_INF);
+   square_matrix* width = floyd_warshall_widest(g);
+   start_timer();
+   res = max_min_closure_square_matrix_threads(g, num_threads);
+   printf("   widest paths:   %lf sec, %s\n", clock_seconds(),
+          res && compare_square_matrices(res, width) == 0 ? "ok" : "differs");
+   r |= res == NULL || compare_square_matrices(res, width) != 0;
+   free_square_matrix(res);
+   free_square_matrix(width);
+   free_square_matrix(g);
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   return r;
+}
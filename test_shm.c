@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/wait.h>
+#include "shared_matrix.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N        1000
+#define DEFAULT_VERSIONS 200
+
+/*
+ * Take a snapshot and return 1 if it is torn: not all elements equal.
+ */
+static int torn_snapshot(square_matrix* shared, square_matrix* copy)
+{
+   size_t n = copy->order;
+   assert(snapshot_shared_square_matrix(shared, copy) == 0);
+   for(size_t e = 1; e < n * n; e++)
+      if(copy->data[0][e] != copy->data[0][0])
+         return 1;
+   return 0;
+}
+
+/*
+ * Attach to the segment, take snapshots until the last version has been
+ * seen, and check that every snapshot is a single version. The producer
+ * waits on ready for two bytes: one after the first snapshot, and one
+ * after a snapshot of a version it wrote, so the consumer overlaps the
+ * writes at least once. Return the number of torn snapshots, or -1 if
+ * fewer than two snapshots were taken.
+ */
+static int consume(const char* name, size_t n, uint64_t versions, int ready)
+{
+   square_matrix* shared = attach_shared_square_matrix(name);
+   square_matrix* copy = new_square_matrix(n);
+   assert(shared != NULL && copy != NULL && shared->order == n);
+
+   int torn = torn_snapshot(shared, copy);
+   size_t snapshots = 1;
+   assert(write(ready, "a", 1) == 1);
+
+   int signalled = 0;
+   while(shared_matrix_version(shared) < versions) {
+      torn += torn_snapshot(shared, copy);
+      snapshots++;
+      if(!signalled && copy->data[0][0] > 0) {
+         assert(write(ready, "b", 1) == 1);
+         signalled = 1;
+      }
+   }
+   close(ready);
+
+   // the final version, read in place without copying
+   uint64_t seq = shared_matrix_read_begin(shared);
+   matrix_element last = shared->data[n-1][n-1];
+   assert(!shared_matrix_read_retry(shared, seq) && last == (matrix_element) versions);
+
+   printf("Consumer took %lu snapshots\n", snapshots);
+
+   free_square_matrix(copy);
+   free_square_matrix(shared);
+
+   return snapshots < 2 ? -1 : torn;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   uint64_t versions = (argc < 3 ? DEFAULT_VERSIONS : atol(argv[2]) );
+   n = n ? n : 1;
+   versions = versions < 2 ? 2 : versions;
+
+   char name[64];
+   snprintf(name, sizeof(name), "/test_shm_%d", (int) getpid());
+
+   square_matrix* shared = create_shared_square_matrix(name, n);
+   assert(shared != NULL && is_shared_square_matrix(shared));
+
+   int ready[2];
+   assert(pipe(ready) == 0);
+
+   pid_t pid = fork();
+   assert(pid >= 0);
+   if(pid == 0) {
+      // the consumer attaches on its own; drop the producer's mapping
+      free_square_matrix(shared);
+      close(ready[0]);
+      exit(consume(name, n, versions, ready[1]) ? 1 : 0);
+   }
+   close(ready[1]);
+
+   // version v is a matrix of v's, written in place, once the consumer
+   // is reading; halfway the producer waits until it has seen a version
+   char c;
+   assert(read(ready[0], &c, 1) == 1);
+   start_timer();
+   for(uint64_t v = 1; v <= versions; v++) {
+      if(v == versions / 2 + 1)
+         assert(read(ready[0], &c, 1) == 1);
+      assert(shared_matrix_write_begin(shared) == 0);
+      for(size_t i = 0; i < n; i++)
+         for(size_t j = 0; j < n; j++)
+            shared->data[i][j] = (matrix_element) v;
+      assert(shared_matrix_write_end(shared) == 0);
+   }
+   printf("Producer wrote %lu versions: %lf wall clock sec\n", versions, clock_seconds() );
+
+   int status;
+   waitpid(pid, &status, 0);
+   int r = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+
+   close(ready[0]);
+
+   // a duplicate is a private copy: writing either side, directly or by
+   // publishing, leaves the other alone and the segment attached
+   square_matrix* dup = duplicate_square_matrix(shared);
+   assert(dup != NULL && make_square_matrix_writable(dup) == 0);
+   dup->data[0][0] = 0;
+   if(r == 0) r = is_shared_square_matrix(dup) || shared->data[0][0] != (matrix_element) versions;
+
+   square_matrix* src = new_square_matrix(n);
+   assert(src != NULL);
+   for(size_t e = 0; e < n * n; e++)
+      src->data[0][e] = 6;
+   assert(publish_shared_square_matrix(shared, src) == 0);
+   if(r == 0) r = dup->data[0][0] != 0 || shared->data[n-1][n-1] != 6;
+
+   fill_square_matrix(shared);
+   if(r == 0) r = !is_shared_square_matrix(shared) || dup->data[0][0] != 0;
+   free_square_matrix(src);
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free_square_matrix(dup);
+   free_square_matrix(shared);
+   assert(unlink_shared_square_matrix(name) == 0);
+
+   return r;
+}
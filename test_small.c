@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "small_matrix.h"
+#include "unixtimer.h"
+
+#define DEFAULT_ORDER       4
+#define DEFAULT_COUNT       200000   // enough matrices that starting the threads does not dominate
+#define DEFAULT_NUM_THREADS 2
+
+int main(int argc, char ** argv)
+{
+   size_t order = (argc < 2 ? DEFAULT_ORDER : atol(argv[1]) );
+   size_t count = (argc < 3 ? DEFAULT_COUNT : atol(argv[2]) );
+   size_t num_threads = (argc < 4 ? DEFAULT_NUM_THREADS : atol(argv[3]) );
+   size_t num_elems = order * order;
+
+   matrix_element* a = new_small_matrix_batch(order, count);
+   matrix_element* b = new_small_matrix_batch(order, count);
+   matrix_element* res1 = new_small_matrix_batch(order, count);
+   assert(a != NULL && b != NULL && res1 != NULL);
+   fill_small_matrix_batch(a, order, count);
+   fill_small_matrix_batch(b, order, count);
+
+   // one square_matrix product per pair, the way callers do it today
+   start_timer();
+   start_clock();
+   for(size_t m = 0; m < count; m++) {
+      square_matrix* m1 = new_square_matrix(order);
+      square_matrix* m2 = new_square_matrix(order);
+      assert(m1 != NULL && m2 != NULL);
+      memcpy(m1->data[0], a + m*num_elems, num_elems * sizeof(matrix_element));
+      memcpy(m2->data[0], b + m*num_elems, num_elems * sizeof(matrix_element));
+      square_matrix* p = mul_square_matrices(m1, m2);
+      assert(p != NULL);
+      memcpy(res1 + m*num_elems, p->data[0], num_elems * sizeof(matrix_element));
+      free_square_matrix(m1);
+      free_square_matrix(m2);
+      free_square_matrix(p);
+   }
+   printf("Per-matrix time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+
+   start_timer();
+   start_clock();
+   matrix_element* res2 = mul_small_matrices_batch(order, count, a, b, num_threads);
+   printf("Batched time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+   assert(res2 != NULL);
+
+   int r = 0;
+   for(size_t e = 0; e < count * num_elems; e++)
+      if(res1[e] != res2[e]) {
+         fprintf(stderr, "Mismatch found for matrix %lu element %lu: %d vs %d\n",
+                 e / num_elems, e % num_elems, res1[e], res2[e]);
+         r = 1;
+         break;
+      }
+
+   // a batch of empty matrices has an empty product
+   matrix_element* empty = mul_small_matrices_batch(0, count, a, b, num_threads);
+   if(empty == NULL)
+      r = 1;
+   free_small_matrix_batch(empty);
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free_small_matrix_batch(a);
+   free_small_matrix_batch(b);
+   free_small_matrix_batch(res1);
+   free_small_matrix_batch(res2);
+
+   return r;
+}
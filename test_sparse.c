@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "sparse_matrix.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           6
+#define DEFAULT_NUM_THREADS 2
+#define DEFAULT_PERCENT     5
+
+/*
+ * Fill given matrix with random values, keeping only about percent% of them nonzero
+ */
+static void fill_sparse_square_matrix(square_matrix* m, int percent)
+{
+   fill_square_matrix(m);
+
+   size_t n = m->order;
+   for(size_t i = 0; i < n; i ++)
+      for(size_t j = 0; j < n; j ++)
+         if(rand() % 100 >= percent)
+            m->data[i][j] = 0;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   int percent = (argc < 4 ? DEFAULT_PERCENT : atoi(argv[3]) );
+
+   square_matrix* m1 = new_square_matrix(n);
+   assert(m1 != NULL);
+   fill_sparse_square_matrix(m1, percent);
+
+   square_matrix* m2 = new_square_matrix(n);
+   assert(m2 != NULL);
+   fill_sparse_square_matrix(m2, percent);
+
+   sparse_matrix* s1 = square_to_sparse_matrix(m1, SPARSE_CSR);
+   sparse_matrix* s2 = square_to_sparse_matrix(m2, SPARSE_CSC);
+   assert(s1 != NULL && s2 != NULL);
+   printf("Density: %lf and %lf\n", square_matrix_density(m1), square_matrix_density(m2));
+
+   start_timer();
+   start_clock();
+   square_matrix* res1 = mul_square_matrices_threads(m1, m2, num_threads);
+   printf("Dense threads time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+   assert(res1 != NULL);
+
+   start_timer();
+   start_clock();
+   square_matrix* res2 = mul_sparse_dense_matrices_threads(s1, m2, num_threads);
+   printf("Sparse x dense time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+   assert(res2 != NULL);
+
+   start_timer();
+   start_clock();
+   square_matrix* res3 = mul_dense_sparse_matrices_threads(m1, s2, num_threads);
+   printf("Dense x sparse time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+   assert(res3 != NULL);
+
+   start_timer();
+   start_clock();
+   sparse_matrix* s3 = mul_sparse_matrices_threads(s1, s2, num_threads);
+   printf("Sparse x sparse time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+   assert(s3 != NULL);
+   square_matrix* res4 = sparse_to_square_matrix(s3);
+   assert(res4 != NULL);
+
+   start_timer();
+   start_clock();
+   square_matrix* res5 = mul_square_matrices_auto(m1, m2, num_threads);
+   printf("Auto time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+   assert(res5 != NULL);
+
+   int r = compare_square_matrices(res1, res2);
+   if(r == 0) r = compare_square_matrices(res1, res3);
+   if(r == 0) r = compare_square_matrices(res1, res4);
+   if(r == 0) r = compare_square_matrices(res1, res5);
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free_square_matrix(m1);
+   free_square_matrix(m2);
+   free_square_matrix(res1);
+   free_square_matrix(res2);
+   free_square_matrix(res3);
+   free_square_matrix(res4);
+   free_square_matrix(res5);
+   free_sparse_matrix(s1);
+   free_sparse_matrix(s2);
+   free_sparse_matrix(s3);
+
+   return r;
+}
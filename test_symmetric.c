@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "square_matrix3.h"
+#include "symmetric_matrix.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           300
+#define DEFAULT_NUM_THREADS 4
+
+// below, across and well beyond the SYRK block, and the one given
+static size_t orders[] = {1, 2, 31, 65, 130, DEFAULT_N};
+
+// a symmetric matrix in full square storage
+static square_matrix* random_symmetric_square_matrix(size_t n)
+{
+   square_matrix* m = new_square_matrix(n);
+   assert(m != NULL);
+   fill_square_matrix(m);
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < i; j++)
+         m->data[j][i] = m->data[i][j];
+   return m;
+}
+
+static int check_order(size_t n, size_t num_threads)
+{
+   square_matrix* m1 = random_symmetric_square_matrix(n);
+   square_matrix* m2 = random_symmetric_square_matrix(n);
+   square_matrix* a = new_square_matrix(n);
+   assert(a != NULL);
+   fill_square_matrix(a);
+
+   symmetric_matrix* s1 = square_to_symmetric_matrix(m1);
+   symmetric_matrix* s2 = square_to_symmetric_matrix(m2);
+   assert(s1 != NULL && s2 != NULL);
+
+   // packing and unpacking, and each element at its packed index
+   square_matrix* back = symmetric_to_square_matrix(s1);
+   int r = back == NULL || compare_square_matrices(back, m1) != 0;
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++)
+         r |= s1->data[SYMMETRIC_INDEX(i, j)] != m1->data[i][j];
+   free_square_matrix(back);
+
+   square_matrix* sum = add_square_matrices(m1, m2);
+   square_matrix* prod = mul_square_matrices(m1, m2);
+   square_matrix* at = transpose_square_matrix(a);
+   square_matrix* aat = mul_square_matrices(a, at);
+   symmetric_matrix* expected_sum = square_to_symmetric_matrix(sum);
+   symmetric_matrix* expected_aat = square_to_symmetric_matrix(aat);
+   assert(expected_sum != NULL && expected_aat != NULL);
+
+   for(size_t t = 1; t <= num_threads; t = (2*t > num_threads && t < num_threads ? num_threads : 2*t) ) {
+      symmetric_matrix* rs = add_symmetric_matrices_threads(s1, s2, t);
+      square_matrix* rp = mul_symmetric_square_matrices_threads(s1, m2, t);
+      start_timer();
+      symmetric_matrix* rk = syrk_square_matrix_threads(a, t);
+      double tk = clock_seconds();
+
+      r |= rs == NULL || compare_symmetric_matrices(rs, expected_sum) != 0;
+      r |= rp == NULL || compare_square_matrices(rp, prod) != 0;
+      r |= rk == NULL || compare_symmetric_matrices(rk, expected_aat) != 0;
+      if(n == orders[sizeof(orders) / sizeof(orders[0]) - 1])
+         printf("   %lu threads: syrk %lf sec\n", t, tk);
+
+      free_symmetric_matrix(rs);
+      free_square_matrix(rp);
+      free_symmetric_matrix(rk);
+   }
+
+   free_square_matrix(m1);
+   free_square_matrix(m2);
+   free_square_matrix(a);
+   free_square_matrix(sum);
+   free_square_matrix(prod);
+   free_square_matrix(at);
+   free_square_matrix(aat);
+   free_symmetric_matrix(s1);
+   free_symmetric_matrix(s2);
+   free_symmetric_matrix(expected_sum);
+   free_symmetric_matrix(expected_aat);
+   return r;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   orders[sizeof(orders) / sizeof(orders[0]) - 1] = n ? n : 1;
+   num_threads = num_threads ? num_threads : 1;
+
+   start_timer();
+   square_matrix* a = new_square_matrix(orders[sizeof(orders) / sizeof(orders[0]) - 1]);
+   assert(a != NULL);
+   fill_square_matrix(a);
+   square_matrix* at = transpose_square_matrix(a);
+   square_matrix* aat = mul_square_matrices(a, at);
+   printf("Sequential A * transpose(A): %lf sec\n", clock_seconds());
+   free_square_matrix(a);
+   free_square_matrix(at);
+   free_square_matrix(aat);
+
+   int r = 0;
+   for(size_t k = 0; k < sizeof(orders) / sizeof(orders[0]); k++) {
+      int rc = check_order(orders[k], num_threads);
+      printf("   order %lu: %s\n", orders[k], rc ? "differs" : "ok");
+      r |= rc;
+   }
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   return r;
+}
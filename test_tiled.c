@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "square_matrix3.h"
+#include "tiled_matrix.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           1000
+#define DEFAULT_NUM_THREADS 4
+
+// tiles that divide the order, leave a ragged edge, or exceed it
+static const size_t tiles[] = {1, 7, 16, TILED_DEFAULT_TILE, 100};
+
+/*
+ * Round-trip m through tiled storage, read and write single rows and
+ * columns, and transpose in place. Return 0 if everything matches.
+ */
+static int check_tile(square_matrix* m, square_matrix* mt, size_t tile, size_t num_threads)
+{
+   size_t n = m->order;
+   tiled_matrix* t = square_to_tiled_matrix_threads(m, tile, num_threads);
+   assert(t != NULL);
+
+   square_matrix* back = tiled_to_square_matrix_threads(t, num_threads);
+   int r = back == NULL || compare_square_matrices(back, m) != 0;
+   free_square_matrix(back);
+
+   // every element at its place, padding zero
+   for(size_t i = 0; i < t->tiles * tile; i++)
+      for(size_t j = 0; j < t->tiles * tile; j++)
+         r |= TILED_AT(t, i, j) != (i < n && j < n ? m->data[i][j] : 0);
+
+   matrix_element* line = malloc(n * sizeof(matrix_element));
+   assert(line != NULL);
+   for(size_t i = 0; i < n; i++) {
+      r |= get_tiled_matrix_row(t, i, line) != 0 || memcmp(line, m->data[i], n * sizeof(matrix_element)) != 0;
+      r |= get_tiled_matrix_column(t, i, line) != 0;
+      for(size_t k = 0; k < n; k++)
+         r |= line[k] != m->data[k][i];
+   }
+
+   // swap the roles: set row i from column i of m, so t becomes transpose(m)
+   tiled_matrix* u = new_tiled_matrix(n, tile);
+   assert(u != NULL);
+   for(size_t i = 0; i < n; i++) {
+      for(size_t k = 0; k < n; k++)
+         line[k] = m->data[k][i];
+      r |= set_tiled_matrix_row(u, i, line) != 0;
+   }
+   tiled_matrix* expected = square_to_tiled_matrix_threads(mt, tile, num_threads);
+   r |= compare_tiled_matrices(u, expected) != 0;
+
+   for(size_t j = 0; j < n; j++) {
+      for(size_t k = 0; k < n; k++)
+         line[k] = m->data[j][k];
+      r |= set_tiled_matrix_column(u, j, line) != 0;
+   }
+   r |= compare_tiled_matrices(u, expected) != 0;
+
+   in_place_transpose_tiled_matrix_threads(t, num_threads);
+   r |= compare_tiled_matrices(t, expected) != 0;
+   for(size_t i = n; i < t->tiles * tile; i++)
+      for(size_t j = 0; j < t->tiles * tile; j++)
+         r |= TILED_AT(t, i, j) != 0 || TILED_AT(t, j, i) != 0;
+
+   r |= get_tiled_matrix_row(t, n, line) != -1 || set_tiled_matrix_column(t, n, line) != -1;
+
+   free(line);
+   free_tiled_matrix(t);
+   free_tiled_matrix(u);
+   free_tiled_matrix(expected);
+   return r;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   n = n ? n : 1;
+   num_threads = num_threads ? num_threads : 1;
+
+   square_matrix* m = new_square_matrix(n);
+   assert(m != NULL);
+   fill_square_matrix(m);
+   square_matrix* mt = transpose_square_matrix(m);
+   assert(mt != NULL);
+
+   int r = 0;
+   for(size_t k = 0; k < sizeof(tiles) / sizeof(tiles[0]); k++)
+      for(size_t t = 1; t <= num_threads; t = (2*t > num_threads && t < num_threads ? num_threads : 2*t) ) {
+         int rc = check_tile(m, mt, tiles[k], t);
+         if(rc)
+            printf("   tile %lu, %lu threads: differs\n", tiles[k], t);
+         r |= rc;
+      }
+
+   // columns of the two layouts, the case tiles are for
+   matrix_element* col = malloc(n * sizeof(matrix_element));
+   tiled_matrix* t = square_to_tiled_matrix_threads(m, TILED_DEFAULT_TILE, num_threads);
+   assert(col != NULL && t != NULL);
+   long long sum[2] = {0, 0};
+
+   start_timer();
+   for(size_t j = 0; j < n; j++)
+      for(size_t i = 0; i < n; i++)
+         sum[0] += m->data[i][j];
+   printf("Row-major column reads: %lf sec\n", clock_seconds());
+
+   start_timer();
+   for(size_t j = 0; j < n; j++) {
+      get_tiled_matrix_column(t, j, col);
+      for(size_t i = 0; i < n; i++)
+         sum[1] += col[i];
+   }
+   printf("Tiled column reads:     %lf sec\n", clock_seconds());
+   r |= sum[0] != sum[1];
+
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free(col);
+   free_tiled_matrix(t);
+   free_square_matrix(m);
+   free_square_matrix(mt);
+
+   return r;
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "square_matrix3.h"
+#include "matrix_gemm.h"
+#include "matrix_trace.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           1000
+#define DEFAULT_NUM_THREADS 4
+#define DEFAULT_TRACE_FILE  "matrix_trace.json"
+#define EVENTS_PER_THREAD   1000
+
+static void* record_events(void* arg)
+{
+   size_t first = *(size_t*) arg;
+   for(size_t i = 0; i < EVENTS_PER_THREAD; i++) {
+      uint64_t begin = matrix_trace_now();
+      matrix_trace_record("test_event", begin, matrix_trace_now(), first + i);
+   }
+   return NULL;
+}
+
+/*
+ * Record EVENTS_PER_THREAD events with sizes first .. first+999 from each
+ * of num_threads threads, export them to path and read them back: every
+ * event must be there once, with the thread that recorded it.
+ * Return 0 if so, 1 otherwise.
+ */
+static int check_tracer(size_t num_threads, const char* path)
+{
+   size_t total = num_threads * EVENTS_PER_THREAD;
+   pthread_t* threads = malloc(num_threads * sizeof(pthread_t));
+   size_t* first = malloc(num_threads * sizeof(size_t));
+   char* seen = calloc(total, 1);
+   size_t* thread_of = calloc(total, sizeof(size_t));
+   assert(threads != NULL && first != NULL && seen != NULL && thread_of != NULL);
+
+   matrix_trace_reset();
+   matrix_trace_enable(1);
+   for(size_t t = 0; t < num_threads; t++) {
+      first[t] = t * EVENTS_PER_THREAD;
+      int status = pthread_create(&threads[t], NULL, record_events, &first[t]);
+      assert(status == 0); // could have handled errors better
+   }
+   for(size_t t = 0; t < num_threads; t++) {
+      int status = pthread_join(threads[t], NULL);
+      assert(status == 0); // could have handled errors better
+   }
+   matrix_trace_enable(0);
+   matrix_trace_record("test_event", 1, 2, total);   // disabled, not recorded
+
+   int r = matrix_trace_count() != total || matrix_trace_export(path) != 0;
+
+   // read the events back from the JSON
+   FILE* f = fopen(path, "r");
+   char line[512];
+   size_t events = 0;
+   while(r == 0 && f && fgets(line, sizeof(line), f)) {
+      const char* args = strstr(line, "\"args\":{\"size\":");
+      size_t size, thread;
+      if(strstr(line, "\"name\":\"test_event\"") == NULL || args == NULL)
+         continue;
+      if(sscanf(args, "\"args\":{\"size\":%zu,\"thread\":%zu}", &size, &thread) != 2 ||
+         size >= total || seen[size])
+         r = 1;
+      else {
+         seen[size] = 1;
+         thread_of[size] = thread;
+         events++;
+      }
+   }
+   r = r || f == NULL || events != total;
+   if(f)
+      fclose(f);
+
+   // the events of one thread share a thread number no other thread has
+   for(size_t t = 0; r == 0 && t < num_threads; t++) {
+      for(size_t i = 0; i < EVENTS_PER_THREAD; i++)
+         r |= thread_of[first[t] + i] != thread_of[first[t]];
+      for(size_t u = 0; u < t; u++)
+         r |= thread_of[first[u]] == thread_of[first[t]];
+   }
+
+   printf("Tracer: %lu threads recorded %lu events, %lu read back\n", num_threads, matrix_trace_count(), events);
+   matrix_trace_reset();
+   free(threads);
+   free(first);
+   free(seen);
+   free(thread_of);
+   return r;
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+   const char* path = (argc < 4 ? DEFAULT_TRACE_FILE : argv[3]);
+   n = n ? n : 1;
+   num_threads = num_threads ? num_threads : 1;
+
+   int r = check_tracer(num_threads, path);
+
+   square_matrix* m1 = new_square_matrix(n);
+   square_matrix* m2 = new_square_matrix(n);
+   assert(m1 != NULL && m2 != NULL);
+   fill_square_matrix(m1);
+   fill_square_matrix(m2);
+
+   // the same kernels untraced and traced
+   square_matrix* res[2][4];
+   double t[2];
+   for(int traced = 0; traced < 2; traced++) {
+      matrix_trace_enable(traced);
+      start_timer();
+      res[traced][0] = add_square_matrices_threads(m1, m2, num_threads);
+      res[traced][1] = mul_square_matrices_threads(m1, m2, num_threads);
+      res[traced][2] = transpose_square_matrix_threads(m1, num_threads);
+      res[traced][3] = gemm_square_matrices_threads(m1, MATRIX_NO_TRANS, m2, MATRIX_TRANS, num_threads);
+      t[traced] = clock_seconds();
+   }
+   matrix_trace_enable(0);
+
+   printf("Untraced %lf sec, traced %lf sec, %lu events\n", t[0], t[1], matrix_trace_count());
+   matrix_trace_print_summary(stdout);
+
+   if(r == 0) r = matrix_trace_export(path) != 0;
+#ifdef MATRIX_TRACE
+   // the trace points are compiled in
+   if(r == 0) r = matrix_trace_count() == 0;
+#endif
+   for(int k = 0; k < 4; k++) {
+      assert(res[0][k] != NULL && res[1][k] != NULL);
+      if(r == 0) r = compare_square_matrices(res[0][k], res[1][k]);
+      free_square_matrix(res[0][k]);
+      free_square_matrix(res[1][k]);
+   }
+
+   printf("Trace written to %s\n", path);
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free_square_matrix(m1);
+   free_square_matrix(m2);
+
+   return r;
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "square_matrix_ws.h"
+#include "unixtimer.h"
+
+#define DEFAULT_N           6
+#define DEFAULT_NUM_THREADS 2
+
+/*
+ * Print the busiest worker's share of the work relative to a perfect
+ * split, and the total number of steals, since the last reset.
+ */
+static void print_balance(ws_pool* pool)
+{
+   size_t num_workers = ws_pool_size(pool);
+   ws_worker_stats stats[num_workers];
+   ws_pool_stats(pool, stats);
+
+   double total = 0.0, max = 0.0;
+   size_t tasks = 0, steals = 0;
+   for(size_t i = 0; i < num_workers; i++) {
+      total += stats[i].busy_seconds;
+      if(stats[i].busy_seconds > max) max = stats[i].busy_seconds;
+      tasks += stats[i].tasks;
+      steals += stats[i].steals;
+   }
+
+   printf("   %lu tasks, %lu steals, imbalance %.3lf\n",
+          tasks, steals, total > 0.0 ? max * num_workers / total : 1.0);
+   ws_pool_reset_stats(pool);
+}
+
+int main(int argc, char ** argv)
+{
+   size_t n = (argc < 2 ? DEFAULT_N : atol(argv[1]) );
+   size_t num_threads = (argc < 3 ? DEFAULT_NUM_THREADS : atol(argv[2]) );
+
+   square_matrix* m1 = new_square_matrix(n);
+   assert(m1 != NULL);
+   fill_square_matrix(m1);
+
+   square_matrix* m2 = new_square_matrix(n);
+   assert(m2 != NULL);
+   fill_square_matrix(m2);
+
+   start_timer();
+   start_clock();
+   square_matrix* prod = mul_square_matrices(m1, m2);
+   printf("Sequential multiplication time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+   assert(prod != NULL);
+
+   square_matrix* sum = add_square_matrices(m1, m2);
+   square_matrix* tran = transpose_square_matrix(m1);
+   assert(sum != NULL && tran != NULL);
+
+   int r = 0;
+   for(size_t t = 1; t <= num_threads; t = (2*t > num_threads && t < num_threads ? num_threads : 2*t) ) {
+      ws_pool* pool = ws_pool_create(t);
+      assert(pool != NULL);
+      printf("%lu worker%s\n", t, (t == 1 ? "" : "s"));
+
+      start_timer();
+      start_clock();
+      square_matrix* res1 = mul_square_matrices_ws(m1, m2, pool);
+      printf("  Divide and conquer multiplication time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+      print_balance(pool);
+
+      start_timer();
+      start_clock();
+      square_matrix* res2 = mul_square_matrices_strassen_ws(m1, m2, pool);
+      printf("  Strassen multiplication time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+      print_balance(pool);
+
+      start_timer();
+      start_clock();
+      square_matrix* res3 = add_square_matrices_ws(m1, m2, pool);
+      printf("  Addition time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+      print_balance(pool);
+
+      start_timer();
+      start_clock();
+      square_matrix* res4 = transpose_square_matrix_ws(m1, pool);
+      printf("  Transpose time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+      print_balance(pool);
+
+      square_matrix* res5 = duplicate_square_matrix(m1);
+      assert(res5 != NULL);
+      start_timer();
+      start_clock();
+      in_place_transpose_square_matrix_ws(res5, pool);
+      printf("  In-place transpose time: %lf wall clock sec, %lf CPU sec\n", clock_seconds(), cpu_seconds() );
+      print_balance(pool);
+
+      assert(res1 != NULL && res2 != NULL && res3 != NULL && res4 != NULL);
+      if(r == 0) r = compare_square_matrices(prod, res1);
+      if(r == 0) r = compare_square_matrices(prod, res2);
+      if(r == 0) r = compare_square_matrices(sum, res3);
+      if(r == 0) r = compare_square_matrices(tran, res4);
+      if(r == 0) r = compare_square_matrices(tran, res5);
+
+      free_square_matrix(res1);
+      free_square_matrix(res2);
+      free_square_matrix(res3);
+      free_square_matrix(res4);
+      free_square_matrix(res5);
+      ws_pool_destroy(pool);
+   }
+   printf("%d %s\n", r, r ? "Do not match." : "Good work!");
+
+   free_square_matrix(m1);
+   free_square_matrix(m2);
+   free_square_matrix(prod);
+   free_square_matrix(sum);
+   free_square_matrix(tran);
+
+   return r;
+}
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+#include "tiled_matrix.h"
+#include "matrix_threads.h"
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
+#define SWAP(x,y) do { matrix_element tmp = (x); (x) = (y); (y) = tmp; } while(0)
+
+/*
+ * Allocate a zeroed tiled matrix of order n with tile x tile tiles.
+ * Return NULL if tile is 0 or the allocation is not successful.
+ */
+tiled_matrix* new_tiled_matrix(size_t n, size_t tile)
+{
+   if(tile == 0)
+      return NULL;
+
+   tiled_matrix* t = malloc(sizeof(tiled_matrix));
+   if(t == NULL)
+      return NULL;
+
+   size_t tiles = (n + tile - 1) / tile;
+   size_t page = sysconf(_SC_PAGESIZE);
+   size_t bytes = tiles * tiles * tile * tile * sizeof(matrix_element);
+   bytes = (bytes + page - 1) / page * page;   // aligned_alloc wants a multiple of the alignment
+
+   t->data = aligned_alloc(page, bytes ? bytes : page);
+   if(t->data == NULL) {
+      free(t);
+      return NULL;
+   }
+   memset(t->data, 0, bytes);
+
+   t->order = n;
+   t->tile = tile;
+   t->tiles = tiles;
+
+   return t;
+}
+
+/*
+ * Deallocate the dynamic memory allocated for the given tiled matrix.
+ */
+void free_tiled_matrix(tiled_matrix* t)
+{
+   if(t == NULL)
+      return;
+
+   free(t->data);
+   free(t);
+}
+
+/*
+ * Compare two tiled matrices, return 0 if they are the same,
+ * non-zero values otherwise. The tile orders may differ.
+ */
+int compare_tiled_matrices(tiled_matrix* t1, tiled_matrix* t2)
+{
+   if(t1 == NULL || t2 == NULL)
+      return -1;
+
+   if(t1->order != t2->order)
+      return -2;
+
+   size_t n = t1->order;
+   for(size_t i = 0; i < n; i++)
+      for(size_t j = 0; j < n; j++)
+         if(TILED_AT(t1, i, j) != TILED_AT(t2, i, j)) {
+            fprintf(stderr, "Mismatch found for element (%lu, %lu): %d vs %d\n",
+                    i, j, TILED_AT(t1, i, j), TILED_AT(t2, i, j));
+            return 1;
+         }
+
+   return 0;
+}
+
+
+typedef struct {
+   size_t id, num_threads;
+   tiled_matrix *t;
+   square_matrix *m;
+} thread_arg_t_tiled;
+
+DEFINE_RUN_THREADS(thread_arg_t_tiled)
+
+/////////////////////////////////////
+//                                 //
+// Conversions                     //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * Thread id converts tile rows id, id + num_threads, ...: a band of
+ * tile rows of the row-major matrix, read sequentially, becomes
+ * tiles contiguous tiles.
+ */
+static void * thread_to_tiled(void * p_arg)
+{
+   thread_arg_t_tiled *p = p_arg;
+   tiled_matrix* t = p->t;
+   size_t n = t->order, b = t->tile;
+   matrix_element** src = p->m->data;
+
+   for(size_t ti = p->id; ti < t->tiles; ti += p->num_threads) {
+      size_t rows = MIN(b, n - ti*b);
+      for(size_t tj = 0; tj < t->tiles; tj++) {
+         size_t cols = MIN(b, n - tj*b);
+         matrix_element* dst = TILED_TILE(t, ti, tj);
+         for(size_t r = 0; r < rows; r++)
+            memcpy(dst + r*b, src[ti*b + r] + tj*b, cols * sizeof(matrix_element));
+      }
+   }
+
+   return NULL;
+}
+
+static void * thread_from_tiled(void * p_arg)
+{
+   thread_arg_t_tiled *p = p_arg;
+   tiled_matrix* t = p->t;
+   size_t n = t->order, b = t->tile;
+   matrix_element** dst = p->m->data;
+
+   for(size_t ti = p->id; ti < t->tiles; ti += p->num_threads) {
+      size_t rows = MIN(b, n - ti*b);
+      for(size_t tj = 0; tj < t->tiles; tj++) {
+         size_t cols = MIN(b, n - tj*b);
+         const matrix_element* src = TILED_TILE(t, ti, tj);
+         for(size_t r = 0; r < rows; r++)
+            memcpy(dst[ti*b + r] + tj*b, src + r*b, cols * sizeof(matrix_element));
+      }
+   }
+
+   return NULL;
+}
+
+/*
+ * Convert a row-major matrix to tile-major storage with tile x tile
+ * tiles. Return a pointer to the newly allocated matrix or NULL if
+ * anything is wrong
+ */
+tiled_matrix* square_to_tiled_matrix_threads(square_matrix* m, size_t tile, size_t num_threads)
+{
+   if(m == NULL || num_threads == 0)
+      return NULL;
+
+   tiled_matrix* t = new_tiled_matrix(m->order, tile);
+   if(t == NULL)
+      return NULL;
+
+   // adjust number of threads for small matrices
+   num_threads = (t->tiles < num_threads) ? (t->tiles ? t->tiles : 1) : num_threads;
+
+   run_threads(thread_to_tiled, (thread_arg_t_tiled){.t = t, .m = m}, num_threads);
+
+   return t;
+}
+
+/*
+ * Convert a tiled matrix back to row-major. Return a pointer to the
+ * newly allocated matrix or NULL if anything is wrong
+ */
+square_matrix* tiled_to_square_matrix_threads(tiled_matrix* t, size_t num_threads)
+{
+   if(t == NULL || num_threads == 0)
+      return NULL;
+
+   square_matrix* m = new_square_matrix(t->order);
+   if(m == NULL)
+      return NULL;
+
+   // adjust number of threads for small matrices
+   num_threads = (t->tiles < num_threads) ? (t->tiles ? t->tiles : 1) : num_threads;
+
+   run_threads(thread_from_tiled, (thread_arg_t_tiled){.t = t, .m = m}, num_threads);
+
+   return m;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Row and column access           //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * Copy row i into row[0..order-1]. The row is a run of tile elements
+ * in each of the tiles of one tile row.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int get_tiled_matrix_row(tiled_matrix* t, size_t i, matrix_element* row)
+{
+   if(t == NULL || row == NULL || i >= t->order)
+      return -1;
+
+   size_t n = t->order, b = t->tile;
+   for(size_t tj = 0; tj < t->tiles; tj++)
+      memcpy(row + tj*b, TILED_TILE(t, i/b, tj) + (i%b)*b, MIN(b, n - tj*b) * sizeof(matrix_element));
+
+   return 0;
+}
+
+/*
+ * Overwrite row i with row[0..order-1].
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int set_tiled_matrix_row(tiled_matrix* t, size_t i, const matrix_element* row)
+{
+   if(t == NULL || row == NULL || i >= t->order)
+      return -1;
+
+   size_t n = t->order, b = t->tile;
+   for(size_t tj = 0; tj < t->tiles; tj++)
+      memcpy(TILED_TILE(t, i/b, tj) + (i%b)*b, row + tj*b, MIN(b, n - tj*b) * sizeof(matrix_element));
+
+   return 0;
+}
+
+/*
+ * Copy column j into col[0..order-1]. Within a tile the column has
+ * stride tile, so a tile's worth of the column touches only that tile's
+ * pages instead of one page per element as in row-major storage.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int get_tiled_matrix_column(tiled_matrix* t, size_t j, matrix_element* col)
+{
+   if(t == NULL || col == NULL || j >= t->order)
+      return -1;
+
+   size_t n = t->order, b = t->tile;
+   for(size_t ti = 0; ti < t->tiles; ti++) {
+      const matrix_element* src = TILED_TILE(t, ti, j/b) + j%b;
+      size_t rows = MIN(b, n - ti*b);
+      for(size_t r = 0; r < rows; r++)
+         col[ti*b + r] = src[r*b];
+   }
+
+   return 0;
+}
+
+/*
+ * Overwrite column j with col[0..order-1].
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int set_tiled_matrix_column(tiled_matrix* t, size_t j, const matrix_element* col)
+{
+   if(t == NULL || col == NULL || j >= t->order)
+      return -1;
+
+   size_t n = t->order, b = t->tile;
+   for(size_t ti = 0; ti < t->tiles; ti++) {
+      matrix_element* dst = TILED_TILE(t, ti, j/b) + j%b;
+      size_t rows = MIN(b, n - ti*b);
+      for(size_t r = 0; r < rows; r++)
+         dst[r*b] = col[ti*b + r];
+   }
+
+   return 0;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// In-place transpose              //
+//                                 //
+/////////////////////////////////////
+
+/*
+ * The tiled counterpart of in_place_transpose_square_matrix_tiled:
+ * tile (ti,tj) is transposed into tile (tj,ti) and vice versa, and
+ * diagonal tiles are transposed in place. Both tiles of a pair are
+ * contiguous, so each swap streams through two blocks of pages instead
+ * of 2*tile rows of the whole matrix. Padding maps onto padding and
+ * stays zero. Thread id handles tile rows id, id + num_threads, ...
+ * and, in each, the tiles on and left of the diagonal.
+ */
+static void * thread_in_place_transpose_tiled(void * p_arg)
+{
+   thread_arg_t_tiled *p = p_arg;
+   tiled_matrix* t = p->t;
+   size_t b = t->tile;
+
+   for(size_t ti = p->id; ti < t->tiles; ti += p->num_threads) {
+      matrix_element* diag = TILED_TILE(t, ti, ti);
+      for(size_t r = 0; r < b; r++)
+         for(size_t c = 0; c < r; c++)
+            SWAP(diag[r*b + c], diag[c*b + r]);
+
+      for(size_t tj = 0; tj < ti; tj++) {
+         matrix_element* restrict lower = TILED_TILE(t, ti, tj);
+         matrix_element* restrict upper = TILED_TILE(t, tj, ti);
+         for(size_t r = 0; r < b; r++)
+            for(size_t c = 0; c < b; c++)
+               SWAP(lower[r*b + c], upper[c*b + r]);
+      }
+   }
+
+   return NULL;
+}
+
+/*
+ * Transpose a tiled matrix in place.
+ */
+void in_place_transpose_tiled_matrix_threads(tiled_matrix* t, size_t num_threads)
+{
+   if(t == NULL || num_threads == 0)
+      return;
+
+   // adjust number of threads for small matrices
+   num_threads = (t->tiles < num_threads) ? (t->tiles ? t->tiles : 1) : num_threads;
+
+   run_threads(thread_in_place_transpose_tiled, (thread_arg_t_tiled){.t = t}, num_threads);
+}
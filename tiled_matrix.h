@@ -0,0 +1,42 @@
+#ifndef __tiled_matrix_h__
+#define __tiled_matrix_h__
+
+#include <stddef.h>
+#include "square_matrix3.h"
+
+// 64 x 64 tiles of 4-byte elements are 16 KiB, four pages each
+#define TILED_DEFAULT_TILE 64
+
+// A tiled matrix of order n is cut into tile x tile tiles, the last row
+// and column of tiles padded with zeros. Each tile is stored row by row
+// in one contiguous block, and the tiles follow each other in row-major
+// tile order; the data is page aligned, so a tile whose size is a
+// multiple of the page size occupies whole pages.
+typedef struct {
+    size_t order;
+    size_t tile;            // order of a tile
+    size_t tiles;           // tiles per side
+    matrix_element* data;   // tiles*tiles*tile*tile elements
+} tiled_matrix;
+
+// first element of tile (ti,tj)
+#define TILED_TILE(t,ti,tj) ((t)->data + ((ti)*(t)->tiles + (tj)) * (t)->tile * (t)->tile)
+
+// element (i,j)
+#define TILED_AT(t,i,j) (TILED_TILE(t, (i)/(t)->tile, (j)/(t)->tile)[((i)%(t)->tile)*(t)->tile + (j)%(t)->tile])
+
+tiled_matrix* new_tiled_matrix(size_t order, size_t tile);
+void free_tiled_matrix(tiled_matrix* t);
+int  compare_tiled_matrices(tiled_matrix* t1, tiled_matrix* t2);
+
+tiled_matrix* square_to_tiled_matrix_threads(square_matrix* m, size_t tile, size_t num_threads);
+square_matrix* tiled_to_square_matrix_threads(tiled_matrix* t, size_t num_threads);
+
+int get_tiled_matrix_row(tiled_matrix* t, size_t i, matrix_element* row);
+int set_tiled_matrix_row(tiled_matrix* t, size_t i, const matrix_element* row);
+int get_tiled_matrix_column(tiled_matrix* t, size_t j, matrix_element* col);
+int set_tiled_matrix_column(tiled_matrix* t, size_t j, const matrix_element* col);
+
+void in_place_transpose_tiled_matrix_threads(tiled_matrix* t, size_t num_threads);
+
+#endif
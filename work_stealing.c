@@ -0,0 +1,586 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <assert.h>
+#include "work_stealing.h"
+
+#define WS_CACHE_LINE  64
+#define WS_DEQUE_SIZE  4096          // tasks per worker deque, a power of two
+#define WS_SPIN_LIMIT  64            // failed searches for work before an idle worker sleeps
+#define WS_IDLE_WAIT_NS 1000000      // upper bound on how long an idle worker sleeps
+
+#define WS_TASK_DETACHED 1           // heap task from ws_pool_submit(), freed when done
+#define WS_TASK_EXTERNAL 2           // task of a thread outside the pool waiting in ws_pool_run()
+
+
+/////////////////////////////////////
+//                                 //
+// Lock-free work-stealing deque   //
+//                                 //
+/////////////////////////////////////
+
+// Chase-Lev deque with the C11 memory orderings of Le, Pop, Cohen and
+// Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak Memory
+// Models" (PPoPP 2013). The owner pushes and pops at the bottom; thieves
+// take from the top. The buffer has a fixed size: a push onto a full
+// deque fails and the caller runs the task itself.
+
+typedef struct {
+   _Alignas(WS_CACHE_LINE) atomic_llong top;
+   _Alignas(WS_CACHE_LINE) atomic_llong bottom;
+   _Alignas(WS_CACHE_LINE) _Atomic(ws_task*) buffer[WS_DEQUE_SIZE];
+} ws_deque;
+
+static int deque_push(ws_deque* q, ws_task* t)
+{
+   long long b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+   long long top = atomic_load_explicit(&q->top, memory_order_acquire);
+   if(b - top >= WS_DEQUE_SIZE)
+      return 0;
+
+   atomic_store_explicit(&q->buffer[b & (WS_DEQUE_SIZE - 1)], t, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+   atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+   return 1;
+}
+
+static ws_task* deque_pop(ws_deque* q)
+{
+   long long b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+   atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+   atomic_thread_fence(memory_order_seq_cst);
+   long long top = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+   ws_task* t = NULL;
+   if(top <= b) {
+      t = atomic_load_explicit(&q->buffer[b & (WS_DEQUE_SIZE - 1)], memory_order_relaxed);
+      if(top == b) {
+         // last task: race against thieves for it
+         if(!atomic_compare_exchange_strong_explicit(&q->top, &top, top + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed))
+            t = NULL;
+         atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+      }
+   }
+   else
+      atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+
+   return t;
+}
+
+static ws_task* deque_steal(ws_deque* q)
+{
+   long long top = atomic_load_explicit(&q->top, memory_order_acquire);
+   atomic_thread_fence(memory_order_seq_cst);
+   long long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+
+   if(top >= b)
+      return NULL;
+
+   ws_task* t = atomic_load_explicit(&q->buffer[top & (WS_DEQUE_SIZE - 1)], memory_order_relaxed);
+   if(!atomic_compare_exchange_strong_explicit(&q->top, &top, top + 1,
+                                               memory_order_seq_cst, memory_order_relaxed))
+      return NULL;
+
+   return t;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Pool and workers                //
+//                                 //
+/////////////////////////////////////
+
+typedef struct {
+   ws_deque deque;
+   ws_pool* pool;
+   size_t id;
+   pthread_t tid;
+   uint64_t rng;              // victim selection
+   int depth;                 // nesting of tasks run by this worker
+   ws_worker_stats stats;     // only written by the worker itself
+} ws_worker;
+
+typedef struct ws_queued {
+   ws_task* task;
+   struct ws_queued* next;
+} ws_queued;
+
+struct ws_pool {
+   size_t num_workers;
+   ws_worker* workers;
+
+   // tasks submitted from outside the pool
+   pthread_mutex_t lock;
+   pthread_cond_t work_cond;     // idle workers sleep here
+   pthread_cond_t done_cond;     // threads in ws_pool_run() wait here
+   ws_queued *head, *tail;
+   atomic_size_t queued;
+
+   atomic_int sleepers;
+   atomic_int shutdown;
+};
+
+static _Thread_local ws_worker* ws_current = NULL;
+
+
+static double elapsed_seconds(struct timespec* start)
+{
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static void wake_sleepers(ws_pool* pool)
+{
+   if(atomic_load_explicit(&pool->sleepers, memory_order_relaxed) > 0)
+      pthread_cond_signal(&pool->work_cond);
+}
+
+static void enqueue_external(ws_pool* pool, ws_task* t)
+{
+   ws_queued* node = malloc(sizeof(ws_queued));
+   assert(node != NULL); // could have handled errors better
+   node->task = t;
+   node->next = NULL;
+
+   pthread_mutex_lock(&pool->lock);
+   if(pool->tail)
+      pool->tail->next = node;
+   else
+      pool->head = node;
+   pool->tail = node;
+   atomic_fetch_add(&pool->queued, 1);
+   pthread_cond_signal(&pool->work_cond);
+   pthread_mutex_unlock(&pool->lock);
+}
+
+static ws_task* dequeue_external(ws_pool* pool)
+{
+   if(atomic_load_explicit(&pool->queued, memory_order_relaxed) == 0)
+      return NULL;
+
+   ws_task* t = NULL;
+   pthread_mutex_lock(&pool->lock);
+   ws_queued* node = pool->head;
+   if(node) {
+      pool->head = node->next;
+      if(pool->head == NULL)
+         pool->tail = NULL;
+      atomic_fetch_sub(&pool->queued, 1);
+      t = node->task;
+      free(node);
+   }
+   pthread_mutex_unlock(&pool->lock);
+
+   return t;
+}
+
+/*
+ * Mark a task as finished. Nothing may touch the task afterwards,
+ * since its owner is free to reuse or release it.
+ */
+static void finish_task(ws_pool* pool, ws_task* t)
+{
+   if(t->flags & WS_TASK_DETACHED) {
+      free(t);
+   }
+   else if(t->flags & WS_TASK_EXTERNAL) {
+      pthread_mutex_lock(&pool->lock);
+      atomic_store_explicit(&t->done, 1, memory_order_release);
+      pthread_cond_broadcast(&pool->done_cond);
+      pthread_mutex_unlock(&pool->lock);
+   }
+   else
+      atomic_store_explicit(&t->done, 1, memory_order_release);
+}
+
+static void execute_task(ws_worker* w, ws_task* t)
+{
+   struct timespec start;
+   int outermost = (w->depth++ == 0);
+   if(outermost)
+      clock_gettime(CLOCK_MONOTONIC, &start);
+
+   t->func(t->arg);
+
+   if(outermost)
+      w->stats.busy_seconds += elapsed_seconds(&start);
+   w->depth--;
+   w->stats.tasks++;
+
+   finish_task(w->pool, t);
+}
+
+/*
+ * Take a task from the submission queue or from a randomly chosen
+ * victim, trying every other worker once.
+ */
+static ws_task* steal_task(ws_worker* w)
+{
+   ws_pool* pool = w->pool;
+
+   ws_task* t = dequeue_external(pool);
+   if(t) {
+      w->stats.steals++;
+      return t;
+   }
+
+   size_t n = pool->num_workers;
+   if(n < 2)
+      return NULL;
+
+   // xorshift64
+   w->rng ^= w->rng << 13;
+   w->rng ^= w->rng >> 7;
+   w->rng ^= w->rng << 17;
+
+   size_t start = w->rng % n;
+   for(size_t i = 0; i < n; i++) {
+      size_t victim = (start + i) % n;
+      if(victim == w->id)
+         continue;
+      t = deque_steal(&pool->workers[victim].deque);
+      if(t) {
+         w->stats.steals++;
+         return t;
+      }
+      w->stats.failed_steals++;
+   }
+
+   return NULL;
+}
+
+static void * worker_main(void * p_arg)
+{
+   ws_worker* w = p_arg;
+   ws_pool* pool = w->pool;
+   ws_current = w;
+
+   size_t misses = 0;
+   while(!atomic_load_explicit(&pool->shutdown, memory_order_acquire)) {
+      ws_task* t = deque_pop(&w->deque);
+      if(t == NULL)
+         t = steal_task(w);
+
+      if(t) {
+         execute_task(w, t);
+         misses = 0;
+         continue;
+      }
+
+      if(++misses < WS_SPIN_LIMIT) {
+         sched_yield();
+         continue;
+      }
+
+      // nothing to do for a while: sleep until new work is announced,
+      // with a timeout in case a push raced with going to sleep
+      pthread_mutex_lock(&pool->lock);
+      if(!atomic_load(&pool->shutdown) && atomic_load(&pool->queued) == 0) {
+         struct timespec deadline;
+         clock_gettime(CLOCK_REALTIME, &deadline);
+         deadline.tv_nsec += WS_IDLE_WAIT_NS;
+         if(deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+         }
+         atomic_fetch_add(&pool->sleepers, 1);
+         pthread_cond_timedwait(&pool->work_cond, &pool->lock, &deadline);
+         atomic_fetch_sub(&pool->sleepers, 1);
+      }
+      pthread_mutex_unlock(&pool->lock);
+   }
+
+   ws_current = NULL;
+   pthread_exit(NULL);
+}
+
+
+/*
+ * Create a pool of num_workers worker threads.
+ * Return NULL if anything is wrong.
+ */
+ws_pool* ws_pool_create(size_t num_workers)
+{
+   if(num_workers == 0)
+      return NULL;
+
+   ws_pool* pool = calloc(1, sizeof(ws_pool));
+   if(pool == NULL)
+      return NULL;
+
+   pool->workers = aligned_alloc(WS_CACHE_LINE, num_workers * sizeof(ws_worker));
+   if(pool->workers == NULL) {
+      free(pool);
+      return NULL;
+   }
+   memset(pool->workers, 0, num_workers * sizeof(ws_worker));
+
+   pool->num_workers = num_workers;
+   pthread_mutex_init(&pool->lock, NULL);
+   pthread_cond_init(&pool->work_cond, NULL);
+   pthread_cond_init(&pool->done_cond, NULL);
+
+   for(size_t i = 0; i < num_workers; i++) {
+      ws_worker* w = &pool->workers[i];
+      w->pool = pool;
+      w->id = i;
+      w->rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+   }
+
+   for(size_t i = 0; i < num_workers; i++) {
+      int status = pthread_create(&pool->workers[i].tid, NULL, worker_main, &pool->workers[i]);
+      assert(status == 0); // could have handled errors better
+   }
+
+   return pool;
+}
+
+/*
+ * Stop the workers and release the pool. Tasks still waiting in the
+ * submission queue are dropped.
+ */
+void ws_pool_destroy(ws_pool* pool)
+{
+   if(pool == NULL)
+      return;
+
+   pthread_mutex_lock(&pool->lock);
+   atomic_store(&pool->shutdown, 1);
+   pthread_cond_broadcast(&pool->work_cond);
+   pthread_mutex_unlock(&pool->lock);
+
+   for(size_t i = 0; i < pool->num_workers; i++)
+      pthread_join(pool->workers[i].tid, NULL);
+
+   while(pool->head) {
+      ws_queued* node = pool->head;
+      pool->head = node->next;
+      if(node->task->flags & WS_TASK_DETACHED)
+         free(node->task);
+      free(node);
+   }
+
+   pthread_mutex_destroy(&pool->lock);
+   pthread_cond_destroy(&pool->work_cond);
+   pthread_cond_destroy(&pool->done_cond);
+   free(pool->workers);
+   free(pool);
+}
+
+/*
+ * Return the number of workers of the pool.
+ */
+size_t ws_pool_size(ws_pool* pool)
+{
+   return pool ? pool->num_workers : 0;
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Fork/join interface             //
+//                                 //
+/////////////////////////////////////
+
+
+/*
+ * Run func(arg) as a task of the pool and wait for it, and for all the
+ * tasks it spawns and joins, to finish. Called from inside a task of the
+ * same pool, func simply runs in place.
+ */
+void ws_pool_run(ws_pool* pool, ws_func func, void* arg)
+{
+   if(pool == NULL || func == NULL)
+      return;
+
+   if(ws_current != NULL && ws_current->pool == pool) {
+      func(arg);
+      return;
+   }
+
+   ws_task t;
+   ws_task_init(&t, func, arg);
+   t.flags |= WS_TASK_EXTERNAL;
+   enqueue_external(pool, &t);
+
+   pthread_mutex_lock(&pool->lock);
+   while(!atomic_load_explicit(&t.done, memory_order_acquire))
+      pthread_cond_wait(&pool->done_cond, &pool->lock);
+   pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Queue func(arg) to run on the pool without waiting for it.
+ * Return 0 on success, -1 if anything is wrong.
+ */
+int ws_pool_submit(ws_pool* pool, ws_func func, void* arg)
+{
+   if(pool == NULL || func == NULL)
+      return -1;
+
+   ws_task* t = malloc(sizeof(ws_task));
+   if(t == NULL)
+      return -1;
+   ws_task_init(t, func, arg);
+   t->flags |= WS_TASK_DETACHED;
+
+   ws_worker* w = ws_current;
+   if(w != NULL && w->pool == pool) {
+      if(deque_push(&w->deque, t))
+         wake_sleepers(pool);
+      else
+         execute_task(w, t);
+   }
+   else
+      enqueue_external(pool, t);
+
+   return 0;
+}
+
+/*
+ * Prepare a task that calls func(arg) for ws_spawn().
+ */
+void ws_task_init(ws_task* t, ws_func func, void* arg)
+{
+   t->func = func;
+   t->arg = arg;
+   atomic_init(&t->done, 0);
+   t->flags = 0;
+}
+
+/*
+ * Make a task available to run in parallel with the caller. Every
+ * spawned task must be joined before the frame holding it returns.
+ * Outside of a pool, or when the deque is full, the task runs at once.
+ */
+void ws_spawn(ws_task* t)
+{
+   ws_worker* w = ws_current;
+
+   if(w == NULL) {
+      t->func(t->arg);
+      atomic_store_explicit(&t->done, 1, memory_order_release);
+      return;
+   }
+
+   if(deque_push(&w->deque, t))
+      wake_sleepers(w->pool);
+   else
+      execute_task(w, t);
+}
+
+/*
+ * Wait for a spawned task to finish. While it has not, the caller runs
+ * its own pending tasks (usually the awaited task itself, which is on
+ * top of its deque unless it was stolen) or steals work from others.
+ */
+void ws_join(ws_task* t)
+{
+   ws_worker* w = ws_current;
+
+   while(!atomic_load_explicit(&t->done, memory_order_acquire)) {
+      ws_task* other = NULL;
+      if(w != NULL) {
+         other = deque_pop(&w->deque);
+         if(other == NULL)
+            other = steal_task(w);
+      }
+
+      if(other)
+         execute_task(w, other);
+      else
+         sched_yield();
+   }
+}
+
+/*
+ * Return the index of the calling worker in its pool, or (size_t)-1
+ * when called from a thread that is not a pool worker.
+ */
+size_t ws_worker_id(void)
+{
+   return ws_current ? ws_current->id : (size_t) -1;
+}
+
+
+typedef struct {
+   size_t first, last, grain;
+   void (*body)(size_t, size_t, void*);
+   void* arg;
+} ws_range;
+
+static void parallel_for_task(void* p_arg)
+{
+   ws_range* r = p_arg;
+
+   if(r->last - r->first <= r->grain) {
+      r->body(r->first, r->last, r->arg);
+      return;
+   }
+
+   // split in halves: spawn the upper half, recurse into the lower one
+   size_t mid = r->first + (r->last - r->first) / 2;
+   ws_range upper = {mid, r->last, r->grain, r->body, r->arg};
+   ws_range lower = {r->first, mid, r->grain, r->body, r->arg};
+
+   ws_task t;
+   ws_task_init(&t, parallel_for_task, &upper);
+   ws_spawn(&t);
+   parallel_for_task(&lower);
+   ws_join(&t);
+}
+
+/*
+ * Call body on subranges of first..last-1 of at most grain indices,
+ * in parallel on the pool of the calling worker.
+ */
+void ws_parallel_for(size_t first, size_t last, size_t grain,
+                     void (*body)(size_t first, size_t last, void* arg), void* arg)
+{
+   if(last <= first)
+      return;
+
+   ws_range r = {first, last, grain ? grain : 1, body, arg};
+   parallel_for_task(&r);
+}
+
+
+/////////////////////////////////////
+//                                 //
+// Load-balance statistics         //
+//                                 //
+/////////////////////////////////////
+
+
+/*
+ * Copy the statistics of every worker into stats, which must have room
+ * for ws_pool_size(pool) entries. Call while the pool is idle.
+ */
+void ws_pool_stats(ws_pool* pool, ws_worker_stats* stats)
+{
+   if(pool == NULL || stats == NULL)
+      return;
+
+   for(size_t i = 0; i < pool->num_workers; i++)
+      stats[i] = pool->workers[i].stats;
+}
+
+/*
+ * Clear the statistics of every worker. Call while the pool is idle.
+ */
+void ws_pool_reset_stats(ws_pool* pool)
+{
+   if(pool == NULL)
+      return;
+
+   for(size_t i = 0; i < pool->num_workers; i++)
+      memset(&pool->workers[i].stats, 0, sizeof(ws_worker_stats));
+}
@@ -0,0 +1,48 @@
+#ifndef __work_stealing_h__
+#define __work_stealing_h__
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Fork/join runtime: a pool of worker threads, each owning a deque of
+// tasks. A worker pushes and pops its own tasks at the bottom of its
+// deque and steals from the top of the deques of other workers when it
+// runs out of work.
+
+typedef struct ws_pool ws_pool;
+
+typedef void (*ws_func)(void* arg);
+
+typedef struct {
+    ws_func func;
+    void* arg;
+    atomic_int done;
+    int flags;          // internal, set by ws_task_init and the pool
+} ws_task;
+
+typedef struct {
+    size_t tasks;           // tasks executed by the worker
+    size_t steals;          // tasks taken from other workers or from the submission queue
+    size_t failed_steals;   // steal attempts that found nothing or lost a race
+    double busy_seconds;    // time spent running tasks, excluding time waiting for work
+} ws_worker_stats;
+
+ws_pool* ws_pool_create(size_t num_workers);
+void     ws_pool_destroy(ws_pool* pool);
+size_t   ws_pool_size(ws_pool* pool);
+
+void ws_pool_run(ws_pool* pool, ws_func func, void* arg);
+int  ws_pool_submit(ws_pool* pool, ws_func func, void* arg);
+
+void ws_task_init(ws_task* t, ws_func func, void* arg);
+void ws_spawn(ws_task* t);
+void ws_join(ws_task* t);
+size_t ws_worker_id(void);
+
+void ws_parallel_for(size_t first, size_t last, size_t grain,
+                     void (*body)(size_t first, size_t last, void* arg), void* arg);
+
+void ws_pool_stats(ws_pool* pool, ws_worker_stats* stats);
+void ws_pool_reset_stats(ws_pool* pool);
+
+#endif